@@ -0,0 +1,253 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+/*
+ * Runs the workloads given as arguments and prints their timings as
+ * JSON. A workload is a Lisp file defining RUN, a procedure without
+ * arguments: each one is loaded in a process of its own, after
+ * common.lisp, then RUN is called a few times to warm up and timed
+ * on the following calls.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../include/libfflisp.h"
+
+#define BENCH_COMMON "bench/common.lisp"
+#define BENCH_WARMUP 2
+#define BENCH_REPETITIONS 10
+#define BENCH_MAX_REPETITIONS 10000
+
+/* What a workload's process sends back. */
+struct sample {
+    long wall_ns[BENCH_MAX_REPETITIONS];
+    unsigned long allocations[BENCH_MAX_REPETITIONS];
+};
+
+static void usage(void)
+{
+    printf("Usage: bench [-w warmup] [-r repetitions] workload.lisp...\n");
+    printf("       -w calls of RUN before the timed ones, %d by default.\n",
+           BENCH_WARMUP);
+    printf("       -r timed calls of RUN, %d by default.\n",
+           BENCH_REPETITIONS);
+
+    return;
+}
+
+static long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int compare_long(const void *a, const void *b)
+{
+    long x = *(const long *) a, y = *(const long *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* The value of rank p percents, the nearest one. */
+static long percentile(long *sorted, int n, int p)
+{
+    int i = (n * p + 99) / 100 - 1;
+
+    return sorted[i < 0 ? 0 : i];
+}
+
+static int eval_or_fail(struct fflisp *f, const char *source)
+{
+    struct lispobj *result;
+
+    if(fflisp_eval_string(f, source, &result) < 0) {
+        fprintf(stderr, "bench: %s: %s\n", source, fflisp_error(f));
+        return -1;
+    }
+    fflisp_release(f, result);
+
+    return 0;
+}
+
+/* In the workload's process, the output of the programs is dropped. */
+static int run(const char *workload, int warmup, int repetitions,
+               struct sample *s)
+{
+    struct fflisp *f = fflisp_init();
+    struct lispobj *result;
+    unsigned long allocations;
+    char source[4096];
+    long start;
+    int i;
+
+    snprintf(source, sizeof(source), "(load \"%s\")", BENCH_COMMON);
+    if(eval_or_fail(f, source) < 0)
+        return -1;
+    snprintf(source, sizeof(source), "(load \"%s\")", workload);
+    if(eval_or_fail(f, source) < 0)
+        return -1;
+
+    for(i = -warmup; i < repetitions; i++) {
+        allocations = fflisp_allocations(f);
+        start = now_ns();
+        if(fflisp_call(f, "run", 0, NULL, &result) < 0) {
+            fprintf(stderr, "bench: %s: %s\n", workload, fflisp_error(f));
+            return -1;
+        }
+        if(i >= 0) {
+            s->wall_ns[i] = now_ns() - start;
+            s->allocations[i] = fflisp_allocations(f) - allocations;
+        }
+        fflisp_release(f, result);
+    }
+    fflisp_free(f);
+
+    return 0;
+}
+
+static int readall(int fd, void *data, size_t size)
+{
+    ssize_t n;
+
+    while(size > 0) {
+        n = read(fd, data, size);
+        if(n <= 0)
+            return -1;
+        data = (char *) data + n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static int writeall(int fd, const void *data, size_t size)
+{
+    ssize_t n;
+
+    while(size > 0) {
+        n = write(fd, data, size);
+        if(n <= 0)
+            return -1;
+        data = (const char *) data + n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+/* Prints the workload's entry, or returns -1 if it failed. */
+static int bench(const char *workload, int warmup, int repetitions,
+                 int first)
+{
+    static struct sample s;
+    const char *name, *dot;
+    struct rusage usage;
+    int fds[2], status, received, null;
+    pid_t pid;
+
+    if(pipe(fds) < 0) {
+        perror("bench: pipe");
+        return -1;
+    }
+
+    pid = fork();
+    if(pid < 0) {
+        perror("bench: fork");
+        return -1;
+    } else if(pid == 0) {
+        close(fds[0]);
+        null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+
+        if(run(workload, warmup, repetitions, &s) < 0
+           || writeall(fds[1], s.wall_ns, repetitions * sizeof(long)) < 0
+           || writeall(fds[1], s.allocations,
+                       repetitions * sizeof(unsigned long)) < 0) {
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    received = readall(fds[0], s.wall_ns, repetitions * sizeof(long)) == 0
+        && readall(fds[0], s.allocations,
+                   repetitions * sizeof(unsigned long)) == 0;
+    close(fds[0]);
+
+    if(wait4(pid, &status, 0, &usage) < 0 || !received
+       || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "bench: %s failed\n", workload);
+        return -1;
+    }
+
+    name = strrchr(workload, '/');
+    name = name != NULL ? name + 1 : workload;
+    dot = strrchr(name, '.');
+
+    /* Allocations are the same on every call, timings are not. */
+    qsort(s.wall_ns, repetitions, sizeof(long), compare_long);
+    printf("%s    {\"name\": \"%.*s\", "
+           "\"wall_ns\": {\"median\": %ld, \"p95\": %ld, "
+           "\"min\": %ld, \"max\": %ld}, "
+           "\"allocations\": %lu, \"peak_rss_kb\": %ld}",
+           first ? "" : ",\n",
+           (int) (dot != NULL ? dot - name : (long) strlen(name)), name,
+           percentile(s.wall_ns, repetitions, 50),
+           percentile(s.wall_ns, repetitions, 95),
+           s.wall_ns[0], s.wall_ns[repetitions - 1],
+           s.allocations[repetitions - 1], usage.ru_maxrss);
+    fflush(stdout);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int warmup = BENCH_WARMUP, repetitions = BENCH_REPETITIONS;
+    int opt, i, failed = 0, first = 1;
+
+    while((opt = getopt(argc, argv, "w:r:h")) != -1) {
+        switch(opt) {
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'r':
+            repetitions = atoi(optarg);
+            break;
+        default:
+            usage();
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if(optind == argc || warmup < 0 || repetitions < 1
+       || repetitions > BENCH_MAX_REPETITIONS) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    printf("{\"warmup\": %d, \"repetitions\": %d, \"benchmarks\": [\n",
+           warmup, repetitions);
+    for(i = optind; i < argc; i++) {
+        if(bench(argv[i], warmup, repetitions, first) < 0) {
+            failed = 1;
+        } else {
+            first = 0;
+        }
+    }
+    printf("\n]}\n");
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,33 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;;; This file is licensed under the terms of MIT license,
+;;;; see LICENSE file.
+;;;;
+;;;; Helpers of the workloads, loaded before each of them.
+
+;; (iota 3) => (1 2 3). Tail calls aren't eliminated, so a long
+;; list is built a thousand elements at a time.
+(label iota-range
+       (lambda (from to)
+         (if (> from to)
+             nil
+             (cons from (iota-range (+ from 1) to)))))
+
+(label iota-from
+       (lambda (from n)
+         (if (> n 1000)
+             (append (iota-range from (+ from 999))
+                     (iota-from (+ from 1000) (- n 1000)))
+             (iota-range from (+ from n -1)))))
+
+(label iota
+       (lambda (n)
+         (iota-from 1 n)))
+
+;; Calls thunk n times, n up to a few thousands.
+(label repeat
+       (lambda (n thunk)
+         (if (= n 0)
+             nil
+             (progn
+               (thunk)
+               (repeat (- n 1) thunk)))))
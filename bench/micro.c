@@ -0,0 +1,363 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+/*
+ * Costs of single runtime operations, out of any program. An
+ * operation runs in batches long enough for the timer, the median
+ * batch gives the cycles and nanoseconds per operation.
+ *
+ * Cycles are the ones of the time stamp counter on x86: its rate is
+ * constant, so it's the nominal clock and not the current one. The
+ * counter is calibrated against the monotonic clock. Elsewhere both
+ * columns are nanoseconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/environment.h"
+#include "../include/read.h"
+#include "../include/print.h"
+#include "../include/subr.h"
+
+/* Batches of each operation, the median one is reported. */
+#define MICRO_RUNS 15
+/* A batch is doubled until it takes this long. */
+#define MICRO_BATCH_NS 2000000L
+#define MICRO_CALIBRATION_NS 50000000L
+
+/* Sizes of the inputs. */
+#define MICRO_SYMBOLS_MAX 10000
+#define MICRO_LIST_LENGTH 1000
+#define MICRO_NESTING 100
+
+static double cycles_per_ns;
+
+/* What the operation works on, set before measuring it. */
+static struct {
+    int type;
+    const char *name;
+    struct lispobj *obj;
+    struct lispobj *env;
+    char *text;
+    long length;
+    FILE *null;
+} arg;
+
+static long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static unsigned long long cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int aux;
+
+    /* Waits for the previous instructions, unlike rdtsc. */
+    return __rdtscp(&aux);
+#else
+    return now_ns();
+#endif
+}
+
+static void calibrate(void)
+{
+    unsigned long long c = cycles();
+    long start = now_ns(), ns;
+
+    while((ns = now_ns() - start) < MICRO_CALIBRATION_NS)
+        ;
+    cycles_per_ns = (double) (cycles() - c) / ns;
+
+    return;
+}
+
+static int compare_cycles(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void measure(const char *name, void (*op)(long))
+{
+    unsigned long long runs[MICRO_RUNS], start;
+    long n = 1, i;
+    double per_op;
+
+    /* Sizing the batch warms up the caches and the allocator too. */
+    for(;;) {
+        start = cycles();
+        op(n);
+        if((cycles() - start) / cycles_per_ns >= MICRO_BATCH_NS)
+            break;
+        n *= 2;
+    }
+
+    for(i = 0; i < MICRO_RUNS; i++) {
+        start = cycles();
+        op(n);
+        runs[i] = cycles() - start;
+    }
+    qsort(runs, MICRO_RUNS, sizeof(unsigned long long), compare_cycles);
+
+    per_op = (double) runs[MICRO_RUNS / 2] / n;
+    printf("%-44s %12.1f %12.1f\n", name, per_op, per_op / cycles_per_ns);
+
+    return;
+}
+
+static void op_object(long n)
+{
+    struct lispobj *obj;
+    char *value = arg.type == STRING || arg.type == ERROR ? "a string" : "1";
+
+    while(n-- > 0) {
+        obj = object_create(arg.type, value);
+        object_delete(obj);
+    }
+
+    return;
+}
+
+static void op_grab_release(long n)
+{
+    while(n-- > 0) {
+        heap_grab(arg.obj);
+        heap_release(arg.obj);
+    }
+
+    return;
+}
+
+static void op_symbol_lookup(long n)
+{
+    while(n-- > 0) {
+        symbol_table_lookup((char *) arg.name);
+    }
+
+    return;
+}
+
+static void op_env_lookup(long n)
+{
+    while(n-- > 0) {
+        env_var_lookup(arg.obj, arg.env);
+    }
+
+    return;
+}
+
+static void op_read(long n)
+{
+    struct reader *r;
+
+    while(n-- > 0) {
+        r = reader_open_buffer(memcpy(malloc(arg.length), arg.text,
+                                      arg.length), arg.length);
+        while(reader_skip(r) != EOF) {
+            heap_release(heap_grab(read_form(r)));
+        }
+        reader_close(r);
+    }
+
+    return;
+}
+
+static void op_print(long n)
+{
+    while(n-- > 0) {
+        print_stream(arg.obj, arg.null);
+    }
+
+    return;
+}
+
+static void bench_objects(void)
+{
+    static const struct {
+        int type;
+        const char *name;
+    } types[] = {
+        {NUMBER, "number"}, {FLOAT, "float"}, {STRING, "string"},
+        {CONS, "cons"}, {ERROR, "error"}
+    };
+    char name[64];
+    int i;
+
+    /* Symbols stay in the symbol table, creating one is a lookup. */
+    for(i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        arg.type = types[i].type;
+        snprintf(name, sizeof(name), "object_create/delete %s",
+                 types[i].name);
+        measure(name, op_object);
+    }
+
+    arg.obj = heap_grab(number(1));
+    measure("heap_grab/release", op_grab_release);
+    heap_release(arg.obj);
+
+    return;
+}
+
+/* Lists of MICRO_LIST_LENGTH elements, and nested ones. */
+static char *input(const char *kind)
+{
+    long size = MICRO_LIST_LENGTH * 32, length = 0;
+    char *s = malloc(size);
+    int i;
+
+    if(!strcmp(kind, "nested")) {
+        for(i = 0; i < MICRO_NESTING; i++)
+            length += sprintf(s + length, "(a ");
+        for(i = 0; i < MICRO_NESTING; i++)
+            length += sprintf(s + length, ")");
+
+        return s;
+    }
+
+    length += sprintf(s + length, "(");
+    for(i = 0; i < MICRO_LIST_LENGTH; i++) {
+        if(!strcmp(kind, "numbers")) {
+            length += sprintf(s + length, "%d ", i * 7919);
+        } else if(!strcmp(kind, "floats")) {
+            length += sprintf(s + length, "%d.%d ", i, i * 7919 % 1000);
+        } else if(!strcmp(kind, "symbols")) {
+            /* A few names, the reader finds most of them interned. */
+            length += sprintf(s + length, "sym-%d ", i % 64);
+        } else {
+            length += sprintf(s + length, "\"string %d\" ", i);
+        }
+    }
+    sprintf(s + length, ")");
+
+    return s;
+}
+
+static void bench_read_print(void)
+{
+    static const char *kinds[] = {
+        "numbers", "floats", "symbols", "strings", "nested"
+    };
+    struct reader *r;
+    char name[64];
+    int i;
+
+    arg.null = fopen("/dev/null", "w");
+
+    for(i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        arg.text = input(kinds[i]);
+        arg.length = strlen(arg.text);
+
+        snprintf(name, sizeof(name), "read %s (%ld bytes)", kinds[i],
+                 arg.length);
+        measure(name, op_read);
+
+        r = reader_open_buffer(strdup(arg.text), arg.length);
+        arg.obj = heap_grab(read_form(r));
+        reader_close(r);
+        snprintf(name, sizeof(name), "print %s", kinds[i]);
+        measure(name, op_print);
+        heap_release(arg.obj);
+
+        free(arg.text);
+    }
+
+    fclose(arg.null);
+
+    return;
+}
+
+static void bench_environment(void)
+{
+    static const int depths[] = {1, 8, 64}, widths[] = {1, 8, 64};
+    struct lispobj *frame;
+    char name[64];
+    int d, w, i, j;
+
+    for(d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        for(w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+            /* The variable is the last one of the outermost frame,
+               every other one is looked at first. */
+            arg.env = NULL;
+            for(i = 0; i < depths[d]; i++) {
+                frame = NULL;
+                for(j = 0; j < widths[w]; j++) {
+                    snprintf(name, sizeof(name), "MICRO-VAR-%d-%d", i, j);
+                    frame = NEW_CONS(NEW_CONS(NEW_SYMBOL(name), NULL),
+                                     frame);
+                }
+                arg.env = NEW_CONS(frame, arg.env);
+            }
+            heap_grab(arg.env);
+            arg.obj = NEW_SYMBOL("MICRO-VAR-0-0");
+
+            snprintf(name, sizeof(name),
+                     "env_var_lookup depth %d width %d",
+                     depths[d], widths[w]);
+            measure(name, op_env_lookup);
+            heap_release(arg.env);
+        }
+    }
+
+    return;
+}
+
+/* Symbols stay interned, the table only grows from here. */
+static void bench_symbol_table(void)
+{
+    static const int sizes[] = {0, 1000, MICRO_SYMBOLS_MAX};
+    struct symbol_table *t;
+    char name[64];
+    int i, n = 0, interned;
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for(; n < sizes[i]; n++) {
+            snprintf(name, sizeof(name), "MICRO-SYMBOL-%d", n);
+            heap_grab(NEW_SYMBOL(name));
+        }
+        for(interned = 0, t = ctx->symbol_table; t != NULL; t = t->parent) {
+            interned += t->count;
+        }
+
+        /* A miss probes to an empty slot, like interning a new one. */
+        arg.name = "MICRO-ABSENT-SYMBOL";
+        snprintf(name, sizeof(name), "symbol_table_lookup miss, %d symbols",
+                 interned);
+        measure(name, op_symbol_lookup);
+
+        arg.name = "CAR";
+        snprintf(name, sizeof(name), "symbol_table_lookup CAR, %d symbols",
+                 interned);
+        measure(name, op_symbol_lookup);
+    }
+
+    return;
+}
+
+int main(int argc, char *argv[])
+{
+    fflisp_ctx_enter(fflisp_ctx_new(NULL));
+    calibrate();
+
+    printf("%-44s %12s %12s\n", "operation", "cycles/op", "ns/op");
+    bench_objects();
+    bench_read_print();
+    bench_environment();
+    bench_symbol_table();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,17 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;;; This file is licensed under the terms of MIT license,
+;;;; see LICENSE file.
+;;;;
+;;;; Church numerals of tapl.lisp: powers, products and predecessors,
+;;;; turned into numbers with succ and zero.
+
+(load "lispcode/tapl.lisp")
+
+(label c10 ((plus ((times c3) c3)) c1))
+
+(label run
+       (lambda ()
+         (progn
+           ((((pow c2) c10) succ) zero)
+           ((((times c10) c10) succ) zero)
+           (((prd ((times c10) c10)) succ) zero))))
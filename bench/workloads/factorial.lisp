@@ -0,0 +1,15 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;;; This file is licensed under the terms of MIT license,
+;;;; see LICENSE file.
+;;;;
+;;;; Factorials of math.lisp, both the recursive and the iterative one.
+
+(load "lispcode/math.lisp")
+
+(label run
+       (lambda ()
+         (repeat 100
+                 (lambda ()
+                   (progn
+                     (factorial 20)
+                     (factorial-iter 20))))))
@@ -0,0 +1,13 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;;; This file is licensed under the terms of MIT license,
+;;;; see LICENSE file.
+;;;;
+;;;; Fibonacci numbers of math.lisp.
+
+(load "lispcode/math.lisp")
+
+(label run
+       (lambda ()
+         (repeat 50
+                 (lambda ()
+                   (fibonacci 90)))))
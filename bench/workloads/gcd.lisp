@@ -0,0 +1,14 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;;; This file is licensed under the terms of MIT license,
+;;;; see LICENSE file.
+;;;;
+;;;; Greatest common divisors of math.lisp, on consecutive Fibonacci
+;;;; numbers: the most steps for their size.
+
+(load "lispcode/math.lisp")
+
+(label run
+       (lambda ()
+         (repeat 100
+                 (lambda ()
+                   (gcd 2880067194370816120 1779979416004714189)))))
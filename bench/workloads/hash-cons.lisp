@@ -0,0 +1,12 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;;; This file is licensed under the terms of MIT license,
+;;;; see LICENSE file.
+;;;;
+;;;; HASH-CONS of a list of 100000 identical elements, every
+;;;; cell hashes from the one after it.
+
+(label same (map (lambda (x) 'a) (iota 100000)))
+
+(label run
+       (lambda ()
+         (hcons-p (hash-cons same))))
@@ -0,0 +1,15 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;;; This file is licensed under the terms of MIT license,
+;;;; see LICENSE file.
+;;;;
+;;;; Intersection of intersect.lisp on two lists of 10000 numbers,
+;;;; half of them in common.
+
+(load "lispcode/intersect.lisp")
+
+(label a (iota 10000))
+(label b (map (lambda (x) (+ x 5000)) a))
+
+(label run
+       (lambda ()
+         (intersect a b)))
@@ -0,0 +1,15 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;;; This file is licensed under the terms of MIT license,
+;;;; see LICENSE file.
+;;;;
+;;;; Intersection of intersect.lisp on two lists of 3000 numbers,
+;;;; half of them in common.
+
+(load "lispcode/intersect.lisp")
+
+(label a (iota 3000))
+(label b (map (lambda (x) (+ x 1500)) a))
+
+(label run
+       (lambda ()
+         (intersect a b)))
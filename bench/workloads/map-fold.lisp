@@ -0,0 +1,16 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;;; This file is licensed under the terms of MIT license,
+;;;; see LICENSE file.
+;;;;
+;;;; MAP, REDUCE and the folds over a list of 10000 numbers.
+
+(load "lispcode/core.lisp")
+
+(label numbers (iota 10000))
+
+(label run
+       (lambda ()
+         (progn
+           (reduce + (map (lambda (x) (* x x)) numbers))
+           (fold-left (lambda (acc x) (+ acc x)) 0 numbers)
+           (fold-right (lambda (x acc) (cons (+ x 1) acc)) nil numbers))))
@@ -0,0 +1,22 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;;;; This file is licensed under the terms of MIT license,
+;;;; see LICENSE file.
+;;;;
+;;;; The metacycle interpreter running a recursive Fibonacci.
+
+(load "lispcode/metacycle-interpreter.lisp")
+
+(label fib
+       '(label fib
+               (lambda (n)
+                 (if (< n 2)
+                     n
+                     (+ (fib (- n 1)) (fib (- n 2)))))))
+
+;; Forms are given one at a time, its PROGN evaluates the first only.
+(label run
+       (lambda ()
+         (let ((env (environment-init nil)))
+           (progn
+             (meval fib env)
+             (meval '(fib 5) env)))))
@@ -0,0 +1,64 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __ARRAY_H__
+#define __ARRAY_H__
+
+#include <stdint.h>
+
+/* Packed array of unboxed int64 or float64 elements. */
+struct array {
+    int kind;
+    long length;
+    union {
+        int64_t *i64;
+        double *f64;
+    } data;
+};
+
+enum {
+    ARRAY_INT64 = 0,
+    ARRAY_FLOAT64,
+};
+
+/* Comparisons for the count kernels. */
+enum {
+    ARRAY_LT = 0,
+    ARRAY_GT,
+    ARRAY_EQ,
+};
+
+/*
+ * Bulk kernels. Integer kernels wrap around on overflow like C
+ * does, the vectorized float sums may round differently from
+ * the scalar ones because they add in a different order.
+ */
+struct array_kernels {
+    char *name;
+
+    int64_t (*i64_sum)(const int64_t*, long);
+    int64_t (*i64_min)(const int64_t*, long);
+    int64_t (*i64_max)(const int64_t*, long);
+    int64_t (*i64_dot)(const int64_t*, const int64_t*, long);
+    void (*i64_add)(int64_t*, const int64_t*, const int64_t*, long);
+    void (*i64_mul)(int64_t*, const int64_t*, const int64_t*, long);
+    void (*i64_scale)(int64_t*, const int64_t*, int64_t, long);
+    long (*i64_count)(const int64_t*, long, int, int64_t);
+
+    double (*f64_sum)(const double*, long);
+    double (*f64_min)(const double*, long);
+    double (*f64_max)(const double*, long);
+    double (*f64_dot)(const double*, const double*, long);
+    void (*f64_add)(double*, const double*, const double*, long);
+    void (*f64_mul)(double*, const double*, const double*, long);
+    void (*f64_scale)(double*, const double*, double, long);
+    long (*f64_count)(const double*, long, int, double);
+};
+
+/* Filled by array_init(), min and max need length > 0. */
+extern struct array_kernels array_kernels;
+
+void array_init(void);
+struct array *array_new(int, long);
+void array_free(struct array*);
+
+#endif /* __ARRAY_H__ */
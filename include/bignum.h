@@ -0,0 +1,42 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __BIGNUM_H__
+#define __BIGNUM_H__
+
+#include <stdint.h>
+
+/*
+ * Arbitrary-precision integer: sign and magnitude
+ * in base 2^32 digits, least significant first.
+ * Zero has size 0.
+ */
+struct bignum {
+    int sign;
+    int size;
+    uint32_t *digits;
+};
+
+/* Below this number of digits multiplication is schoolbook. */
+#define KARATSUBA_THRESHOLD 32
+
+/* Room for a long in a bignum view, see bignum_view(). */
+#define BIGNUM_LONG_DIGITS 2
+
+struct bignum *bignum_new(int);
+void bignum_free(struct bignum*);
+struct bignum *bignum_copy(const struct bignum*);
+struct bignum *bignum_from_long(long);
+struct bignum *bignum_view(struct lispobj*, struct bignum*, uint32_t*);
+int bignum_to_long(const struct bignum*, long*);
+double bignum_to_double(const struct bignum*);
+struct bignum *bignum_from_string(const char*);
+char *bignum_to_string(const struct bignum*);
+int bignum_cmp(const struct bignum*, const struct bignum*);
+struct bignum *bignum_add(const struct bignum*, const struct bignum*);
+struct bignum *bignum_sub(const struct bignum*, const struct bignum*);
+struct bignum *bignum_mul(const struct bignum*, const struct bignum*);
+int bignum_divmod(const struct bignum*, const struct bignum*,
+                  struct bignum**, struct bignum**);
+struct lispobj *bignum_normalize(struct bignum*);
+
+#endif /* __BIGNUM_H__ */
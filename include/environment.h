@@ -6,12 +6,38 @@
 #define ENV_FIRST(env) (CAR((env)))
 #define ENV_REST(env) (CDR((env)))
 
+/* Symbols the evaluator compares with, interned once by env_init(). */
+enum {
+    SYM_NIL = 0,
+    SYM_PROC,
+    SYM_ERROR,
+    SYM_QUOTE,
+    SYM_SETQ,
+    SYM_LABEL,
+    SYM_IF,
+    SYM_COND,
+    SYM_LET,
+    SYM_LET_SEQUENTIAL,
+    SYM_LETREC,
+    SYM_PROGN,
+    SYM_LAMBDA,
+    SYM_IGNORE_ERRORS,
+    SYM_HANDLER_CASE,
+    SYM_FUTURE,
+    SYM_MAX,
+};
+
+#define SYMBOL_NIL (ctx->symbols[SYM_NIL])
+#define SYMBOL_PROC (ctx->symbols[SYM_PROC])
+#define SYMBOL_ERROR (ctx->symbols[SYM_ERROR])
+
 struct lispobj *env_var_lookup(struct lispobj*, struct lispobj*);
 struct lispobj *env_var_assign(struct lispobj*, struct lispobj*, struct lispobj*);
 struct lispobj *env_var_define(struct lispobj*, struct lispobj*, struct lispobj*);
-struct lispobj *env_val_list(struct lispobj*, struct lispobj*);
+struct lispobj *env_var_bind(struct lispobj*, struct lispobj*, struct lispobj*);
+void env_val_push(struct lispobj*, struct lispobj*);
 struct lispobj *env_proc_make(struct lispobj*, struct lispobj*, struct lispobj*);
-struct lispobj *env_frame_make(struct lispobj*, struct lispobj*);
+struct lispobj *env_frame_make(struct lispobj*, int, struct lispobj**);
 struct lispobj *env_init(void);
 #ifdef __DEBUG_ENV__
 void env_debug(void);
@@ -0,0 +1,89 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __ERROR_H__
+#define __ERROR_H__
+
+#include <setjmp.h>
+
+/*
+ * Handler of a non-local exit. Handlers live on the C stack
+ * and are linked into the handlers list of the context, error_signal()
+ * unwinds the evaluator stack and longjmps to the innermost one:
+ *
+ *   struct handler h;
+ *
+ *   handler_push(&h);
+ *   if(setjmp(h.jmp)) {
+ *       // h is already popped, h.condition is ours to release.
+ *   } else {
+ *       ...
+ *       handler_pop(&h);
+ *   }
+ */
+struct handler {
+    jmp_buf jmp;
+    /* Evaluator stack index at the moment of push. */
+    int stack_index;
+    /* Depth of the profiler's shadow stack, the same way. */
+    int profile_depth;
+    /* Signalled object. */
+    struct lispobj *condition;
+    struct handler *prev;
+};
+
+/* Predefined errors, they are allocated once by error_init(). */
+enum {
+    E_ARGS = 0,
+    E_STACK,
+    E_NOT_NUMBER,
+    E_NOT_CONS,
+    E_NOT_STRING,
+    E_NOT_SYMBOL,
+    E_WRONG_TYPE,
+    E_DIVISION_BY_ZERO,
+    E_UNKNOWN_PROC,
+    E_BAD_COND,
+    E_BAD_LET,
+    E_EMPTY_LET,
+    E_BAD_HANDLER,
+    E_NOT_VECTOR,
+    E_BAD_INDEX,
+    E_NOT_ARRAY,
+    E_ARRAY_MISMATCH,
+    E_EMPTY_ARRAY,
+    E_NOT_HASHTABLE,
+    E_BAD_TEST,
+    E_IMMUTABLE,
+    E_MAX,
+};
+
+#define ERROR_ARGS (ctx->errors[E_ARGS])
+#define ERROR_STACK (ctx->errors[E_STACK])
+#define ERROR_NOT_NUMBER (ctx->errors[E_NOT_NUMBER])
+#define ERROR_NOT_CONS (ctx->errors[E_NOT_CONS])
+#define ERROR_NOT_STRING (ctx->errors[E_NOT_STRING])
+#define ERROR_NOT_SYMBOL (ctx->errors[E_NOT_SYMBOL])
+#define ERROR_WRONG_TYPE (ctx->errors[E_WRONG_TYPE])
+#define ERROR_DIVISION_BY_ZERO (ctx->errors[E_DIVISION_BY_ZERO])
+#define ERROR_UNKNOWN_PROC (ctx->errors[E_UNKNOWN_PROC])
+#define ERROR_BAD_COND (ctx->errors[E_BAD_COND])
+#define ERROR_BAD_LET (ctx->errors[E_BAD_LET])
+#define ERROR_EMPTY_LET (ctx->errors[E_EMPTY_LET])
+#define ERROR_BAD_HANDLER (ctx->errors[E_BAD_HANDLER])
+#define ERROR_NOT_VECTOR (ctx->errors[E_NOT_VECTOR])
+#define ERROR_BAD_INDEX (ctx->errors[E_BAD_INDEX])
+#define ERROR_NOT_ARRAY (ctx->errors[E_NOT_ARRAY])
+#define ERROR_ARRAY_MISMATCH (ctx->errors[E_ARRAY_MISMATCH])
+#define ERROR_EMPTY_ARRAY (ctx->errors[E_EMPTY_ARRAY])
+#define ERROR_NOT_HASHTABLE (ctx->errors[E_NOT_HASHTABLE])
+#define ERROR_BAD_TEST (ctx->errors[E_BAD_TEST])
+#define ERROR_IMMUTABLE (ctx->errors[E_IMMUTABLE])
+
+void error_init(void);
+void error_print(struct lispobj*);
+void error_exit(struct lispobj*) __attribute__((noreturn));
+void handler_push(struct handler*);
+void handler_pop(struct handler*);
+void error_signal(struct lispobj*) __attribute__((noreturn));
+
+#endif /* __ERROR_H__ */
@@ -5,5 +5,6 @@
 
 struct lispobj *eval(struct lispobj*, struct lispobj*);
 struct lispobj *apply(struct lispobj*, struct lispobj*);
+struct lispobj *apply_argv(struct lispobj*, int, struct lispobj**);
 
 #endif /* __EVAL_H__ */
@@ -0,0 +1,87 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __FASL_H__
+#define __FASL_H__
+
+#include <stdint.h>
+
+struct reader;
+
+/*
+ * Fasl file: the forms of a source file as the reader made them,
+ * kept next to it as NAME.fasl for NAME.lisp. The evaluator walks
+ * plain forms, so there is nothing else to keep. Numbers are in
+ * host byte order, a foreign file fails the version check.
+ *
+ * Header, names of the symbols, then every form: a byte which is
+ * nonzero if the source goes on after it, and the object. Nothing
+ * is read past the end, a damaged file fails to decode.
+ */
+struct fasl_header {
+    char magic[4];
+    uint32_t version;
+    /* Source the file was made of. */
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint64_t hash;
+    uint32_t symbols;
+    uint32_t forms;
+};
+
+#define FASL_MAGIC "FASL"
+#define FASL_VERSION 2
+
+/* Tags of objects, lengths and integers are LEB128 varints. */
+enum {
+    FASL_NULL = 0,
+    FASL_SYMBOL,
+    FASL_NUMBER,
+    FASL_FLOAT,
+    FASL_BIGNUM,
+    FASL_STRING,
+    FASL_ERROR,
+    FASL_VECTOR,
+    /* Count of conses, their cars and the last cdr. */
+    FASL_LIST,
+};
+
+struct fasl_buffer {
+    unsigned char *data;
+    long length;
+    long size;
+};
+
+struct fasl {
+    unsigned char *data;
+    long length;
+    long pos;
+    struct lispobj **symbols;
+    uint32_t nsymbols;
+    /* Forms left. */
+    uint32_t forms;
+    int broken;
+};
+
+struct fasl_writer {
+    struct fasl_buffer names;
+    struct fasl_buffer code;
+    /* Symbol to its index. */
+    struct hash_table *symbols;
+    uint32_t nsymbols;
+    uint32_t forms;
+    /* Set by a form which can't be written. */
+    int broken;
+};
+
+char *fasl_path(const char*);
+struct fasl *fasl_open(const char*);
+struct lispobj *fasl_next(struct fasl*, int*);
+void fasl_close(struct fasl*);
+struct fasl_writer *fasl_writer_new(void);
+void fasl_write_form(struct fasl_writer*, struct lispobj*, int);
+int fasl_writer_finish(struct fasl_writer*, const char*, struct reader*);
+void fasl_writer_free(struct fasl_writer*);
+int compile_file(const char*);
+
+#endif /* __FASL_H__ */
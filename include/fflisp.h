@@ -1,12 +1,66 @@
 /* This file is licensed under the terms of MIT license, see LICENSE file. */
 
 #ifndef __FFLISP_H__
-#define __FFLIST_H__
+#define __FFLISP_H__
 
-extern struct lispobj *symbol_table;
-extern struct lispobj *environment;
-extern struct lispobj *nil;
-extern struct lispobj *t;
-extern struct heap *heap;
+#include "../include/error.h"
+#include "../include/hcons.h"
+#include "../include/environment.h"
+
+struct pool_futures;
+struct pool_job;
+struct symbol_table;
+struct profile;
+
+/*
+ * Interpreter context: everything one interpreter owns. A thread
+ * runs the context it has entered, the runtime reaches it through
+ * the thread's ctx pointer. Contexts of different threads have
+ * nothing to write in common, so they run in parallel.
+ *
+ * A context made from a base one starts with the symbols and the
+ * definitions of the base. The base is frozen for that: its objects
+ * become shared, nobody counts, frees or changes them any more. It
+ * must not run again and is freed after all contexts made from it.
+ */
+struct fflisp_ctx {
+    struct heap *heap;
+    /* Objects of a frozen context. */
+    struct heap *shared;
+    /* evaluator stack */
+    struct stack *stack;
+    /* list of error handlers */
+    struct handler *handlers;
+    /* interned symbols, see heap.h */
+    struct symbol_table *symbol_table;
+    /* global environment */
+    struct lispobj *environment;
+    /* alias to the T object */
+    struct lispobj *t;
+    /* preallocated errors, see error.h */
+    struct lispobj *errors[E_MAX];
+    /* special forms and others, see environment.h */
+    struct lispobj *symbols[SYM_MAX];
+    struct hcons_table hcons;
+    /* reader builds hash-consed lists if nonzero */
+    int read_hash_cons;
+    /* results aren't printed if nonzero, see error_exit() */
+    int batch;
+    /* reader of the standard input */
+    struct reader *stdin_reader;
+    struct fflisp_ctx *base;
+    /* futures not joined yet, see pool.c */
+    struct pool_futures *futures;
+    /* job the context runs, NULL unless it's a pool's one */
+    struct pool_job *job;
+    /* NULL unless it's profiled, see profile.h */
+    struct profile *profile;
+};
+
+extern __thread struct fflisp_ctx *ctx;
+
+struct fflisp_ctx *fflisp_ctx_new(struct fflisp_ctx*);
+struct fflisp_ctx *fflisp_ctx_enter(struct fflisp_ctx*);
+void fflisp_ctx_free(struct fflisp_ctx*);
 
 #endif /* __FFLISP_H__ */
@@ -0,0 +1,63 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __HASHTABLE_H__
+#define __HASHTABLE_H__
+
+/* Key comparison of a hash table. */
+enum {
+    HASH_EQ = 0,
+    HASH_EQL,
+    HASH_EQUAL,
+};
+
+enum {
+    HASH_SLOT_EMPTY = 0,
+    HASH_SLOT_FULL,
+    HASH_SLOT_DELETED,
+};
+
+struct hash_entry {
+    struct lispobj *key;
+    struct lispobj *value;
+    unsigned long hash;
+    int state;
+};
+
+/* Open addressing with linear probing, size is a power of two. */
+struct hash_part {
+    struct hash_entry *entries;
+    long size;
+    /* Full and deleted slots, they both lengthen probes. */
+    long used;
+};
+
+/*
+ * Growing doesn't rehash everything at once: the old part stays
+ * around and every operation moves a few of its slots into the
+ * new one, lookups check both until the old part is drained.
+ */
+struct hash_table {
+    int test;
+    long count;
+    struct hash_part cur;
+    struct hash_part old;
+    /* Next slot of the old part to move. */
+    long migrate;
+};
+
+#define HASH_MIN_SIZE 8
+/* Slots of the old part moved by a single operation. */
+#define HASH_MIGRATE_STEP 16
+
+struct hash_table *hash_table_new(int);
+void hash_table_free(struct hash_table*);
+void hash_table_drop(struct hash_table*);
+unsigned long hash_mix(unsigned long);
+unsigned long hash_object(int, struct lispobj*);
+struct lispobj *hash_table_get(struct hash_table*, struct lispobj*, int*);
+struct lispobj *hash_table_peek(struct hash_table*, struct lispobj*, int*);
+void hash_table_put(struct hash_table*, struct lispobj*, struct lispobj*);
+int hash_table_remove(struct hash_table*, struct lispobj*);
+void hash_table_settle(struct hash_table*);
+
+#endif /* __HASHTABLE_H__ */
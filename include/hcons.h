@@ -0,0 +1,34 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __HCONS_H__
+#define __HCONS_H__
+
+/*
+ * Hash-consed conses carry a nonzero hash. They are immutable and
+ * there is only one of them for each structure, so EQUAL on two of
+ * them is a pointer comparison.
+ */
+#define IS_HCONS(x)                                                     \
+    ((x) != NULL && OBJ_TYPE((x)) == CONS && CONS_VALUE((x))->hash != 0)
+
+#define HCONS_MIN_SIZE 64
+
+/*
+ * Weak table of all hash-consed conses: it doesn't grab them,
+ * object_delete() takes a cons out of it instead. Open addressing
+ * with linear probing, slots of removed conses keep a tombstone.
+ */
+struct hcons_table {
+    struct lispobj **slots;
+    long size;
+    long count;
+    /* Live conses and tombstones. */
+    long used;
+};
+
+struct lispobj *hcons(struct lispobj*, struct lispobj*);
+struct lispobj *hcons_tree(struct lispobj*);
+void hcons_forget(struct lispobj*);
+long hcons_count(void);
+
+#endif /* __HCONS_H__ */
@@ -3,20 +3,65 @@
 #ifndef __HEAP_H__
 #define __HEAP_H__
 
+struct symbol_cache;
+
 struct heap {
     struct lispobj **data;
     int index;
     int size;
+    /* Objects ever added, for the benchmarks. */
+    unsigned long added;
+    /* Futures reading the objects, see heap_defer(). */
+    int readers;
+    /* Objects let go while there were readers, one reference each. */
+    struct lispobj **deferred;
+    int ndeferred;
+    int deferred_size;
+};
+
+/* Slots of a symbol table, a grown table keeps the old ones. */
+struct symbol_slots {
+    long size;
+    struct symbol_slots *prev;
+    struct lispobj *slots[];
+};
+
+/*
+ * Interned symbols by name, open addressing with linear probing. A
+ * context made from another one, or lent its symbols, interns into
+ * a table of its own on top of the other's, which it only reads.
+ * Other threads may read a table while it changes: slots are stored
+ * one at a time and grown ones are replaced whole.
+ */
+struct symbol_table {
+    struct symbol_slots *slots;
+    /* Live symbols, and live ones with tombstones. */
+    long count;
+    long used;
+    struct symbol_table *parent;
 };
 
 struct heap *heap_init(void);
+void heap_free(struct heap*);
 struct lispobj *heap_add(struct lispobj*);
 void heap_remove(struct lispobj*);
 void heap_clean(void);
+void heap_freeze(void);
+void heap_share(void);
+int heap_foreign(struct lispobj*);
 struct lispobj *heap_grab(struct lispobj*);
 void heap_release(struct lispobj*);
+void heap_sweep(void);
+struct symbol_table *symbol_table_new(struct symbol_table*);
+void symbol_table_free(struct symbol_table*);
 struct lispobj *symbol_table_intern(struct lispobj*);
 struct lispobj *symbol_table_lookup(char*);
+struct lispobj *symbol_table_lookup_token(const char*, long);
+void heap_detach(void);
+struct lispobj *heap_adopt(struct lispobj*);
+struct symbol_cache *symbol_cache_new(void);
+void symbol_cache_free(struct symbol_cache*);
+struct lispobj *symbol_cache_intern(struct symbol_cache*, const char*, long);
 #ifdef __DEBUG_SYMT__
 void symbol_table_debug(void);
 #endif /* __DEBUG_SYMT__ */
@@ -25,5 +70,15 @@ void heap_debug(void);
 #endif /* __DEBUG_HEAP__ */
 
 #define HEAP_SIZE (2 << 10)
+/* Heap index of an object of a frozen context, see fflisp.h. */
+#define HEAP_SHARED (-2)
+#define IS_SHARED(x) ((x) != NULL && (x)->heap_index == HEAP_SHARED)
+/* Objects the context may not change, shared ones and the objects
+   a job reads from the contexts which run it, see heap_foreign(). */
+#define IS_FROZEN(x) (IS_SHARED(x) || heap_foreign(x))
+/* First number of buckets of a symbol cache, a power of two. */
+#define SYMBOL_CACHE_SIZE 256
+/* First number of slots of a symbol table, a power of two. */
+#define SYMBOL_TABLE_SIZE 1024
 
 #endif /* __HEAP_H__ */
@@ -0,0 +1,114 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __LIBFFLISP_H__
+#define __LIBFFLISP_H__
+
+/*
+ * Embedding API of libfflisp.a and libfflisp.so.
+ *
+ * An interpreter boots the primitives once in fflisp_init(), programs
+ * then run in a context made on top of them: definitions of one call
+ * are seen by the next, until fflisp_reset() drops them all without
+ * booting again. An interpreter is used by one thread at a time,
+ * different interpreters run in parallel.
+ *
+ * Values are struct lispobj pointers, NULL is NIL. Every value an
+ * fflisp_ function returns is a reference of the caller's, given back
+ * with fflisp_release(). Values are only good in their interpreter
+ * and until it's reset or freed.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fflisp;
+struct lispobj;
+
+/* Types of values, the same as in object.h. */
+enum {
+    FFLISP_NIL = -1,
+    FFLISP_CONS = 0,
+    FFLISP_NUMBER,
+    FFLISP_SYMBOL,
+    FFLISP_STRING,
+    FFLISP_ERROR,
+    FFLISP_SUBR,
+    FFLISP_BIGNUM,
+    FFLISP_FLOAT,
+    FFLISP_VECTOR,
+    FFLISP_ARRAY,
+    FFLISP_HASHTABLE,
+    FFLISP_FUTURE
+};
+
+/* The only symbols libfflisp.so exports. */
+#define FFLISP_API __attribute__((visibility("default")))
+
+/* Any number of arguments for fflisp_define(). */
+#define FFLISP_VARIADIC (-1)
+
+FFLISP_API struct fflisp *fflisp_init(void);
+FFLISP_API void fflisp_reset(struct fflisp*);
+FFLISP_API void fflisp_free(struct fflisp*);
+
+/*
+ * These return 0 and store the result, or -1 if the code signalled a
+ * condition or couldn't be read: fflisp_error() tells which then.
+ */
+FFLISP_API int fflisp_eval_string(struct fflisp*, const char *source,
+                                  struct lispobj **result);
+FFLISP_API int fflisp_call(struct fflisp*, const char *name, int argc,
+                           struct lispobj **argv, struct lispobj **result);
+FFLISP_API const char *fflisp_error(struct fflisp*);
+
+/*
+ * Defines a native procedure, called with data and its arguments.
+ * Natives are defined again by fflisp_reset(), so they outlive it.
+ *
+ * The arguments are borrowed, the result is a reference of its own:
+ * made by the functions below, or an argument given to
+ * fflisp_retain(). It fails with fflisp_fail(), which doesn't return.
+ */
+FFLISP_API void fflisp_define(struct fflisp*, const char *name,
+                              struct lispobj *(*native)(void*, int,
+                                                        struct lispobj**),
+                              void *data, int min_args, int max_args);
+FFLISP_API void fflisp_fail(struct fflisp*, const char *message)
+    __attribute__((noreturn));
+
+FFLISP_API struct lispobj *fflisp_retain(struct fflisp*, struct lispobj*);
+FFLISP_API void fflisp_release(struct fflisp*, struct lispobj*);
+
+/* Values in. */
+FFLISP_API struct lispobj *fflisp_number(struct fflisp*, long);
+FFLISP_API struct lispobj *fflisp_float(struct fflisp*, double);
+FFLISP_API struct lispobj *fflisp_string(struct fflisp*, const char*,
+                                          long length);
+FFLISP_API struct lispobj *fflisp_symbol(struct fflisp*, const char*);
+FFLISP_API struct lispobj *fflisp_cons(struct fflisp*, struct lispobj*,
+                                       struct lispobj*);
+
+/*
+ * Values out. A string isn't NUL-terminated. The CAR and the CDR
+ * are borrowed from the list.
+ */
+FFLISP_API int fflisp_type(struct lispobj*);
+FFLISP_API int fflisp_to_long(struct lispobj*, long*);
+FFLISP_API int fflisp_to_double(struct lispobj*, double*);
+FFLISP_API const char *fflisp_to_string(struct lispobj*, long *length);
+FFLISP_API const char *fflisp_symbol_name(struct lispobj*);
+FFLISP_API struct lispobj *fflisp_car(struct lispobj*);
+FFLISP_API struct lispobj *fflisp_cdr(struct lispobj*);
+/* The printed value, freed by the caller. */
+FFLISP_API char *fflisp_print(struct fflisp*, struct lispobj*);
+
+/* Objects made in the interpreter since its last reset, not counting
+   those of the jobs of PMAP and friends. */
+FFLISP_API unsigned long fflisp_allocations(struct fflisp*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBFFLISP_H__ */
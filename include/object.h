@@ -9,36 +9,76 @@ enum {
     SYMBOL,
     STRING,
     ERROR,
+    SUBR,
+    BIGNUM,
+    FLOAT,
+    VECTOR,
+    ARRAY,
+    HASHTABLE,
+    FUTURE,
 };
 
 struct lispobj {
     int refs;
     int type;
+    /* Slot in the heap, -1 if it's not there. Fits the padding
+       malloc gives a 16 byte object anyway. */
+    int heap_index;
     union {
-        int number;
+        long number;
+        double real;
         char *symbol;
-        char *string;
+        struct string {
+            long length;
+            /* Not NUL-terminated when it's a slice. */
+            char *data;
+            /* Owner of the shared buffer, NULL if data is ours. */
+            struct lispobj *parent;
+        } *string;
         char *error;
+        struct subr *subr;
+        struct bignum *bignum;
+        struct array *array;
+        struct hash_table *hashtable;
+        struct pool_job *future;
         struct cons {
             struct lispobj *car;
             struct lispobj *cdr;
+            /* Nonzero if the cons is hash-consed, see hcons.h. */
+            unsigned long hash;
         } *cons;
+        struct vector {
+            int length;
+            struct lispobj *data[];
+        } *vector;
     } value;
 };
 
 #include "../include/fflisp.h"
 
-#define OBJ_TRUE t
-#define OBJ_FALSE nil
+#define OBJ_TRUE (ctx->t)
+#define OBJ_FALSE NULL
 
 #define SYMBOL_VALUE(x) ((x)->value.symbol)
 #define NUMBER_VALUE(x) ((x)->value.number)
 #define STRING_VALUE(x) ((x)->value.string)
+#define STRING_DATA(x) (STRING_VALUE((x))->data)
+#define STRING_LENGTH(x) (STRING_VALUE((x))->length)
 #define ERROR_VALUE(x) ((x)->value.error)
 #define CONS_VALUE(x) ((x)->value.cons)
+#define SUBR_VALUE(x) ((x)->value.subr)
+#define BIGNUM_VALUE(x) ((x)->value.bignum)
+#define FLOAT_VALUE(x) ((x)->value.real)
+#define ARRAY_VALUE(x) ((x)->value.array)
+#define HASHTABLE_VALUE(x) ((x)->value.hashtable)
+#define FUTURE_VALUE(x) ((x)->value.future)
+#define VECTOR_VALUE(x) ((x)->value.vector)
+#define VECTOR_LENGTH(x) (VECTOR_VALUE((x))->length)
+#define VECTOR_DATA(x) (VECTOR_VALUE((x))->data)
 
 #define NEW_SYMBOL(o) (object_create(SYMBOL, (o)))
 #define NEW_NUMBER(o) (object_create(NUMBER, (o)))
+#define NEW_FLOAT(o) (object_create(FLOAT, (o)))
 #define NEW_STRING(o) (object_create(STRING, (o)))
 #define NEW_ERROR(o) (object_create(ERROR, (o)))
 #define NEW_CONS(car, cdr) (cons((car), (cdr)))
@@ -55,6 +95,8 @@ struct lispobj {
 #define OBJ_REFS(x) ((x)->refs)
 
 struct lispobj *object_create(int, char*);
+struct lispobj *symbol_fresh(const char*);
 void object_delete(struct lispobj*);
+void object_free(struct lispobj*);
 
 #endif /* __OBJECT_H__ */
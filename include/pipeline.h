@@ -0,0 +1,43 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <pthread.h>
+
+struct reader;
+
+/* Forms read ahead at most, a power of two. */
+#define PIPELINE_SIZE 1024
+/* Smaller files aren't worth a thread. */
+#define PIPELINE_MIN (1 << 16)
+
+struct pipeline_slot {
+    struct lispobj *form;
+    /* Nonzero if the input goes on right after the form. */
+    int more;
+};
+
+/*
+ * Forms of a file read ahead by a reader thread while the evaluator
+ * works. The queue has one producer and one consumer and no locks:
+ * each side only moves its own index.
+ */
+struct pipeline {
+    /* Of the evaluator, the reader thread only reads its mode. */
+    struct fflisp_ctx *ctx;
+    struct reader *reader;
+    struct symbol_cache *symbols;
+    pthread_t thread;
+    struct pipeline_slot slots[PIPELINE_SIZE];
+    /* Next slot to fill, written by the reader thread. */
+    unsigned long head __attribute__((aligned(64)));
+    /* Next slot to take, written by the evaluator. */
+    unsigned long tail __attribute__((aligned(64)));
+};
+
+struct pipeline *pipeline_start(struct reader*);
+struct lispobj *pipeline_next(struct pipeline*, int*);
+void pipeline_finish(struct pipeline*);
+
+#endif /* __PIPELINE_H__ */
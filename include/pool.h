@@ -0,0 +1,44 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+/* Shorter lists aren't worth waking the workers. */
+#define POOL_MIN_LENGTH 64
+/* Chunks per worker when the caller doesn't choose their size, so
+   a slow chunk doesn't keep the others idle. */
+#define POOL_CHUNKS 4
+
+/* First number of slots of a deque of jobs, a power of two. */
+#define POOL_DEQUE_SIZE 64
+
+/* Jobs nested on the C stack of a thread at most, a deeper one
+   fails with a stack overflow. */
+#define POOL_NESTING 256
+/* Slots of the evaluator stack a nested job counts for the C stack
+   the frames of the pool take. */
+#define POOL_NESTING_COST 64
+/* C stack of a pool thread, the evaluator stack is sized for it. */
+#define POOL_STACK_SIZE (8 << 20)
+
+struct pool_job;
+
+/*
+ * Work split into count pieces, run() makes the object of one piece
+ * and returns it grabbed. It runs in a context of its own: it reads
+ * the objects of the caller, which waits meanwhile, and whatever it
+ * makes stays in that context until pool_run() moves it over.
+ */
+struct pool_task {
+    struct lispobj *(*run)(struct pool_task*, long);
+    long count;
+};
+
+int pool_workers(void);
+int pool_run(struct pool_task*, struct lispobj*);
+struct lispobj *pool_future(struct lispobj*, struct lispobj*);
+struct lispobj *pool_touch(struct lispobj*);
+void pool_future_free(struct pool_job*);
+void pool_drain(void);
+
+#endif /* __POOL_H__ */
@@ -3,6 +3,36 @@
 #ifndef __PRINT_H__
 #define __PRINT_H__
 
+#include <stdio.h>
+
+/* Enough for any double format_float() produces. */
+#define FLOAT_STRING_SIZE 32
+
+/* Output of print() goes to the stream in writes of this size. */
+#define PRINT_BUFFER_SIZE (1 << 16)
+/* First size of the buffer of print_to_string(), it grows. */
+#define PRINT_STRING_SIZE 256
+
+/*
+ * Printing state, nothing is global so printing is reentrant.
+ * Text is gathered in the buffer, a full buffer is written to the
+ * stream or grown if there is none.
+ */
+struct printer {
+    char *data;
+    long length;
+    long size;
+    FILE *stream;
+    /* Looked up by the first list, PROC is NULL if it's not
+       interned: there are no procedures then. */
+    struct lispobj *proc;
+    struct lispobj *nil;
+};
+
 void print(struct lispobj*);
+void print_stream(struct lispobj*, FILE*);
+struct lispobj *print_to_string(struct lispobj*);
+void print_append(struct lispobj*, char**, long*, long*);
+void format_float(char*, double);
 
 #endif /* __PRINT_H__ */
@@ -0,0 +1,86 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+/*
+ * Sampling profiler of Lisp procedures. While it's on, apply_argv()
+ * keeps a shadow stack of the procedures being applied, and every
+ * PROFILE_INTERVAL of CPU time SIGPROF copies it into the samples.
+ * Samples are folded into counts of distinct stacks outside of the
+ * signal handler, and written as the folded stacks of flamegraph.pl.
+ *
+ * A lambda is named by the LABEL it's written in, a lambda written
+ * inside of it NAME/lambda. Others are named by where they
+ * are written: lambda@FILE#N is in the Nth top-level form of FILE.
+ * Primitives have their own names.
+ *
+ * Only the context which started the profiler is sampled, not the
+ * jobs of PMAP and FUTURE nor the sessions of a server.
+ */
+
+/* Microseconds of CPU time between samples. */
+#define PROFILE_INTERVAL 1000
+/* Innermost frames kept by a sample, deeper stacks are cut. */
+#define PROFILE_FRAMES 128
+/* As deep as the shadow stack is kept, calls deeper are counted. */
+#define PROFILE_DEPTH (1 << 16)
+/* Frames of the samples waiting to be folded, folded at half. */
+#define PROFILE_SAMPLES (1 << 18)
+/* First sizes of the tables, powers of two. */
+#define PROFILE_PROCS 256
+#define PROFILE_STACKS 1024
+
+/* Procedure of the stacks: a lambda by its body, or a struct subr. */
+struct profile_proc {
+    const void *key;
+    char *name;
+    /* Nonzero once the name is final, a LABEL or a primitive. */
+    int labelled;
+};
+
+/* A distinct stack, outermost procedure first. */
+struct profile_stack {
+    unsigned long hash;
+    int length;
+    long count;
+    struct profile_proc **frames;
+};
+
+struct profile {
+    /* Where the folded stacks go. */
+    char *path;
+    struct profile_proc **stack;
+    /* The signal handler reads it, it changes after the frame. */
+    volatile int depth;
+    /* Runs of frames ended by NULL, innermost last. */
+    struct profile_proc **samples;
+    volatile long length;
+    /* Samples with no room left. */
+    volatile long lost;
+    /* Procedures by key and stacks by frames, open addressing. */
+    struct profile_proc **procs;
+    long procs_count;
+    long procs_size;
+    struct profile_stack *stacks;
+    long stacks_count;
+    long stacks_size;
+    /* Tags of procedures and of lambdas, looked up once. */
+    struct lispobj *proc_tag;
+    struct lispobj *lambda_tag;
+    /* Top-level form being loaded, file is NULL out of a load. */
+    const char *file;
+    int form;
+};
+
+struct lispobj;
+
+void profile_start(const char*);
+void profile_stop(void);
+void profile_enter(struct profile*, struct lispobj*);
+void profile_leave(struct profile*);
+void profile_form(struct profile*, struct lispobj*);
+void profile_label(struct profile*, struct lispobj*, struct lispobj*,
+                   struct lispobj*);
+
+#endif /* __PROFILE_H__ */
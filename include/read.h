@@ -3,6 +3,37 @@
 #ifndef __READ_H__
 #define __READ_H__
 
-struct lispobj *read(FILE*);
+/*
+ * Input of the reader is a memory buffer: a whole mapped file,
+ * or blocks read from a descriptor. Tokens are taken right out
+ * of the buffer, refilling keeps the token being read.
+ */
+struct reader {
+    char *data;
+    long length;
+    /* Next character. */
+    long pos;
+    /* Start of the token being read, -1 if there is none. */
+    long mark;
+    /* Source of the blocks, -1 when the input is all in data. */
+    int fd;
+    int own_fd;
+    /* Capacity of data, it's 0 for a mapped file. */
+    long size;
+    long mapped;
+    /* Symbols of a reader thread, NULL to use the symbol table. */
+    struct symbol_cache *symbols;
+};
+
+/* Size of the first buffer for a descriptor, it grows for longer tokens. */
+#define READER_BLOCK (1 << 16)
+
+struct reader *reader_open_file(const char*);
+struct reader *reader_open_fd(int);
+struct reader *reader_open_buffer(char*, long);
+void reader_close(struct reader*);
+int reader_peek(struct reader*);
+int reader_skip(struct reader*);
+struct lispobj *read_form(struct reader*);
 
 #endif /* __READ_H__ */
@@ -3,7 +3,10 @@
 #ifndef __REPL_H__
 #define __REPL_H__
 
+struct reader;
+
 int load(const char*);
-void repl(FILE*);
+void batch(struct reader*);
+void repl(struct reader*);
 
 #endif /* __REPL_H__ */
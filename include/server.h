@@ -0,0 +1,29 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+/*
+ * Frames in both directions are a 4-byte big-endian length and that
+ * many bytes. A request holds source code, its response the printed
+ * results of its forms, one per line.
+ */
+#define SERVER_FRAME_HEADER 4
+/* Longer requests close the connection. */
+#define SERVER_MAX_REQUEST (16 << 20)
+
+/* A connection isn't read while this much of its output is unsent, */
+#define SERVER_MAX_OUTPUT (1 << 20)
+/* or while it has this many requests waiting. */
+#define SERVER_MAX_PENDING 64
+
+/* Bytes read from a connection per event, so others get their turn. */
+#define SERVER_READ_SIZE (1 << 16)
+#define SERVER_EVENTS 64
+
+/* Latency buckets: under 1us, then powers of two of microseconds. */
+#define SERVER_BUCKETS 32
+
+int server_run(const char*);
+
+#endif /* __SERVER_H__ */
@@ -0,0 +1,25 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#ifndef __STACK_H__
+#define __STACK_H__
+
+/*
+ * Evaluator stack: arguments of a call are evaluated onto it
+ * and handed to the procedure as a vector, so applying
+ * a primitive doesn't allocate anything.
+ */
+struct stack {
+    struct lispobj **data;
+    int index;
+    int size;
+};
+
+struct stack *stack_init(void);
+void stack_free(struct stack*);
+void stack_push(struct lispobj*);
+void stack_unwind(int);
+
+/* The size is fixed, so argument vectors never move. */
+#define STACK_SIZE (1 << 16)
+
+#endif /* __STACK_H__ */
@@ -3,54 +3,141 @@
 #ifndef __SUBR_H__
 #define __SUBR_H__
 
+/* Primitive procedure, SUBR object points to it. */
+struct subr {
+    char *name;
+    struct lispobj *(*fn)(int, struct lispobj**);
+    int min_args;
+    int max_args; /* SUBR_VARIADIC if there is no limit. */
+    int flags;
+    /* Set instead of fn for a native of libfflisp.h, it's given data
+       and returns a grabbed object. */
+    struct lispobj *(*native)(void*, int, struct lispobj**);
+    void *data;
+};
+
+#define SUBR_VARIADIC (-1)
+
+/* No side effects, result depends only on the arguments. */
+#define SUBR_PURE 0x1
+/* May return a freshly allocated object. */
+#define SUBR_ALLOC 0x2
+
+#define IS_INTEGER(x)                                               \
+    ((x) != NULL && (OBJ_TYPE((x)) == NUMBER || OBJ_TYPE((x)) == BIGNUM))
+
+#define IS_NUMERIC(x) (IS_INTEGER((x)) || ((x) != NULL && OBJ_TYPE((x)) == FLOAT))
+
 int length(struct lispobj*);
+int eql(struct lispobj*, struct lispobj*);
+int equal(struct lispobj*, struct lispobj*);
 struct lispobj *cons(struct lispobj*, struct lispobj*);
 struct lispobj *list(int, ...);
+struct lispobj *number(long);
+struct lispobj *flonum(double);
+struct lispobj *string(const char*, long);
+struct lispobj *string_slice(struct lispobj*, long, long);
+char *string_to_c(struct lispobj*);
+struct lispobj *vector(int, struct lispobj*);
+struct lispobj *list_to_vector(struct lispobj*);
+
+struct lispobj *subr_newline(int, struct lispobj**);
+struct lispobj *subr_display(int, struct lispobj**);
+struct lispobj *subr_rplaca(int, struct lispobj**);
+struct lispobj *subr_rplacd(int, struct lispobj**);
+struct lispobj *subr_hcons(int, struct lispobj**);
+struct lispobj *subr_hash_cons(int, struct lispobj**);
+struct lispobj *subr_hcons_p(int, struct lispobj**);
+struct lispobj *subr_hash_cons_reader(int, struct lispobj**);
+struct lispobj *subr_apply(int, struct lispobj**);
+struct lispobj *subr_error(int, struct lispobj**);
+struct lispobj *subr_signal(int, struct lispobj**);
+struct lispobj *subr_error_message(int, struct lispobj**);
+struct lispobj *subr_eval(int, struct lispobj**);
+struct lispobj *subr_touch(int, struct lispobj**);
+struct lispobj *subr_read(int, struct lispobj**);
+struct lispobj *subr_load(int, struct lispobj**);
+struct lispobj *subr_car(int, struct lispobj**);
+struct lispobj *subr_cdr(int, struct lispobj**);
+struct lispobj *subr_cons(int, struct lispobj**);
+struct lispobj *subr_pair(int, struct lispobj**);
+struct lispobj *subr_number(int, struct lispobj**);
+struct lispobj *subr_string(int, struct lispobj**);
+struct lispobj *subr_symbol(int, struct lispobj**);
+struct lispobj *subr_atom(int, struct lispobj**);
+struct lispobj *subr_null(int, struct lispobj**);
+struct lispobj *subr_not(int, struct lispobj**);
+struct lispobj *subr_or(int, struct lispobj**);
+struct lispobj *subr_and(int, struct lispobj**);
+struct lispobj *subr_eq(int, struct lispobj**);
+struct lispobj *subr_eql(int, struct lispobj**);
+struct lispobj *subr_list(int, struct lispobj**);
+struct lispobj *subr_plus(int, struct lispobj**);
+struct lispobj *subr_multi(int, struct lispobj**);
+struct lispobj *subr_mod(int, struct lispobj**);
+struct lispobj *subr_compar(int, struct lispobj**);
+struct lispobj *subr_greatthan(int, struct lispobj**);
+struct lispobj *subr_lessthan(int, struct lispobj**);
+struct lispobj *subr_minus(int, struct lispobj**);
+struct lispobj *subr_divide(int, struct lispobj**);
+struct lispobj *subr_equal(int, struct lispobj**);
+struct lispobj *subr_make_vector(int, struct lispobj**);
+struct lispobj *subr_vector_ref(int, struct lispobj**);
+struct lispobj *subr_vector_set(int, struct lispobj**);
+struct lispobj *subr_vector_length(int, struct lispobj**);
+struct lispobj *subr_vector_to_list(int, struct lispobj**);
+struct lispobj *subr_list_to_vector(int, struct lispobj**);
+struct lispobj *subr_make_int64_array(int, struct lispobj**);
+struct lispobj *subr_make_float64_array(int, struct lispobj**);
+struct lispobj *subr_list_to_int64_array(int, struct lispobj**);
+struct lispobj *subr_list_to_float64_array(int, struct lispobj**);
+struct lispobj *subr_array_to_list(int, struct lispobj**);
+struct lispobj *subr_array_length(int, struct lispobj**);
+struct lispobj *subr_array_ref(int, struct lispobj**);
+struct lispobj *subr_array_set(int, struct lispobj**);
+struct lispobj *subr_array_sum(int, struct lispobj**);
+struct lispobj *subr_array_min(int, struct lispobj**);
+struct lispobj *subr_array_max(int, struct lispobj**);
+struct lispobj *subr_array_dot(int, struct lispobj**);
+struct lispobj *subr_array_add(int, struct lispobj**);
+struct lispobj *subr_array_mul(int, struct lispobj**);
+struct lispobj *subr_array_scale(int, struct lispobj**);
+struct lispobj *subr_array_count(int, struct lispobj**);
+struct lispobj *subr_make_hash_table(int, struct lispobj**);
+struct lispobj *subr_gethash(int, struct lispobj**);
+struct lispobj *subr_puthash(int, struct lispobj**);
+struct lispobj *subr_remhash(int, struct lispobj**);
+struct lispobj *subr_hash_count(int, struct lispobj**);
+struct lispobj *subr_maphash(int, struct lispobj**);
+struct lispobj *subr_string_length(int, struct lispobj**);
+struct lispobj *subr_string_append(int, struct lispobj**);
+struct lispobj *subr_substring(int, struct lispobj**);
+struct lispobj *subr_string_search(int, struct lispobj**);
+struct lispobj *subr_string_split(int, struct lispobj**);
+struct lispobj *subr_string_to_number(int, struct lispobj**);
+struct lispobj *subr_number_to_string(int, struct lispobj**);
+struct lispobj *subr_write_to_string(int, struct lispobj**);
+struct lispobj *subr_string_equal(int, struct lispobj**);
+/* list.c */
+struct lispobj *subr_length(int, struct lispobj**);
+struct lispobj *subr_map(int, struct lispobj**);
+struct lispobj *subr_reduce(int, struct lispobj**);
+struct lispobj *subr_fold_left(int, struct lispobj**);
+struct lispobj *subr_fold_right(int, struct lispobj**);
+struct lispobj *subr_append(int, struct lispobj**);
+struct lispobj *subr_reverse(int, struct lispobj**);
+struct lispobj *subr_remove_if(int, struct lispobj**);
+struct lispobj *subr_find_if(int, struct lispobj**);
+struct lispobj *subr_find(int, struct lispobj**);
+struct lispobj *subr_member(int, struct lispobj**);
+struct lispobj *subr_assoc(int, struct lispobj**);
+struct lispobj *subr_nth(int, struct lispobj**);
+struct lispobj *subr_last(int, struct lispobj**);
+struct lispobj *subr_sort(int, struct lispobj**);
+struct lispobj *subr_pmap(int, struct lispobj**);
+struct lispobj *subr_pfilter(int, struct lispobj**);
+struct lispobj *subr_preduce(int, struct lispobj**);
+struct lispobj *subr_heap(int, struct lispobj**);
+struct lispobj *subr_heap_object(int, struct lispobj**);
 
-struct lispobj *subr_newline(struct lispobj*);
-struct lispobj *subr_display(struct lispobj*);
-struct lispobj *subr_rplaca(struct lispobj*);
-struct lispobj *subr_rplacd(struct lispobj*);
-struct lispobj *subr_apply(struct lispobj*);
-struct lispobj *subr_error(struct lispobj*);
-struct lispobj *subr_eval(struct lispobj*);
-struct lispobj *subr_read(struct lispobj*);
-struct lispobj *subr_load(struct lispobj*);
-struct lispobj *subr_car(struct lispobj*);
-struct lispobj *subr_cdr(struct lispobj*);
-struct lispobj *subr_cons(struct lispobj*);
-struct lispobj *subr_pair(struct lispobj*);
-struct lispobj *subr_number(struct lispobj*);
-struct lispobj *subr_string(struct lispobj*);
-struct lispobj *subr_symbol(struct lispobj*);
-struct lispobj *subr_atom(struct lispobj*);
-struct lispobj *subr_null(struct lispobj*);
-struct lispobj *subr_not(struct lispobj*);
-struct lispobj *subr_or(struct lispobj*);
-struct lispobj *subr_and(struct lispobj*);
-struct lispobj *subr_eq(struct lispobj*);
-struct lispobj *subr_eql(struct lispobj*);
-struct lispobj *subr_list(struct lispobj*);
-struct lispobj *subr_plus(struct lispobj*);
-struct lispobj *subr_multi(struct lispobj*);
-struct lispobj *subr_mod(struct lispobj*);
-struct lispobj *subr_compar(struct lispobj*);
-struct lispobj *subr_greatthan(struct lispobj*);
-struct lispobj *subr_lessthan(struct lispobj*);
-struct lispobj *subr_minus(struct lispobj*);
-struct lispobj *subr_divide(struct lispobj*);
-struct lispobj *subr_equal(struct lispobj*);
-struct lispobj *subr_heap(struct lispobj *);
-struct lispobj *subr_heap_object(struct lispobj *);
-
-#define ERROR_ARGS object_create(ERROR, "Recieve wrong number of arguments.\n")
-
-/*
-#define ERROR_ARGS(n)                                                   \
-    do {                                                                \
-        char error[64];                                                 \
-        snprintf(error, 64, "Recieve wrong number of arguments: %d.\n", (n)); \
-        return object_create(ERROR, error);                             \
-    } while(0)
-*/
 #endif /* __SUBR_H__ */
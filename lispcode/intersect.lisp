@@ -13,11 +13,11 @@
                                (cons x y)) b))
                       a))))
 
+;; Remember members of b in a hash table, then keep those of a
+;; which are there: linear instead of the cartesian product.
 (label intersect
        (lambda (a b)
-         (map (lambda (x)
-                (car x))
-              (remove-if (lambda (x)
-                           (not (= (car x) (cdr x))))
-                         (cartesian a b)))))
-       
+         (let ((seen (make-hash-table 'eql)))
+           (progn
+             (map (lambda (y) (puthash y t seen)) b)
+             (remove-if (lambda (x) (null (gethash x seen))) a)))))
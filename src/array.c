@@ -0,0 +1,779 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/array.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ARRAY_X86
+#include <immintrin.h>
+#endif
+
+struct array_kernels array_kernels;
+
+struct array *array_new(int kind, long length)
+{
+    struct array *a;
+    void *data = NULL;
+
+    a = malloc(sizeof(struct array));
+    a->kind = kind;
+    a->length = length;
+
+    /* Both element types are 8 bytes, align for 256-bit loads. */
+    if(posix_memalign(&data, 32, sizeof(int64_t) * (length > 0 ? length : 1))) {
+        data = NULL;
+    }
+    a->data.i64 = data;
+
+    return a;
+}
+
+void array_free(struct array *a)
+{
+    free(a->data.i64);
+    free(a);
+
+    return;
+}
+
+/* Scalar kernels, they work everywhere. */
+
+static int64_t i64_sum_scalar(const int64_t *a, long n)
+{
+    uint64_t sum = 0; // unsigned, so overflow wraps
+    long i;
+
+    for(i = 0; i < n; i++) {
+        sum += a[i];
+    }
+
+    return (int64_t) sum;
+}
+
+static int64_t i64_min_scalar(const int64_t *a, long n)
+{
+    int64_t m = a[0];
+    long i;
+
+    for(i = 1; i < n; i++) {
+        if(a[i] < m)
+            m = a[i];
+    }
+
+    return m;
+}
+
+static int64_t i64_max_scalar(const int64_t *a, long n)
+{
+    int64_t m = a[0];
+    long i;
+
+    for(i = 1; i < n; i++) {
+        if(a[i] > m)
+            m = a[i];
+    }
+
+    return m;
+}
+
+static int64_t i64_dot_scalar(const int64_t *a, const int64_t *b, long n)
+{
+    uint64_t sum = 0;
+    long i;
+
+    for(i = 0; i < n; i++) {
+        sum += (uint64_t) a[i] * (uint64_t) b[i];
+    }
+
+    return (int64_t) sum;
+}
+
+static void i64_add_scalar(int64_t *r, const int64_t *a,
+                           const int64_t *b, long n)
+{
+    long i;
+
+    for(i = 0; i < n; i++) {
+        r[i] = (int64_t) ((uint64_t) a[i] + (uint64_t) b[i]);
+    }
+
+    return;
+}
+
+static void i64_mul_scalar(int64_t *r, const int64_t *a,
+                           const int64_t *b, long n)
+{
+    long i;
+
+    for(i = 0; i < n; i++) {
+        r[i] = (int64_t) ((uint64_t) a[i] * (uint64_t) b[i]);
+    }
+
+    return;
+}
+
+static void i64_scale_scalar(int64_t *r, const int64_t *a, int64_t k, long n)
+{
+    long i;
+
+    for(i = 0; i < n; i++) {
+        r[i] = (int64_t) ((uint64_t) a[i] * (uint64_t) k);
+    }
+
+    return;
+}
+
+static long i64_count_scalar(const int64_t *a, long n, int op, int64_t k)
+{
+    long i, count = 0;
+
+    for(i = 0; i < n; i++) {
+        switch(op) {
+        case ARRAY_LT:
+            count += a[i] < k;
+            break;
+        case ARRAY_GT:
+            count += a[i] > k;
+            break;
+        default:
+            count += a[i] == k;
+            break;
+        }
+    }
+
+    return count;
+}
+
+static double f64_sum_scalar(const double *a, long n)
+{
+    double sum = 0.0;
+    long i;
+
+    for(i = 0; i < n; i++) {
+        sum += a[i];
+    }
+
+    return sum;
+}
+
+static double f64_min_scalar(const double *a, long n)
+{
+    double m = a[0];
+    long i;
+
+    for(i = 1; i < n; i++) {
+        if(a[i] < m)
+            m = a[i];
+    }
+
+    return m;
+}
+
+static double f64_max_scalar(const double *a, long n)
+{
+    double m = a[0];
+    long i;
+
+    for(i = 1; i < n; i++) {
+        if(a[i] > m)
+            m = a[i];
+    }
+
+    return m;
+}
+
+static double f64_dot_scalar(const double *a, const double *b, long n)
+{
+    double sum = 0.0;
+    long i;
+
+    for(i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+static void f64_add_scalar(double *r, const double *a,
+                           const double *b, long n)
+{
+    long i;
+
+    for(i = 0; i < n; i++) {
+        r[i] = a[i] + b[i];
+    }
+
+    return;
+}
+
+static void f64_mul_scalar(double *r, const double *a,
+                           const double *b, long n)
+{
+    long i;
+
+    for(i = 0; i < n; i++) {
+        r[i] = a[i] * b[i];
+    }
+
+    return;
+}
+
+static void f64_scale_scalar(double *r, const double *a, double k, long n)
+{
+    long i;
+
+    for(i = 0; i < n; i++) {
+        r[i] = a[i] * k;
+    }
+
+    return;
+}
+
+static long f64_count_scalar(const double *a, long n, int op, double k)
+{
+    long i, count = 0;
+
+    for(i = 0; i < n; i++) {
+        switch(op) {
+        case ARRAY_LT:
+            count += a[i] < k;
+            break;
+        case ARRAY_GT:
+            count += a[i] > k;
+            break;
+        default:
+            count += a[i] == k;
+            break;
+        }
+    }
+
+    return count;
+}
+
+#ifdef ARRAY_X86
+
+/*
+ * SSE2 kernels, two lanes. SSE2 has no 64-bit integer compares
+ * and multiplies, so only sum and add are vectorized for int64.
+ * Each kernel finishes the tail with its scalar version.
+ */
+
+__attribute__((target("sse2")))
+static int64_t i64_sum_sse2(const int64_t *a, long n)
+{
+    __m128i acc = _mm_setzero_si128();
+    int64_t lanes[2];
+    long i;
+
+    for(i = 0; i + 2 <= n; i += 2) {
+        acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i *) (a + i)));
+    }
+    _mm_storeu_si128((__m128i *) lanes, acc);
+
+    return (int64_t) ((uint64_t) lanes[0] + (uint64_t) lanes[1] +
+                      (uint64_t) i64_sum_scalar(a + i, n - i));
+}
+
+__attribute__((target("sse2")))
+static void i64_add_sse2(int64_t *r, const int64_t *a,
+                         const int64_t *b, long n)
+{
+    long i;
+
+    for(i = 0; i + 2 <= n; i += 2) {
+        _mm_storeu_si128((__m128i *) (r + i),
+                         _mm_add_epi64(_mm_loadu_si128((const __m128i *) (a + i)),
+                                       _mm_loadu_si128((const __m128i *) (b + i))));
+    }
+    i64_add_scalar(r + i, a + i, b + i, n - i);
+
+    return;
+}
+
+__attribute__((target("sse2")))
+static double f64_sum_sse2(const double *a, long n)
+{
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    double lanes[2];
+    long i;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+
+    return lanes[0] + lanes[1] + f64_sum_scalar(a + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static double f64_min_sse2(const double *a, long n)
+{
+    __m128d m;
+    double lanes[2], tail;
+    long i;
+
+    if(n < 2)
+        return a[0];
+
+    m = _mm_loadu_pd(a);
+    for(i = 2; i + 2 <= n; i += 2) {
+        m = _mm_min_pd(m, _mm_loadu_pd(a + i));
+    }
+    _mm_storeu_pd(lanes, m);
+    if(lanes[1] < lanes[0])
+        lanes[0] = lanes[1];
+    if(i < n && (tail = f64_min_scalar(a + i, n - i)) < lanes[0])
+        lanes[0] = tail;
+
+    return lanes[0];
+}
+
+__attribute__((target("sse2")))
+static double f64_max_sse2(const double *a, long n)
+{
+    __m128d m;
+    double lanes[2], tail;
+    long i;
+
+    if(n < 2)
+        return a[0];
+
+    m = _mm_loadu_pd(a);
+    for(i = 2; i + 2 <= n; i += 2) {
+        m = _mm_max_pd(m, _mm_loadu_pd(a + i));
+    }
+    _mm_storeu_pd(lanes, m);
+    if(lanes[1] > lanes[0])
+        lanes[0] = lanes[1];
+    if(i < n && (tail = f64_max_scalar(a + i, n - i)) > lanes[0])
+        lanes[0] = tail;
+
+    return lanes[0];
+}
+
+__attribute__((target("sse2")))
+static double f64_dot_sse2(const double *a, const double *b, long n)
+{
+    __m128d acc = _mm_setzero_pd();
+    double lanes[2];
+    long i;
+
+    for(i = 0; i + 2 <= n; i += 2) {
+        acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i),
+                                         _mm_loadu_pd(b + i)));
+    }
+    _mm_storeu_pd(lanes, acc);
+
+    return lanes[0] + lanes[1] + f64_dot_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void f64_add_sse2(double *r, const double *a, const double *b, long n)
+{
+    long i;
+
+    for(i = 0; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(r + i, _mm_add_pd(_mm_loadu_pd(a + i),
+                                        _mm_loadu_pd(b + i)));
+    }
+    f64_add_scalar(r + i, a + i, b + i, n - i);
+
+    return;
+}
+
+__attribute__((target("sse2")))
+static void f64_mul_sse2(double *r, const double *a, const double *b, long n)
+{
+    long i;
+
+    for(i = 0; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(r + i, _mm_mul_pd(_mm_loadu_pd(a + i),
+                                        _mm_loadu_pd(b + i)));
+    }
+    f64_mul_scalar(r + i, a + i, b + i, n - i);
+
+    return;
+}
+
+__attribute__((target("sse2")))
+static void f64_scale_sse2(double *r, const double *a, double k, long n)
+{
+    __m128d vk = _mm_set1_pd(k);
+    long i;
+
+    for(i = 0; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(r + i, _mm_mul_pd(_mm_loadu_pd(a + i), vk));
+    }
+    f64_scale_scalar(r + i, a + i, k, n - i);
+
+    return;
+}
+
+__attribute__((target("sse2")))
+static long f64_count_sse2(const double *a, long n, int op, double k)
+{
+    __m128d v, vk = _mm_set1_pd(k);
+    long i, count = 0;
+    int mask;
+
+    for(i = 0; i + 2 <= n; i += 2) {
+        v = _mm_loadu_pd(a + i);
+        switch(op) {
+        case ARRAY_LT:
+            mask = _mm_movemask_pd(_mm_cmplt_pd(v, vk));
+            break;
+        case ARRAY_GT:
+            mask = _mm_movemask_pd(_mm_cmpgt_pd(v, vk));
+            break;
+        default:
+            mask = _mm_movemask_pd(_mm_cmpeq_pd(v, vk));
+            break;
+        }
+        count += (mask & 1) + (mask >> 1);
+    }
+
+    return count + f64_count_scalar(a + i, n - i, op, k);
+}
+
+/*
+ * AVX2 kernels, four lanes. There is no 64-bit integer multiply
+ * below AVX-512, so the int64 mul, scale and dot stay scalar.
+ */
+
+__attribute__((target("avx2")))
+static int64_t i64_sum_avx2(const int64_t *a, long n)
+{
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    int64_t lanes[4];
+    long i;
+
+    for(i = 0; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_epi64(acc0,
+                                _mm256_loadu_si256((const __m256i *) (a + i)));
+        acc1 = _mm256_add_epi64(acc1,
+                                _mm256_loadu_si256((const __m256i *) (a + i + 4)));
+    }
+    _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(acc0, acc1));
+
+    return (int64_t) ((uint64_t) lanes[0] + (uint64_t) lanes[1] +
+                      (uint64_t) lanes[2] + (uint64_t) lanes[3] +
+                      (uint64_t) i64_sum_scalar(a + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static int64_t i64_min_avx2(const int64_t *a, long n)
+{
+    __m256i m, v;
+    int64_t lanes[4], tail;
+    long i;
+    int j;
+
+    if(n < 4)
+        return i64_min_scalar(a, n);
+
+    m = _mm256_loadu_si256((const __m256i *) a);
+    for(i = 4; i + 4 <= n; i += 4) {
+        v = _mm256_loadu_si256((const __m256i *) (a + i));
+        m = _mm256_blendv_epi8(m, v, _mm256_cmpgt_epi64(m, v));
+    }
+    _mm256_storeu_si256((__m256i *) lanes, m);
+    for(j = 1; j < 4; j++) {
+        if(lanes[j] < lanes[0])
+            lanes[0] = lanes[j];
+    }
+    if(i < n && (tail = i64_min_scalar(a + i, n - i)) < lanes[0])
+        lanes[0] = tail;
+
+    return lanes[0];
+}
+
+__attribute__((target("avx2")))
+static int64_t i64_max_avx2(const int64_t *a, long n)
+{
+    __m256i m, v;
+    int64_t lanes[4], tail;
+    long i;
+    int j;
+
+    if(n < 4)
+        return i64_max_scalar(a, n);
+
+    m = _mm256_loadu_si256((const __m256i *) a);
+    for(i = 4; i + 4 <= n; i += 4) {
+        v = _mm256_loadu_si256((const __m256i *) (a + i));
+        m = _mm256_blendv_epi8(m, v, _mm256_cmpgt_epi64(v, m));
+    }
+    _mm256_storeu_si256((__m256i *) lanes, m);
+    for(j = 1; j < 4; j++) {
+        if(lanes[j] > lanes[0])
+            lanes[0] = lanes[j];
+    }
+    if(i < n && (tail = i64_max_scalar(a + i, n - i)) > lanes[0])
+        lanes[0] = tail;
+
+    return lanes[0];
+}
+
+__attribute__((target("avx2")))
+static void i64_add_avx2(int64_t *r, const int64_t *a,
+                         const int64_t *b, long n)
+{
+    long i;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_si256((__m256i *) (r + i),
+                            _mm256_add_epi64(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                             _mm256_loadu_si256((const __m256i *) (b + i))));
+    }
+    i64_add_scalar(r + i, a + i, b + i, n - i);
+
+    return;
+}
+
+__attribute__((target("avx2")))
+static long i64_count_avx2(const int64_t *a, long n, int op, int64_t k)
+{
+    __m256i v, mask, acc = _mm256_setzero_si256(), vk = _mm256_set1_epi64x(k);
+    int64_t lanes[4];
+    long i;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        v = _mm256_loadu_si256((const __m256i *) (a + i));
+        switch(op) {
+        case ARRAY_LT:
+            mask = _mm256_cmpgt_epi64(vk, v);
+            break;
+        case ARRAY_GT:
+            mask = _mm256_cmpgt_epi64(v, vk);
+            break;
+        default:
+            mask = _mm256_cmpeq_epi64(v, vk);
+            break;
+        }
+        /* A true lane is -1. */
+        acc = _mm256_sub_epi64(acc, mask);
+    }
+    _mm256_storeu_si256((__m256i *) lanes, acc);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+        i64_count_scalar(a + i, n - i, op, k);
+}
+
+__attribute__((target("avx2")))
+static double f64_sum_avx2(const double *a, long n)
+{
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    double lanes[4];
+    long i;
+
+    for(i = 0; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+    }
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+        f64_sum_scalar(a + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static double f64_min_avx2(const double *a, long n)
+{
+    __m256d m;
+    double lanes[4], tail;
+    long i;
+    int j;
+
+    if(n < 4)
+        return f64_min_scalar(a, n);
+
+    m = _mm256_loadu_pd(a);
+    for(i = 4; i + 4 <= n; i += 4) {
+        m = _mm256_min_pd(m, _mm256_loadu_pd(a + i));
+    }
+    _mm256_storeu_pd(lanes, m);
+    for(j = 1; j < 4; j++) {
+        if(lanes[j] < lanes[0])
+            lanes[0] = lanes[j];
+    }
+    if(i < n && (tail = f64_min_scalar(a + i, n - i)) < lanes[0])
+        lanes[0] = tail;
+
+    return lanes[0];
+}
+
+__attribute__((target("avx2")))
+static double f64_max_avx2(const double *a, long n)
+{
+    __m256d m;
+    double lanes[4], tail;
+    long i;
+    int j;
+
+    if(n < 4)
+        return f64_max_scalar(a, n);
+
+    m = _mm256_loadu_pd(a);
+    for(i = 4; i + 4 <= n; i += 4) {
+        m = _mm256_max_pd(m, _mm256_loadu_pd(a + i));
+    }
+    _mm256_storeu_pd(lanes, m);
+    for(j = 1; j < 4; j++) {
+        if(lanes[j] > lanes[0])
+            lanes[0] = lanes[j];
+    }
+    if(i < n && (tail = f64_max_scalar(a + i, n - i)) > lanes[0])
+        lanes[0] = tail;
+
+    return lanes[0];
+}
+
+__attribute__((target("avx2")))
+static double f64_dot_avx2(const double *a, const double *b, long n)
+{
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    double lanes[4];
+    long i;
+
+    for(i = 0; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                                 _mm256_loadu_pd(b + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                                 _mm256_loadu_pd(b + i + 4)));
+    }
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+        f64_dot_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void f64_add_avx2(double *r, const double *a, const double *b, long n)
+{
+    long i;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(r + i, _mm256_add_pd(_mm256_loadu_pd(a + i),
+                                              _mm256_loadu_pd(b + i)));
+    }
+    f64_add_scalar(r + i, a + i, b + i, n - i);
+
+    return;
+}
+
+__attribute__((target("avx2")))
+static void f64_mul_avx2(double *r, const double *a, const double *b, long n)
+{
+    long i;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                              _mm256_loadu_pd(b + i)));
+    }
+    f64_mul_scalar(r + i, a + i, b + i, n - i);
+
+    return;
+}
+
+__attribute__((target("avx2")))
+static void f64_scale_avx2(double *r, const double *a, double k, long n)
+{
+    __m256d vk = _mm256_set1_pd(k);
+    long i;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), vk));
+    }
+    f64_scale_scalar(r + i, a + i, k, n - i);
+
+    return;
+}
+
+__attribute__((target("avx2")))
+static long f64_count_avx2(const double *a, long n, int op, double k)
+{
+    __m256d v, vk = _mm256_set1_pd(k);
+    long i, count = 0;
+    int mask;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        v = _mm256_loadu_pd(a + i);
+        switch(op) {
+        case ARRAY_LT:
+            mask = _mm256_movemask_pd(_mm256_cmp_pd(v, vk, _CMP_LT_OQ));
+            break;
+        case ARRAY_GT:
+            mask = _mm256_movemask_pd(_mm256_cmp_pd(v, vk, _CMP_GT_OQ));
+            break;
+        default:
+            mask = _mm256_movemask_pd(_mm256_cmp_pd(v, vk, _CMP_EQ_OQ));
+            break;
+        }
+        count += __builtin_popcount(mask);
+    }
+
+    return count + f64_count_scalar(a + i, n - i, op, k);
+}
+
+#endif /* ARRAY_X86 */
+
+/*
+ * Pick the kernels once at startup. FFLISP_SIMD=scalar|sse2|avx2
+ * caps the choice, which is handy to compare the implementations.
+ */
+void array_init(void)
+{
+    char *cap = getenv("FFLISP_SIMD");
+    struct array_kernels k = {
+        "scalar",
+        i64_sum_scalar, i64_min_scalar, i64_max_scalar, i64_dot_scalar,
+        i64_add_scalar, i64_mul_scalar, i64_scale_scalar, i64_count_scalar,
+        f64_sum_scalar, f64_min_scalar, f64_max_scalar, f64_dot_scalar,
+        f64_add_scalar, f64_mul_scalar, f64_scale_scalar, f64_count_scalar,
+    };
+
+#ifdef ARRAY_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("sse2") &&
+       (cap == NULL || strcmp(cap, "scalar") != 0)) {
+        k.name = "sse2";
+        k.i64_sum = i64_sum_sse2;
+        k.i64_add = i64_add_sse2;
+        k.f64_sum = f64_sum_sse2;
+        k.f64_min = f64_min_sse2;
+        k.f64_max = f64_max_sse2;
+        k.f64_dot = f64_dot_sse2;
+        k.f64_add = f64_add_sse2;
+        k.f64_mul = f64_mul_sse2;
+        k.f64_scale = f64_scale_sse2;
+        k.f64_count = f64_count_sse2;
+
+        if(__builtin_cpu_supports("avx2") &&
+           (cap == NULL || strcmp(cap, "sse2") != 0)) {
+            k.name = "avx2";
+            k.i64_sum = i64_sum_avx2;
+            k.i64_min = i64_min_avx2;
+            k.i64_max = i64_max_avx2;
+            k.i64_add = i64_add_avx2;
+            k.i64_count = i64_count_avx2;
+            k.f64_sum = f64_sum_avx2;
+            k.f64_min = f64_min_avx2;
+            k.f64_max = f64_max_avx2;
+            k.f64_dot = f64_dot_avx2;
+            k.f64_add = f64_add_avx2;
+            k.f64_mul = f64_mul_avx2;
+            k.f64_scale = f64_scale_avx2;
+            k.f64_count = f64_count_avx2;
+        }
+    }
+#endif /* ARRAY_X86 */
+
+    array_kernels = k;
+
+    return;
+}
@@ -0,0 +1,621 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "../include/object.h"
+#include "../include/bignum.h"
+
+#define BASE ((uint64_t) 1 << 32)
+/* The biggest power of 10 which fits a digit. */
+#define DECIMAL_BASE 1000000000
+#define DECIMAL_DIGITS 9
+
+static int mag_trim(const uint32_t *a, int n)
+{
+    while(n > 0 && a[n - 1] == 0) {
+        n--;
+    }
+
+    return n;
+}
+
+static int mag_cmp(const uint32_t *a, int an, const uint32_t *b, int bn)
+{
+    int i;
+
+    if(an != bn) {
+        return an > bn ? 1 : -1;
+    }
+
+    for(i = an - 1; i >= 0; i--) {
+        if(a[i] != b[i]) {
+            return a[i] > b[i] ? 1 : -1;
+        }
+    }
+
+    return 0;
+}
+
+/* r += x, the carry must fit into rn digits of r. */
+static void mag_add_into(uint32_t *r, int rn, const uint32_t *x, int xn)
+{
+    uint64_t carry = 0;
+    int i;
+
+    for(i = 0; i < xn; i++) {
+        carry += (uint64_t) r[i] + x[i];
+        r[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+    for(; carry && i < rn; i++) {
+        carry += r[i];
+        r[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+
+    return;
+}
+
+/* r -= x, r must not be less than x. */
+static void mag_sub_into(uint32_t *r, int rn, const uint32_t *x, int xn)
+{
+    uint64_t d;
+    uint32_t borrow = 0;
+    int i;
+
+    for(i = 0; i < xn; i++) {
+        d = (uint64_t) r[i] - x[i] - borrow;
+        r[i] = (uint32_t) d;
+        borrow = (d >> 63) & 1;
+    }
+    for(; borrow && i < rn; i++) {
+        d = (uint64_t) r[i] - borrow;
+        r[i] = (uint32_t) d;
+        borrow = (d >> 63) & 1;
+    }
+
+    return;
+}
+
+static void mag_mul_school(uint32_t *r, const uint32_t *a, int an,
+                           const uint32_t *b, int bn)
+{
+    int i, j;
+
+    memset(r, 0, sizeof(uint32_t) * (an + bn));
+
+    for(i = 0; i < an; i++) {
+        uint64_t carry = 0;
+
+        for(j = 0; j < bn; j++) {
+            carry += (uint64_t) a[i] * b[j] + r[i + j];
+            r[i + j] = (uint32_t) carry;
+            carry >>= 32;
+        }
+        r[i + bn] = (uint32_t) carry;
+    }
+
+    return;
+}
+
+/* r = a * b, writes exactly an + bn digits of r. */
+static void mag_mul(uint32_t *r, const uint32_t *a, int an,
+                    const uint32_t *b, int bn)
+{
+    uint32_t *sa, *sb, *z1;
+    int i, m, n;
+
+    if(an < bn) {
+        const uint32_t *t = a;
+
+        a = b; b = t;
+        n = an; an = bn; bn = n;
+    }
+
+    if(bn < KARATSUBA_THRESHOLD) {
+        mag_mul_school(r, a, an, b, bn);
+        return;
+    }
+
+    if(an >= 2 * bn) {
+        /* Too unbalanced for splitting, multiply by slices of a. */
+        uint32_t *tmp = malloc(sizeof(uint32_t) * 2 * bn);
+
+        memset(r, 0, sizeof(uint32_t) * (an + bn));
+        for(i = 0; i < an; i += bn) {
+            n = an - i < bn ? an - i : bn;
+
+            mag_mul(tmp, a + i, n, b, bn);
+            mag_add_into(r + i, an + bn - i, tmp, n + bn);
+        }
+        free(tmp);
+
+        return;
+    }
+
+    /*
+     * Karatsuba: a = a1 * B^m + a0, b = b1 * B^m + b0,
+     * a * b = z2 * B^2m + z1 * B^m + z0, where
+     * z1 = (a0 + a1) * (b0 + b1) - z0 - z2.
+     */
+    m = (an + 1) / 2;
+
+    mag_mul(r, a, m, b, m);
+    mag_mul(r + 2 * m, a + m, an - m, b + m, bn - m);
+
+    sa = calloc(m + 1, sizeof(uint32_t));
+    sb = calloc(m + 1, sizeof(uint32_t));
+    z1 = malloc(sizeof(uint32_t) * (2 * m + 2));
+
+    memcpy(sa, a, sizeof(uint32_t) * m);
+    mag_add_into(sa, m + 1, a + m, an - m);
+    memcpy(sb, b, sizeof(uint32_t) * m);
+    mag_add_into(sb, m + 1, b + m, bn - m);
+
+    mag_mul(z1, sa, m + 1, sb, m + 1);
+    mag_sub_into(z1, 2 * m + 2, r, 2 * m);
+    mag_sub_into(z1, 2 * m + 2, r + 2 * m, an + bn - 2 * m);
+    mag_add_into(r + m, an + bn - m, z1, mag_trim(z1, 2 * m + 2));
+
+    free(sa);
+    free(sb);
+    free(z1);
+
+    return;
+}
+
+/*
+ * Long division (Knuth's algorithm D), q gets un - vn + 1 digits
+ * and r gets vn digits. Needs un >= vn and a normalized v.
+ */
+static void mag_divmod(uint32_t *q, uint32_t *r, const uint32_t *u, int un,
+                       const uint32_t *v, int vn)
+{
+    uint32_t *nu, *nv;
+    int i, j, s;
+
+    if(vn == 1) {
+        uint64_t rem = 0;
+
+        for(i = un - 1; i >= 0; i--) {
+            uint64_t cur = (rem << 32) | u[i];
+
+            q[i] = (uint32_t) (cur / v[0]);
+            rem = cur % v[0];
+        }
+        r[0] = (uint32_t) rem;
+
+        return;
+    }
+
+    /* Shift so the top digit of v has its high bit set. */
+    s = __builtin_clz(v[vn - 1]);
+    nv = malloc(sizeof(uint32_t) * vn);
+    nu = malloc(sizeof(uint32_t) * (un + 1));
+
+    for(i = vn - 1; i > 0; i--) {
+        nv[i] = (v[i] << s) | (s ? v[i - 1] >> (32 - s) : 0);
+    }
+    nv[0] = v[0] << s;
+
+    nu[un] = s ? u[un - 1] >> (32 - s) : 0;
+    for(i = un - 1; i > 0; i--) {
+        nu[i] = (u[i] << s) | (s ? u[i - 1] >> (32 - s) : 0);
+    }
+    nu[0] = u[0] << s;
+
+    for(j = un - vn; j >= 0; j--) {
+        uint64_t num, qhat, rhat;
+        int64_t t, k;
+
+        num = ((uint64_t) nu[j + vn] << 32) | nu[j + vn - 1];
+        qhat = num / nv[vn - 1];
+        rhat = num % nv[vn - 1];
+
+        while(qhat >= BASE ||
+              qhat * nv[vn - 2] > ((rhat << 32) | nu[j + vn - 2])) {
+            qhat--;
+            rhat += nv[vn - 1];
+            if(rhat >= BASE) {
+                break;
+            }
+        }
+
+        /* Multiply and subtract. */
+        k = 0;
+        for(i = 0; i < vn; i++) {
+            uint64_t p = qhat * nv[i];
+
+            t = (int64_t) nu[i + j] - k - (int64_t) (p & 0xffffffff);
+            nu[i + j] = (uint32_t) t;
+            k = (int64_t) (p >> 32) - (t >> 32);
+        }
+        t = (int64_t) nu[j + vn] - k;
+        nu[j + vn] = (uint32_t) t;
+
+        q[j] = (uint32_t) qhat;
+        if(t < 0) {
+            /* Subtracted too much, add back. */
+            q[j]--;
+            k = 0;
+            for(i = 0; i < vn; i++) {
+                t = (int64_t) nu[i + j] + nv[i] + k;
+                nu[i + j] = (uint32_t) t;
+                k = t >> 32;
+            }
+            nu[j + vn] += (uint32_t) k;
+        }
+    }
+
+    for(i = 0; i < vn; i++) {
+        r[i] = (nu[i] >> s) | (s ? nu[i + 1] << (32 - s) : 0);
+    }
+
+    free(nu);
+    free(nv);
+
+    return;
+}
+
+/* Multiply by a digit and add a digit in place, returns the carry. */
+static uint32_t mag_mul_add(uint32_t *a, int an, uint32_t m, uint32_t c)
+{
+    uint64_t carry = c;
+    int i;
+
+    for(i = 0; i < an; i++) {
+        carry += (uint64_t) a[i] * m;
+        a[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+
+    return (uint32_t) carry;
+}
+
+/* Divide by a digit in place, returns the remainder. */
+static uint32_t mag_div_digit(uint32_t *a, int an, uint32_t d)
+{
+    uint64_t rem = 0;
+    int i;
+
+    for(i = an - 1; i >= 0; i--) {
+        uint64_t cur = (rem << 32) | a[i];
+
+        a[i] = (uint32_t) (cur / d);
+        rem = cur % d;
+    }
+
+    return (uint32_t) rem;
+}
+
+struct bignum *bignum_new(int size)
+{
+    struct bignum *b;
+
+    b = malloc(sizeof(struct bignum));
+    b->sign = 1;
+    b->size = size;
+    b->digits = calloc(size > 0 ? size : 1, sizeof(uint32_t));
+
+    return b;
+}
+
+void bignum_free(struct bignum *b)
+{
+    free(b->digits);
+    free(b);
+
+    return;
+}
+
+static struct bignum *bignum_trim(struct bignum *b)
+{
+    b->size = mag_trim(b->digits, b->size);
+    if(b->size == 0) {
+        b->sign = 1;
+    }
+
+    return b;
+}
+
+struct bignum *bignum_copy(const struct bignum *b)
+{
+    struct bignum *r;
+
+    r = bignum_new(b->size);
+    r->sign = b->sign;
+    memcpy(r->digits, b->digits, sizeof(uint32_t) * b->size);
+
+    return r;
+}
+
+struct bignum *bignum_from_long(long value)
+{
+    struct bignum *b;
+    unsigned long m;
+
+    m = value < 0 ? -(unsigned long) value : (unsigned long) value;
+
+    b = bignum_new(BIGNUM_LONG_DIGITS);
+    b->sign = value < 0 ? -1 : 1;
+    b->digits[0] = (uint32_t) m;
+    b->digits[1] = (uint32_t) (m >> 32);
+
+    return bignum_trim(b);
+}
+
+/*
+ * Bignum view of an integer object. Fixnums are written into
+ * the caller's view and buf, so nothing is allocated.
+ */
+struct bignum *bignum_view(struct lispobj *obj, struct bignum *view, uint32_t *buf)
+{
+    unsigned long m;
+
+    if(OBJ_TYPE(obj) == BIGNUM) {
+        return BIGNUM_VALUE(obj);
+    }
+
+    m = NUMBER_VALUE(obj) < 0 ?
+        -(unsigned long) NUMBER_VALUE(obj) :
+        (unsigned long) NUMBER_VALUE(obj);
+
+    buf[0] = (uint32_t) m;
+    buf[1] = (uint32_t) (m >> 32);
+    view->sign = NUMBER_VALUE(obj) < 0 ? -1 : 1;
+    view->digits = buf;
+    view->size = mag_trim(buf, BIGNUM_LONG_DIGITS);
+
+    return view;
+}
+
+int bignum_to_long(const struct bignum *b, long *value)
+{
+    unsigned long m = 0;
+
+    if(b->size > BIGNUM_LONG_DIGITS) {
+        return 0;
+    }
+
+    if(b->size > 0) {
+        m = b->digits[0];
+    }
+    if(b->size > 1) {
+        m |= (unsigned long) b->digits[1] << 32;
+    }
+
+    if(b->sign > 0) {
+        if(m > LONG_MAX) {
+            return 0;
+        }
+        *value = (long) m;
+    } else {
+        if(m > (unsigned long) LONG_MAX + 1) {
+            return 0;
+        }
+        *value = (long) -m;
+    }
+
+    return 1;
+}
+
+/* Becomes infinity when the exponent does not fit a double. */
+double bignum_to_double(const struct bignum *b)
+{
+    double d = 0.0;
+    int i;
+
+    for(i = b->size - 1; i >= 0; i--) {
+        d = d * (double) BASE + b->digits[i];
+    }
+
+    return b->sign * d;
+}
+
+struct bignum *bignum_from_string(const char *s)
+{
+    struct bignum *b;
+    int sign = 1, len, chunk, size = 0;
+
+    if(*s == '-' || *s == '+') {
+        sign = *s == '-' ? -1 : 1;
+        s++;
+    }
+
+    len = strlen(s);
+    /* 9 decimal digits never need more than one base 2^32 digit. */
+    b = bignum_new(len / DECIMAL_DIGITS + 1);
+
+    /* Eat the digits by chunks of 9: b = b * 10^9 + chunk. */
+    chunk = len % DECIMAL_DIGITS ? len % DECIMAL_DIGITS : DECIMAL_DIGITS;
+    while(len > 0) {
+        uint32_t value = 0, scale = 1, carry;
+        int i;
+
+        for(i = 0; i < chunk; i++) {
+            value = value * 10 + (s[i] - '0');
+            scale *= 10;
+        }
+
+        carry = mag_mul_add(b->digits, size, scale, value);
+        if(carry) {
+            b->digits[size++] = carry;
+        }
+
+        s += chunk;
+        len -= chunk;
+        chunk = DECIMAL_DIGITS;
+    }
+
+    b->size = size;
+    b->sign = sign;
+
+    return bignum_trim(b);
+}
+
+char *bignum_to_string(const struct bignum *b)
+{
+    uint32_t *tmp, *chunks;
+    char *s, *p;
+    int n, size = b->size;
+
+    if(size == 0) {
+        s = malloc(2);
+        strcpy(s, "0");
+
+        return s;
+    }
+
+    tmp = malloc(sizeof(uint32_t) * size);
+    memcpy(tmp, b->digits, sizeof(uint32_t) * size);
+    /* log10(2^32) < 10, so there are at most 2 chunks per digit. */
+    chunks = malloc(sizeof(uint32_t) * (2 * size + 1));
+
+    /* Peel off 9 decimal digits at a time. */
+    n = 0;
+    while(size > 0) {
+        chunks[n++] = mag_div_digit(tmp, size, DECIMAL_BASE);
+        size = mag_trim(tmp, size);
+    }
+
+    s = malloc(n * DECIMAL_DIGITS + 2);
+    p = s;
+    if(b->sign < 0) {
+        *p++ = '-';
+    }
+    p += sprintf(p, "%u", chunks[--n]);
+    while(n > 0) {
+        p += sprintf(p, "%09u", chunks[--n]);
+    }
+
+    free(chunks);
+    free(tmp);
+
+    return s;
+}
+
+int bignum_cmp(const struct bignum *a, const struct bignum *b)
+{
+    if(a->sign != b->sign) {
+        return a->sign > b->sign ? 1 : -1;
+    }
+
+    return a->sign * mag_cmp(a->digits, a->size, b->digits, b->size);
+}
+
+/* Add magnitudes when signs agree, subtract them otherwise. */
+static struct bignum *bignum_add_signed(const struct bignum *a,
+                                        const struct bignum *b, int bsign)
+{
+    struct bignum *r;
+
+    if(a->sign == bsign) {
+        r = bignum_new((a->size > b->size ? a->size : b->size) + 1);
+        memcpy(r->digits, a->digits, sizeof(uint32_t) * a->size);
+        mag_add_into(r->digits, r->size, b->digits, b->size);
+        r->sign = a->sign;
+    } else if(mag_cmp(a->digits, a->size, b->digits, b->size) >= 0) {
+        r = bignum_new(a->size);
+        memcpy(r->digits, a->digits, sizeof(uint32_t) * a->size);
+        mag_sub_into(r->digits, r->size, b->digits, b->size);
+        r->sign = a->sign;
+    } else {
+        r = bignum_new(b->size);
+        memcpy(r->digits, b->digits, sizeof(uint32_t) * b->size);
+        mag_sub_into(r->digits, r->size, a->digits, a->size);
+        r->sign = bsign;
+    }
+
+    return bignum_trim(r);
+}
+
+struct bignum *bignum_add(const struct bignum *a, const struct bignum *b)
+{
+    return bignum_add_signed(a, b, b->sign);
+}
+
+struct bignum *bignum_sub(const struct bignum *a, const struct bignum *b)
+{
+    return bignum_add_signed(a, b, -b->sign);
+}
+
+struct bignum *bignum_mul(const struct bignum *a, const struct bignum *b)
+{
+    struct bignum *r;
+
+    r = bignum_new(a->size + b->size);
+    if(a->size > 0 && b->size > 0) {
+        mag_mul(r->digits, a->digits, a->size, b->digits, b->size);
+    }
+    r->sign = a->sign * b->sign;
+
+    return bignum_trim(r);
+}
+
+/*
+ * Truncating division like C does: the quotient rounds toward zero
+ * and the remainder has the sign of a. Returns 0 on division by zero.
+ */
+int bignum_divmod(const struct bignum *a, const struct bignum *b,
+                  struct bignum **q, struct bignum **r)
+{
+    struct bignum *qb, *rb;
+
+    if(b->size == 0) {
+        return 0;
+    }
+
+    if(mag_cmp(a->digits, a->size, b->digits, b->size) < 0) {
+        qb = bignum_new(0);
+        rb = bignum_new(a->size);
+        memcpy(rb->digits, a->digits, sizeof(uint32_t) * a->size);
+    } else {
+        qb = bignum_new(a->size - b->size + 1);
+        rb = bignum_new(b->size);
+        mag_divmod(qb->digits, rb->digits, a->digits, a->size,
+                   b->digits, b->size);
+    }
+    qb->sign = a->sign * b->sign;
+    rb->sign = a->sign;
+
+    bignum_trim(qb);
+    bignum_trim(rb);
+
+    if(q != NULL) {
+        *q = qb;
+    } else {
+        bignum_free(qb);
+    }
+    if(r != NULL) {
+        *r = rb;
+    } else {
+        bignum_free(rb);
+    }
+
+    return 1;
+}
+
+/*
+ * Wrap a bignum into an object. Whatever fits a machine word
+ * becomes a plain NUMBER, so fixnums keep the cheap path.
+ */
+struct lispobj *bignum_normalize(struct bignum *b)
+{
+    struct lispobj *obj;
+    long value;
+
+    if(bignum_to_long(b, &value)) {
+        bignum_free(b);
+
+        obj = object_create(NUMBER, NULL);
+        NUMBER_VALUE(obj) = value;
+    } else {
+        obj = object_create(BIGNUM, NULL);
+        BIGNUM_VALUE(obj) = b;
+    }
+
+    return obj;
+}
@@ -0,0 +1,144 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../include/object.h"
+#include "../include/subr.h"
+#include "../include/environment.h"
+#include "../include/heap.h"
+#include "../include/stack.h"
+#include "../include/error.h"
+#include "../include/array.h"
+#include "../include/read.h"
+#include "../include/pool.h"
+
+/* Context the thread runs. */
+__thread struct fflisp_ctx *ctx = NULL;
+
+static pthread_once_t process_once = PTHREAD_ONCE_INIT;
+/* Taken to freeze a base, children may be made on several threads. */
+static pthread_mutex_t freeze_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* State of the whole process, it never changes afterwards. */
+static void process_init(void)
+{
+    /* Choose bulk array kernels for this CPU. */
+    array_init();
+
+    return;
+}
+
+static void ctx_boot(void)
+{
+    /* Preallocate errors. */
+    error_init();
+    /* Define global alias to TRUE object. */
+    ctx->t = heap_grab(NEW_SYMBOL("T"));
+    /* Configure environment. */
+    ctx->environment = heap_grab(env_init());
+
+    return;
+}
+
+/*
+ * Everything of the base is shared as it is: symbols, errors and
+ * hash-consed conses. Programs get a frame of their own on top of
+ * the base environment, with T and NIL in it like in env_init().
+ */
+static void ctx_inherit(struct fflisp_ctx *base)
+{
+    struct hcons_table *table = &base->hcons;
+    struct fflisp_ctx *self;
+
+    pthread_mutex_lock(&freeze_lock);
+    if(base->shared == NULL) {
+        self = fflisp_ctx_enter(base);
+        heap_share();
+        fflisp_ctx_enter(self);
+    }
+    pthread_mutex_unlock(&freeze_lock);
+
+    ctx->base = base;
+    ctx->symbol_table = symbol_table_new(base->symbol_table);
+    ctx->t = base->t;
+    memcpy(ctx->errors, base->errors, sizeof(ctx->errors));
+    memcpy(ctx->symbols, base->symbols, sizeof(ctx->symbols));
+    ctx->read_hash_cons = base->read_hash_cons;
+
+    if(table->size > 0) {
+        ctx->hcons = *table;
+        ctx->hcons.slots = malloc(sizeof(struct lispobj *) * table->size);
+        memcpy(ctx->hcons.slots, table->slots,
+               sizeof(struct lispobj *) * table->size);
+    }
+
+    ctx->environment = heap_grab(NEW_CONS(NULL, base->environment));
+    env_var_define(NEW_SYMBOL("T"), ctx->t, ctx->environment);
+    env_var_define(SYMBOL_NIL, NULL, ctx->environment);
+
+    return;
+}
+
+/*
+ * A fresh context if base is NULL, which boots the primitives,
+ * otherwise one which starts where the base is, and freezes it.
+ */
+struct fflisp_ctx *fflisp_ctx_new(struct fflisp_ctx *base)
+{
+    struct fflisp_ctx *c, *prev;
+
+    pthread_once(&process_once, process_init);
+
+    c = malloc(sizeof(struct fflisp_ctx));
+    memset(c, 0, sizeof(struct fflisp_ctx));
+
+    prev = fflisp_ctx_enter(c);
+    ctx->heap = heap_init();
+    ctx->stack = stack_init();
+    if(base == NULL) {
+        ctx_boot();
+    } else {
+        ctx_inherit(base);
+    }
+    fflisp_ctx_enter(prev);
+
+    return c;
+}
+
+/* Makes c the context of the thread, returns the previous one. */
+struct fflisp_ctx *fflisp_ctx_enter(struct fflisp_ctx *c)
+{
+    struct fflisp_ctx *prev = ctx;
+
+    ctx = c;
+
+    return prev;
+}
+
+/* Contexts made from c must be freed already. */
+void fflisp_ctx_free(struct fflisp_ctx *c)
+{
+    struct fflisp_ctx *prev = fflisp_ctx_enter(c);
+
+    /* Futures read the heap, they are done before it goes. */
+    pool_drain();
+    heap_clean();
+    heap_free(c->heap);
+    if(c->shared != NULL) {
+        heap_free(c->shared);
+    }
+    stack_free(c->stack);
+    symbol_table_free(c->symbol_table);
+    free(c->hcons.slots);
+    if(c->stdin_reader != NULL) {
+        reader_close(c->stdin_reader);
+    }
+
+    fflisp_ctx_enter(prev != c ? prev : NULL);
+    free(c);
+
+    return;
+}
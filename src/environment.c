@@ -8,6 +8,8 @@
 #include "../include/subr.h"
 #include "../include/eval.h"
 #include "../include/environment.h"
+#include "../include/stack.h"
+#include "../include/error.h"
 
 /*
  * Representation of environment is like a s-exp:
@@ -18,21 +20,15 @@
  *
  * Representation of PROC:
  * (proc (x) (* x x) <env>)
- * Representation of SUBR:
- * (subr <address>)
+ * SUBR is an object of its own type pointing to struct subr.
  */
 
-struct subrs {
-    char *var;
-    struct lispobj *(*val)(struct lispobj*);
-};
-
-static struct lispobj *env_subr_init(struct subrs*, int, int);
+static struct lispobj *env_subr_init(struct subr*, int, int);
 
 #ifdef __DEBUG_ENV__
 void env_debug(void)
 {
-    struct lispobj *tmp_env = environment;
+    struct lispobj *tmp_env = ctx->environment;
     
     while(tmp_env != NULL) {
         struct lispobj *frame = ENV_FIRST(tmp_env);
@@ -57,30 +53,51 @@ void env_debug(void)
 }
 #endif /* __DEBUG_ENV__ */
 
-struct lispobj *env_var_lookup(struct lispobj *var, struct lispobj *env)
+static struct lispobj *env_frame_find(struct lispobj *var, struct lispobj *frame)
 {
-    struct lispobj *frame, *cell;
-    char error[64];
-    
-    while(env != NULL) {
-        frame = ENV_FIRST(env);
-        while(frame != NULL) {
-            cell = CAR(frame);
+    struct lispobj *cell;
 
-            if(CAR(cell) == var) {
-                /* Return whole cell, e.g. (foo . 1). */
-                return cell;
-            }
+    while(frame != NULL) {
+        cell = CAR(frame);
 
-            frame = CDR(frame);
+        if(CAR(cell) == var) {
+            /* Return whole cell, e.g. (foo . 1). */
+            return cell;
         }
+
+        frame = CDR(frame);
+    }
+
+    return NULL;
+}
+
+static struct lispobj *env_var_find(struct lispobj *var, struct lispobj *env)
+{
+    struct lispobj *cell;
+    
+    while(env != NULL) {
+        if((cell = env_frame_find(var, ENV_FIRST(env))) != NULL)
+            return cell;
         
         env = ENV_REST(env);
     }
+
+    return NULL;
+}
+
+struct lispobj *env_var_lookup(struct lispobj *var, struct lispobj *env)
+{
+    struct lispobj *cell;
     
-    snprintf(error, 64, "Unbound variable: %s.\n", SYMBOL_VALUE(var));
+    cell = env_var_find(var, env);
+    if(cell == NULL) {
+        char error[64];
+        
+        snprintf(error, 64, "Unbound variable: %s.\n", SYMBOL_VALUE(var));
+        error_signal(NEW_ERROR(error));
+    }
     
-    return NEW_ERROR(error);
+    return cell;
 }
 
 struct lispobj *env_var_assign(struct lispobj *var, struct lispobj *val, struct lispobj *env)
@@ -88,13 +105,12 @@ struct lispobj *env_var_assign(struct lispobj *var, struct lispobj *val, struct
     struct lispobj *cell;
 
     if(var == NULL || OBJ_TYPE(var) != SYMBOL) {
-        return NEW_ERROR("Variable name is not a symbol.\n");
+        error_signal(ERROR_NOT_SYMBOL);
     }
-    /* Checking on variable existence. */ 
+    /* Variable must exist. */ 
     cell = env_var_lookup(var, env);
-    /* If variable not exists return error. */
-    if(OBJ_TYPE(cell) == ERROR) {
-        return cell;
+    if(IS_FROZEN(cell)) {
+        error_signal(ERROR_IMMUTABLE);
     }
     /* Remove old value. */
     heap_release(CDR(cell));
@@ -106,150 +122,225 @@ struct lispobj *env_var_assign(struct lispobj *var, struct lispobj *val, struct
 
 struct lispobj *env_var_define(struct lispobj *var, struct lispobj *val, struct lispobj *env)
 {
-    struct lispobj *frame, *pair, *cell, *lookup;
-
-    /* Checking on variable existence. */
-    lookup = env_var_lookup(var, env);
-    /* If variable exists return error. */
-    if(OBJ_TYPE(lookup) != ERROR) {
+    if(var == NULL || OBJ_TYPE(var) != SYMBOL) {
+        error_signal(ERROR_NOT_SYMBOL);
+    }
+    /* Variable must not exist in this frame, outer ones may have it. */
+    if(env_frame_find(var, ENV_FIRST(env)) != NULL) {
         char error[64];
         
         snprintf(error, 64, "Variable already exists: %s.\n", SYMBOL_VALUE(var));
-        return NEW_ERROR(error);
+        error_signal(NEW_ERROR(error));
     }
-    /* Remove not necessary object. */
-    heap_release(lookup);
 
-    /* Get top frame from environment. */
-    frame = ENV_FIRST(env);
+    return env_var_bind(var, val, env);
+}
 
-    /* Creating cell for new variable. */
-    cell = NEW_CONS(var, val);
-    /* Appending new cell into the frame. */
-    pair = NEW_CONS(cell, frame);
-    frame = heap_grab(pair);
+struct lispobj *env_var_bind(struct lispobj *var, struct lispobj *val, struct lispobj *env)
+{
+    struct lispobj *frame;
+
+    /* Unlike env_var_define() don't look for an existing variable,
+       the new cell just shadows the outer ones. */
+    if(IS_FROZEN(env)) {
+        error_signal(ERROR_IMMUTABLE);
+    }
+    frame = NEW_CONS(NEW_CONS(var, val), ENV_FIRST(env));
+    heap_release(ENV_FIRST(env));
+    ENV_FIRST(env) = heap_grab(frame);
 
-    /* Appending the frame into the environment. */
-    CAR(env) = frame;
-    
     return val;
 }
 
-struct lispobj *env_val_list(struct lispobj *vars, struct lispobj *env)
+/* Evaluate exps pushing the values onto the evaluator stack. */
+void env_val_push(struct lispobj *exps, struct lispobj *env)
 {
-    if(vars != NULL) {
-        struct lispobj *vals, *car, *cdr;
-        
-        car = eval(CAR(vars), env);
-        if(car != NULL && OBJ_TYPE(car) == ERROR) {
-            return car;
-        }
-        vals = NEW_CONS(NULL, NULL);
-        CAR(vals) = car;
-
-        cdr = env_val_list(CDR(vars), env);
-        if(cdr != NULL && OBJ_TYPE(cdr) == ERROR) {
-            heap_release(vals);
-            return cdr;
-        }
-        CDR(vals) = heap_grab(cdr);
-
-        return vals;
+    while(exps != NULL) {
+        stack_push(eval(CAR(exps), env));
+        exps = CDR(exps);
     }
 
-    return NULL;
+    return;
 }
 
 struct lispobj *env_proc_make(struct lispobj *params, struct lispobj *body, struct lispobj *env)
 {
-    return list(4, NEW_SYMBOL("PROC"), params, body, env);
+    return list(4, SYMBOL_PROC, params, body, env);
 }
 
-struct lispobj *env_frame_make(struct lispobj *vars, struct lispobj *vals)
+struct lispobj *env_frame_make(struct lispobj *vars, int argc, struct lispobj **argv)
 {
     struct lispobj *frame, *tmp;
+    int i;
 
-    frame = NEW_CONS(NULL, NULL);
-    tmp = frame;
+    if(argc == 0) {
+        return NULL;
+    }
 
-    while(vars != NULL) {
-        struct lispobj *cell;
+    frame = NEW_CONS(NEW_CONS(CAR(vars), argv[0]), NULL);
+    tmp = frame;
 
-        cell = NEW_CONS(CAR(vars), CAR(vals));
-        
-        CAR(tmp) = heap_grab(cell);
+    for(i = 1; i < argc; i++) {
         vars = CDR(vars);
-        vals = CDR(vals);
         
-        if(vars != NULL) {
-            CDR(tmp) = heap_grab(NEW_CONS(NULL, NULL));
-            tmp = CDR(tmp);
-        }
+        CDR(tmp) = heap_grab(NEW_CONS(NEW_CONS(CAR(vars), argv[i]), NULL));
+        tmp = CDR(tmp);
     }
-    CDR(tmp) = NULL;
 
     return frame;
 }
 
+static char *symbol_names[SYM_MAX] = {
+    [SYM_NIL] = "NIL",
+    [SYM_PROC] = "PROC",
+    [SYM_ERROR] = "ERROR",
+    [SYM_QUOTE] = "QUOTE",
+    [SYM_SETQ] = "SETQ",
+    [SYM_LABEL] = "LABEL",
+    [SYM_IF] = "IF",
+    [SYM_COND] = "COND",
+    [SYM_LET] = "LET",
+    [SYM_LET_SEQUENTIAL] = "LET*",
+    [SYM_LETREC] = "LETREC",
+    [SYM_PROGN] = "PROGN",
+    [SYM_LAMBDA] = "LAMBDA",
+    [SYM_IGNORE_ERRORS] = "IGNORE-ERRORS",
+    [SYM_HANDLER_CASE] = "HANDLER-CASE",
+    [SYM_FUTURE] = "FUTURE",
+};
+
 struct lispobj *env_init(void)
 {
     struct lispobj *frame, *cell, *tmp, *env = NULL;
-    static struct subrs s[] = {{"CAR", subr_car},
-                               {"CDR", subr_cdr},
-                               {"CONS", subr_cons},
-                               {"PAIR", subr_pair},
-                               {"STRING", subr_string},
-                               {"NUMBER", subr_number},
-                               {"SYMBOL", subr_symbol},
-                               {"ATOM", subr_atom},
-                               {"NULL", subr_null},
-                               {"NOT", subr_not},
-                               {"OR", subr_or},
-                               {"AND", subr_and},
-                               {"EQ", subr_eq},
-                               {"EQL", subr_eql},
-                               {"LIST", subr_list},
-                               {"+", subr_plus},
-                               {"-", subr_minus},
-                               {"*", subr_multi},
-                               {"=", subr_compar},
-                               {">", subr_greatthan},
-                               {"<", subr_lessthan},
-                               {"/", subr_divide},
-                               {"MOD", subr_mod},
-                               {"HEAP", subr_heap},
-                               {"HEAP-OBJECT", subr_heap_object},
-                               {"LOAD", subr_load},
-                               {"READ", subr_read},
-                               {"EVAL", subr_eval},
-                               {"ERROR", subr_error},
-                               {"APPLY", subr_apply},
-                               {"DISPLAY", subr_display},
-                               {"NEWLINE", subr_newline},
-                               {"RPLACA", subr_rplaca},
-                               {"RPLACD", subr_rplacd},
-                               {"EQUAL", subr_equal}};
+    int i;
+    static struct subr s[] = {
+        {"CAR", subr_car, 1, 1, SUBR_PURE},
+        {"CDR", subr_cdr, 1, 1, SUBR_PURE},
+        {"CONS", subr_cons, 2, 2, SUBR_PURE | SUBR_ALLOC},
+        {"PAIR", subr_pair, 1, 1, SUBR_PURE},
+        {"STRING", subr_string, 1, 1, SUBR_PURE},
+        {"NUMBER", subr_number, 1, 1, SUBR_PURE},
+        {"SYMBOL", subr_symbol, 1, 1, SUBR_PURE},
+        {"ATOM", subr_atom, 1, 1, SUBR_PURE},
+        {"NULL", subr_null, 1, 1, SUBR_PURE},
+        {"NOT", subr_not, 1, 1, SUBR_PURE},
+        {"OR", subr_or, 0, SUBR_VARIADIC, SUBR_PURE},
+        {"AND", subr_and, 0, SUBR_VARIADIC, SUBR_PURE},
+        {"EQ", subr_eq, 2, 2, SUBR_PURE},
+        {"EQL", subr_eql, 2, 2, SUBR_PURE},
+        {"LIST", subr_list, 0, SUBR_VARIADIC, SUBR_PURE | SUBR_ALLOC},
+        {"+", subr_plus, 0, SUBR_VARIADIC, SUBR_PURE | SUBR_ALLOC},
+        {"-", subr_minus, 1, SUBR_VARIADIC, SUBR_PURE | SUBR_ALLOC},
+        {"*", subr_multi, 0, SUBR_VARIADIC, SUBR_PURE | SUBR_ALLOC},
+        {"=", subr_compar, 2, 2, SUBR_PURE},
+        {">", subr_greatthan, 2, 2, SUBR_PURE},
+        {"<", subr_lessthan, 2, 2, SUBR_PURE},
+        {"/", subr_divide, 2, SUBR_VARIADIC, SUBR_PURE | SUBR_ALLOC},
+        {"MOD", subr_mod, 2, 2, SUBR_PURE | SUBR_ALLOC},
+        {"HEAP", subr_heap, 0, 0, 0},
+        {"HEAP-OBJECT", subr_heap_object, 1, 1, 0},
+        {"LOAD", subr_load, 1, 1, 0},
+        {"READ", subr_read, 0, 0, SUBR_ALLOC},
+        {"EVAL", subr_eval, 1, 1, SUBR_ALLOC},
+        {"TOUCH", subr_touch, 1, 1, 0},
+        {"ERROR", subr_error, 1, 1, SUBR_ALLOC},
+        {"SIGNAL", subr_signal, 1, 1, 0},
+        {"ERROR-MESSAGE", subr_error_message, 1, 1, SUBR_PURE | SUBR_ALLOC},
+        {"APPLY", subr_apply, 2, 2, SUBR_ALLOC},
+        {"DISPLAY", subr_display, 1, 1, 0},
+        {"NEWLINE", subr_newline, 0, 0, 0},
+        {"RPLACA", subr_rplaca, 2, 2, 0},
+        {"RPLACD", subr_rplacd, 2, 2, 0},
+        {"HCONS", subr_hcons, 2, 2, SUBR_PURE | SUBR_ALLOC},
+        {"HASH-CONS", subr_hash_cons, 1, 1, SUBR_PURE | SUBR_ALLOC},
+        {"HCONS-P", subr_hcons_p, 1, 1, SUBR_PURE},
+        {"HASH-CONS-READER", subr_hash_cons_reader, 0, 1, 0},
+        {"EQUAL", subr_equal, 2, 2, SUBR_PURE},
+        {"MAKE-VECTOR", subr_make_vector, 1, 2, SUBR_ALLOC},
+        {"VECTOR-REF", subr_vector_ref, 2, 2, 0},
+        {"VECTOR-SET!", subr_vector_set, 3, 3, 0},
+        {"VECTOR-LENGTH", subr_vector_length, 1, 1, 0},
+        {"VECTOR->LIST", subr_vector_to_list, 1, 1, SUBR_ALLOC},
+        {"LIST->VECTOR", subr_list_to_vector, 1, 1, SUBR_PURE | SUBR_ALLOC},
+        {"MAKE-INT64-ARRAY", subr_make_int64_array, 1, 2, SUBR_ALLOC},
+        {"MAKE-FLOAT64-ARRAY", subr_make_float64_array, 1, 2, SUBR_ALLOC},
+        {"LIST->INT64-ARRAY", subr_list_to_int64_array, 1, 1, SUBR_ALLOC},
+        {"LIST->FLOAT64-ARRAY", subr_list_to_float64_array, 1, 1, SUBR_ALLOC},
+        {"ARRAY->LIST", subr_array_to_list, 1, 1, SUBR_ALLOC},
+        {"ARRAY-LENGTH", subr_array_length, 1, 1, 0},
+        {"ARRAY-REF", subr_array_ref, 2, 2, SUBR_ALLOC},
+        {"ARRAY-SET!", subr_array_set, 3, 3, 0},
+        {"ARRAY-SUM", subr_array_sum, 1, 1, SUBR_ALLOC},
+        {"ARRAY-MIN", subr_array_min, 1, 1, SUBR_ALLOC},
+        {"ARRAY-MAX", subr_array_max, 1, 1, SUBR_ALLOC},
+        {"ARRAY-DOT", subr_array_dot, 2, 2, SUBR_ALLOC},
+        {"ARRAY-ADD", subr_array_add, 2, 2, SUBR_ALLOC},
+        {"ARRAY-MUL", subr_array_mul, 2, 2, SUBR_ALLOC},
+        {"ARRAY-SCALE", subr_array_scale, 2, 2, SUBR_ALLOC},
+        {"ARRAY-COUNT", subr_array_count, 3, 3, SUBR_ALLOC},
+        {"MAKE-HASH-TABLE", subr_make_hash_table, 0, 1, SUBR_ALLOC},
+        {"GETHASH", subr_gethash, 2, 3, 0},
+        {"PUTHASH", subr_puthash, 3, 3, 0},
+        {"REMHASH", subr_remhash, 2, 2, 0},
+        {"HASH-COUNT", subr_hash_count, 1, 1, SUBR_ALLOC},
+        {"MAPHASH", subr_maphash, 2, 2, 0},
+        {"STRING-LENGTH", subr_string_length, 1, 1, SUBR_PURE | SUBR_ALLOC},
+        {"STRING-APPEND", subr_string_append, 0, SUBR_VARIADIC,
+         SUBR_PURE | SUBR_ALLOC},
+        {"SUBSTRING", subr_substring, 2, 3, SUBR_PURE | SUBR_ALLOC},
+        {"STRING-SEARCH", subr_string_search, 2, 3, SUBR_PURE | SUBR_ALLOC},
+        {"STRING-SPLIT", subr_string_split, 2, 2, SUBR_PURE | SUBR_ALLOC},
+        {"STRING->NUMBER", subr_string_to_number, 1, 1, SUBR_PURE | SUBR_ALLOC},
+        {"NUMBER->STRING", subr_number_to_string, 1, 1, SUBR_PURE | SUBR_ALLOC},
+        {"WRITE-TO-STRING", subr_write_to_string, 1, 1, SUBR_ALLOC},
+        {"STRING=", subr_string_equal, 2, 2, SUBR_PURE},
+        {"LENGTH", subr_length, 1, 1, SUBR_PURE | SUBR_ALLOC},
+        {"MAP", subr_map, 2, SUBR_VARIADIC, SUBR_ALLOC},
+        {"REDUCE", subr_reduce, 2, 2, 0},
+        {"FOLD-LEFT", subr_fold_left, 3, 3, 0},
+        {"FOLD-RIGHT", subr_fold_right, 3, 3, 0},
+        {"APPEND", subr_append, 0, SUBR_VARIADIC, SUBR_PURE | SUBR_ALLOC},
+        {"REVERSE", subr_reverse, 1, 1, SUBR_PURE | SUBR_ALLOC},
+        {"REMOVE-IF", subr_remove_if, 2, 2, SUBR_ALLOC},
+        {"FIND-IF", subr_find_if, 2, 2, 0},
+        {"FIND", subr_find, 2, 2, SUBR_PURE},
+        {"MEMBER", subr_member, 2, 2, SUBR_PURE},
+        {"ASSOC", subr_assoc, 2, 2, SUBR_PURE},
+        {"NTH", subr_nth, 2, 2, SUBR_PURE},
+        {"LAST", subr_last, 1, 1, SUBR_PURE},
+        {"SORT", subr_sort, 2, 3, SUBR_ALLOC},
+        {"PMAP", subr_pmap, 2, 3, SUBR_ALLOC},
+        {"PFILTER", subr_pfilter, 2, 3, SUBR_ALLOC},
+        {"PREDUCE", subr_preduce, 2, 3, 0}
+    };
     
-    frame = heap_grab(env_subr_init(s, sizeof(s) / sizeof(struct subrs), 0));
+    /* Never released, the evaluator compares them by address. */
+    for(i = 0; i < SYM_MAX; i++) {
+        ctx->symbols[i] = heap_grab(NEW_SYMBOL(symbol_names[i]));
+    }
+
+    frame = heap_grab(env_subr_init(s, sizeof(s) / sizeof(struct subr), 0));
     
-    env = NEW_CONS(frame, NULL);
+    /* Programs define into a frame of their own on top of the
+       primitives, so a LABEL may shadow a primitive but not T or NIL. */
+    env = NEW_CONS(NULL, NEW_CONS(frame, NULL));
     
     env_var_define(NEW_SYMBOL("T"), NEW_SYMBOL("T"), env);
-    env_var_define(NEW_SYMBOL("NIL"), NULL, env);
+    env_var_define(SYMBOL_NIL, NULL, env);
     
     return env;
 }
 
-static struct lispobj *env_subr_init(struct subrs *s, int size, int i)
+static struct lispobj *env_subr_init(struct subr *s, int size, int i)
 {
     if(i < size) {
         struct lispobj *cell, *frame, *val;
-        char num[32];
         
-        snprintf(num, 32, "%d", (int) s[i].val);
-        val = list(2, NEW_SYMBOL("SUBR"), NEW_NUMBER(num));
+        val = object_create(SUBR, NULL);
+        SUBR_VALUE(val) = &s[i];
 
-        cell = NEW_CONS(NEW_SYMBOL(s[i].var), val);
+        /* Names of primitives are all different. */
+        cell = NEW_CONS(symbol_fresh(s[i].name), val);
         
         frame = NEW_CONS(cell, env_subr_init(s, size, i + 1));
         
@@ -0,0 +1,128 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/stack.h"
+#include "../include/print.h"
+#include "../include/error.h"
+#include "../include/profile.h"
+
+static char *error_messages[E_MAX] = {
+    [E_ARGS] = "Recieve wrong number of arguments.\n",
+    [E_STACK] = "Stack overflow.\n",
+    [E_NOT_NUMBER] = "Argument is not a number.\n",
+    [E_NOT_CONS] = "Argument is not a CONS type.\n",
+    [E_NOT_STRING] = "Argument is not a string.\n",
+    [E_NOT_SYMBOL] = "Variable name is not a symbol.\n",
+    [E_WRONG_TYPE] = "Wrong arguments type.\n",
+    [E_DIVISION_BY_ZERO] = "Division by zero.\n",
+    [E_UNKNOWN_PROC] = "Unknown procedure.\n",
+    [E_BAD_COND] = "Bad cond clause.\n",
+    [E_BAD_LET] = "Bad binding in the let exp.\n",
+    [E_EMPTY_LET] = "Empty bindgings in the let exp.\n",
+    [E_BAD_HANDLER] = "Bad handler-case clause.\n",
+    [E_NOT_VECTOR] = "Argument is not a vector.\n",
+    [E_BAD_INDEX] = "Index is out of range.\n",
+    [E_NOT_ARRAY] = "Argument is not a typed array.\n",
+    [E_ARRAY_MISMATCH] = "Arrays differ in type or length.\n",
+    [E_EMPTY_ARRAY] = "Array is empty.\n",
+    [E_NOT_HASHTABLE] = "Argument is not a hash table.\n",
+    [E_BAD_TEST] = "Hash table test must be EQ, EQL or EQUAL.\n",
+    [E_IMMUTABLE] = "Hash-consed or shared data is immutable.\n",
+};
+
+void error_init(void)
+{
+    int i;
+
+    /* They are never released, so signalling them is free. */
+    for(i = 0; i < E_MAX; i++) {
+        ctx->errors[i] = heap_grab(NEW_ERROR(error_messages[i]));
+    }
+
+    return;
+}
+
+void error_print(struct lispobj *condition)
+{
+    if(condition != NULL && OBJ_TYPE(condition) == ERROR) {
+        print(condition);
+    } else {
+        printf("Unhandled condition: ");
+        print(condition);
+    }
+
+    return;
+}
+
+/*
+ * A batch program ends at the first condition nobody handles, it's
+ * told on stderr after the output so far.
+ */
+void error_exit(struct lispobj *condition)
+{
+    const char *message;
+
+    fflush(stdout);
+    if(condition != NULL && OBJ_TYPE(condition) == ERROR) {
+        print_stream(condition, stderr);
+        message = ERROR_VALUE(condition);
+        if(*message == '\0' || message[strlen(message) - 1] != '\n') {
+            fputc('\n', stderr);
+        }
+    } else {
+        fputs("Unhandled condition: ", stderr);
+        print_stream(condition, stderr);
+        fputc('\n', stderr);
+    }
+
+    /* Nothing is freed, the process is gone anyway. */
+    exit(EXIT_FAILURE);
+}
+
+void handler_push(struct handler *h)
+{
+    h->stack_index = ctx->stack->index;
+    h->profile_depth = ctx->profile != NULL ? ctx->profile->depth : 0;
+    h->condition = NULL;
+    h->prev = ctx->handlers;
+    ctx->handlers = h;
+
+    return;
+}
+
+void handler_pop(struct handler *h)
+{
+    ctx->handlers = h->prev;
+
+    return;
+}
+
+void error_signal(struct lispobj *condition)
+{
+    struct handler *h = ctx->handlers;
+
+    if(h == NULL) {
+        /* Nobody to catch it. */
+        if(ctx->batch) {
+            error_exit(condition);
+        }
+        error_print(condition);
+        printf("\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Grab it first, it may live on the stack being unwound. */
+    h->condition = heap_grab(condition);
+    ctx->handlers = h->prev;
+    stack_unwind(h->stack_index);
+    if(ctx->profile != NULL) {
+        ctx->profile->depth = h->profile_depth;
+    }
+
+    longjmp(h->jmp, 1);
+}
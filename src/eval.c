@@ -2,303 +2,447 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <setjmp.h>
 
 #include "../include/object.h"
 #include "../include/heap.h"
 #include "../include/subr.h"
 #include "../include/environment.h"
 #include "../include/eval.h"
+#include "../include/stack.h"
+#include "../include/error.h"
+#include "../include/pool.h"
+#include "../include/profile.h"
 
 static struct lispobj *eval_progn(struct lispobj*, struct lispobj*);
 static struct lispobj *eval_cond(struct lispobj *, struct lispobj*);
-static struct lispobj *eval_let(struct lispobj*, struct lispobj*);
+static struct lispobj *eval_let(struct lispobj*, struct lispobj*, int);
+static struct lispobj *eval_ignore_errors(struct lispobj*, struct lispobj*);
+static struct lispobj *eval_handler_case(struct lispobj*, struct lispobj*);
 
+/* Kinds of the let form, see eval_let(). */
+enum {
+    LET_PARALLEL = 0, /* let: values see only the outer env. */
+    LET_SEQUENTIAL,   /* let*: value sees the previous bindings. */
+    LET_RECURSIVE,    /* letrec: values see all the bindings. */
+};
+
+/*
+ * Errors don't come back as return values: they are signalled
+ * with error_signal() and unwind straight to the nearest handler.
+ * Everything that must be released on the way is kept on the
+ * evaluator stack.
+ */
 struct lispobj *eval(struct lispobj *obj, struct lispobj *env)
 {
-    struct lispobj *ret;
+    struct lispobj *ret, **sym = ctx->symbols;
     
-    if(obj == NULL || OBJ_TYPE(obj) == NUMBER ||
-       OBJ_TYPE(obj) == ERROR || OBJ_TYPE(obj) == STRING) {
+    if(obj == NULL ||
+       (OBJ_TYPE(obj) != SYMBOL && OBJ_TYPE(obj) != CONS)) {
         /* Return self-evaluating object. */
         ret = heap_grab(obj);
     } else if(OBJ_TYPE(obj) == SYMBOL) {
         /* Lookup value of the variable in the env. */
-        struct lispobj *val;
-
-        val = env_var_lookup(obj, env);
-        if(OBJ_TYPE(val) == ERROR) {
-            ret = heap_grab(val);
-        } else {
-            ret = heap_grab(CDR(val));
-        }
-    } else if(NEW_SYMBOL("QUOTE") == CAR(obj)) {
+        ret = heap_grab(CDR(env_var_lookup(obj, env)));
+    } else if(sym[SYM_QUOTE] == CAR(obj)) {
         /* (quote whatever) */
         if(length(obj) != 2) {
-            ret = heap_grab(ERROR_ARGS);
-        } else {
-            /* Return quoted object. */
-            ret = heap_grab(CADR(obj));
+            error_signal(ERROR_ARGS);
         }
+        /* Return quoted object. */
+        ret = heap_grab(CADR(obj));
 #ifdef __DEBUG_GC__
         printf("eval quote debug:");
         heap_debug_object(ret);
         printf("\n");
 #endif
-    } else if(NEW_SYMBOL("SETQ") == CAR(obj)) {
+    } else if(sym[SYM_SETQ] == CAR(obj)) {
         /* (setq var val) */
+        struct lispobj *val;
+        
         if(length(obj) != 3) {
-            ret = heap_grab(ERROR_ARGS);
-        } else {
-            /* Try to assign existing variable. */
-            struct lispobj *val;
-            
-            val = eval(CADDR(obj), env);
-            if(val != NULL && OBJ_TYPE(val) == ERROR) {
-                ret = val;
-            } else {
-                ret = heap_grab(env_var_assign(CADR(obj), val, env));
-                heap_release(val);
-            }
+            error_signal(ERROR_ARGS);
         }
-    } else if(NEW_SYMBOL("LABEL") == CAR(obj)) {
+        /* Try to assign existing variable. */
+        val = eval(CADDR(obj), env);
+        ret = heap_grab(env_var_assign(CADR(obj), val, env));
+        heap_release(val);
+    } else if(sym[SYM_LABEL] == CAR(obj)) {
         /* (label var val) */
+        struct lispobj *val;
+        
         if(length(obj) != 3) {
-            ret = heap_grab(ERROR_ARGS);
-        } else {
-            /* Try to define new variable. */
-            struct lispobj *val;
-
-            val = eval(CADDR(obj), env);
-            if(val != NULL && OBJ_TYPE(val) == ERROR) {
-                ret = val;
-            } else {
-                ret = heap_grab(env_var_define(CADR(obj), val, env));
-                heap_release(val);
-            }
+            error_signal(ERROR_ARGS);
         }
-    } else if(NEW_SYMBOL("IF") == CAR(obj)) {
+        /* Try to define new variable. */
+        val = eval(CADDR(obj), env);
+        ret = heap_grab(env_var_define(CADR(obj), val, env));
+        if(ctx->profile != NULL) {
+            profile_label(ctx->profile, CADR(obj), CADDR(obj), val);
+        }
+        heap_release(val);
+    } else if(sym[SYM_IF] == CAR(obj)) {
         /* (if predicate consequence alternative) */
+        struct lispobj *pred;
+        
         if(length(obj) != 4) {
-            ret = heap_grab(ERROR_ARGS);
+            error_signal(ERROR_ARGS);
+        }
+        /* Invoke condition function, only its truth is needed. */
+        pred = eval(CADR(obj), env);
+        heap_release(pred);
+        
+        if(pred) {
+            /* Eval consequence. */
+            ret = eval(CADDR(obj), env);
         } else {
-            /* Invoke condition function. */
-            struct lispobj *pred;
-
-            pred = eval(CADR(obj), env);
-            if(pred != NULL && OBJ_TYPE(pred) == ERROR) {
-                ret = pred;
-            } else {
-                if(pred) {
-                    /* Eval consequence. */
-                    ret = eval(CADDR(obj), env);
-                } else {
-                    /* Eval alternative. */
-                    ret = eval(CADDDR(obj), env);
-                }
-
-                heap_release(pred);
-            }
+            /* Eval alternative. */
+            ret = eval(CADDDR(obj), env);
         }
-    } else if(NEW_SYMBOL("COND") == CAR(obj)) {
+    } else if(sym[SYM_COND] == CAR(obj)) {
         /* (cond (cond1 ret1) (cond2 ret2)) */
         if(length(obj) < 2) {
-            ret = heap_grab(ERROR_ARGS);
-        } else {
-            ret = eval_cond(CDR(obj), env);
+            error_signal(ERROR_ARGS);
         }
-    }
-    else if(NEW_SYMBOL("LET") == CAR(obj)) {
+        ret = eval_cond(CDR(obj), env);
+    } else if(sym[SYM_LET] == CAR(obj)) {
+        /* (let ((var val) ...) body) */
         if(length(obj) < 3) {
-            ret = heap_grab(ERROR_ARGS);
-        } else {
-            ret = eval_let(CDR(obj), env);
+            error_signal(ERROR_ARGS);
+        }
+        ret = eval_let(CDR(obj), env, LET_PARALLEL);
+    } else if(sym[SYM_LET_SEQUENTIAL] == CAR(obj)) {
+        /* (let* ((var val) ...) body) */
+        if(length(obj) < 3) {
+            error_signal(ERROR_ARGS);
         }
-    } else if(NEW_SYMBOL("PROGN") == CAR(obj)) {
+        ret = eval_let(CDR(obj), env, LET_SEQUENTIAL);
+    } else if(sym[SYM_LETREC] == CAR(obj)) {
+        /* (letrec ((var val) ...) body) */
+        if(length(obj) < 3) {
+            error_signal(ERROR_ARGS);
+        }
+        ret = eval_let(CDR(obj), env, LET_RECURSIVE);
+    } else if(sym[SYM_PROGN] == CAR(obj)) {
         ret = eval_progn(CDR(obj), env);
-    } else if(NEW_SYMBOL("LAMBDA") == CAR(obj)) {
+    } else if(sym[SYM_LAMBDA] == CAR(obj)) {
         /* (lambda (var) (proc var var)) */
         if(length(obj) < 3) {
-            ret = heap_grab(ERROR_ARGS);
-        } else {
-            /* Make and return new procedure. */
-            ret = heap_grab(env_proc_make(CADR(obj), CDDR(obj), env));
+            error_signal(ERROR_ARGS);
+        }
+        /* Make and return new procedure. */
+        ret = heap_grab(env_proc_make(CADR(obj), CDDR(obj), env));
+    } else if(sym[SYM_IGNORE_ERRORS] == CAR(obj)) {
+        /* (ignore-errors body) */
+        ret = eval_ignore_errors(CDR(obj), env);
+    } else if(sym[SYM_HANDLER_CASE] == CAR(obj)) {
+        /* (handler-case exp (type (var) body) ...) */
+        if(length(obj) < 2) {
+            error_signal(ERROR_ARGS);
         }
+        ret = eval_handler_case(CDR(obj), env);
+    } else if(sym[SYM_FUTURE] == CAR(obj)) {
+        /* (future body) */
+        if(length(obj) < 2) {
+            error_signal(ERROR_ARGS);
+        }
+        ret = heap_grab(pool_future(CDR(obj), env));
     } else {
         /* Apply case. */
-        struct lispobj *proc = eval(CAR(obj), env);
-        
-        if(proc != NULL && OBJ_TYPE(proc) == ERROR) {
-            ret = proc;
-        } else {
-            struct lispobj *args = heap_grab(env_val_list(CDR(obj), env));
+        int base = ctx->stack->index;
 
-            if(args != NULL && OBJ_TYPE(args) == ERROR) {
-                ret = args;
-            } else {
-                ret = apply(proc, args);
-                heap_release(args);
-            }
-            
-            heap_release(proc);
-        }
+        /* Keep the procedure on the stack under its arguments,
+           so unwinding releases it too. */
+        stack_push(eval(CAR(obj), env));
+        env_val_push(CDR(obj), env);
+
+        ret = apply_argv(ctx->stack->data[base],
+                         ctx->stack->index - base - 1,
+                         ctx->stack->data + base + 1);
+        stack_unwind(base);
     }
     
     return ret;
 }
 
+/*
+ * List form of the application, it's used by APPLY
+ * to spread a list of arguments onto the stack.
+ */
 struct lispobj *apply(struct lispobj *proc, struct lispobj *args)
-{    
-    if(proc != NULL && OBJ_TYPE(proc) == CONS) {
-        struct lispobj *ret;
-        
-        if(NEW_SYMBOL("SUBR") == CAR(proc)) {
-            /* Apply primitive function. */
-            struct lispobj *body, *(*subr)(struct lispobj *);
-
-            body = CADR(proc);
-            subr = (struct lispobj *) NUMBER_VALUE(body);
-            //subr = (struct lispobj *) body;
-
-            ret = heap_grab(subr(args));
-        } else if(NEW_SYMBOL("PROC") == CAR(proc)) {
-            /* Apply user defined procedure. */
-            struct lispobj *body, *params, *penv;
-
-            body = CADDR(proc);
-            params = CADR(proc);
-            penv = CADDDR(proc);
-            
-            if(length(params) == length(args)) {
-                struct lispobj *env;
-
-                if(params == NULL || params == NEW_SYMBOL("NIL")) {
-                    env = penv;
-
-                    ret = eval_progn(body, env);
-                } else {
-                    env = heap_grab(NEW_CONS(env_frame_make(params, args), penv));
-
-                    ret = eval_progn(body, env);
-                    heap_release(env);
-                }
-            } else {
-                char error[64]; 
-                snprintf(error,
-                         64,
-                         "Has recieved wrong number of parameters: %d.\n",
-                         length(args));
-                ret = heap_grab(NEW_ERROR(error));
-            }
+{
+    struct lispobj *ret;
+    int base = ctx->stack->index;
+
+    while(args != NULL && args != SYMBOL_NIL) {
+        stack_push(heap_grab(CAR(args)));
+        args = CDR(args);
+    }
+
+    ret = apply_argv(proc, ctx->stack->index - base, ctx->stack->data + base);
+    stack_unwind(base);
+
+    return ret;
+}
+
+/*
+ * The profiler's shadow stack is kept here, a context which isn't
+ * profiled pays for the test only.
+ */
+struct lispobj *apply_argv(struct lispobj *proc, int argc, struct lispobj **argv)
+{
+    struct profile *p = ctx->profile;
+    struct lispobj *ret;
+
+    if(p != NULL) {
+        profile_enter(p, proc);
+    }
+
+    if(proc != NULL && OBJ_TYPE(proc) == SUBR) {
+        /* Apply primitive function. */
+        struct subr *subr = SUBR_VALUE(proc);
+
+        if(argc < subr->min_args ||
+           (subr->max_args != SUBR_VARIADIC && argc > subr->max_args)) {
+            error_signal(ERROR_ARGS);
+        }
+
+        if(subr->native != NULL) {
+            ret = subr->native(subr->data, argc, argv);
         } else {
-            goto error;
+            ret = heap_grab(subr->fn(argc, argv));
         }
+    } else if(proc != NULL && OBJ_TYPE(proc) == CONS &&
+              SYMBOL_PROC == CAR(proc)) {
+        /* Apply user defined procedure. */
+        struct lispobj *body, *params, *penv, *tmp;
+        int n = 0;
 
-        return ret;
+        body = CADDR(proc);
+        params = CADR(proc);
+        penv = CADDDR(proc);
+
+        /* Counted here, NIL or NULL ends the list without a lookup. */
+        for(tmp = params; tmp != NULL && OBJ_TYPE(tmp) == CONS;
+            tmp = CDR(tmp)) {
+            n++;
+        }
+        if(n != argc) {
+            char error[64]; 
+            snprintf(error,
+                     64,
+                     "Has recieved wrong number of parameters: %d.\n",
+                     argc);
+            error_signal(NEW_ERROR(error));
+        }
+
+        if(n == 0) {
+            ret = eval_progn(body, penv);
+        } else {
+            struct lispobj *env;
+            int base = ctx->stack->index;
+
+            env = NEW_CONS(env_frame_make(params, argc, argv), penv);
+            stack_push(heap_grab(env));
+
+            ret = eval_progn(body, env);
+            stack_unwind(base);
+        }
+    } else {
+        error_signal(ERROR_UNKNOWN_PROC);
     }
-    
-    error:
-    return heap_grab(NEW_ERROR("Unknown procedure.\n"));
+
+    if(p != NULL) {
+        profile_leave(p);
+    }
+
+    return ret;
 }
 
 static struct lispobj *eval_progn(struct lispobj *exps, struct lispobj *env)
 {
     if(exps == NULL) {
         return exps;
-    } else if(CDR(exps) == NULL) {
-        return eval(CAR(exps), env);
-    } else {
-        eval(CAR(exps), env);
-        return eval_progn(CDR(exps), env);
     }
+
+    while(CDR(exps) != NULL) {
+        heap_release(eval(CAR(exps), env));
+        exps = CDR(exps);
+    }
+
+    return eval(CAR(exps), env);
 }
 
 static struct lispobj* eval_cond(struct lispobj *exps, struct lispobj *env)
 {
-    struct lispobj *ret = OBJ_FALSE;
-    
-    if(exps != NULL) {
-        struct lispobj *cond;
+    while(exps != NULL) {
+        struct lispobj *cond, *pred;
     
         cond = CAR(exps);
-        if(cond != NULL && OBJ_TYPE(cond) == CONS) {
-            struct lispobj *pred;
-
-            pred = eval(CAR(cond), env);
-            if(pred != NULL && OBJ_TYPE(pred) == ERROR) {
-                ret = pred;
-            } else {
-                if(pred) {
-                    if(length(cond) == 1) {
-                        ret = OBJ_TRUE;
-                    } else {
-                        ret = eval(CADR(cond), env);
-                    }
-                } else {
-                    ret = eval_cond(CDR(exps), env);
-                }
-                heap_release(pred);
+        if(cond == NULL || OBJ_TYPE(cond) != CONS) {
+            error_signal(ERROR_BAD_COND);
+        }
+
+        pred = eval(CAR(cond), env);
+        heap_release(pred);
+
+        if(pred) {
+            if(length(cond) == 1) {
+                return heap_grab(OBJ_TRUE);
             }
+            
+            return eval(CADR(cond), env);
+        }
+
+        exps = CDR(exps);
+    }
+
+    return OBJ_FALSE;
+}
+
+/*
+ * The bindings go straight into a new frame on top of env,
+ * so no closure and no temporary lists of vars and vals are built.
+ */
+static struct lispobj *eval_let(struct lispobj *exps, struct lispobj *env, int kind)
+{
+    struct lispobj *binds, *bind, *lenv, *ret;
+    int base = ctx->stack->index;
+
+    binds = CAR(exps);
+
+    if(binds == NULL || OBJ_TYPE(binds) != CONS) {
+        error_signal(ERROR_EMPTY_LET);
+    }
+
+    /* Check all the bindings before any evaluation. */
+    for(bind = binds; bind != NULL; bind = CDR(bind)) {
+        if(CAR(bind) == NULL || OBJ_TYPE(CAR(bind)) != CONS ||
+           length(CAR(bind)) != 2 ||
+           CAR(CAR(bind)) == NULL || OBJ_TYPE(CAR(CAR(bind))) != SYMBOL) {
+            error_signal(ERROR_BAD_LET);
+        }
+    }
+
+    lenv = NEW_CONS(NULL, env);
+    stack_push(heap_grab(lenv));
+
+    if(kind == LET_RECURSIVE) {
+        /* Make all the variables visible before evaluating values. */
+        for(bind = binds; bind != NULL; bind = CDR(bind)) {
+            env_var_bind(CAR(CAR(bind)), NULL, lenv);
+        }
+    }
+
+    for(bind = binds; bind != NULL; bind = CDR(bind)) {
+        struct lispobj *val;
+
+        val = eval(CADR(CAR(bind)), kind == LET_PARALLEL ? env : lenv);
+
+        if(kind == LET_RECURSIVE) {
+            env_var_assign(CAR(CAR(bind)), val, lenv);
         } else {
-            ret = NEW_ERROR("Bad cond clause.\n");
+            env_var_bind(CAR(CAR(bind)), val, lenv);
         }
+        heap_release(val);
     }
 
+    ret = eval_progn(CDR(exps), lenv);
+    stack_unwind(base);
+
     return ret;
 }
 
-struct lispobj *eval_let(struct lispobj *exps, struct lispobj *env)
+static struct lispobj *eval_ignore_errors(struct lispobj *exps, struct lispobj *env)
 {
-    struct lispobj *binds, *body, *vars, *vals, *lambda, *ret, *evals;
+    struct handler h;
+    struct lispobj *ret;
 
-    binds = CAR(exps);
-    body = CDR(exps);
+    handler_push(&h);
+    if(setjmp(h.jmp)) {
+        heap_release(h.condition);
 
-    if(length(binds) > 0) {
-        struct lispobj *tvars, *tvals;
-        
-        vars = heap_grab(NEW_CONS(NULL, NULL));
-        vals = heap_grab(NEW_CONS(NULL, NULL));
-        tvars = vars; tvals = vals;
-        
-        while(binds != NULL) {
-            struct lispobj *bind = CAR(binds);
+        return OBJ_FALSE;
+    }
 
-            if(length(bind) != 2) {
-                ret = NEW_ERROR("Bad binding in the let exp.\n");
-                goto exit;
-            }
-            
-            CAR(tvars) = heap_grab(CAR(bind));
-            CAR(tvals) = heap_grab(CADR(bind));
-            CDR(tvars) = heap_grab(NEW_CONS(NULL, NULL));
-            CDR(tvals) = heap_grab(NEW_CONS(NULL, NULL));
-            
-            tvars = CDR(tvars);
-            tvals = CDR(tvals);
-            binds = CDR(binds);
+    ret = eval_progn(exps, env);
+    handler_pop(&h);
+
+    return ret;
+}
+
+/*
+ * Clause type T catches everything, ERROR catches error objects,
+ * any other symbol catches a signalled symbol or a list tagged by it.
+ */
+static int condition_match(struct lispobj *type, struct lispobj *condition)
+{
+    if(type == OBJ_TRUE) {
+        return 1;
+    } else if(condition == NULL) {
+        return 0;
+    } else if(type == SYMBOL_ERROR) {
+        return OBJ_TYPE(condition) == ERROR;
+    } else if(OBJ_TYPE(condition) == SYMBOL) {
+        return condition == type;
+    } else if(OBJ_TYPE(condition) == CONS) {
+        return CAR(condition) == type;
+    }
+
+    return 0;
+}
+
+static struct lispobj *eval_handler_case(struct lispobj *exps, struct lispobj *env)
+{
+    struct handler h;
+    struct lispobj *clause, *vars, *ret;
+    int base;
+
+    for(clause = CDR(exps); clause != NULL; clause = CDR(clause)) {
+        if(CAR(clause) == NULL || OBJ_TYPE(CAR(clause)) != CONS ||
+           length(CAR(clause)) < 2) {
+            error_signal(ERROR_BAD_HANDLER);
         }
+    }
 
-        tvars = NULL;
-        tvals = NULL;
-    } else {
-        return NEW_ERROR("Empty bindgings in the let exp.\n");
+    handler_push(&h);
+    if(!setjmp(h.jmp)) {
+        ret = eval(CAR(exps), env);
+        handler_pop(&h);
+
+        return ret;
     }
 
-    lambda = heap_grab(env_proc_make(vars, body, env));
+    base = ctx->stack->index;
+    /* Our reference to the condition goes away with the stack. */
+    stack_push(h.condition);
     
-    evals = heap_grab(env_val_list(vals, env));
-    if(evals != NULL && OBJ_TYPE(evals) == ERROR) {
-        ret = evals;
-    } else {
-        ret = apply(lambda, evals);
-        heap_release(evals);
+    for(clause = CDR(exps); clause != NULL; clause = CDR(clause)) {
+        if(condition_match(CAR(CAR(clause)), h.condition)) {
+            break;
+        }
     }
 
-    heap_release(lambda);
-    
-    exit:
-    heap_release(vals);
-    heap_release(vars);
+    if(clause == NULL) {
+        /* Nobody here wants it, pass it to the outer handler. */
+        error_signal(h.condition);
+    }
+
+    clause = CAR(clause);
+    vars = CADR(clause);
+
+    if(vars != NULL && vars != SYMBOL_NIL) {
+        struct lispobj *lenv;
+
+        lenv = NEW_CONS(NULL, env);
+        stack_push(heap_grab(lenv));
+        env_var_bind(CAR(vars), h.condition, lenv);
+
+        env = lenv;
+    }
+
+    ret = eval_progn(CDDR(clause), env);
+    stack_unwind(base);
 
     return ret;
 }
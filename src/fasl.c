@@ -0,0 +1,618 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/subr.h"
+#include "../include/bignum.h"
+#include "../include/hashtable.h"
+#include "../include/hcons.h"
+#include "../include/read.h"
+#include "../include/fasl.h"
+
+#define FASL_HASH_SEED 0xcbf29ce484222325UL
+
+/* FNV-1a, h is FASL_HASH_SEED or the hash of preceding bytes. */
+static uint64_t fasl_hash(uint64_t h, const unsigned char *s, long n)
+{
+    long i;
+
+    for(i = 0; i < n; i++) {
+        h = (h ^ s[i]) * 0x100000001b3UL;
+    }
+
+    return h;
+}
+
+/* NAME.lisp is cached as NAME.fasl, any other NAME as NAME.fasl too. */
+char *fasl_path(const char *source)
+{
+    char *path;
+    long n = strlen(source);
+
+    if(n > 5 && !strcmp(source + n - 5, ".lisp")) {
+        n -= 5;
+    }
+    path = malloc(n + sizeof(".fasl"));
+    memcpy(path, source, n);
+    strcpy(path + n, ".fasl");
+
+    return path;
+}
+
+static void *fasl_map(const char *path, struct stat *st)
+{
+    void *map;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+
+    if(fstat(fd, st) != 0 || !S_ISREG(st->st_mode) || st->st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    return map != MAP_FAILED ? map : NULL;
+}
+
+/*
+ * Same mtime and size is enough. A source touched without a change
+ * still has the same text, its hash tells that.
+ */
+static int fasl_fresh(const struct fasl_header *h, const char *source)
+{
+    struct stat st;
+    void *text;
+    int fresh;
+
+    if(stat(source, &st) != 0 || h->size != st.st_size)
+        return 0;
+
+    if(h->mtime_sec == st.st_mtim.tv_sec &&
+       h->mtime_nsec == st.st_mtim.tv_nsec)
+        return 1;
+
+    if(st.st_size == 0)
+        return h->hash == FASL_HASH_SEED;
+
+    if((text = fasl_map(source, &st)) == NULL)
+        return 0;
+    fresh = h->size == st.st_size &&
+        h->hash == fasl_hash(FASL_HASH_SEED, text, st.st_size);
+    munmap(text, st.st_size);
+
+    return fresh;
+}
+
+static uint64_t fasl_varint(struct fasl *f)
+{
+    uint64_t v = 0;
+    int shift = 0;
+    unsigned char b;
+
+    do {
+        if(f->pos >= f->length || shift > 63) {
+            f->broken = 1;
+            return 0;
+        }
+        b = f->data[f->pos++];
+        v |= (uint64_t) (b & 0x7f) << shift;
+        shift += 7;
+    } while(b & 0x80);
+
+    return v;
+}
+
+/* Returns NULL if the next n bytes aren't there. */
+static const unsigned char *fasl_bytes(struct fasl *f, uint64_t n)
+{
+    const unsigned char *p;
+
+    if(f->broken || n > (uint64_t) (f->length - f->pos)) {
+        f->broken = 1;
+        return NULL;
+    }
+    p = f->data + f->pos;
+    f->pos += n;
+
+    return p;
+}
+
+/* The source must be there and have the same text. */
+struct fasl *fasl_open(const char *source)
+{
+    struct fasl *f;
+    struct fasl_header h;
+    struct stat st;
+    const unsigned char *name;
+    char *path, *copy;
+    unsigned char *map;
+    uint64_t n;
+    uint32_t i;
+
+    path = fasl_path(source);
+    map = fasl_map(path, &st);
+    free(path);
+    if(map == NULL)
+        return NULL;
+
+    if(st.st_size < (long) sizeof(h)) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    memcpy(&h, map, sizeof(h));
+    if(memcmp(h.magic, FASL_MAGIC, 4) || h.version != FASL_VERSION ||
+       !fasl_fresh(&h, source)) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    f = malloc(sizeof(struct fasl));
+    memset(f, 0, sizeof(struct fasl));
+    f->data = map;
+    f->length = st.st_size;
+    f->pos = sizeof(h);
+    f->forms = h.forms;
+    f->symbols = malloc(sizeof(struct lispobj *) * (h.symbols + 1));
+
+    /* Interned once, forms refer to them by index. */
+    for(i = 0; i < h.symbols; i++) {
+        n = fasl_varint(f);
+        if((name = fasl_bytes(f, n)) == NULL)
+            break;
+        copy = malloc(n + 1);
+        memcpy(copy, name, n);
+        copy[n] = '\0';
+        f->symbols[f->nsymbols++] = heap_grab(NEW_SYMBOL(copy));
+        free(copy);
+    }
+
+    if(f->broken) {
+        fasl_close(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+void fasl_close(struct fasl *f)
+{
+    uint32_t i;
+
+    for(i = 0; i < f->nsymbols; i++) {
+        heap_release(f->symbols[i]);
+    }
+    free(f->symbols);
+    munmap(f->data, f->length);
+    free(f);
+
+    return;
+}
+
+static struct lispobj *fasl_decode(struct fasl *f);
+
+static struct lispobj *fasl_decode_list(struct fasl *f)
+{
+    struct lispobj *head = NULL, *tail = NULL, *cell, *obj;
+    uint64_t i, n = fasl_varint(f);
+
+    for(i = 0; i < n && !f->broken; i++) {
+        obj = fasl_decode(f);
+        cell = NEW_CONS(obj, NULL);
+        if(head == NULL) {
+            head = cell;
+        } else {
+            CDR(tail) = heap_grab(cell);
+        }
+        tail = cell;
+    }
+    if(tail != NULL && !f->broken) {
+        CDR(tail) = heap_grab(fasl_decode(f));
+    }
+
+    if(head == NULL || f->broken) {
+        /* The reader never makes an empty list. */
+        f->broken = 1;
+        heap_release(heap_grab(head));
+        return NULL;
+    }
+
+    /* Like the reader: inner lists are hash-consed already. */
+    if(ctx->read_hash_cons) {
+        obj = hcons_tree(head);
+        heap_release(heap_grab(head));
+
+        return obj;
+    }
+
+    return head;
+}
+
+/* Sets f->broken on a bad object, what's built so far is freed. */
+static struct lispobj *fasl_decode(struct fasl *f)
+{
+    struct lispobj *obj;
+    const unsigned char *p;
+    struct bignum *b;
+    uint64_t n, i;
+    int64_t v;
+    double d;
+    char *copy;
+
+    if((p = fasl_bytes(f, 1)) == NULL)
+        return NULL;
+
+    switch(*p) {
+    case FASL_NULL:
+        return NULL;
+    case FASL_SYMBOL:
+        n = fasl_varint(f);
+        if(n >= f->nsymbols) {
+            f->broken = 1;
+            return NULL;
+        }
+
+        return f->symbols[n];
+    case FASL_NUMBER:
+        /* Zigzag, small negative numbers stay short. */
+        n = fasl_varint(f);
+        v = (int64_t) (n >> 1) ^ -(int64_t) (n & 1);
+
+        return number(v);
+    case FASL_FLOAT:
+        if((p = fasl_bytes(f, sizeof(d))) == NULL)
+            return NULL;
+        memcpy(&d, p, sizeof(d));
+
+        return flonum(d);
+    case FASL_BIGNUM:
+        if((p = fasl_bytes(f, 1)) == NULL)
+            return NULL;
+        v = *p ? -1 : 1;
+        n = fasl_varint(f);
+        if(n > INT32_MAX || (p = fasl_bytes(f, n * 4)) == NULL) {
+            f->broken = 1;
+            return NULL;
+        }
+        b = bignum_new(n);
+        b->sign = v;
+        memcpy(b->digits, p, n * 4);
+        obj = object_create(BIGNUM, NULL);
+        BIGNUM_VALUE(obj) = b;
+
+        return obj;
+    case FASL_STRING:
+        n = fasl_varint(f);
+        if((p = fasl_bytes(f, n)) == NULL)
+            return NULL;
+
+        return string((const char *) p, n);
+    case FASL_ERROR:
+        n = fasl_varint(f);
+        if((p = fasl_bytes(f, n)) == NULL)
+            return NULL;
+        copy = malloc(n + 1);
+        memcpy(copy, p, n);
+        copy[n] = '\0';
+        obj = NEW_ERROR(copy);
+        free(copy);
+
+        return obj;
+    case FASL_VECTOR:
+        n = fasl_varint(f);
+        if(n > (uint64_t) (f->length - f->pos)) {
+            /* Every element takes a byte at least. */
+            f->broken = 1;
+            return NULL;
+        }
+        obj = vector(n, NULL);
+        for(i = 0; i < n && !f->broken; i++) {
+            VECTOR_DATA(obj)[i] = heap_grab(fasl_decode(f));
+        }
+        if(f->broken) {
+            heap_release(heap_grab(obj));
+            return NULL;
+        }
+
+        return obj;
+    case FASL_LIST:
+        return fasl_decode_list(f);
+    default:
+        f->broken = 1;
+
+        return NULL;
+    }
+}
+
+/* Grabbed form, NULL after the last one. */
+struct lispobj *fasl_next(struct fasl *f, int *more)
+{
+    const unsigned char *p;
+    struct lispobj *obj = NULL;
+
+    if(f->forms == 0 || f->broken)
+        return NULL;
+    f->forms--;
+
+    if((p = fasl_bytes(f, 1)) != NULL) {
+        *more = *p;
+        obj = fasl_decode(f);
+    }
+    if(f->broken) {
+        /* Say it and stop. */
+        *more = 0;
+        return heap_grab(NEW_ERROR("Broken fasl file.\n"));
+    }
+
+    return heap_grab(obj);
+}
+
+static void fasl_put(struct fasl_buffer *b, const void *data, long n)
+{
+    if(b->length + n > b->size) {
+        b->size = b->size ? b->size * 2 : 4096;
+        if(b->size < b->length + n) {
+            b->size = b->length + n;
+        }
+        b->data = realloc(b->data, b->size);
+    }
+    memcpy(b->data + b->length, data, n);
+    b->length += n;
+
+    return;
+}
+
+static void fasl_put_byte(struct fasl_buffer *b, unsigned char c)
+{
+    fasl_put(b, &c, 1);
+
+    return;
+}
+
+static void fasl_put_varint(struct fasl_buffer *b, uint64_t v)
+{
+    unsigned char bytes[10];
+    int n = 0;
+
+    do {
+        bytes[n] = v & 0x7f;
+        v >>= 7;
+        if(v != 0) {
+            bytes[n] |= 0x80;
+        }
+        n++;
+    } while(v != 0);
+    fasl_put(b, bytes, n);
+
+    return;
+}
+
+struct fasl_writer *fasl_writer_new(void)
+{
+    struct fasl_writer *w;
+
+    w = malloc(sizeof(struct fasl_writer));
+    memset(w, 0, sizeof(struct fasl_writer));
+    w->symbols = hash_table_new(HASH_EQ);
+
+    return w;
+}
+
+void fasl_writer_free(struct fasl_writer *w)
+{
+    hash_table_free(w->symbols);
+    free(w->names.data);
+    free(w->code.data);
+    free(w);
+
+    return;
+}
+
+static void fasl_encode(struct fasl_writer *w, struct lispobj *obj)
+{
+    struct fasl_buffer *b = &w->code;
+    struct lispobj *index, *cell;
+    struct bignum *big;
+    uint64_t n;
+    int found, i;
+
+    if(obj == NULL) {
+        fasl_put_byte(b, FASL_NULL);
+        return;
+    }
+
+    switch(OBJ_TYPE(obj)) {
+    case SYMBOL:
+        index = hash_table_get(w->symbols, obj, &found);
+        if(!found) {
+            index = number(w->nsymbols++);
+            hash_table_put(w->symbols, obj, index);
+            n = strlen(SYMBOL_VALUE(obj));
+            fasl_put_varint(&w->names, n);
+            fasl_put(&w->names, SYMBOL_VALUE(obj), n);
+        }
+        fasl_put_byte(b, FASL_SYMBOL);
+        fasl_put_varint(b, NUMBER_VALUE(index));
+
+        break;
+    case NUMBER:
+        fasl_put_byte(b, FASL_NUMBER);
+        fasl_put_varint(b, ((uint64_t) NUMBER_VALUE(obj) << 1) ^
+                        (uint64_t) (NUMBER_VALUE(obj) >> 63));
+
+        break;
+    case FLOAT:
+        fasl_put_byte(b, FASL_FLOAT);
+        fasl_put(b, &FLOAT_VALUE(obj), sizeof(double));
+
+        break;
+    case BIGNUM:
+        big = BIGNUM_VALUE(obj);
+        fasl_put_byte(b, FASL_BIGNUM);
+        fasl_put_byte(b, big->sign < 0);
+        fasl_put_varint(b, big->size);
+        fasl_put(b, big->digits, big->size * 4);
+
+        break;
+    case STRING:
+        fasl_put_byte(b, FASL_STRING);
+        fasl_put_varint(b, STRING_LENGTH(obj));
+        fasl_put(b, STRING_DATA(obj), STRING_LENGTH(obj));
+
+        break;
+    case ERROR:
+        n = strlen(ERROR_VALUE(obj));
+        fasl_put_byte(b, FASL_ERROR);
+        fasl_put_varint(b, n);
+        fasl_put(b, ERROR_VALUE(obj), n);
+
+        break;
+    case VECTOR:
+        fasl_put_byte(b, FASL_VECTOR);
+        fasl_put_varint(b, VECTOR_LENGTH(obj));
+        for(i = 0; i < VECTOR_LENGTH(obj); i++) {
+            fasl_encode(w, VECTOR_DATA(obj)[i]);
+        }
+
+        break;
+    case CONS:
+        for(n = 0, cell = obj; cell != NULL && OBJ_TYPE(cell) == CONS;
+            cell = CDR(cell)) {
+            n++;
+        }
+        fasl_put_byte(b, FASL_LIST);
+        fasl_put_varint(b, n);
+        for(cell = obj; cell != NULL && OBJ_TYPE(cell) == CONS;
+            cell = CDR(cell)) {
+            fasl_encode(w, CAR(cell));
+        }
+        fasl_encode(w, cell);
+
+        break;
+    default:
+        /* The reader makes none of the others. */
+        w->broken = 1;
+
+        break;
+    }
+
+    return;
+}
+
+/* Call before the form is evaluated, evaluation may change it. */
+void fasl_write_form(struct fasl_writer *w, struct lispobj *form, int more)
+{
+    if(w->broken)
+        return;
+
+    fasl_put_byte(&w->code, more != 0);
+    fasl_encode(w, form);
+    w->forms++;
+
+    return;
+}
+
+static int fasl_write_all(int fd, const void *data, long n)
+{
+    const char *p = data;
+    long done;
+
+    while(n > 0) {
+        if((done = write(fd, p, n)) < 0)
+            return 0;
+        p += done;
+        n -= done;
+    }
+
+    return 1;
+}
+
+/*
+ * Writes the fasl of the source the reader has read, it has to be
+ * a mapped file. The file is replaced at once, a load running
+ * alongside sees the old one or the new one. Returns 0 on failure.
+ */
+int fasl_writer_finish(struct fasl_writer *w, const char *source,
+                       struct reader *r)
+{
+    struct fasl_header h;
+    struct stat st;
+    char *path, *tmp;
+    int fd, ok;
+
+    if(w->broken || (r->mapped == 0 && r->length != 0) ||
+       stat(source, &st) != 0 || st.st_size != r->length)
+        return 0;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, FASL_MAGIC, 4);
+    h.version = FASL_VERSION;
+    h.mtime_sec = st.st_mtim.tv_sec;
+    h.mtime_nsec = st.st_mtim.tv_nsec;
+    h.size = st.st_size;
+    h.hash = fasl_hash(FASL_HASH_SEED, (unsigned char *) r->data,
+                       r->length);
+    h.symbols = w->nsymbols;
+    h.forms = w->forms;
+
+    path = fasl_path(source);
+    tmp = malloc(strlen(path) + 8);
+    /* Unique, contexts of one process may write the same file. */
+    sprintf(tmp, "%s.XXXXXX", path);
+
+    ok = (fd = mkstemp(tmp)) >= 0 && fchmod(fd, 0644) == 0;
+    if(fd >= 0) {
+        ok = ok && fasl_write_all(fd, &h, sizeof(h)) &&
+            fasl_write_all(fd, w->names.data, w->names.length) &&
+            fasl_write_all(fd, w->code.data, w->code.length);
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(tmp, path) == 0;
+        if(!ok) {
+            unlink(tmp);
+        }
+    }
+    free(tmp);
+    free(path);
+
+    return ok;
+}
+
+/* fflisp --compile: writes the fasl without evaluating anything. */
+int compile_file(const char *source)
+{
+    struct reader *r;
+    struct fasl_writer *w;
+    struct lispobj *form;
+    int ok;
+
+    if((r = reader_open_file(source)) == NULL) {
+        perror(source);
+        return 0;
+    }
+
+    w = fasl_writer_new();
+    while(reader_skip(r) != EOF) {
+        form = heap_grab(read_form(r));
+        fasl_write_form(w, form, reader_peek(r) != EOF);
+        heap_release(form);
+    }
+
+    if(!(ok = fasl_writer_finish(w, source, r))) {
+        fprintf(stderr, "%s: can't write the fasl file.\n", source);
+    }
+    fasl_writer_free(w);
+    reader_close(r);
+
+    return ok;
+}
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -9,31 +10,53 @@
 #include "../include/object.h"
 #include "../include/environment.h"
 #include "../include/heap.h"
+#include "../include/stack.h"
+#include "../include/error.h"
+#include "../include/array.h"
 #include "../include/repl.h"
+#include "../include/read.h"
+#include "../include/fasl.h"
+#include "../include/server.h"
+#include "../include/profile.h"
 
 #define VERSION "0.0.0rc7"
-/* global symbol table */
-struct lispobj *symbol_table = NULL;
-/* global environment */
-struct lispobj *environment = NULL;
-/* global pointer to NIL */
-struct lispobj *nil = NULL;
-/* global pointer to T */
-struct lispobj *t = NULL;
-/* global pointer to heap */
-struct heap *heap = NULL;
+/* Status of a batch program whose script can't be read, an error
+   ends it with EXIT_FAILURE. */
+#define EXIT_NO_INPUT 2
 
 static void usage(void)
 {
-    printf("Usage: fflisp [--load filename] [--help].\n");
+    printf("Usage: fflisp [--hash-cons] [--load filename]"
+           " [--compile filename]\n"
+           "              [--script filename] [--eval expr] [--batch]\n"
+           "              [--serve path] [--profile filename] [--help].\n");
+    printf("       --hash-cons read lists as hash-consed data.\n");
     printf("       --load eval code from file.\n");
+    printf("       --compile write the fasl file of a source and exit.\n");
+    printf("       --script eval code from file, print only what it"
+           " writes.\n");
+    printf("       --eval eval code from the argument, the same way.\n");
+    printf("       --batch eval code from stdin, the same way.\n");
+    printf("       Those three exit with %d on an error, %d if the file"
+           " can't be read.\n", EXIT_FAILURE, EXIT_NO_INPUT);
+    printf("       --serve answer requests on a unix socket, after"
+           " the loads.\n");
+    printf("       --profile write the folded stacks of the Lisp"
+           " procedures at exit,\n"
+           "                 for flamegraph.pl.\n");
     printf("       --help print help message.\n");
 
     return;
 }
 
+/* Once, before the first output of the interpreter. */
 static void welcome(void)
 {
+    static int shown = 0;
+
+    if(shown++)
+        return;
+
     printf("Welcome to FFLISP " VERSION
            " <http://github.com/grouzen/fflisp/>.\n");
     printf("Nedokushev Michael <grouzen.hexy@gmail.com> (c) 2010.\n");
@@ -60,29 +83,62 @@ void sigint_handler(int signum)
 
 int main(int argc, char *argv[])
 {
-    int opt;
+    struct reader *r;
+    char *serve = NULL, *profile = NULL;
+    int opt, batch_mode = 0, batch_stdin = 0;
     static struct option long_options[] = {
+        {"hash-cons", 0, NULL, 'c'},
         {"load", 1, NULL, 'l'},
+        {"compile", 1, NULL, 'C'},
+        {"script", 1, NULL, 'S'},
+        {"eval", 1, NULL, 'e'},
+        {"batch", 0, NULL, 'b'},
+        {"serve", 1, NULL, 's'},
+        {"profile", 1, NULL, 'p'},
         {"help", 0, NULL, 'h'},
         {0, 0, 0, 0}
     };
 
-    signal(SIGINT, sigint_handler);
-
-    /* Initialize heap. */
-    heap = heap_init();
-    /* Define global alias to TRUE object. */
-    t = heap_grab(NEW_SYMBOL("T"));
-    /* Define global alias to NIL object. */
-    nil = NULL;
-    /* Configure environment. */
-    environment = heap_grab(env_init());
-    
-    welcome();
-    
+    /* A batch program is quiet from the start, --load before
+       --script too, so look for one first. The profiler is
+       started before any of them too. */
+    opterr = 0;
+    while((opt = getopt_long_only(argc, argv, "", long_options, NULL)) != -1) {
+        if(opt == 'S' || opt == 'e' || opt == 'b') {
+            batch_mode = 1;
+        } else if(opt == 'p') {
+            profile = optarg;
+        }
+    }
+    opterr = 1;
+    optind = 0;
+
+    if(!batch_mode) {
+        signal(SIGINT, sigint_handler);
+    }
+
+    /* Boot the interpreter. */
+    fflisp_ctx_enter(fflisp_ctx_new(NULL));
+    ctx->batch = batch_mode;
+    if(profile != NULL) {
+        profile_start(profile);
+        atexit(profile_stop);
+    }
+
     while((opt = getopt_long_only(argc, argv, "", long_options, NULL)) != -1) {
         switch(opt) {
+        case 'c':
+            ctx->read_hash_cons = 1;
+
+            break;
+        case 'C':
+            opt = compile_file(optarg);
+            heap_clean();
+            exit(opt ? EXIT_SUCCESS : EXIT_FAILURE);
         case 'l':
+            if(!batch_mode) {
+                welcome();
+            }
 #if 0
             printf("load file: %s.\n", optarg);
             if(load(optarg)) {
@@ -93,6 +149,28 @@ int main(int argc, char *argv[])
 #endif
             load(optarg);
             
+            break;
+        case 'S':
+            if(!load(optarg)) {
+                exit(EXIT_NO_INPUT);
+            }
+
+            break;
+        case 'e':
+            r = reader_open_buffer(strdup(optarg), strlen(optarg));
+            batch(r);
+            reader_close(r);
+
+            break;
+        case 'b':
+            batch_stdin = 1;
+
+            break;
+        case 's':
+            serve = optarg;
+
+            break;
+        case 'p':
             break;
         case 'h':
         default:
@@ -101,7 +179,21 @@ int main(int argc, char *argv[])
             exit(EXIT_FAILURE);
         }
     }
-    
-    repl(stdin);
+
+    if(serve != NULL) {
+        exit(server_run(serve) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if(batch_mode) {
+        if(batch_stdin) {
+            batch(reader_open_fd(STDIN_FILENO));
+        }
+        /* No teardown, exit() only flushes the output. */
+        exit(EXIT_SUCCESS);
+    }
+
+    welcome();
+    ctx->stdin_reader = reader_open_fd(STDIN_FILENO);
+    repl(ctx->stdin_reader);
     return 0;
 }
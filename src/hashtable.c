@@ -0,0 +1,355 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/subr.h"
+#include "../include/bignum.h"
+#include "../include/hashtable.h"
+
+/* Elements and depth of a structure which EQUAL hashing looks at. */
+#define HASH_EQUAL_WIDTH 16
+#define HASH_EQUAL_DEPTH 4
+
+/* Finalizer of splitmix64, spreads bits of pointers and small ints. */
+unsigned long hash_mix(unsigned long h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53UL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static unsigned long hash_eql(struct lispobj *obj)
+{
+    unsigned long h;
+    double d;
+    int i;
+
+    if(obj == NULL)
+        return hash_mix(0);
+
+    switch(OBJ_TYPE(obj)) {
+    case NUMBER:
+        return hash_mix((unsigned long) NUMBER_VALUE(obj) ^ NUMBER);
+    case FLOAT:
+        /* 0.0 and -0.0 are EQL. */
+        d = FLOAT_VALUE(obj) == 0.0 ? 0.0 : FLOAT_VALUE(obj);
+        memcpy(&h, &d, sizeof(h));
+
+        return hash_mix(h ^ FLOAT);
+    case BIGNUM:
+        h = BIGNUM_VALUE(obj)->sign;
+        for(i = 0; i < BIGNUM_VALUE(obj)->size; i++) {
+            h = h * 31 + BIGNUM_VALUE(obj)->digits[i];
+        }
+
+        return hash_mix(h ^ BIGNUM);
+    default:
+        return hash_mix((unsigned long) (uintptr_t) obj);
+    }
+}
+
+/* Has to agree with equal(): equal objects get equal hashes. */
+static unsigned long hash_equal(struct lispobj *obj, int depth)
+{
+    unsigned long h;
+    unsigned char *s;
+    long i;
+
+    if(obj == NULL)
+        return hash_eql(obj);
+
+    switch(OBJ_TYPE(obj)) {
+    case CONS:
+        h = CONS;
+        for(i = 0; depth > 0 && i < HASH_EQUAL_WIDTH &&
+                obj != NULL && OBJ_TYPE(obj) == CONS; i++) {
+            h = h * 31 + hash_equal(CAR(obj), depth - 1);
+            obj = CDR(obj);
+        }
+        if(depth > 0 && i < HASH_EQUAL_WIDTH) {
+            /* The tail of a dotted list. */
+            h = h * 31 + hash_equal(obj, depth - 1);
+        }
+
+        return hash_mix(h);
+    case VECTOR:
+        h = VECTOR ^ VECTOR_LENGTH(obj);
+        for(i = 0; depth > 0 && i < HASH_EQUAL_WIDTH &&
+                i < VECTOR_LENGTH(obj); i++) {
+            h = h * 31 + hash_equal(VECTOR_DATA(obj)[i], depth - 1);
+        }
+
+        return hash_mix(h);
+    case STRING:
+        /* FNV-1a. */
+        h = 0xcbf29ce484222325UL;
+        s = (unsigned char *) STRING_DATA(obj);
+        for(i = 0; i < STRING_LENGTH(obj); i++) {
+            h = (h ^ s[i]) * 0x100000001b3UL;
+        }
+
+        return h;
+    default:
+        return hash_eql(obj);
+    }
+}
+
+unsigned long hash_object(int test, struct lispobj *obj)
+{
+    switch(test) {
+    case HASH_EQ:
+        return hash_mix((unsigned long) (uintptr_t) obj);
+    case HASH_EQL:
+        return hash_eql(obj);
+    default:
+        return hash_equal(obj, HASH_EQUAL_DEPTH);
+    }
+}
+
+static int hash_match(int test, struct lispobj *a, struct lispobj *b)
+{
+    switch(test) {
+    case HASH_EQ:
+        return a == b;
+    case HASH_EQL:
+        return eql(a, b);
+    default:
+        return equal(a, b);
+    }
+}
+
+struct hash_table *hash_table_new(int test)
+{
+    struct hash_table *t;
+
+    t = malloc(sizeof(struct hash_table));
+    memset(t, 0, sizeof(struct hash_table));
+    t->test = test;
+
+    return t;
+}
+
+static void hash_part_free(struct hash_part *p)
+{
+    long i;
+
+    for(i = 0; i < p->size; i++) {
+        if(p->entries[i].state == HASH_SLOT_FULL) {
+            heap_release(p->entries[i].key);
+            heap_release(p->entries[i].value);
+        }
+    }
+    free(p->entries);
+
+    return;
+}
+
+void hash_table_free(struct hash_table *t)
+{
+    hash_part_free(&t->cur);
+    hash_part_free(&t->old);
+    free(t);
+
+    return;
+}
+
+/* Only the table, keys and values are left to the caller. */
+void hash_table_drop(struct hash_table *t)
+{
+    free(t->cur.entries);
+    free(t->old.entries);
+    free(t);
+
+    return;
+}
+
+static struct hash_entry *hash_part_find(struct hash_table *t,
+                                         struct hash_part *p,
+                                         struct lispobj *key,
+                                         unsigned long hash)
+{
+    struct hash_entry *e;
+    long i, mask = p->size - 1;
+
+    if(p->entries == NULL)
+        return NULL;
+
+    /* The load limit guarantees an empty slot somewhere. */
+    for(i = hash & mask; ; i = (i + 1) & mask) {
+        e = &p->entries[i];
+        if(e->state == HASH_SLOT_EMPTY) {
+            return NULL;
+        } else if(e->state == HASH_SLOT_FULL && e->hash == hash &&
+                  hash_match(t->test, e->key, key)) {
+            return e;
+        }
+    }
+}
+
+static struct hash_entry *hash_table_find(struct hash_table *t,
+                                          struct lispobj *key)
+{
+    struct hash_entry *e;
+    unsigned long hash = hash_object(t->test, key);
+
+    if((e = hash_part_find(t, &t->cur, key, hash)) == NULL) {
+        e = hash_part_find(t, &t->old, key, hash);
+    }
+
+    return e;
+}
+
+/* Key must not be in the part yet, references pass to the part. */
+static void hash_part_insert(struct hash_part *p, struct lispobj *key,
+                             struct lispobj *value, unsigned long hash)
+{
+    struct hash_entry *e;
+    long i, mask = p->size - 1;
+
+    for(i = hash & mask; ; i = (i + 1) & mask) {
+        e = &p->entries[i];
+        if(e->state != HASH_SLOT_FULL)
+            break;
+    }
+    if(e->state == HASH_SLOT_EMPTY) {
+        p->used++;
+    }
+
+    e->key = key;
+    e->value = value;
+    e->hash = hash;
+    e->state = HASH_SLOT_FULL;
+
+    return;
+}
+
+/* Move up to n slots of the old part into the current one. */
+static void hash_table_migrate(struct hash_table *t, long n)
+{
+    struct hash_entry *e;
+
+    while(t->old.entries != NULL && n-- > 0) {
+        e = &t->old.entries[t->migrate++];
+        if(e->state == HASH_SLOT_FULL) {
+            hash_part_insert(&t->cur, e->key, e->value, e->hash);
+            /* Not EMPTY, that would cut probe chains still in use. */
+            e->state = HASH_SLOT_DELETED;
+        }
+
+        if(t->migrate == t->old.size) {
+            free(t->old.entries);
+            memset(&t->old, 0, sizeof(struct hash_part));
+        }
+    }
+
+    return;
+}
+
+/* Drains the old part, lookups don't write to the table after it. */
+void hash_table_settle(struct hash_table *t)
+{
+    hash_table_migrate(t, LONG_MAX);
+
+    return;
+}
+
+static void hash_table_grow(struct hash_table *t)
+{
+    long size = t->cur.size;
+
+    /* Previous move is almost done by now, finish it. */
+    hash_table_migrate(t, LONG_MAX);
+
+    if(size == 0) {
+        size = HASH_MIN_SIZE;
+    } else if(t->count * 2 >= size) {
+        size *= 2;
+    } // else the part is clogged by deleted slots, just clean it
+
+    t->old = t->cur;
+    t->migrate = 0;
+    t->cur.entries = calloc(size, sizeof(struct hash_entry));
+    t->cur.size = size;
+    t->cur.used = 0;
+
+    return;
+}
+
+struct lispobj *hash_table_get(struct hash_table *t, struct lispobj *key,
+                               int *found)
+{
+    struct hash_entry *e;
+
+    hash_table_migrate(t, HASH_MIGRATE_STEP);
+
+    e = hash_table_find(t, key);
+    *found = e != NULL;
+
+    return e != NULL ? e->value : NULL;
+}
+
+/* Like hash_table_get(), but it doesn't write to the table. */
+struct lispobj *hash_table_peek(struct hash_table *t, struct lispobj *key,
+                                int *found)
+{
+    struct hash_entry *e = hash_table_find(t, key);
+
+    *found = e != NULL;
+
+    return e != NULL ? e->value : NULL;
+}
+
+void hash_table_put(struct hash_table *t, struct lispobj *key,
+                    struct lispobj *value)
+{
+    struct hash_entry *e;
+    struct lispobj *tmp;
+
+    hash_table_migrate(t, HASH_MIGRATE_STEP);
+
+    if((e = hash_table_find(t, key)) != NULL) {
+        tmp = e->value;
+        e->value = heap_grab(value);
+        heap_release(tmp);
+
+        return;
+    }
+
+    /* Keep the load under 3/4. */
+    if((t->cur.used + 1) * 4 > t->cur.size * 3) {
+        hash_table_grow(t);
+    }
+
+    hash_part_insert(&t->cur, heap_grab(key), heap_grab(value),
+                     hash_object(t->test, key));
+    t->count++;
+
+    return;
+}
+
+int hash_table_remove(struct hash_table *t, struct lispobj *key)
+{
+    struct hash_entry *e;
+
+    hash_table_migrate(t, HASH_MIGRATE_STEP);
+
+    if((e = hash_table_find(t, key)) == NULL)
+        return 0;
+
+    e->state = HASH_SLOT_DELETED;
+    t->count--;
+    heap_release(e->key);
+    heap_release(e->value);
+
+    return 1;
+}
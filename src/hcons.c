@@ -0,0 +1,172 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/subr.h"
+#include "../include/hashtable.h"
+#include "../include/hcons.h"
+
+/* Marks the slot of a removed cons, the same in every context. */
+static struct lispobj tombstone;
+
+#define HCONS_TOMBSTONE (&tombstone)
+
+/* Children are canonical already, see hcons(). */
+static unsigned long hcons_child_hash(struct lispobj *obj)
+{
+    if(IS_HCONS(obj))
+        return CONS_VALUE(obj)->hash;
+
+    return hash_object(HASH_EQUAL, obj);
+}
+
+static int hcons_child_match(struct lispobj *a, struct lispobj *b)
+{
+    /* Two different hash-consed children are never EQUAL. */
+    return a == b || (!IS_HCONS(a) && !IS_HCONS(b) && equal(a, b));
+}
+
+static unsigned long hcons_hash(struct lispobj *car, struct lispobj *cdr)
+{
+    unsigned long h;
+
+    /* A mere fold would repeat along a list of the same elements. */
+    h = hash_mix(hcons_child_hash(car) * 0x9e3779b97f4a7c15UL ^
+                 hcons_child_hash(cdr));
+
+    /* Zero is the mark of ordinary conses. */
+    return h != 0 ? h : 1;
+}
+
+static void hcons_insert(struct lispobj **slots, long size,
+                         struct lispobj *obj)
+{
+    long i, mask = size - 1;
+
+    for(i = CONS_VALUE(obj)->hash & mask;
+        slots[i] != NULL && slots[i] != HCONS_TOMBSTONE;
+        i = (i + 1) & mask)
+        ;
+    slots[i] = obj;
+
+    return;
+}
+
+static void hcons_grow(void)
+{
+    struct hcons_table *table = &ctx->hcons;
+    struct lispobj **slots;
+    long i, size = table->size;
+
+    if(size == 0) {
+        size = HCONS_MIN_SIZE;
+    } else if(table->count * 2 >= size) {
+        size *= 2;
+    } // else only tombstones clog the table, just rebuild it
+
+    slots = calloc(size, sizeof(struct lispobj *));
+    for(i = 0; i < table->size; i++) {
+        if(table->slots[i] != NULL && table->slots[i] != HCONS_TOMBSTONE) {
+            hcons_insert(slots, size, table->slots[i]);
+        }
+    }
+    free(table->slots);
+
+    table->slots = slots;
+    table->size = size;
+    table->used = table->count;
+
+    return;
+}
+
+/* Both children must be canonical. */
+static struct lispobj *hcons_node(struct lispobj *car, struct lispobj *cdr)
+{
+    struct hcons_table *table = &ctx->hcons;
+    struct lispobj *obj;
+    unsigned long hash = hcons_hash(car, cdr);
+    long i, mask;
+
+    if((table->used + 1) * 4 > table->size * 3) {
+        hcons_grow();
+    }
+
+    mask = table->size - 1;
+    for(i = hash & mask; (obj = table->slots[i]) != NULL; i = (i + 1) & mask) {
+        if(obj != HCONS_TOMBSTONE && CONS_VALUE(obj)->hash == hash &&
+           hcons_child_match(CAR(obj), car) &&
+           hcons_child_match(CDR(obj), cdr)) {
+            return obj;
+        }
+    }
+
+    obj = NEW_CONS(car, cdr);
+    CONS_VALUE(obj)->hash = hash;
+    hcons_insert(table->slots, table->size, obj);
+    table->count++;
+    table->used++;
+
+    return obj;
+}
+
+/*
+ * Canonical copy of a structure, anything but conses stays as it
+ * is. The CDRs are walked with a loop, only CARs recurse.
+ */
+struct lispobj *hcons_tree(struct lispobj *obj)
+{
+    struct lispobj **spine = NULL, *tail;
+    long n = 0, size = 0;
+
+    for(tail = obj; tail != NULL && OBJ_TYPE(tail) == CONS &&
+            !IS_HCONS(tail); tail = CDR(tail)) {
+        if(n == size) {
+            size = size ? size * 2 : 16;
+            spine = realloc(spine, size * sizeof(struct lispobj *));
+        }
+        spine[n++] = tail;
+    }
+
+    /* Built from the end, every new cons grabs the previous one. */
+    while(n > 0) {
+        n--;
+        tail = hcons_node(hcons_tree(CAR(spine[n])), tail);
+    }
+    free(spine);
+
+    return tail;
+}
+
+struct lispobj *hcons(struct lispobj *car, struct lispobj *cdr)
+{
+    car = hcons_tree(car);
+
+    return hcons_node(car, hcons_tree(cdr));
+}
+
+/* Called by object_delete() for a hash-consed cons. */
+void hcons_forget(struct lispobj *obj)
+{
+    struct hcons_table *table = &ctx->hcons;
+    long i, mask = table->size - 1;
+
+    for(i = CONS_VALUE(obj)->hash & mask; table->slots[i] != NULL;
+        i = (i + 1) & mask) {
+        if(table->slots[i] == obj) {
+            table->slots[i] = HCONS_TOMBSTONE;
+            table->count--;
+
+            return;
+        }
+    }
+
+    return;
+}
+
+long hcons_count(void)
+{
+    return ctx->hcons.count;
+}
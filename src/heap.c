@@ -7,10 +7,20 @@
 #include "../include/object.h"
 #include "../include/subr.h"
 #include "../include/heap.h"
+#include "../include/bignum.h"
+#include "../include/array.h"
+#include "../include/hashtable.h"
 
 static void symbol_table_delete(struct lispobj*);
 static void heap_grow(void);
 
+/*
+ * Nonzero on a thread that builds objects for the evaluator, like
+ * the reader thread of a pipelined load. Its objects stay out of
+ * the heap until the evaluator takes them with heap_adopt().
+ */
+static __thread int heap_detached = 0;
+
 //#ifdef __DEBUG_HEAP__
 void heap_debug_object(struct lispobj *obj)
 {
@@ -21,9 +31,21 @@ void heap_debug_object(struct lispobj *obj)
         if(OBJ_TYPE(obj) == SYMBOL) {
             printf("(symbol %s) ", SYMBOL_VALUE(obj));
         } else if(OBJ_TYPE(obj) == NUMBER) {
-            printf("(number %d) ", NUMBER_VALUE(obj));
+            printf("(number %ld) ", NUMBER_VALUE(obj));
+        } else if(OBJ_TYPE(obj) == FLOAT) {
+            printf("(float %g) ", FLOAT_VALUE(obj));
+        } else if(OBJ_TYPE(obj) == BIGNUM) {
+            printf("(bignum %d digits) ", BIGNUM_VALUE(obj)->size);
         } else if(OBJ_TYPE(obj) == STRING) {
-            printf("(string %s) ", STRING_VALUE(obj));
+            printf("(string %.*s) ", (int) STRING_LENGTH(obj), STRING_DATA(obj));
+        } else if(OBJ_TYPE(obj) == HASHTABLE) {
+            printf("(hash-table %ld) ", HASHTABLE_VALUE(obj)->count);
+        } else if(OBJ_TYPE(obj) == ARRAY) {
+            printf("(array %ld) ", ARRAY_VALUE(obj)->length);
+        } else if(OBJ_TYPE(obj) == VECTOR) {
+            printf("(vector %d) ", VECTOR_LENGTH(obj));
+        } else if(OBJ_TYPE(obj) == SUBR) {
+            printf("(subr %s) ", SUBR_VALUE(obj)->name);
         } else {
             printf("(cons) ");
         }
@@ -33,6 +55,7 @@ void heap_debug_object(struct lispobj *obj)
 
 void heap_debug(void)
 {
+    struct heap *heap = ctx->heap;
     int i = 0;
     while(i < heap->index) {
         heap_debug_object(heap->data[i]);
@@ -56,91 +79,198 @@ struct heap *heap_init(void)
     memset(h->data, 0, sizeof(struct lispobj *) * HEAP_SIZE);
     h->index = 0;
     h->size = HEAP_SIZE;
+    h->added = 0;
+    h->readers = 0;
+    h->deferred = NULL;
+    h->ndeferred = 0;
+    h->deferred_size = 0;
 
     return h;
 }
 
+/* Only the table, objects are freed by heap_clean(). */
+void heap_free(struct heap *h)
+{
+    free(h->deferred);
+    free(h->data);
+    free(h);
+
+    return;
+}
+
 struct lispobj *heap_add(struct lispobj *obj)
 {
+    struct heap *heap = ctx->heap;
+
+    if(heap_detached) {
+        obj->heap_index = -1;
+        return obj;
+    }
+
     if(heap->index >= heap->size) {
         heap_grow();
     }
 
+    obj->heap_index = heap->index;
     heap->data[heap->index] = obj;
     heap->index++;
+    heap->added++;
 
     return obj;
 }
 
 static void heap_grow(void)
 {
-    struct heap *new_heap = malloc(sizeof(struct heap));
+    struct heap *heap = ctx->heap;
 
-    new_heap->data = malloc(sizeof(struct lispobj *) * (heap->size * 2));
-    memset(new_heap->data, 0, sizeof(struct lispobj *) * (heap->size * 2));
-    new_heap->size = heap->size * 2;
-    new_heap->index = 0;
+    heap->data = realloc(heap->data,
+                         sizeof(struct lispobj *) * (heap->size * 2));
+    memset(heap->data + heap->size, 0,
+           sizeof(struct lispobj *) * heap->size);
+    heap->size *= 2;
 
-    while(new_heap->index < heap->index) {
-        new_heap->data[new_heap->index] = heap->data[new_heap->index];
-        new_heap->index++;
-    }
+    return;
+}
+
+/* The last object fills the hole, so it's O(1). */
+void heap_remove(struct lispobj *obj)
+{
+    struct heap *heap;
+    int i = obj->heap_index;
+
+    if(heap_detached || i < 0)
+        return;
 
-    free(heap->data);
-    free(heap);
+    heap = ctx->heap;
+    if(i >= heap->index || heap->data[i] != obj)
+        return;
 
-    heap = new_heap;
+    heap->data[i] = heap->data[heap->index - 1];
+    heap->data[i]->heap_index = i;
+    heap->data[heap->index - 1] = NULL;
+    heap->index--;
+    obj->heap_index = -1;
 
     return;
 }
 
-void heap_remove(struct lispobj *obj)
+/*
+ * Frees every object of the context, shared ones too. Each goes
+ * alone, without dropping its references to the others, so the
+ * order doesn't matter. Empty slots held objects moved elsewhere.
+ */
+void heap_clean(void)
 {
-    int i = 0;
-    while(i < heap->size) {
-        /* Try to find object in the heap. */
-        if(obj == heap->data[i]) {
-            /* If object found,
-               assign current heap element to null,
-               decrement heap's index.
-            */
-            heap->data[i] = heap->data[heap->index - 1];
-            heap->data[heap->index - 1] = NULL;
-            heap->index--;
-            
-            return;
+    struct heap *heaps[] = {ctx->heap, ctx->shared};
+    struct heap *heap;
+    int i, j;
+
+    for(j = 0; j < 2 && (heap = heaps[j]) != NULL; j++) {
+        for(i = 0; i < heap->index; i++) {
+            if(heap->data[i] != NULL)
+                object_free(heap->data[i]);
+            heap->data[i] = NULL;
         }
-        i++;
+        heap->index = 0;
+        heap->ndeferred = 0;
     }
 
     return;
 }
 
-void heap_clean(void)
+/*
+ * Marks every object of the context shared, other threads may read
+ * them. Nothing grabs, releases or changes a shared object, a hash
+ * table is done growing first so a lookup doesn't move its entries.
+ */
+void heap_freeze(void)
 {
-    while(heap->index > 0) {
-        /* Call heap_remove() while the heap not will become empty. */
-        object_delete(heap->data[0]);
+    struct heap *heap = ctx->heap;
+    struct lispobj *obj;
+    int i;
+
+    for(i = 0; i < heap->index; i++) {
+        obj = heap->data[i];
+        obj->heap_index = HEAP_SHARED;
+        if(OBJ_TYPE(obj) == HASHTABLE && HASHTABLE_VALUE(obj) != NULL)
+            hash_table_settle(HASHTABLE_VALUE(obj));
     }
 
     return;
 }
 
+/* Freezes the context for good, it may be a base of others then. */
+void heap_share(void)
+{
+    heap_freeze();
+    ctx->shared = ctx->heap;
+    ctx->heap = heap_init();
+
+    return;
+}
+
+/*
+ * Nonzero if obj is in the heap of another context, which the job
+ * run by the current one reads. A job doesn't count references to
+ * those objects, nor changes them, see pool.c. Objects of no heap
+ * yet, made by a reader thread, are the job's.
+ */
+int heap_foreign(struct lispobj *obj)
+{
+    struct heap *heap;
+    int i;
+
+    if(ctx->job == NULL || obj == NULL)
+        return 0;
+
+    heap = ctx->heap;
+    i = obj->heap_index;
+
+    return i >= 0 && (i >= heap->index || heap->data[i] != obj);
+}
+
 struct lispobj *heap_grab(struct lispobj *obj)
 {
-    if(obj != NULL) {
+    if(obj != NULL && !IS_SHARED(obj) &&
+       (ctx->job == NULL || !heap_foreign(obj))) {
         OBJ_REFS(obj)++;
     }
 
     return obj;
 }
 
+/*
+ * Keeps an object which nobody refers to until the futures reading
+ * the heap are joined, one of them may still be looking at it.
+ */
+static void heap_defer(struct lispobj *obj)
+{
+    struct heap *heap = ctx->heap;
+
+    if(heap->ndeferred == heap->deferred_size) {
+        heap->deferred_size = heap->deferred_size ?
+            heap->deferred_size * 2 : HEAP_SIZE;
+        heap->deferred = realloc(heap->deferred, sizeof(struct lispobj *) *
+                                 heap->deferred_size);
+    }
+    OBJ_REFS(obj) = 1;
+    heap->deferred[heap->ndeferred++] = obj;
+
+    return;
+}
+
 void heap_release(struct lispobj *obj)
 {
-    if(obj != NULL) {
+    if(obj != NULL && !IS_SHARED(obj) &&
+       (ctx->job == NULL || !heap_foreign(obj))) {
         OBJ_REFS(obj)--;
     
         if(OBJ_REFS(obj) <= 0) {
+            if(ctx->heap->readers > 0) {
+                heap_defer(obj);
+                return;
+            }
+
             /* If object is a symbol delete it from symbol table. */
             if(OBJ_TYPE(obj) == SYMBOL)
                 symbol_table_delete(obj);
@@ -151,19 +281,81 @@ void heap_release(struct lispobj *obj)
     return;
 }
 
+/* Frees what waited for the readers of the heap, they are gone. */
+void heap_sweep(void)
+{
+    struct heap *heap = ctx->heap;
+
+    while(heap->ndeferred > 0 && heap->readers == 0) {
+        heap_release(heap->deferred[--heap->ndeferred]);
+    }
+
+    return;
+}
+
+/* Slot of a deleted symbol, the same in every table. */
+static struct lispobj symbol_tombstone;
+
+/* FNV-1a of the upper case name, tokens come in any case. */
+static unsigned long symbol_hash(const char *name, long length)
+{
+    unsigned long hash = 0xcbf29ce484222325UL;
+    long i;
+    char ch;
+
+    for(i = 0; i < length; i++) {
+        ch = name[i] >= 'a' && name[i] <= 'z' ? name[i] - 0x20 : name[i];
+        hash = (hash ^ (unsigned char) ch) * 0x100000001b3UL;
+    }
+
+    return hash;
+}
+
+/* Empty, it has slots once something is interned into it. */
+struct symbol_table *symbol_table_new(struct symbol_table *parent)
+{
+    struct symbol_table *t;
+
+    t = malloc(sizeof(struct symbol_table));
+    memset(t, 0, sizeof(struct symbol_table));
+    t->parent = parent;
+
+    return t;
+}
+
+/* The symbols go with their heap, the parent stays. */
+void symbol_table_free(struct symbol_table *t)
+{
+    struct symbol_slots *s, *prev;
+
+    if(t == NULL)
+        return;
+
+    for(s = t->slots; s != NULL; s = prev) {
+        prev = s->prev;
+        free(s);
+    }
+    free(t);
+
+    return;
+}
+
 #ifdef __DEBUG_SYMT__
 void symbol_table_debug(void)
 {
-    struct lispobj *tmp_symt;
-    tmp_symt = symbol_table;
+    struct symbol_table *t;
+    struct lispobj *obj;
+    long i;
 
     printf("__DEBUG_SYMT__: symbol table:\n");
     
-    while(tmp_symt != NULL) {
-        printf("[%s %d]\n",
-               SYMBOL_VALUE(CAR(tmp_symt)),
-               OBJ_REFS(CAR(tmp_symt)));
-        tmp_symt = CDR(tmp_symt);
+    for(t = ctx->symbol_table; t != NULL; t = t->parent) {
+        for(i = 0; t->slots != NULL && i < t->slots->size; i++) {
+            obj = t->slots->slots[i];
+            if(obj != NULL && obj != &symbol_tombstone) {
+                printf("[%s %d]\n", SYMBOL_VALUE(obj), OBJ_REFS(obj));
+            }
+        }
     }
     printf("\n");
     
@@ -171,61 +363,328 @@ void symbol_table_debug(void)
 }
 #endif /* __DEBUG_SYMT__ */
 
+static void symbol_slots_put(struct symbol_slots *s, struct lispobj *symbol,
+                             unsigned long hash)
+{
+    long i, mask = s->size - 1;
+
+    for(i = hash & mask;
+        s->slots[i] != NULL && s->slots[i] != &symbol_tombstone;
+        i = (i + 1) & mask)
+        ;
+    __atomic_store_n(&s->slots[i], symbol, __ATOMIC_RELEASE);
+
+    return;
+}
+
+/* Rehashed into new slots, the old ones stay for other readers. */
+static void symbol_table_grow(struct symbol_table *t)
+{
+    struct symbol_slots *old = t->slots, *s;
+    struct lispobj *obj;
+    long size = SYMBOL_TABLE_SIZE, i;
+
+    while(size < t->count * 4) {
+        size *= 2;
+    }
+
+    s = calloc(1, sizeof(struct symbol_slots) +
+               sizeof(struct lispobj *) * size);
+    s->size = size;
+    s->prev = old;
+    for(i = 0; old != NULL && i < old->size; i++) {
+        obj = old->slots[i];
+        if(obj != NULL && obj != &symbol_tombstone) {
+            symbol_slots_put(s, obj, symbol_hash(SYMBOL_VALUE(obj),
+                                                 strlen(SYMBOL_VALUE(obj))));
+        }
+    }
+    t->used = t->count;
+    __atomic_store_n(&t->slots, s, __ATOMIC_RELEASE);
+
+    return;
+}
+
+/* Only the context's own table, symbols of the parent aren't its. */
 static void symbol_table_delete(struct lispobj *symbol)
 {
-    struct lispobj *tmp_symt, *prev_cons;
-    
-    tmp_symt = symbol_table;
-    prev_cons = NULL;
-
-    /* Try to find the necessary symbol in the symbol table. */
-    while(tmp_symt != NULL) {
-        struct lispobj *curs = CAR(tmp_symt);
-
-        /* If have found it delete it. */
-        if(curs == symbol) {
-            if(prev_cons != NULL) {
-                CDR(prev_cons) = CDR(tmp_symt);
-            } else {
-                symbol_table = CDR(tmp_symt);
-            }
-                            
-            CAR(tmp_symt) = NULL;
-            CDR(tmp_symt) = NULL;
-            object_delete(tmp_symt);
-            
+    struct symbol_table *t = ctx->symbol_table;
+    struct symbol_slots *s;
+    long i, mask;
+
+    if(t == NULL || (s = t->slots) == NULL)
+        return;
+
+    mask = s->size - 1;
+    i = symbol_hash(SYMBOL_VALUE(symbol), strlen(SYMBOL_VALUE(symbol)));
+    for(i &= mask; s->slots[i] != NULL; i = (i + 1) & mask) {
+        if(s->slots[i] == symbol) {
+            __atomic_store_n(&s->slots[i], &symbol_tombstone,
+                             __ATOMIC_RELEASE);
+            t->count--;
+
             return;
         }
-
-        prev_cons = tmp_symt;
-        tmp_symt = CDR(tmp_symt);
     }
-    
+
     return;
 }
 
 struct lispobj *symbol_table_intern(struct lispobj *symbol)
 {
-    struct lispobj *pair;
+    struct symbol_table *t = ctx->symbol_table;
+    const char *name = SYMBOL_VALUE(symbol);
 
-    /* Inserting new symbol on the top of the symbol table. */
-    pair = NEW_CONS(symbol, symbol_table);
-    symbol_table = heap_grab(pair);
+    if(t == NULL) {
+        t = ctx->symbol_table = symbol_table_new(NULL);
+    }
+    /* At most half full, tombstones included. */
+    if(t->slots == NULL || (t->used + 1) * 2 > t->slots->size) {
+        symbol_table_grow(t);
+    }
+
+    symbol_slots_put(t->slots, heap_grab(symbol),
+                     symbol_hash(name, strlen(name)));
+    t->count++;
+    t->used++;
 
-    /* Just return symbol. */
     return symbol;
 }
 
-struct lispobj *symbol_table_lookup(char *symbol)
+/*
+ * Looks up a name through the tables of the context. A token of the
+ * reader is compared as if it was in upper case.
+ */
+static struct lispobj *symbol_table_find(const char *token, long length,
+                                         int upcase)
 {
-    struct lispobj *tmp = symbol_table;
-    
-    while(tmp != NULL) {
-        if(!strcmp(SYMBOL_VALUE(CAR(tmp)), symbol)) {
-            return CAR(tmp);
+    unsigned long hash = symbol_hash(token, length);
+    struct symbol_table *t;
+    struct symbol_slots *s;
+    struct lispobj *obj;
+    const char *name;
+    long i, j, mask;
+
+    for(t = ctx->symbol_table; t != NULL; t = t->parent) {
+        if((s = __atomic_load_n(&t->slots, __ATOMIC_ACQUIRE)) == NULL)
+            continue;
+
+        mask = s->size - 1;
+        for(i = hash & mask;
+            (obj = __atomic_load_n(&s->slots[i], __ATOMIC_ACQUIRE)) != NULL;
+            i = (i + 1) & mask) {
+            if(obj == &symbol_tombstone)
+                continue;
+            name = SYMBOL_VALUE(obj);
+            for(j = 0; j < length; j++) {
+                if(name[j] != (upcase && token[j] >= 'a' && token[j] <= 'z' ?
+                               token[j] - 0x20 : token[j]))
+                    break;
+            }
+            if(j == length && name[j] == '\0')
+                return obj;
         }
-        tmp = CDR(tmp);
     }
 
     return NULL;
 }
+
+/* Looks up a token of the reader: not NUL-terminated and
+   compared as if it was in upper case. */
+struct lispobj *symbol_table_lookup_token(const char *token, long length)
+{
+    return symbol_table_find(token, length, 1);
+}
+
+struct lispobj *symbol_table_lookup(char *symbol)
+{
+    return symbol_table_find(symbol, strlen(symbol), 0);
+}
+
+void heap_detach(void)
+{
+    heap_detached = 1;
+
+    return;
+}
+
+/*
+ * A symbol of a detached thread. The thread never touches the symbol
+ * table, which the evaluator changes all the time, it interns names
+ * into a cache of its own. The evaluator swaps these stand-ins for
+ * real symbols in heap_adopt(), once per name.
+ */
+struct cached_symbol {
+    /* The stand-in, the cache holds a reference to it. */
+    struct lispobj obj;
+    /* Interned symbol, set and owned by the evaluator. */
+    struct lispobj *symbol;
+    struct cached_symbol *next;
+    unsigned long hash;
+    long length;
+    char name[];
+};
+
+struct symbol_cache {
+    struct cached_symbol **buckets;
+    long size;
+    long count;
+};
+
+struct symbol_cache *symbol_cache_new(void)
+{
+    struct symbol_cache *c;
+
+    c = malloc(sizeof(struct symbol_cache));
+    c->size = SYMBOL_CACHE_SIZE;
+    c->count = 0;
+    c->buckets = calloc(c->size, sizeof(struct cached_symbol *));
+
+    return c;
+}
+
+/* Only after the evaluator is done with every form of the cache. */
+void symbol_cache_free(struct symbol_cache *c)
+{
+    struct cached_symbol *cs, *next;
+    long i;
+
+    for(i = 0; i < c->size; i++) {
+        for(cs = c->buckets[i]; cs != NULL; cs = next) {
+            next = cs->next;
+            heap_release(cs->symbol);
+            free(cs);
+        }
+    }
+    free(c->buckets);
+    free(c);
+
+    return;
+}
+
+static void symbol_cache_grow(struct symbol_cache *c)
+{
+    struct cached_symbol **buckets, *cs, *next;
+    long i, size = c->size * 2;
+
+    buckets = calloc(size, sizeof(struct cached_symbol *));
+    for(i = 0; i < c->size; i++) {
+        for(cs = c->buckets[i]; cs != NULL; cs = next) {
+            next = cs->next;
+            cs->next = buckets[cs->hash & (size - 1)];
+            buckets[cs->hash & (size - 1)] = cs;
+        }
+    }
+    free(c->buckets);
+    c->buckets = buckets;
+    c->size = size;
+
+    return;
+}
+
+/* Takes a token of the reader, like symbol_table_lookup_token(). */
+struct lispobj *symbol_cache_intern(struct symbol_cache *c,
+                                    const char *token, long length)
+{
+    struct cached_symbol *cs;
+    unsigned long hash = symbol_hash(token, length);
+    long i;
+
+    for(cs = c->buckets[hash & (c->size - 1)]; cs != NULL; cs = cs->next) {
+        if(cs->hash != hash || cs->length != length)
+            continue;
+        for(i = 0; i < length; i++) {
+            if(cs->name[i] != (token[i] >= 'a' && token[i] <= 'z' ?
+                               token[i] - 0x20 : token[i]))
+                break;
+        }
+        if(i == length)
+            return &cs->obj;
+    }
+
+    if(c->count >= c->size) {
+        symbol_cache_grow(c);
+    }
+
+    cs = malloc(sizeof(struct cached_symbol) + length + 1);
+    for(i = 0; i < length; i++) {
+        cs->name[i] = token[i] >= 'a' && token[i] <= 'z' ?
+            token[i] - 0x20 : token[i];
+    }
+    cs->name[length] = '\0';
+    cs->length = length;
+    cs->hash = hash;
+    cs->symbol = NULL;
+    OBJ_TYPE(&cs->obj) = SYMBOL;
+    OBJ_REFS(&cs->obj) = 1;
+    cs->obj.heap_index = -1;
+    SYMBOL_VALUE(&cs->obj) = cs->name;
+
+    cs->next = c->buckets[hash & (c->size - 1)];
+    c->buckets[hash & (c->size - 1)] = cs;
+    c->count++;
+
+    return &cs->obj;
+}
+
+/*
+ * Only stand-ins are replaced, the caller grabs the replacement of
+ * a slot. Stand-ins keep their counts, those belong to the thread
+ * that made them.
+ */
+static struct lispobj *heap_adopt_slot(struct lispobj *obj)
+{
+    struct lispobj *adopted = heap_adopt(obj);
+
+    return adopted != obj ? heap_grab(adopted) : adopted;
+}
+
+/*
+ * Puts a form made by a detached thread into the heap. Every symbol
+ * in it comes from a symbol cache and is replaced by the interned
+ * one, so a symbol form returns another object.
+ */
+struct lispobj *heap_adopt(struct lispobj *obj)
+{
+    struct cached_symbol *cs;
+    struct lispobj *cell;
+    int i;
+
+    if(obj == NULL)
+        return NULL;
+
+    switch(OBJ_TYPE(obj)) {
+    case SYMBOL:
+        cs = (struct cached_symbol *) obj;
+        if(cs->symbol == NULL) {
+            cs->symbol = heap_grab(NEW_SYMBOL(cs->name));
+        }
+
+        return cs->symbol;
+    case CONS:
+        /* Iterative along the list, recursive into elements. */
+        for(cell = obj; ; cell = CDR(cell)) {
+            heap_add(cell);
+            CAR(cell) = heap_adopt_slot(CAR(cell));
+            if(CDR(cell) == NULL || OBJ_TYPE(CDR(cell)) != CONS) {
+                CDR(cell) = heap_adopt_slot(CDR(cell));
+                break;
+            }
+        }
+
+        break;
+    case VECTOR:
+        heap_add(obj);
+        for(i = 0; i < VECTOR_LENGTH(obj); i++) {
+            VECTOR_DATA(obj)[i] = heap_adopt_slot(VECTOR_DATA(obj)[i]);
+        }
+
+        break;
+    default:
+        heap_add(obj);
+
+        break;
+    }
+
+    return obj;
+}
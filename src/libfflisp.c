@@ -0,0 +1,431 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/stack.h"
+#include "../include/environment.h"
+#include "../include/eval.h"
+#include "../include/read.h"
+#include "../include/print.h"
+#include "../include/error.h"
+#include "../include/subr.h"
+#include "../include/libfflisp.h"
+
+/* The public types are the ones of object.h. */
+_Static_assert((int) FFLISP_CONS == (int) CONS &&
+               (int) FFLISP_FUTURE == (int) FUTURE,
+               "types of libfflisp.h and object.h differ");
+
+struct native {
+    struct subr subr;
+    struct native *next;
+};
+
+/*
+ * The base context holds the primitives and is frozen, programs run
+ * in one made from it. Resetting only makes that one again.
+ */
+struct fflisp {
+    struct fflisp_ctx *base;
+    struct fflisp_ctx *ctx;
+    struct native *natives;
+    /* Message of the last failure, NULL if there was none. */
+    char *error;
+};
+
+/*
+ * Values of a native are made in the context running it, that's a
+ * job's one in PMAP. Otherwise they are made in the interpreter's.
+ */
+static struct fflisp_ctx *api_enter(struct fflisp *f)
+{
+    return fflisp_ctx_enter(ctx != NULL ? ctx : f->ctx);
+}
+
+/* Keeps the message of a condition like error_print() shows it. */
+static void api_failed(struct fflisp *f, struct lispobj *condition)
+{
+    long length = 0, size = PRINT_STRING_SIZE;
+    char *data = malloc(size);
+
+    if(condition == NULL || OBJ_TYPE(condition) != ERROR) {
+        strcpy(data, "Unhandled condition: ");
+        length = strlen(data);
+    }
+    print_append(condition, &data, &length, &size);
+    /* Messages of the primitives end in a newline. */
+    if(length > 0 && data[length - 1] == '\n') {
+        length--;
+    }
+    data = realloc(data, length + 1);
+    data[length] = '\0';
+
+    free(f->error);
+    f->error = data;
+
+    return;
+}
+
+/* Symbols are upper case, as the reader makes them. */
+static char *api_upcase(const char *name)
+{
+    char *s = strdup(name), *p;
+
+    for(p = s; *p != '\0'; p++) {
+        if(*p >= 'a' && *p <= 'z') {
+            *p -= 0x20;
+        }
+    }
+
+    return s;
+}
+
+static struct lispobj *api_symbol(const char *name)
+{
+    char *s = api_upcase(name);
+    struct lispobj *obj = NEW_SYMBOL(s);
+
+    free(s);
+
+    return obj;
+}
+
+static void api_bind(struct native *n)
+{
+    struct lispobj *var, *val;
+    struct handler h;
+
+    var = NEW_SYMBOL(n->subr.name);
+    val = object_create(SUBR, NULL);
+    SUBR_VALUE(val) = &n->subr;
+
+    handler_push(&h);
+    if(setjmp(h.jmp)) {
+        /* Defined already, by a program or fflisp_define(). */
+        heap_release(h.condition);
+        env_var_assign(var, val, ctx->environment);
+    } else {
+        env_var_define(var, val, ctx->environment);
+        handler_pop(&h);
+    }
+
+    return;
+}
+
+struct fflisp *fflisp_init(void)
+{
+    struct fflisp *f = malloc(sizeof(struct fflisp));
+
+    f->base = fflisp_ctx_new(NULL);
+    f->ctx = fflisp_ctx_new(f->base);
+    f->natives = NULL;
+    f->error = NULL;
+
+    return f;
+}
+
+/* Forgets every definition of the programs, the natives stay. */
+void fflisp_reset(struct fflisp *f)
+{
+    struct fflisp_ctx *prev;
+    struct native *n;
+
+    fflisp_ctx_free(f->ctx);
+    f->ctx = fflisp_ctx_new(f->base);
+
+    prev = fflisp_ctx_enter(f->ctx);
+    for(n = f->natives; n != NULL; n = n->next) {
+        api_bind(n);
+    }
+    fflisp_ctx_enter(prev);
+
+    free(f->error);
+    f->error = NULL;
+
+    return;
+}
+
+void fflisp_free(struct fflisp *f)
+{
+    struct native *n;
+
+    fflisp_ctx_free(f->ctx);
+    fflisp_ctx_free(f->base);
+    while((n = f->natives) != NULL) {
+        f->natives = n->next;
+        free(n->subr.name);
+        free(n);
+    }
+    free(f->error);
+    free(f);
+
+    return;
+}
+
+/* Results of all the forms are dropped but the last one's. */
+int fflisp_eval_string(struct fflisp *f, const char *source,
+                       struct lispobj **result)
+{
+    struct lispobj *read_obj;
+    struct fflisp_ctx *prev;
+    struct handler h;
+    struct reader *r;
+    int status = 0;
+
+    prev = fflisp_ctx_enter(f->ctx);
+    r = reader_open_buffer(strdup(source), strlen(source));
+    *result = NULL;
+
+    while(reader_skip(r) != EOF) {
+        read_obj = heap_grab(read_form(r));
+        if(read_obj != NULL && OBJ_TYPE(read_obj) == ERROR) {
+            api_failed(f, read_obj);
+            heap_release(read_obj);
+            status = -1;
+
+            break;
+        }
+
+        handler_push(&h);
+        if(setjmp(h.jmp)) {
+            api_failed(f, h.condition);
+            heap_release(h.condition);
+            heap_release(read_obj);
+            status = -1;
+
+            break;
+        }
+        heap_release(*result);
+        *result = NULL;
+        *result = eval(read_obj, ctx->environment);
+        handler_pop(&h);
+
+        heap_release(read_obj);
+    }
+    reader_close(r);
+
+    if(status < 0) {
+        heap_release(*result);
+        *result = NULL;
+    }
+    fflisp_ctx_enter(prev);
+
+    return status;
+}
+
+/* Applies the global procedure called name. */
+int fflisp_call(struct fflisp *f, const char *name, int argc,
+                struct lispobj **argv, struct lispobj **result)
+{
+    struct lispobj *proc;
+    struct fflisp_ctx *prev;
+    struct handler h;
+    int base, i, status = 0;
+
+    prev = fflisp_ctx_enter(f->ctx);
+    *result = NULL;
+
+    handler_push(&h);
+    if(setjmp(h.jmp)) {
+        api_failed(f, h.condition);
+        heap_release(h.condition);
+        status = -1;
+    } else {
+        proc = CDR(env_var_lookup(api_symbol(name), ctx->environment));
+
+        /* On the stack, so a condition releases them too. */
+        base = ctx->stack->index;
+        for(i = 0; i < argc; i++) {
+            stack_push(heap_grab(argv[i]));
+        }
+        *result = apply_argv(proc, argc, ctx->stack->data + base);
+        stack_unwind(base);
+        handler_pop(&h);
+    }
+
+    fflisp_ctx_enter(prev);
+
+    return status;
+}
+
+const char *fflisp_error(struct fflisp *f)
+{
+    return f->error;
+}
+
+void fflisp_define(struct fflisp *f, const char *name,
+                   struct lispobj *(*native)(void*, int, struct lispobj**),
+                   void *data, int min_args, int max_args)
+{
+    struct fflisp_ctx *prev;
+    struct native *n = malloc(sizeof(struct native));
+
+    memset(n, 0, sizeof(struct native));
+    n->subr.name = api_upcase(name);
+    n->subr.min_args = min_args;
+    n->subr.max_args = max_args;
+    n->subr.native = native;
+    n->subr.data = data;
+    n->next = f->natives;
+    f->natives = n;
+
+    prev = fflisp_ctx_enter(f->ctx);
+    api_bind(n);
+    fflisp_ctx_enter(prev);
+
+    return;
+}
+
+void fflisp_fail(struct fflisp *f, const char *message)
+{
+    api_enter(f);
+    error_signal(NEW_ERROR((char *) message));
+}
+
+struct lispobj *fflisp_retain(struct fflisp *f, struct lispobj *obj)
+{
+    return heap_grab(obj);
+}
+
+void fflisp_release(struct fflisp *f, struct lispobj *obj)
+{
+    struct fflisp_ctx *prev = api_enter(f);
+
+    heap_release(obj);
+    fflisp_ctx_enter(prev);
+
+    return;
+}
+
+struct lispobj *fflisp_number(struct fflisp *f, long value)
+{
+    struct fflisp_ctx *prev = api_enter(f);
+    struct lispobj *obj = heap_grab(number(value));
+
+    fflisp_ctx_enter(prev);
+
+    return obj;
+}
+
+struct lispobj *fflisp_float(struct fflisp *f, double value)
+{
+    struct fflisp_ctx *prev = api_enter(f);
+    struct lispobj *obj = heap_grab(flonum(value));
+
+    fflisp_ctx_enter(prev);
+
+    return obj;
+}
+
+struct lispobj *fflisp_string(struct fflisp *f, const char *data,
+                              long length)
+{
+    struct fflisp_ctx *prev = api_enter(f);
+    struct lispobj *obj = heap_grab(string(data, length));
+
+    fflisp_ctx_enter(prev);
+
+    return obj;
+}
+
+struct lispobj *fflisp_symbol(struct fflisp *f, const char *name)
+{
+    struct fflisp_ctx *prev = api_enter(f);
+    struct lispobj *obj = heap_grab(api_symbol(name));
+
+    fflisp_ctx_enter(prev);
+
+    return obj;
+}
+
+struct lispobj *fflisp_cons(struct fflisp *f, struct lispobj *car,
+                            struct lispobj *cdr)
+{
+    struct fflisp_ctx *prev = api_enter(f);
+    struct lispobj *obj = heap_grab(NEW_CONS(car, cdr));
+
+    fflisp_ctx_enter(prev);
+
+    return obj;
+}
+
+int fflisp_type(struct lispobj *obj)
+{
+    return obj != NULL ? OBJ_TYPE(obj) : FFLISP_NIL;
+}
+
+/* These return 0, or -1 if the value has another type. */
+int fflisp_to_long(struct lispobj *obj, long *value)
+{
+    if(obj == NULL || OBJ_TYPE(obj) != NUMBER)
+        return -1;
+
+    *value = NUMBER_VALUE(obj);
+
+    return 0;
+}
+
+int fflisp_to_double(struct lispobj *obj, double *value)
+{
+    if(obj != NULL && OBJ_TYPE(obj) == NUMBER) {
+        *value = NUMBER_VALUE(obj);
+    } else if(obj != NULL && OBJ_TYPE(obj) == FLOAT) {
+        *value = FLOAT_VALUE(obj);
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+const char *fflisp_to_string(struct lispobj *obj, long *length)
+{
+    if(obj == NULL || OBJ_TYPE(obj) != STRING)
+        return NULL;
+
+    *length = STRING_LENGTH(obj);
+
+    return STRING_DATA(obj);
+}
+
+const char *fflisp_symbol_name(struct lispobj *obj)
+{
+    if(obj == NULL || OBJ_TYPE(obj) != SYMBOL)
+        return NULL;
+
+    return SYMBOL_VALUE(obj);
+}
+
+struct lispobj *fflisp_car(struct lispobj *obj)
+{
+    return obj != NULL && OBJ_TYPE(obj) == CONS ? CAR(obj) : NULL;
+}
+
+struct lispobj *fflisp_cdr(struct lispobj *obj)
+{
+    return obj != NULL && OBJ_TYPE(obj) == CONS ? CDR(obj) : NULL;
+}
+
+char *fflisp_print(struct fflisp *f, struct lispobj *obj)
+{
+    struct fflisp_ctx *prev = api_enter(f);
+    long length = 0, size = PRINT_STRING_SIZE;
+    char *data = malloc(size);
+
+    print_append(obj, &data, &length, &size);
+    data = realloc(data, length + 1);
+    data[length] = '\0';
+    fflisp_ctx_enter(prev);
+
+    return data;
+}
+
+unsigned long fflisp_allocations(struct fflisp *f)
+{
+    return f->ctx->heap->added;
+}
@@ -0,0 +1,599 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+/*
+ * List library. Lists are walked with loops and results are built
+ * front to back through a tail pointer, user procedures are the
+ * only thing that goes back to apply_argv(). So neither the C
+ * stack nor the evaluator stack grows with the length of a list.
+ *
+ * Anything held across a call of a user procedure is rooted on
+ * the evaluator stack, an error signalled by the procedure then
+ * releases it when the handler unwinds the stack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/eval.h"
+#include "../include/subr.h"
+#include "../include/error.h"
+#include "../include/array.h"
+#include "../include/stack.h"
+#include "../include/fflisp.h"
+#include "../include/pool.h"
+
+/* Result list under construction. */
+struct list_builder {
+    /* Stack slot holding the head. */
+    int slot;
+    struct lispobj *head;
+    struct lispobj *tail;
+};
+
+/* True at the end of the list, signals on an improper tail. */
+static int list_end(struct lispobj *list, struct lispobj *nil_symbol)
+{
+    if(list == NULL || list == nil_symbol)
+        return 1;
+    if(OBJ_TYPE(list) != CONS)
+        error_signal(ERROR_NOT_CONS);
+
+    return 0;
+}
+
+/*
+ * Drop a reference without deleting the object, subrs return
+ * objects which nobody has grabbed yet.
+ */
+static struct lispobj *unroot(struct lispobj *obj)
+{
+    if(obj != NULL && !IS_FROZEN(obj)) {
+        OBJ_REFS(obj)--;
+    }
+
+    return obj;
+}
+
+static void builder_init(struct list_builder *b)
+{
+    b->slot = ctx->stack->index;
+    b->head = b->tail = NULL;
+    stack_push(NULL);
+
+    return;
+}
+
+static void builder_add(struct list_builder *b, struct lispobj *obj)
+{
+    struct lispobj *cell = heap_grab(NEW_CONS(obj, NULL));
+
+    if(b->head == NULL) {
+        b->head = ctx->stack->data[b->slot] = cell;
+    } else {
+        CDR(b->tail) = cell;
+    }
+    b->tail = cell;
+
+    return;
+}
+
+/* Pops the head off the stack, everything above it must be gone. */
+static struct lispobj *builder_finish(struct list_builder *b)
+{
+    ctx->stack->index = b->slot;
+
+    return unroot(b->head);
+}
+
+/* Apply proc and tell whether the result is true. */
+static int call_test(struct lispobj *proc, int argc, struct lispobj **argv)
+{
+    struct lispobj *ret = apply_argv(proc, argc, argv);
+
+    heap_release(ret);
+
+    return ret != NULL;
+}
+
+struct lispobj *subr_length(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list;
+    long n = 0;
+
+    for(list = argv[0]; !list_end(list, nil_symbol); list = CDR(list)) {
+        n++;
+    }
+
+    return number(n);
+}
+
+/* (map proc list ...), stops at the end of the shortest list. */
+struct lispobj *subr_map(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *state, **cur, **args;
+    struct lispobj *tmp;
+    struct list_builder b;
+    int n = argc - 1, base = ctx->stack->index, i;
+
+    /* Cursors into the lists and the current arguments. */
+    state = vector(2 * n, NULL);
+    stack_push(heap_grab(state));
+    cur = VECTOR_DATA(state);
+    args = cur + n;
+    for(i = 0; i < n; i++) {
+        cur[i] = heap_grab(argv[i + 1]);
+    }
+
+    builder_init(&b);
+    for(;;) {
+        for(i = 0; i < n; i++) {
+            if(list_end(cur[i], nil_symbol))
+                break;
+            tmp = args[i];
+            args[i] = heap_grab(CAR(cur[i]));
+            heap_release(tmp);
+
+            tmp = cur[i];
+            cur[i] = heap_grab(CDR(tmp));
+            heap_release(tmp);
+        }
+        if(i < n)
+            break;
+
+        tmp = apply_argv(argv[0], n, args);
+        builder_add(&b, tmp);
+        heap_release(tmp);
+    }
+    tmp = builder_finish(&b);
+    stack_unwind(base);
+
+    return tmp;
+}
+
+/* Left to right, empty list gives NIL and a single element itself. */
+struct lispobj *subr_reduce(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list = argv[1];
+    struct lispobj *args[2];
+    int base = ctx->stack->index;
+
+    if(list_end(list, nil_symbol))
+        return OBJ_FALSE;
+
+    /* The accumulator lives in the stack slot. */
+    stack_push(heap_grab(CAR(list)));
+    for(list = CDR(list); !list_end(list, nil_symbol); list = CDR(list)) {
+        args[0] = ctx->stack->data[base];
+        args[1] = CAR(list);
+        ctx->stack->data[base] = apply_argv(argv[0], 2, args);
+        heap_release(args[0]);
+    }
+    ctx->stack->index = base;
+
+    return unroot(ctx->stack->data[base]);
+}
+
+/* (proc (proc (proc start x1) x2) x3) */
+struct lispobj *subr_fold_left(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list;
+    struct lispobj *args[2];
+    int base = ctx->stack->index;
+
+    stack_push(heap_grab(argv[1]));
+    for(list = argv[2]; !list_end(list, nil_symbol); list = CDR(list)) {
+        args[0] = ctx->stack->data[base];
+        args[1] = CAR(list);
+        ctx->stack->data[base] = apply_argv(argv[0], 2, args);
+        heap_release(args[0]);
+    }
+    ctx->stack->index = base;
+
+    return unroot(ctx->stack->data[base]);
+}
+
+/* (proc x1 (proc x2 (proc x3 start))), the list is walked backwards
+   through a vector of its elements. */
+struct lispobj *subr_fold_right(int argc, struct lispobj **argv)
+{
+    struct lispobj *elems, *ret, *args[2];
+    int base = ctx->stack->index, i;
+
+    elems = list_to_vector(argv[2]);
+    stack_push(heap_grab(elems));
+
+    stack_push(heap_grab(argv[1]));
+    for(i = VECTOR_LENGTH(elems) - 1; i >= 0; i--) {
+        args[0] = VECTOR_DATA(elems)[i];
+        args[1] = ctx->stack->data[base + 1];
+        ctx->stack->data[base + 1] = apply_argv(argv[0], 2, args);
+        heap_release(args[1]);
+    }
+    ret = unroot(ctx->stack->data[base + 1]);
+    /* Only the elements go, they are still held by the list. */
+    ctx->stack->index = base + 1;
+    stack_unwind(base);
+
+    return ret;
+}
+
+/* Copies every list except the last one, which becomes the tail. */
+struct lispobj *subr_append(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list, *last;
+    struct list_builder b;
+    int i;
+
+    if(argc == 0)
+        return OBJ_FALSE;
+    last = argv[argc - 1] == nil_symbol ? OBJ_FALSE : argv[argc - 1];
+
+    builder_init(&b);
+    for(i = 0; i < argc - 1; i++) {
+        for(list = argv[i]; !list_end(list, nil_symbol); list = CDR(list)) {
+            builder_add(&b, CAR(list));
+        }
+    }
+    if(b.head == NULL) {
+        ctx->stack->index = b.slot;
+
+        return last;
+    }
+    CDR(b.tail) = heap_grab(last);
+
+    return builder_finish(&b);
+}
+
+struct lispobj *subr_reverse(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list, *ret = OBJ_FALSE;
+
+    for(list = argv[0]; !list_end(list, nil_symbol); list = CDR(list)) {
+        ret = NEW_CONS(CAR(list), ret);
+    }
+
+    return ret;
+}
+
+struct lispobj *subr_remove_if(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list;
+    struct list_builder b;
+
+    builder_init(&b);
+    for(list = argv[1]; !list_end(list, nil_symbol); list = CDR(list)) {
+        if(!call_test(argv[0], 1, &CAR(list))) {
+            builder_add(&b, CAR(list));
+        }
+    }
+
+    return builder_finish(&b);
+}
+
+/* First element satisfying pred. */
+struct lispobj *subr_find_if(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list;
+
+    for(list = argv[1]; !list_end(list, nil_symbol); list = CDR(list)) {
+        if(call_test(argv[0], 1, &CAR(list)))
+            return CAR(list);
+    }
+
+    return OBJ_FALSE;
+}
+
+/* (find item list), compares with EQUAL. */
+struct lispobj *subr_find(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list;
+
+    for(list = argv[1]; !list_end(list, nil_symbol); list = CDR(list)) {
+        if(equal(argv[0], CAR(list)))
+            return CAR(list);
+    }
+
+    return OBJ_FALSE;
+}
+
+/* (member item list), the tail starting with item, compares with EQUAL. */
+struct lispobj *subr_member(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list;
+
+    for(list = argv[1]; !list_end(list, nil_symbol); list = CDR(list)) {
+        if(equal(argv[0], CAR(list)))
+            return list;
+    }
+
+    return OBJ_FALSE;
+}
+
+/* (assoc key alist), compares with EQUAL, skips elements
+   which are not pairs. */
+struct lispobj *subr_assoc(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list, *pair;
+
+    for(list = argv[1]; !list_end(list, nil_symbol); list = CDR(list)) {
+        pair = CAR(list);
+        if(pair != NULL && OBJ_TYPE(pair) == CONS && equal(argv[0], CAR(pair)))
+            return pair;
+    }
+
+    return OBJ_FALSE;
+}
+
+/* (nth n list), NIL past the end. */
+struct lispobj *subr_nth(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list = argv[1];
+    long n;
+
+    if(argv[0] == NULL || OBJ_TYPE(argv[0]) != NUMBER)
+        error_signal(ERROR_NOT_NUMBER);
+    if((n = NUMBER_VALUE(argv[0])) < 0)
+        error_signal(ERROR_BAD_INDEX);
+
+    for(; !list_end(list, nil_symbol); list = CDR(list)) {
+        if(n-- == 0)
+            return CAR(list);
+    }
+
+    return OBJ_FALSE;
+}
+
+/* The last cons of the list. */
+struct lispobj *subr_last(int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list = argv[0];
+
+    if(list_end(list, nil_symbol))
+        return OBJ_FALSE;
+    while(!list_end(CDR(list), nil_symbol)) {
+        list = CDR(list);
+    }
+
+    return list;
+}
+
+/*
+ * (sort list pred [key]) returns a sorted copy. Bottom-up merge
+ * sort over element indices, which keeps equal elements in their
+ * order. Keys are computed once per element, pred is called as
+ * (pred a b) and has to tell whether a goes strictly before b.
+ */
+struct lispobj *subr_sort(int argc, struct lispobj **argv)
+{
+    struct lispobj *list, *elems, *keys, *order, *args[2];
+    struct list_builder b;
+    int64_t *from, *to, *tmp;
+    long n, width, i, lo, mid, hi, l, r, k;
+    int base = ctx->stack->index;
+
+    elems = list_to_vector(argv[0]);
+    stack_push(heap_grab(elems));
+    n = VECTOR_LENGTH(elems);
+
+    keys = elems;
+    if(argc > 2 && argv[2] != NULL) {
+        keys = vector(n, NULL);
+        stack_push(heap_grab(keys));
+        for(i = 0; i < n; i++) {
+            VECTOR_DATA(keys)[i] = apply_argv(argv[2], 1,
+                                              VECTOR_DATA(elems) + i);
+        }
+    }
+
+    /* Two index buffers in a packed array, so they go away on error. */
+    order = object_create(ARRAY, NULL);
+    ARRAY_VALUE(order) = array_new(ARRAY_INT64, 2 * n);
+    stack_push(heap_grab(order));
+    from = ARRAY_VALUE(order)->data.i64;
+    to = from + n;
+    for(i = 0; i < n; i++) {
+        from[i] = i;
+    }
+
+    for(width = 1; width < n; width *= 2) {
+        for(lo = 0; lo < n; lo += 2 * width) {
+            mid = lo + width < n ? lo + width : n;
+            hi = lo + 2 * width < n ? lo + 2 * width : n;
+
+            for(l = lo, r = mid, k = lo; l < mid && r < hi; k++) {
+                /* Take from the right only when strictly before. */
+                args[0] = VECTOR_DATA(keys)[from[r]];
+                args[1] = VECTOR_DATA(keys)[from[l]];
+                to[k] = call_test(argv[1], 2, args) ? from[r++] : from[l++];
+            }
+            while(l < mid) {
+                to[k++] = from[l++];
+            }
+            while(r < hi) {
+                to[k++] = from[r++];
+            }
+        }
+        tmp = from;
+        from = to;
+        to = tmp;
+    }
+
+    builder_init(&b);
+    for(i = 0; i < n; i++) {
+        builder_add(&b, VECTOR_DATA(elems)[from[i]]);
+    }
+    list = builder_finish(&b);
+    /* The result is only referenced by the builder's slot, which
+       builder_finish() has dropped, so unwinding can't free it. */
+    stack_unwind(base);
+
+    return list;
+}
+
+/*
+ * PMAP, PFILTER and PREDUCE split the list into chunks which run on
+ * the worker pool, see pool.h. Results of the chunks are joined in
+ * the order of the list.
+ */
+enum {
+    PLIST_MAP = 0,
+    PLIST_FILTER,
+    PLIST_REDUCE,
+};
+
+struct plist_task {
+    struct pool_task task;
+    int op;
+    struct lispobj *proc;
+    /* First cell of every chunk. */
+    struct lispobj **starts;
+    long chunk;
+    long length;
+};
+
+/* A chunk, like MAP, REMOVE-IF with the test reversed or REDUCE. */
+static struct lispobj *plist_chunk(struct pool_task *task, long i)
+{
+    struct plist_task *t = (struct plist_task *) task;
+    struct lispobj *list = t->starts[i], *args[2], *ret;
+    struct list_builder b;
+    long n = t->length - i * t->chunk;
+    int base = ctx->stack->index;
+
+    if(n > t->chunk)
+        n = t->chunk;
+
+    if(t->op == PLIST_REDUCE) {
+        stack_push(heap_grab(CAR(list)));
+        for(list = CDR(list), n--; n > 0; list = CDR(list), n--) {
+            args[0] = ctx->stack->data[base];
+            args[1] = CAR(list);
+            ctx->stack->data[base] = apply_argv(t->proc, 2, args);
+            heap_release(args[0]);
+        }
+        ctx->stack->index = base;
+
+        return ctx->stack->data[base];
+    }
+
+    builder_init(&b);
+    for(; n > 0; list = CDR(list), n--) {
+        if(t->op == PLIST_MAP) {
+            ret = apply_argv(t->proc, 1, &CAR(list));
+            builder_add(&b, ret);
+            heap_release(ret);
+        } else if(call_test(t->proc, 1, &CAR(list))) {
+            builder_add(&b, CAR(list));
+        }
+    }
+    ctx->stack->index = b.slot;
+
+    return b.head;
+}
+
+/* (op proc list [chunk-size]) */
+static struct lispobj *plist_run(int op, int argc, struct lispobj **argv)
+{
+    struct lispobj *nil_symbol = SYMBOL_NIL, *list, *starts, *results;
+    struct lispobj **r, *args[2], *tail, *ret;
+    struct plist_task t;
+    long length = 0, chunks, i, step;
+    int base = ctx->stack->index;
+
+    for(list = argv[1]; !list_end(list, nil_symbol); list = CDR(list)) {
+        length++;
+    }
+    if(length == 0)
+        return OBJ_FALSE;
+
+    t.task.run = plist_chunk;
+    t.op = op;
+    t.proc = argv[0];
+    t.length = length;
+    if(argc > 2) {
+        if(argv[2] == NULL || OBJ_TYPE(argv[2]) != NUMBER)
+            error_signal(ERROR_NOT_NUMBER);
+        if(NUMBER_VALUE(argv[2]) <= 0)
+            error_signal(ERROR_BAD_INDEX);
+        t.chunk = NUMBER_VALUE(argv[2]);
+    } else {
+        i = (long) pool_workers() * POOL_CHUNKS;
+        t.chunk = (length + i - 1) / i;
+    }
+    chunks = (length + t.chunk - 1) / t.chunk;
+
+    /* Short lists run here as a single chunk. */
+    if(length < POOL_MIN_LENGTH || chunks < 2) {
+        t.chunk = length;
+        chunks = 1;
+    }
+
+    starts = vector(chunks, NULL);
+    stack_push(heap_grab(starts));
+    results = vector(chunks, NULL);
+    stack_push(heap_grab(results));
+    for(list = argv[1], i = 0; i < length; list = CDR(list), i++) {
+        if(i % t.chunk == 0)
+            VECTOR_DATA(starts)[i / t.chunk] = heap_grab(list);
+    }
+    t.starts = VECTOR_DATA(starts);
+    t.task.count = chunks;
+
+    r = VECTOR_DATA(results);
+    if(chunks == 1 || !pool_run(&t.task, results)) {
+        for(i = 0; i < chunks; i++) {
+            r[i] = plist_chunk(&t.task, i);
+        }
+    }
+
+    if(op == PLIST_REDUCE) {
+        /* Pairwise, the operator has to be associative. */
+        for(step = 1; step < chunks; step *= 2) {
+            for(i = 0; i + step < chunks; i += 2 * step) {
+                args[0] = r[i];
+                args[1] = r[i + step];
+                ret = apply_argv(argv[0], 2, args);
+                r[i] = ret;
+                r[i + step] = NULL;
+                heap_release(args[0]);
+                heap_release(args[1]);
+            }
+        }
+        ret = r[0];
+    } else {
+        /* Chunk lists are linked back to front, each holds the next. */
+        ret = OBJ_FALSE;
+        for(i = chunks - 1; i >= 0; i--) {
+            if(r[i] == NULL)
+                continue;
+            for(tail = r[i]; CDR(tail) != NULL; tail = CDR(tail))
+                ;
+            CDR(tail) = heap_grab(ret);
+            ret = r[i];
+        }
+    }
+    heap_grab(ret);
+    stack_unwind(base);
+
+    return unroot(ret);
+}
+
+/* (pmap proc list [chunk-size]) */
+struct lispobj *subr_pmap(int argc, struct lispobj **argv)
+{
+    return plist_run(PLIST_MAP, argc, argv);
+}
+
+/* (pfilter pred list [chunk-size]), the elements pred is true for. */
+struct lispobj *subr_pfilter(int argc, struct lispobj **argv)
+{
+    return plist_run(PLIST_FILTER, argc, argv);
+}
+
+/* (preduce proc list [chunk-size]), like REDUCE for associative proc. */
+struct lispobj *subr_preduce(int argc, struct lispobj **argv)
+{
+    return plist_run(PLIST_REDUCE, argc, argv);
+}
@@ -3,41 +3,69 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "../include/object.h"
 #include "../include/heap.h"
+#include "../include/bignum.h"
+#include "../include/array.h"
+#include "../include/hashtable.h"
+#include "../include/hcons.h"
+#include "../include/pool.h"
 
 #define NEW_OBJECT(obj) ((obj) = malloc(sizeof(struct lispobj)))
 
+/*
+ * Interns a symbol the caller knows isn't in the table: the names
+ * of the primitives at boot, where the lookups would be most of it.
+ */
+struct lispobj *symbol_fresh(const char *name)
+{
+    struct lispobj *obj;
+
+    NEW_OBJECT(obj);
+    SYMBOL_VALUE(obj) = strcpy(malloc(strlen(name) + 1), name);
+    OBJ_TYPE(obj) = SYMBOL;
+    OBJ_REFS(obj) = 0;
+
+    /* In the heap first, the table grabs it. */
+    heap_add(obj);
+    obj = symbol_table_intern(obj);
+
+    return obj;
+}
+
 struct lispobj *object_create(int type, char *value)
 {
     struct lispobj *obj;
-    char *symbol_name, *error, *string;
+    char *error;
+    long len;
     struct cons *cons;
     
     switch(type) {
     case SYMBOL:
-        symbol_name = malloc(sizeof(char) * (strlen(value) + 1));
-
         obj = symbol_table_lookup(value);
         
         if(obj == NULL) {
-            NEW_OBJECT(obj);
-            SYMBOL_VALUE(obj) = strcpy(symbol_name, value);
-            OBJ_TYPE(obj) = SYMBOL;
-            
-            OBJ_REFS(obj) = 0;
-            
-            obj = symbol_table_intern(obj);
-            heap_add(obj);
+            obj = symbol_fresh(value);
         }
         
         break;
     case STRING:
-        string = malloc(sizeof(char) * (strlen(value) + 1));
-        
         NEW_OBJECT(obj);
-        STRING_VALUE(obj) = strcpy(string, value);
+
+        if(value != NULL) {
+            /* Header and text in one block. */
+            len = strlen(value);
+            STRING_VALUE(obj) = malloc(sizeof(struct string) + len + 1);
+            STRING_LENGTH(obj) = len;
+            STRING_DATA(obj) = (char *) (STRING_VALUE(obj) + 1);
+            STRING_VALUE(obj)->parent = NULL;
+            memcpy(STRING_DATA(obj), value, len + 1);
+        } else {
+            /* Caller sets the string. */
+            STRING_VALUE(obj) = NULL;
+        }
         OBJ_TYPE(obj) = STRING;
         heap_add(obj);
 
@@ -45,13 +73,52 @@ struct lispobj *object_create(int type, char *value)
 
         break;
     case NUMBER:
-        NEW_OBJECT(obj);
-        NUMBER_VALUE(obj) = atoi(value);
+        if(value != NULL) {
+            long number;
+            
+            errno = 0;
+            number = strtol(value, NULL, 10);
+            if(errno == ERANGE) {
+                /* Doesn't fit a machine word. */
+                obj = object_create(BIGNUM, NULL);
+                BIGNUM_VALUE(obj) = bignum_from_string(value);
+
+                break;
+            }
+
+            NEW_OBJECT(obj);
+            NUMBER_VALUE(obj) = number;
+        } else {
+            NEW_OBJECT(obj);
+            NUMBER_VALUE(obj) = 0;
+        }
         OBJ_TYPE(obj) = NUMBER;
         heap_add(obj);
         
         OBJ_REFS(obj) = 0;
         
+        break;
+    case FLOAT:
+        NEW_OBJECT(obj);
+
+        /* The double lives right in the object, no boxing. */
+        FLOAT_VALUE(obj) = value != NULL ? strtod(value, NULL) : 0.0;
+        OBJ_TYPE(obj) = FLOAT;
+        heap_add(obj);
+
+        OBJ_REFS(obj) = 0;
+
+        break;
+    case BIGNUM:
+        NEW_OBJECT(obj);
+
+        /* Caller sets the bignum. */
+        BIGNUM_VALUE(obj) = NULL;
+        OBJ_TYPE(obj) = BIGNUM;
+        heap_add(obj);
+
+        OBJ_REFS(obj) = 0;
+
         break;
     case CONS:
         cons = malloc(sizeof(struct cons));
@@ -61,11 +128,67 @@ struct lispobj *object_create(int type, char *value)
         CONS_VALUE(obj) = cons;
         CAR(obj) = NULL;
         CDR(obj) = NULL;
+        cons->hash = 0;
         OBJ_TYPE(obj) = CONS;
         heap_add(obj);
 
         OBJ_REFS(obj) = 0;
         
+        break;
+    case HASHTABLE:
+        NEW_OBJECT(obj);
+
+        /* Caller sets the table. */
+        HASHTABLE_VALUE(obj) = NULL;
+        OBJ_TYPE(obj) = HASHTABLE;
+        heap_add(obj);
+
+        OBJ_REFS(obj) = 0;
+
+        break;
+    case FUTURE:
+        NEW_OBJECT(obj);
+
+        /* Caller sets the job. */
+        FUTURE_VALUE(obj) = NULL;
+        OBJ_TYPE(obj) = FUTURE;
+        heap_add(obj);
+
+        OBJ_REFS(obj) = 0;
+
+        break;
+    case ARRAY:
+        NEW_OBJECT(obj);
+
+        /* Caller sets the array. */
+        ARRAY_VALUE(obj) = NULL;
+        OBJ_TYPE(obj) = ARRAY;
+        heap_add(obj);
+
+        OBJ_REFS(obj) = 0;
+
+        break;
+    case VECTOR:
+        NEW_OBJECT(obj);
+
+        /* Caller allocates the elements. */
+        VECTOR_VALUE(obj) = NULL;
+        OBJ_TYPE(obj) = VECTOR;
+        heap_add(obj);
+
+        OBJ_REFS(obj) = 0;
+
+        break;
+    case SUBR:
+        NEW_OBJECT(obj);
+
+        /* Caller sets the pointer to a static struct subr. */
+        SUBR_VALUE(obj) = NULL;
+        OBJ_TYPE(obj) = SUBR;
+        heap_add(obj);
+
+        OBJ_REFS(obj) = 0;
+
         break;
     case ERROR:
         error = malloc(sizeof(char) * (strlen(value) + 1));
@@ -89,6 +212,8 @@ struct lispobj *object_create(int type, char *value)
 
 void object_delete(struct lispobj *obj)
 {
+    struct lispobj *next;
+
     heap_remove(obj);
     
     switch(OBJ_TYPE(obj)) {
@@ -98,21 +223,43 @@ void object_delete(struct lispobj *obj)
 
         break;
     case NUMBER:
+    case FLOAT:
         free(obj);
 
         break;
     case CONS:
-        if(CAR(obj) != NULL)
-            heap_release(CAR(obj));
-        if(CDR(obj) != NULL)
-            heap_release(CDR(obj));
-        
-        free(CONS_VALUE(obj));
-        free(obj);
+        /* A list dies a cons at a time, recursing into the cdr
+           would run out of stack on a long one. */
+        while(obj != NULL) {
+            if(CONS_VALUE(obj)->hash != 0)
+                hcons_forget(obj);
+            if(CAR(obj) != NULL)
+                heap_release(CAR(obj));
+            next = CDR(obj);
+
+            free(CONS_VALUE(obj));
+            free(obj);
+
+            obj = NULL;
+            /* Frozen first, the count of a frozen cons isn't ours to read. */
+            if(next != NULL && !IS_FROZEN(next) &&
+               OBJ_TYPE(next) == CONS && OBJ_REFS(next) <= 1 &&
+               ctx->heap->readers == 0) {
+                /* This was its last reference, and nobody reads it. */
+                heap_remove(next);
+                obj = next;
+            } else if(next != NULL) {
+                heap_release(next);
+            }
+        }
 
         break;
     case STRING:
-        free(STRING_VALUE(obj));
+        if(STRING_VALUE(obj) != NULL) {
+            if(STRING_VALUE(obj)->parent != NULL)
+                heap_release(STRING_VALUE(obj)->parent);
+            free(STRING_VALUE(obj));
+        }
         free(obj);
 
         break;
@@ -120,10 +267,104 @@ void object_delete(struct lispobj *obj)
         free(ERROR_VALUE(obj));
         free(obj);
 
+        break;
+    case HASHTABLE:
+        if(HASHTABLE_VALUE(obj) != NULL)
+            hash_table_free(HASHTABLE_VALUE(obj));
+        free(obj);
+
+        break;
+    case ARRAY:
+        if(ARRAY_VALUE(obj) != NULL)
+            array_free(ARRAY_VALUE(obj));
+        free(obj);
+
+        break;
+    case FUTURE:
+        if(FUTURE_VALUE(obj) != NULL)
+            pool_future_free(FUTURE_VALUE(obj));
+        free(obj);
+
+        break;
+    case VECTOR:
+        if(VECTOR_VALUE(obj) != NULL) {
+            int i;
+
+            for(i = 0; i < VECTOR_LENGTH(obj); i++) {
+                heap_release(VECTOR_DATA(obj)[i]);
+            }
+            free(VECTOR_VALUE(obj));
+        }
+        free(obj);
+
+        break;
+    case SUBR:
+        free(obj);
+
+        break;
+    case BIGNUM:
+        if(BIGNUM_VALUE(obj) != NULL)
+            bignum_free(BIGNUM_VALUE(obj));
+        free(obj);
+
+        break;
+    default:
+        break;
+    }
+
+    return;
+}
+
+/*
+ * Frees the object alone, the objects it refers to are left as they
+ * are. For heap_clean(), which frees all of them anyway.
+ */
+void object_free(struct lispobj *obj)
+{
+    switch(OBJ_TYPE(obj)) {
+    case SYMBOL:
+        free(SYMBOL_VALUE(obj));
+
+        break;
+    case CONS:
+        free(CONS_VALUE(obj));
+
+        break;
+    case STRING:
+        free(STRING_VALUE(obj));
+
+        break;
+    case ERROR:
+        free(ERROR_VALUE(obj));
+
+        break;
+    case HASHTABLE:
+        if(HASHTABLE_VALUE(obj) != NULL)
+            hash_table_drop(HASHTABLE_VALUE(obj));
+
+        break;
+    case ARRAY:
+        if(ARRAY_VALUE(obj) != NULL)
+            array_free(ARRAY_VALUE(obj));
+
+        break;
+    case FUTURE:
+        free(FUTURE_VALUE(obj));
+
+        break;
+    case VECTOR:
+        free(VECTOR_VALUE(obj));
+
+        break;
+    case BIGNUM:
+        if(BIGNUM_VALUE(obj) != NULL)
+            bignum_free(BIGNUM_VALUE(obj));
+
         break;
     default:
         break;
     }
+    free(obj);
 
     return;
 }
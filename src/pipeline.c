@@ -0,0 +1,146 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/read.h"
+#include "../include/pipeline.h"
+
+/* Busy polls of an index before the waiting side backs off. */
+#define PIPELINE_SPIN 256
+
+static void pipeline_pause(int *spins, int sleep)
+{
+    struct timespec ts = {0, 50000};
+
+    if(++*spins < PIPELINE_SPIN) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else if(sleep) {
+        nanosleep(&ts, NULL);
+    } else {
+        sched_yield();
+    }
+
+    return;
+}
+
+/* A full queue means the reader is far ahead, it may as well sleep. */
+static void pipeline_push(struct pipeline *p, struct lispobj *form, int more)
+{
+    struct pipeline_slot *slot;
+    unsigned long head = p->head;
+    int spins = 0;
+
+    while(head - __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE) ==
+          PIPELINE_SIZE) {
+        pipeline_pause(&spins, 1);
+    }
+
+    slot = &p->slots[head & (PIPELINE_SIZE - 1)];
+    slot->form = form;
+    slot->more = more;
+    __atomic_store_n(&p->head, head + 1, __ATOMIC_RELEASE);
+
+    return;
+}
+
+static void *pipeline_reader(void *arg)
+{
+    struct pipeline *p = arg;
+    struct lispobj *form;
+
+    fflisp_ctx_enter(p->ctx);
+    heap_detach();
+
+    do {
+        if(reader_skip(p->reader) == EOF) {
+            form = NULL;
+        } else {
+            form = heap_grab(read_form(p->reader));
+        }
+        pipeline_push(p, form, reader_peek(p->reader) != EOF);
+    } while(form != NULL);
+
+    return NULL;
+}
+
+/*
+ * Returns NULL if the reader thread can't be started, or would only
+ * take turns with the evaluator on a single CPU.
+ */
+struct pipeline *pipeline_start(struct reader *r)
+{
+    struct pipeline *p;
+    cpu_set_t cpus;
+
+    if(sched_getaffinity(0, sizeof(cpus), &cpus) != 0 ||
+       CPU_COUNT(&cpus) < 2)
+        return NULL;
+
+    if(posix_memalign((void **) &p, 64, sizeof(struct pipeline)) != 0)
+        return NULL;
+    memset(p, 0, sizeof(struct pipeline));
+    p->ctx = ctx;
+    p->reader = r;
+    p->symbols = r->symbols = symbol_cache_new();
+
+    if(pthread_create(&p->thread, NULL, pipeline_reader, p) != 0) {
+        r->symbols = NULL;
+        symbol_cache_free(p->symbols);
+        free(p);
+
+        return NULL;
+    }
+
+    return p;
+}
+
+/*
+ * Next form of the file, grabbed, or NULL at its end. A form is put
+ * into the heap only here, the reader thread never touches objects
+ * the evaluator sees.
+ */
+struct lispobj *pipeline_next(struct pipeline *p, int *more)
+{
+    struct pipeline_slot *slot;
+    struct lispobj *form, *adopted;
+    unsigned long tail = p->tail;
+    int spins = 0;
+
+    while(__atomic_load_n(&p->head, __ATOMIC_ACQUIRE) == tail) {
+        pipeline_pause(&spins, 0);
+    }
+
+    slot = &p->slots[tail & (PIPELINE_SIZE - 1)];
+    form = slot->form;
+    *more = slot->more;
+    __atomic_store_n(&p->tail, tail + 1, __ATOMIC_RELEASE);
+
+    /* A symbol form is replaced, its stand-in keeps the reference. */
+    if((adopted = heap_adopt(form)) != form) {
+        heap_grab(adopted);
+    }
+
+    return adopted;
+}
+
+/* Only after pipeline_next() has returned NULL. */
+void pipeline_finish(struct pipeline *p)
+{
+    pthread_join(p->thread, NULL);
+    p->reader->symbols = NULL;
+    symbol_cache_free(p->symbols);
+    free(p);
+
+    return;
+}
@@ -0,0 +1,1219 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+/*
+ * Work-stealing scheduler of futures and of the pieces of parallel
+ * list operations. Jobs run on a fixed set of threads, one per CPU,
+ * and on any thread which waits for a job.
+ *
+ * A job runs in a context of its own, lent the symbols and the
+ * environment of the context which made it, its owner. It reads the
+ * objects of the owner as they are, without counting references to
+ * them nor changing them, see heap_foreign(). A future starts as
+ * soon as it's made and its owner goes on meanwhile, so the owner
+ * keeps what it lets go until its futures are joined, see
+ * heap_defer(). Changing what a running future reads is a race, as
+ * in any threaded program. What a job makes stays in its context
+ * until the owner joins the job and adopts the result into its heap.
+ *
+ * Each pool thread has a Chase-Lev deque: the thread pushes and
+ * pops jobs at the bottom, idle threads steal from the top. Jobs
+ * of other threads go to a queue of the pool. A thread waiting for
+ * a job only runs jobs of its own context, or jobs made under the
+ * one it waits for, stolen from the thread running it
+ * (leapfrogging). Jobs run nested on the C stack of the waiter, so
+ * a nested one gets what's left of the evaluator stack, which is
+ * what guards the C stack, and the nesting has a limit.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/stack.h"
+#include "../include/eval.h"
+#include "../include/error.h"
+#include "../include/hashtable.h"
+#include "../include/read.h"
+#include "../include/pool.h"
+
+/* Heap index of an object on its way out of a job, see pool_adopt(). */
+#define POOL_MOVING (-3)
+
+enum {
+    JOB_PENDING = 0,
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+    /* A future whose result the owner has adopted. */
+    JOB_JOINED,
+};
+
+struct pool_job {
+    /* A piece of the task, or the body of a future if it's NULL. */
+    struct pool_task *task;
+    long index;
+    struct lispobj *body;
+    struct lispobj *env;
+    /* The future, held until the job is joined. */
+    struct lispobj *future;
+    /* Context which made the job, and the job that context runs. */
+    struct fflisp_ctx *owner;
+    struct pool_job *parent;
+    /* Context the job ran in, until the owner adopts the result. */
+    struct fflisp_ctx *ctx;
+    struct lispobj *result;
+    struct lispobj *condition;
+    int state;
+    /* Deque it was pushed to, NULL for the queue of the pool. */
+    struct pool_deque *home;
+    /* Deque of the thread running it, NULL if it has none. */
+    struct pool_deque *runner;
+    struct pool_group *group;
+    /* Next piece of the group, or neighbours among the futures. */
+    struct pool_job *next;
+    struct pool_job *prev;
+    /* Next job of the queue of the pool. */
+    struct pool_job *queued;
+};
+
+/* Pieces of a task, joined together. */
+struct pool_group {
+    struct pool_job *head;
+    struct pool_job *tail;
+    /* Jobs not done yet. */
+    long remaining;
+    /* Set when a piece of a task signals, the others are skipped. */
+    int failed;
+};
+
+/*
+ * Futures of a context not joined yet, oldest first. Contexts of the
+ * joined ones, and tables their results replaced, are reused once no
+ * future of the context runs: until then another one may still be
+ * reading what was adopted from them.
+ */
+struct pool_futures {
+    struct pool_job *head;
+    struct pool_job *tail;
+    /* Futures not done yet, counted down by their threads. */
+    long running;
+    struct fflisp_ctx **spent;
+    int nspent;
+    int spent_size;
+    /* Tables of hash tables the adopted results replaced. */
+    struct hash_table **tables;
+    int ntables;
+    int tables_size;
+};
+
+/* Slots of a deque, a grown deque keeps the old ones for thieves. */
+struct pool_ring {
+    long size;
+    struct pool_ring *prev;
+    struct pool_job *slots[];
+};
+
+struct pool_deque {
+    long top;
+    long bottom;
+    struct pool_ring *ring;
+};
+
+/* Objects moved by an adoption, they go into the heap at the end. */
+struct pool_moves {
+    struct lispobj **data;
+    long length;
+    long size;
+    struct hash_table **tables;
+    long ntables;
+    long tables_size;
+};
+
+struct pool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int nthreads;
+    struct pool_deque *deques;
+    /* Jobs published by threads without a deque. */
+    struct pool_job *queue_head;
+    struct pool_job *queue_tail;
+    long queued;
+    /* Threads asleep, and a counter they wait to change. */
+    int sleepers;
+    unsigned long epoch;
+    /* Contexts for jobs to run in. */
+    struct fflisp_ctx **spare;
+    int nspare;
+    int spare_size;
+};
+
+static struct pool pool = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+};
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/* Deque of the thread, NULL unless it's a pool thread. */
+static __thread struct pool_deque *pool_self = NULL;
+/* Jobs running nested on the C stack of the thread. */
+static __thread int pool_depth = 0;
+
+static struct pool_ring *ring_new(long size)
+{
+    struct pool_ring *r;
+
+    r = malloc(sizeof(struct pool_ring) + sizeof(struct pool_job *) * size);
+    r->size = size;
+    r->prev = NULL;
+
+    return r;
+}
+
+static struct pool_ring *deque_grow(struct pool_deque *d, struct pool_ring *r,
+                                    long top, long bottom)
+{
+    struct pool_ring *n = ring_new(r->size * 2);
+    long i;
+
+    for(i = top; i < bottom; i++) {
+        n->slots[i & (n->size - 1)] = r->slots[i & (r->size - 1)];
+    }
+    n->prev = r;
+    __atomic_store_n(&d->ring, n, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+/* Owner only. */
+static void deque_push(struct pool_deque *d, struct pool_job *job)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    struct pool_ring *r = __atomic_load_n(&d->ring, __ATOMIC_RELAXED);
+
+    if(b - t >= r->size)
+        r = deque_grow(d, r, t, b);
+    __atomic_store_n(&r->slots[b & (r->size - 1)], job, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+
+    return;
+}
+
+/* Owner only, the newest job. */
+static struct pool_job *deque_pop(struct pool_deque *d)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    struct pool_ring *r = __atomic_load_n(&d->ring, __ATOMIC_RELAXED);
+    struct pool_job *job = NULL;
+    long t;
+
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if(t <= b) {
+        job = __atomic_load_n(&r->slots[b & (r->size - 1)], __ATOMIC_RELAXED);
+        if(t == b) {
+            /* The last one, a thief may be taking it. */
+            if(!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED))
+                job = NULL;
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+
+    return job;
+}
+
+/* Any thread, the oldest job. NULL if empty or another thief won. */
+static struct pool_job *deque_steal(struct pool_deque *d)
+{
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE), b;
+    struct pool_ring *r;
+    struct pool_job *job;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if(t >= b)
+        return NULL;
+
+    r = __atomic_load_n(&d->ring, __ATOMIC_ACQUIRE);
+    job = __atomic_load_n(&r->slots[t & (r->size - 1)], __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+
+    return job;
+}
+
+/* Owner only, the newest job without taking it. */
+static struct pool_job *deque_peek(struct pool_deque *d)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    struct pool_ring *r = __atomic_load_n(&d->ring, __ATOMIC_RELAXED);
+
+    if(t >= b)
+        return NULL;
+
+    return __atomic_load_n(&r->slots[(b - 1) & (r->size - 1)],
+                           __ATOMIC_RELAXED);
+}
+
+static int deque_empty(struct pool_deque *d)
+{
+    return __atomic_load_n(&d->top, __ATOMIC_ACQUIRE) >=
+        __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+}
+
+static int pool_has_work(void)
+{
+    int i;
+
+    if(__atomic_load_n(&pool.queued, __ATOMIC_ACQUIRE) > 0)
+        return 1;
+    for(i = 0; i < pool.nthreads; i++) {
+        if(!deque_empty(&pool.deques[i]))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Appends a job to the queue of the pool. */
+static void queue_put(struct pool_job *job)
+{
+    job->home = NULL;
+    job->queued = NULL;
+
+    pthread_mutex_lock(&pool.lock);
+    if(pool.queue_tail != NULL) {
+        pool.queue_tail->queued = job;
+    } else {
+        pool.queue_head = job;
+    }
+    pool.queue_tail = job;
+    __atomic_store_n(&pool.queued, pool.queued + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&pool.lock);
+
+    return;
+}
+
+/* Idle threads: own jobs first, newest first; then the queue, then
+   the others. */
+static struct pool_job *pool_take(void)
+{
+    struct pool_job *job = NULL;
+    int i, start;
+
+    if((job = deque_pop(pool_self)) != NULL)
+        return job;
+    start = pool_self - pool.deques + 1;
+
+    if(__atomic_load_n(&pool.queued, __ATOMIC_ACQUIRE) > 0) {
+        pthread_mutex_lock(&pool.lock);
+        if((job = pool.queue_head) != NULL) {
+            if((pool.queue_head = job->queued) == NULL)
+                pool.queue_tail = NULL;
+            __atomic_store_n(&pool.queued, pool.queued - 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&pool.lock);
+        if(job != NULL)
+            return job;
+    }
+
+    for(i = 0; i < pool.nthreads; i++) {
+        job = deque_steal(&pool.deques[(start + i) % pool.nthreads]);
+        if(job != NULL)
+            return job;
+    }
+
+    return NULL;
+}
+
+/*
+ * Whether a thread waiting for job x, or for the pieces of group g
+ * if x is NULL, may run job y: it's one of them, or made under one
+ * unless the thread is as deep as jobs nest.
+ */
+static int pool_related(struct pool_job *y, struct pool_group *g,
+                        struct pool_job *x)
+{
+    int nested = pool_depth < POOL_NESTING;
+
+    for(; y != NULL; y = nested ? y->parent : NULL) {
+        if(x != NULL ? y == x : y->group == g)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* With the lock held, the oldest related job of the queue. */
+static struct pool_job *queue_find(struct pool_group *g, struct pool_job *x,
+                                   int take)
+{
+    struct pool_job *job, *last = NULL;
+
+    for(job = pool.queue_head; job != NULL; last = job, job = job->queued) {
+        if(!pool_related(job, g, x))
+            continue;
+        if(take) {
+            if(last != NULL) {
+                last->queued = job->queued;
+            } else {
+                pool.queue_head = job->queued;
+            }
+            if(pool.queue_tail == job)
+                pool.queue_tail = last;
+            __atomic_store_n(&pool.queued, pool.queued - 1, __ATOMIC_RELEASE);
+        }
+
+        return job;
+    }
+
+    return NULL;
+}
+
+/* Wakes the sleepers, if any, after new jobs or a finished one. */
+static void pool_signal(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&pool.sleepers, __ATOMIC_SEQ_CST) == 0)
+        return;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.epoch++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    return;
+}
+
+/* A job stolen from deque d, handed back to the pool if unrelated. */
+static struct pool_job *pool_steal_related(struct pool_deque *d,
+                                           struct pool_group *g,
+                                           struct pool_job *x)
+{
+    struct pool_job *job;
+
+    if(d == NULL || d == pool_self || (job = deque_steal(d)) == NULL)
+        return NULL;
+    if(pool_related(job, g, x))
+        return job;
+
+    queue_put(job);
+    pool_signal();
+
+    return NULL;
+}
+
+/*
+ * A job for a thread waiting for job x, or for the pieces of group
+ * g: one of the current context, from the bottom of the deque of the
+ * thread, where the jobs of outer frames are below it; or a related
+ * one, see pool_related(), from the queue or from the top of the
+ * deque of a thread running what it waits for.
+ */
+static struct pool_job *pool_take_related(struct pool_group *g,
+                                          struct pool_job *x)
+{
+    struct pool_job *job;
+
+    if(pool_self != NULL && (job = deque_pop(pool_self)) != NULL) {
+        if(job->owner == ctx)
+            return job;
+        deque_push(pool_self, job);
+    }
+
+    if(__atomic_load_n(&pool.queued, __ATOMIC_ACQUIRE) > 0) {
+        pthread_mutex_lock(&pool.lock);
+        job = queue_find(g, x, 1);
+        pthread_mutex_unlock(&pool.lock);
+        if(job != NULL)
+            return job;
+    }
+
+    if(pool_depth >= POOL_NESTING)
+        return NULL;
+    if(x != NULL) {
+        if(__atomic_load_n(&x->state, __ATOMIC_ACQUIRE) == JOB_RUNNING)
+            return pool_steal_related(x->runner, g, x);
+
+        return NULL;
+    }
+    for(job = g->head; job != NULL; job = job->next) {
+        if(__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) == JOB_RUNNING &&
+           (x = pool_steal_related(job->runner, g, NULL)) != NULL)
+            return x;
+    }
+
+    return NULL;
+}
+
+/* Until group g or job x is done; the pool threads wait forever. */
+static int pool_done(struct pool_group *g, struct pool_job *x)
+{
+    if(g != NULL)
+        return __atomic_load_n(&g->remaining, __ATOMIC_ACQUIRE) == 0;
+    if(x != NULL)
+        return __atomic_load_n(&x->state, __ATOMIC_ACQUIRE) >= JOB_DONE;
+
+    return 0;
+}
+
+/* With the lock held, whether pool_take_related() may find a job. */
+static int pool_has_related(struct pool_group *g, struct pool_job *x)
+{
+    struct pool_job *job;
+
+    if(pool_self != NULL && (job = deque_peek(pool_self)) != NULL &&
+       job->owner == ctx)
+        return 1;
+    if(queue_find(g, x, 0) != NULL)
+        return 1;
+    if(pool_depth >= POOL_NESTING)
+        return 0;
+
+    for(job = x != NULL ? x : g->head; job != NULL;
+        job = x != NULL ? NULL : job->next) {
+        if(__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) == JOB_RUNNING &&
+           job->runner != NULL && job->runner != pool_self &&
+           !deque_empty(job->runner))
+            return 1;
+    }
+
+    return 0;
+}
+
+static void pool_sleep(struct pool_group *g, struct pool_job *x)
+{
+    unsigned long epoch;
+    int work;
+
+    pthread_mutex_lock(&pool.lock);
+    __atomic_add_fetch(&pool.sleepers, 1, __ATOMIC_SEQ_CST);
+    epoch = pool.epoch;
+    work = g == NULL && x == NULL ? pool_has_work() : pool_has_related(g, x);
+    if(!pool_done(g, x) && !work) {
+        while(pool.epoch == epoch) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+    }
+    __atomic_sub_fetch(&pool.sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool.lock);
+
+    return;
+}
+
+/* The worker sees what the owner does, its heap holds the rest. */
+static void pool_lend(struct fflisp_ctx *w, struct fflisp_ctx *owner)
+{
+    struct hcons_table *table = &owner->hcons;
+
+    w->symbol_table = symbol_table_new(owner->symbol_table);
+    w->environment = owner->environment;
+    w->t = owner->t;
+    memcpy(w->errors, owner->errors, sizeof(w->errors));
+    memcpy(w->symbols, owner->symbols, sizeof(w->symbols));
+    w->read_hash_cons = owner->read_hash_cons;
+
+    if(table->size > 0) {
+        w->hcons = *table;
+        w->hcons.slots = malloc(sizeof(struct lispobj *) * table->size);
+        memcpy(w->hcons.slots, table->slots,
+               sizeof(struct lispobj *) * table->size);
+    }
+
+    return;
+}
+
+/* A heap and a stack, the rest is lent by the owner of the job. */
+static struct fflisp_ctx *pool_ctx_get(struct fflisp_ctx *owner)
+{
+    struct fflisp_ctx *w = NULL;
+
+    pthread_mutex_lock(&pool.lock);
+    if(pool.nspare > 0)
+        w = pool.spare[--pool.nspare];
+    pthread_mutex_unlock(&pool.lock);
+
+    if(w == NULL) {
+        w = malloc(sizeof(struct fflisp_ctx));
+        memset(w, 0, sizeof(struct fflisp_ctx));
+        w->heap = heap_init();
+        w->stack = stack_init();
+    }
+    pool_lend(w, owner);
+
+    return w;
+}
+
+/* Frees what the job left in the context and keeps it for another. */
+static void pool_ctx_put(struct fflisp_ctx *w)
+{
+    struct fflisp_ctx *prev = fflisp_ctx_enter(w);
+
+    w->job = NULL;
+    w->heap->readers = 0;
+    heap_clean();
+    w->stack->index = 0;
+    w->stack->size = STACK_SIZE;
+    w->handlers = NULL;
+    symbol_table_free(w->symbol_table);
+    w->symbol_table = NULL;
+    free(w->hcons.slots);
+    memset(&w->hcons, 0, sizeof(struct hcons_table));
+    if(w->stdin_reader != NULL) {
+        reader_close(w->stdin_reader);
+        w->stdin_reader = NULL;
+    }
+    fflisp_ctx_enter(prev);
+
+    pthread_mutex_lock(&pool.lock);
+    if(pool.nspare == pool.spare_size) {
+        pool.spare_size = pool.spare_size ? pool.spare_size * 2 : 16;
+        pool.spare = realloc(pool.spare,
+                             sizeof(struct fflisp_ctx *) * pool.spare_size);
+    }
+    pool.spare[pool.nspare++] = w;
+    pthread_mutex_unlock(&pool.lock);
+
+    return;
+}
+
+static void pool_eval(struct pool_job *job)
+{
+    struct handler h;
+    struct lispobj *body, *ret = NULL;
+
+    handler_push(&h);
+    if(setjmp(h.jmp)) {
+        job->condition = h.condition;
+        if(job->task != NULL)
+            __atomic_store_n(&job->group->failed, 1, __ATOMIC_RELEASE);
+
+        return;
+    }
+
+    if(job->task != NULL) {
+        ret = job->task->run(job->task, job->index);
+    } else {
+        for(body = job->body; body != NULL; body = CDR(body)) {
+            heap_release(ret);
+            ret = eval(CAR(body), job->env);
+        }
+    }
+    job->result = ret;
+    handler_pop(&h);
+
+    return;
+}
+
+/*
+ * Runs a job on the C stack of the thread. A nested one gets what's
+ * left of the evaluator stack of the context it runs under, less a
+ * share for the C stack the frames in between take; a job which
+ * would go past that or past POOL_NESTING fails with a stack
+ * overflow instead of overflowing the C stack.
+ */
+static void pool_execute(struct pool_job *job)
+{
+    struct pool_group *g = job->group;
+    struct fflisp_ctx *prev = ctx;
+    long room = STACK_SIZE;
+
+    job->runner = pool_self;
+    __atomic_store_n(&job->state, JOB_RUNNING, __ATOMIC_RELEASE);
+
+    if(prev != NULL)
+        room = prev->stack->size - prev->stack->index;
+    room -= POOL_NESTING_COST;
+
+    if(pool_depth >= POOL_NESTING || room < POOL_NESTING_COST) {
+        job->condition = job->owner->errors[E_STACK];
+        if(g != NULL)
+            __atomic_store_n(&g->failed, 1, __ATOMIC_RELEASE);
+    } else {
+        job->ctx = pool_ctx_get(job->owner);
+        job->ctx->stack->size = room;
+        job->ctx->job = job;
+        fflisp_ctx_enter(job->ctx);
+        pool_depth++;
+        if(g == NULL || !__atomic_load_n(&g->failed, __ATOMIC_ACQUIRE))
+            pool_eval(job);
+        /* Futures the job made and didn't touch are joined before it's
+           done, the owner adopts what they made with the result. */
+        pool_drain();
+        pool_depth--;
+        fflisp_ctx_enter(prev);
+    }
+
+    if(g != NULL) {
+        __atomic_store_n(&job->state, JOB_DONE, __ATOMIC_RELEASE);
+        /* The group may be gone once it's done. */
+        __atomic_sub_fetch(&g->remaining, 1, __ATOMIC_ACQ_REL);
+    } else {
+        /* The futures of the owner may be gone once it's done. */
+        __atomic_sub_fetch(&job->owner->futures->running, 1,
+                           __ATOMIC_ACQ_REL);
+        __atomic_store_n(&job->state, JOB_DONE, __ATOMIC_RELEASE);
+    }
+    pool_signal();
+
+    return;
+}
+
+/* Runs jobs until g or x is done, related ones unless it's idle. */
+static void pool_help(struct pool_group *g, struct pool_job *x)
+{
+    struct pool_job *job;
+
+    while(!pool_done(g, x)) {
+        job = g == NULL && x == NULL ? pool_take() : pool_take_related(g, x);
+        if(job != NULL) {
+            pool_execute(job);
+        } else {
+            pool_sleep(g, x);
+        }
+    }
+
+    return;
+}
+
+static void *pool_thread(void *arg)
+{
+    pool_self = arg;
+    pool_help(NULL, NULL);
+
+    return NULL;
+}
+
+/*
+ * A thread per CPU the process may run on, the caller counts as one.
+ * FFLISP_WORKERS=n sets the number instead.
+ */
+static void pool_init(void)
+{
+    char *env = getenv("FFLISP_WORKERS");
+    cpu_set_t cpus;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int n = 1, i;
+
+    if(env != NULL) {
+        n = atoi(env);
+    } else if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+        n = CPU_COUNT(&cpus);
+    }
+    if(n < 1) {
+        n = 1;
+    }
+
+    /* Threads look at every deque, so they are all there first. The
+       deque of a thread which failed to start stays empty. */
+    pool.nthreads = n - 1;
+    pool.deques = calloc(n, sizeof(struct pool_deque));
+    for(i = 0; i < pool.nthreads; i++) {
+        pool.deques[i].ring = ring_new(POOL_DEQUE_SIZE);
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, POOL_STACK_SIZE);
+    for(i = 0; i < pool.nthreads; i++) {
+        if(pthread_create(&thread, &attr, pool_thread, &pool.deques[i]) != 0)
+            break;
+    }
+    pthread_attr_destroy(&attr);
+
+    return;
+}
+
+int pool_workers(void)
+{
+    pthread_once(&pool_once, pool_init);
+
+    return pool.nthreads + 1;
+}
+
+static void group_add(struct pool_group *g, struct pool_job *job)
+{
+    job->group = g;
+    job->next = NULL;
+    if(g->tail != NULL) {
+        g->tail->next = job;
+    } else {
+        g->head = job;
+    }
+    g->tail = job;
+    g->remaining++;
+
+    return;
+}
+
+/* Onto the deque of the thread, or the queue if it has none. */
+static void pool_publish(struct pool_job *job)
+{
+    __atomic_store_n(&job->state, JOB_QUEUED, __ATOMIC_RELEASE);
+    if(pool_self != NULL) {
+        job->home = pool_self;
+        deque_push(pool_self, job);
+    } else {
+        queue_put(job);
+    }
+
+    return;
+}
+
+static int pool_owned(struct heap *h, struct lispobj *obj)
+{
+    int i = obj->heap_index;
+
+    return i >= 0 && i < h->index && h->data[i] == obj;
+}
+
+static void pool_move(struct pool_moves *m, struct heap *h,
+                      struct lispobj *obj)
+{
+    h->data[obj->heap_index] = NULL;
+    obj->heap_index = POOL_MOVING;
+
+    if(m->length == m->size) {
+        m->size = m->size ? m->size * 2 : 256;
+        m->data = realloc(m->data, sizeof(struct lispobj *) * m->size);
+    }
+    m->data[m->length++] = obj;
+
+    return;
+}
+
+/* Made by a future of the context which is done but not joined. */
+static int pool_unjoined(struct lispobj *obj)
+{
+    struct pool_job *job;
+
+    if(ctx->futures == NULL)
+        return 0;
+    for(job = ctx->futures->head; job != NULL; job = job->next) {
+        if(__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) == JOB_DONE &&
+           job->ctx != NULL && pool_owned(job->ctx->heap, obj))
+            return 1;
+    }
+
+    return 0;
+}
+
+static struct lispobj *pool_adopt(struct pool_moves*, struct fflisp_ctx*,
+                                  struct lispobj*);
+
+/* Built anew, keys made by the job may hash differently now. */
+static void pool_adopt_table(struct pool_moves *m, struct fflisp_ctx *w,
+                             struct lispobj *obj)
+{
+    struct hash_table *old = HASHTABLE_VALUE(obj), *t;
+    struct hash_part *parts[] = {&old->cur, &old->old};
+    struct hash_entry *e;
+    struct lispobj *key, *value;
+    long i;
+    int j;
+
+    t = hash_table_new(old->test);
+    for(j = 0; j < 2; j++) {
+        for(i = 0; i < parts[j]->size; i++) {
+            e = &parts[j]->entries[i];
+            if(e->state != HASH_SLOT_FULL)
+                continue;
+
+            key = pool_adopt(m, w, e->key);
+            value = pool_adopt(m, w, e->value);
+            hash_table_put(t, key, value);
+            /* The old table's references, it goes without releasing. */
+            heap_release(key);
+            heap_release(value);
+        }
+    }
+    /* Another future may still be reading the old one. */
+    if(m->ntables == m->tables_size) {
+        m->tables_size = m->tables_size ? m->tables_size * 2 : 16;
+        m->tables = realloc(m->tables,
+                            sizeof(struct hash_table *) * m->tables_size);
+    }
+    m->tables[m->ntables++] = old;
+    HASHTABLE_VALUE(obj) = t;
+
+    return;
+}
+
+/*
+ * Moves an object made in the context w of a job into the heap of
+ * the current context, with everything it refers to; objects from
+ * elsewhere stay. Returns what a reference to obj becomes, counted:
+ * the job didn't count objects it didn't make. A symbol of the job
+ * is the current context's one of that name, if there is one by now.
+ */
+static struct lispobj *pool_adopt(struct pool_moves *m, struct fflisp_ctx *w,
+                                  struct lispobj *obj)
+{
+    struct heap *h;
+    struct lispobj *cell, *next;
+    struct pool_job *job;
+    int i;
+
+    if(obj == NULL || obj->heap_index == POOL_MOVING)
+        return obj;
+    if(w == NULL || !pool_owned(w->heap, obj)) {
+        /* A job doesn't count what another job made, so it's counted
+           here for the future which made it, adopted later. */
+        if(ctx->job != NULL && pool_unjoined(obj)) {
+            OBJ_REFS(obj)++;
+            return obj;
+        }
+        return heap_grab(obj);
+    }
+
+    h = w->heap;
+    switch(OBJ_TYPE(obj)) {
+    case SYMBOL:
+        if((next = symbol_table_lookup(SYMBOL_VALUE(obj))) != NULL)
+            return heap_grab(next);
+
+        pool_move(m, h, obj);
+        symbol_table_intern(obj);
+
+        break;
+    case CONS:
+        pool_move(m, h, obj);
+        /* Iterative along the list, recursive into elements. */
+        for(cell = obj; ; cell = next) {
+            CAR(cell) = pool_adopt(m, w, CAR(cell));
+            next = CDR(cell);
+            if(next == NULL || OBJ_TYPE(next) != CONS ||
+               next->heap_index == POOL_MOVING || !pool_owned(h, next)) {
+                CDR(cell) = pool_adopt(m, w, next);
+                break;
+            }
+            pool_move(m, h, next);
+        }
+
+        break;
+    case VECTOR:
+        pool_move(m, h, obj);
+        for(i = 0; i < VECTOR_LENGTH(obj); i++) {
+            VECTOR_DATA(obj)[i] = pool_adopt(m, w, VECTOR_DATA(obj)[i]);
+        }
+
+        break;
+    case STRING:
+        pool_move(m, h, obj);
+        if(STRING_VALUE(obj) != NULL && STRING_VALUE(obj)->parent != NULL) {
+            STRING_VALUE(obj)->parent =
+                pool_adopt(m, w, STRING_VALUE(obj)->parent);
+        }
+
+        break;
+    case HASHTABLE:
+        pool_move(m, h, obj);
+        if(HASHTABLE_VALUE(obj) != NULL)
+            pool_adopt_table(m, w, obj);
+
+        break;
+    case FUTURE:
+        /* Joined by the job already, so what it holds is in w. */
+        pool_move(m, h, obj);
+        job = FUTURE_VALUE(obj);
+        job->owner = ctx;
+        job->result = pool_adopt(m, w, job->result);
+        job->condition = pool_adopt(m, w, job->condition);
+
+        break;
+    default:
+        pool_move(m, h, obj);
+
+        break;
+    }
+
+    return obj;
+}
+
+/*
+ * Adopts the result of a job. Tables it replaced go with its context
+ * if the job is a future, see struct pool_futures; the pieces of a
+ * task aren't read by anyone else.
+ */
+static void pool_adopt_job(struct pool_job *job)
+{
+    struct pool_moves m;
+    struct pool_futures *f = ctx->futures;
+    long i;
+
+    memset(&m, 0, sizeof(struct pool_moves));
+    job->result = pool_adopt(&m, job->ctx, job->result);
+    job->condition = pool_adopt(&m, job->ctx, job->condition);
+
+    for(i = 0; i < m.length; i++) {
+        heap_add(m.data[i]);
+    }
+    for(i = 0; i < m.ntables; i++) {
+        if(job->task != NULL) {
+            hash_table_drop(m.tables[i]);
+            continue;
+        }
+        if(f->ntables == f->tables_size) {
+            f->tables_size = f->tables_size ? f->tables_size * 2 : 16;
+            f->tables = realloc(f->tables,
+                                sizeof(struct hash_table *) * f->tables_size);
+        }
+        f->tables[f->ntables++] = m.tables[i];
+    }
+    free(m.data);
+    free(m.tables);
+
+    return;
+}
+
+/* Once no future of the context runs, nobody reads what's spent. */
+static void pool_reuse(struct pool_futures *f)
+{
+    int i;
+
+    for(i = 0; i < f->nspent; i++) {
+        pool_ctx_put(f->spent[i]);
+    }
+    f->nspent = 0;
+    for(i = 0; i < f->ntables; i++) {
+        hash_table_drop(f->tables[i]);
+    }
+    f->ntables = 0;
+
+    return;
+}
+
+/*
+ * Waits for a future of the context, running jobs meanwhile, and
+ * adopts its result. The future lets go of the context then, what
+ * the context let go of meanwhile goes once no future reads it.
+ */
+static void pool_join(struct pool_job *job)
+{
+    struct pool_futures *f = ctx->futures;
+    struct lispobj *future = job->future;
+
+    pool_help(NULL, job);
+    pool_adopt_job(job);
+
+    if(job->prev != NULL) {
+        job->prev->next = job->next;
+    } else {
+        f->head = job->next;
+    }
+    if(job->next != NULL) {
+        job->next->prev = job->prev;
+    } else {
+        f->tail = job->prev;
+    }
+    job->next = job->prev = NULL;
+    __atomic_store_n(&job->state, JOB_JOINED, __ATOMIC_RELEASE);
+
+    if(job->ctx != NULL) {
+        if(f->nspent == f->spent_size) {
+            f->spent_size = f->spent_size ? f->spent_size * 2 : 16;
+            f->spent = realloc(f->spent,
+                               sizeof(struct fflisp_ctx *) * f->spent_size);
+        }
+        f->spent[f->nspent++] = job->ctx;
+        job->ctx = NULL;
+    }
+    if(__atomic_load_n(&f->running, __ATOMIC_ACQUIRE) == 0)
+        pool_reuse(f);
+
+    heap_release(job->body);
+    heap_release(job->env);
+    job->body = job->env = NULL;
+    job->future = NULL;
+    ctx->heap->readers--;
+    heap_sweep();
+    /* Last, the future may go and the job with it. */
+    heap_release(future);
+
+    return;
+}
+
+/*
+ * (future body ...), the body starts running on the pool right away.
+ * Done futures nobody touched are joined as new ones come, their
+ * contexts are reused sooner so.
+ */
+struct lispobj *pool_future(struct lispobj *body, struct lispobj *env)
+{
+    struct pool_futures *f;
+    struct pool_job *job;
+    struct lispobj *obj;
+
+    pool_workers();
+    if(ctx->futures == NULL) {
+        ctx->futures = malloc(sizeof(struct pool_futures));
+        memset(ctx->futures, 0, sizeof(struct pool_futures));
+    }
+    f = ctx->futures;
+    while(f->head != NULL &&
+          __atomic_load_n(&f->head->state, __ATOMIC_ACQUIRE) == JOB_DONE) {
+        pool_join(f->head);
+    }
+
+    job = malloc(sizeof(struct pool_job));
+    memset(job, 0, sizeof(struct pool_job));
+    job->body = heap_grab(body);
+    job->env = heap_grab(env);
+    job->owner = ctx;
+    job->parent = ctx->job;
+
+    obj = object_create(FUTURE, NULL);
+    FUTURE_VALUE(obj) = job;
+    job->future = heap_grab(obj);
+
+    job->prev = f->tail;
+    if(f->tail != NULL) {
+        f->tail->next = job;
+    } else {
+        f->head = job;
+    }
+    f->tail = job;
+    ctx->heap->readers++;
+    __atomic_add_fetch(&f->running, 1, __ATOMIC_ACQ_REL);
+
+    pool_publish(job);
+    pool_signal();
+
+    return obj;
+}
+
+/*
+ * Value of a future, waiting for it if it's not done; other objects
+ * are their own value. Signals the condition the body signalled.
+ */
+struct lispobj *pool_touch(struct lispobj *obj)
+{
+    struct pool_job *job;
+
+    if(obj == NULL || OBJ_TYPE(obj) != FUTURE)
+        return obj;
+
+    job = FUTURE_VALUE(obj);
+    if(job->owner == ctx &&
+       __atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != JOB_JOINED) {
+        pool_join(job);
+    } else {
+        /* Another context's, a sibling's or one of an outer job. */
+        pool_help(NULL, job);
+    }
+    if(job->condition != NULL)
+        error_signal(job->condition);
+
+    return job->result;
+}
+
+/* Of a future which goes, the job is done and joined. */
+void pool_future_free(struct pool_job *job)
+{
+    heap_release(job->result);
+    heap_release(job->condition);
+    free(job);
+
+    return;
+}
+
+/* Joins every future of the context, before it or its heap goes. */
+void pool_drain(void)
+{
+    struct pool_futures *f = ctx->futures;
+
+    if(f == NULL)
+        return;
+
+    while(f->head != NULL) {
+        pool_join(f->head);
+    }
+    pool_reuse(f);
+    free(f->spent);
+    free(f->tables);
+    free(f);
+    ctx->futures = NULL;
+
+    return;
+}
+
+/*
+ * Runs the task on the pool and puts the object of every piece into
+ * the slots of results, in order. Results must be the caller's and
+ * its slots NULL.
+ *
+ * Returns 0 without running anything if there are no workers.
+ * Signals the condition of the first piece which signalled.
+ */
+int pool_run(struct pool_task *t, struct lispobj *results)
+{
+    struct pool_group g;
+    struct pool_job *jobs, *job;
+    struct lispobj *condition = NULL;
+    long k;
+
+    if(pool_workers() < 2)
+        return 0;
+
+    memset(&g, 0, sizeof(struct pool_group));
+    jobs = calloc(t->count, sizeof(struct pool_job));
+    for(k = 0; k < t->count; k++) {
+        jobs[k].task = t;
+        jobs[k].index = k;
+        jobs[k].owner = ctx;
+        jobs[k].parent = ctx->job;
+        group_add(&g, &jobs[k]);
+    }
+    for(job = g.head; job != NULL; job = job->next) {
+        pool_publish(job);
+    }
+    pool_signal();
+    pool_help(&g, NULL);
+
+    /* Nobody else reads what the pieces made, contexts go right away. */
+    for(k = 0; k < t->count; k++) {
+        pool_adopt_job(&jobs[k]);
+        if(jobs[k].ctx != NULL)
+            pool_ctx_put(jobs[k].ctx);
+    }
+
+    for(k = 0; k < t->count; k++) {
+        if(condition == NULL && jobs[k].condition != NULL) {
+            condition = jobs[k].condition;
+        } else {
+            heap_release(jobs[k].condition);
+        }
+    }
+    for(k = 0; k < t->count; k++) {
+        if(condition == NULL) {
+            VECTOR_DATA(results)[k] = jobs[k].result;
+        } else {
+            heap_release(jobs[k].result);
+        }
+    }
+    free(jobs);
+
+    if(condition != NULL) {
+        /* The handler grabs it again, the stack lets the adopted
+           reference go. */
+        stack_push(condition);
+        error_signal(condition);
+    }
+
+    return 1;
+}
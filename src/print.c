@@ -1,85 +1,313 @@
 /* This file is licensed under the terms of MIT license, see LICENSE file. */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "../include/object.h"
+#include "../include/subr.h"
+#include "../include/bignum.h"
+#include "../include/array.h"
+#include "../include/hashtable.h"
+#include "../include/heap.h"
+#include "../include/print.h"
 
-static void print_list(struct lispobj*);
+static void print_object(struct printer*, struct lispobj*);
+static void print_list(struct printer*, struct lispobj*);
 
-int print_bracket = 1;
+static void print_flush(struct printer *p)
+{
+    fwrite(p->data, 1, p->length, p->stream);
+    p->length = 0;
+
+    return;
+}
+
+static void print_put(struct printer *p, const char *s, long n)
+{
+    if(p->length + n > p->size) {
+        if(p->stream != NULL) {
+            print_flush(p);
+            if(n > p->size) {
+                /* Too long to be worth a copy, a huge string. */
+                fwrite(s, 1, n, p->stream);
+                return;
+            }
+        } else {
+            while(p->length + n > p->size) {
+                p->size *= 2;
+            }
+            p->data = realloc(p->data, p->size);
+        }
+    }
+    memcpy(p->data + p->length, s, n);
+    p->length += n;
+
+    return;
+}
+
+static void print_puts(struct printer *p, const char *s)
+{
+    print_put(p, s, strlen(s));
+
+    return;
+}
+
+static void print_long(struct printer *p, long value)
+{
+    char buf[24], *s = buf + sizeof(buf);
+    unsigned long u = value < 0 ? -(unsigned long) value : value;
+
+    do {
+        *--s = '0' + u % 10;
+        u /= 10;
+    } while(u != 0);
+    if(value < 0) {
+        *--s = '-';
+    }
+    print_put(p, s, buf + sizeof(buf) - s);
+
+    return;
+}
+
+static void printer_init(struct printer *p, char *data, long size,
+                         FILE *stream)
+{
+    p->data = data;
+    p->length = 0;
+    p->size = size;
+    p->stream = stream;
+    p->proc = NULL;
+    p->nil = NULL;
+
+    return;
+}
+
+void print_stream(struct lispobj *obj, FILE *stream)
+{
+    struct printer p;
+    char data[PRINT_BUFFER_SIZE];
+
+    printer_init(&p, data, sizeof(data), stream);
+    print_object(&p, obj);
+    print_flush(&p);
+
+    return;
+}
 
 void print(struct lispobj *obj)
 {
+    print_stream(obj, stdout);
+
+    return;
+}
+
+/* What print() would write, as a string. */
+struct lispobj *print_to_string(struct lispobj *obj)
+{
+    struct printer p;
+    struct lispobj *str;
+
+    printer_init(&p, malloc(PRINT_STRING_SIZE), PRINT_STRING_SIZE, NULL);
+    print_object(&p, obj);
+    str = string(p.data, p.length);
+    free(p.data);
+
+    return str;
+}
+
+/*
+ * Appends the printed object to a malloc'd buffer of *size bytes
+ * holding *length, which grows if needed.
+ */
+void print_append(struct lispobj *obj, char **data, long *length, long *size)
+{
+    struct printer p;
+
+    printer_init(&p, *data, *size, NULL);
+    p.length = *length;
+    print_object(&p, obj);
+    *data = p.data;
+    *length = p.length;
+    *size = p.size;
+
+    return;
+}
+
+#define IS_PROCEDURE(p, x)                                              \
+    ((p)->proc != NULL && OBJ_TYPE((x)) == CONS && CAR((x)) == (p)->proc)
+
+static void print_procedure(struct printer *p, struct lispobj *obj)
+{
+    char buf[32];
+
+    print_puts(p, "<procedure ");
+    if(CADR(obj) != NULL && OBJ_TYPE(CADR(obj)) == CONS) {
+        /* Not print_object(), a parameter may be called PROC. */
+        print_list(p, CADR(obj));
+    } else if(CADR(obj) != p->nil) {
+        print_object(p, CADR(obj));
+    } else {
+        print_puts(p, "()");
+    }
+    snprintf(buf, sizeof(buf), " %p>", (void *) CADDDR(obj));
+    print_puts(p, buf);
+
+    return;
+}
+
+/* Iterative along the list, only elements recurse. */
+static void print_list(struct printer *p, struct lispobj *obj)
+{
+    print_put(p, "(", 1);
+    for(;;) {
+        print_object(p, CAR(obj));
+
+        if((obj = CDR(obj)) == NULL)
+            break;
+        if(OBJ_TYPE(obj) != CONS || IS_PROCEDURE(p, obj)) {
+            print_put(p, " . ", 3);
+            print_object(p, obj);
+            break;
+        }
+        print_put(p, " ", 1);
+    }
+    print_put(p, ")", 1);
+
+    return;
+}
+
+static void print_vector(struct printer *p, struct lispobj *obj)
+{
+    int i;
+
+    print_put(p, "#(", 2);
+    for(i = 0; i < VECTOR_LENGTH(obj); i++) {
+        if(i > 0) {
+            print_put(p, " ", 1);
+        }
+        print_object(p, VECTOR_DATA(obj)[i]);
+    }
+    print_put(p, ")", 1);
+
+    return;
+}
+
+static void print_object(struct printer *p, struct lispobj *obj)
+{
+    static char *tests[] = {"EQ", "EQL", "EQUAL"};
+    char buf[64], *digits;
+
 #ifdef __DEBUG_PRINT__
-    printf("[");
+    print_put(p, "[", 1);
 #endif /* __DEBUG_PRINT__ */
     if(obj == NULL) {
-        printf("NIL");
-    } else if(OBJ_TYPE(obj) == ERROR) {
-        printf("Error: %s", ERROR_VALUE(obj));
-    } else if(OBJ_TYPE(obj) == SYMBOL) {
-        printf("%s", SYMBOL_VALUE(obj));
-    } else if(OBJ_TYPE(obj) == NUMBER) {
-        printf("%d", NUMBER_VALUE(obj));
-    } else if(OBJ_TYPE(obj) == STRING) {
-        printf("\"%s\"", STRING_VALUE(obj));
+        print_put(p, "NIL", 3);
     } else {
-        if(CAR(obj) == NEW_SYMBOL("PROC")) {
-            printf("<procedure ");
-            if(CADR(obj) != NEW_SYMBOL("NIL")) {
-                print_list(CADR(obj));
+        switch(OBJ_TYPE(obj)) {
+        case ERROR:
+            print_puts(p, "Error: ");
+            print_puts(p, ERROR_VALUE(obj));
+
+            break;
+        case SYMBOL:
+            print_puts(p, SYMBOL_VALUE(obj));
+
+            break;
+        case NUMBER:
+            print_long(p, NUMBER_VALUE(obj));
+
+            break;
+        case FLOAT:
+            format_float(buf, FLOAT_VALUE(obj));
+            print_puts(p, buf);
+
+            break;
+        case BIGNUM:
+            digits = bignum_to_string(BIGNUM_VALUE(obj));
+            print_puts(p, digits);
+            free(digits);
+
+            break;
+        case STRING:
+            print_put(p, "\"", 1);
+            print_put(p, STRING_DATA(obj), STRING_LENGTH(obj));
+            print_put(p, "\"", 1);
+
+            break;
+        case HASHTABLE:
+            snprintf(buf, sizeof(buf), "<hash-table %s %ld>",
+                     tests[HASHTABLE_VALUE(obj)->test],
+                     HASHTABLE_VALUE(obj)->count);
+            print_puts(p, buf);
+
+            break;
+        case ARRAY:
+            snprintf(buf, sizeof(buf), "<%s-array %ld>",
+                     ARRAY_VALUE(obj)->kind == ARRAY_INT64 ?
+                     "int64" : "float64",
+                     ARRAY_VALUE(obj)->length);
+            print_puts(p, buf);
+
+            break;
+        case VECTOR:
+            print_vector(p, obj);
+
+            break;
+        case FUTURE:
+            print_puts(p, "<future>");
+
+            break;
+        case SUBR:
+            print_puts(p, "<primitive-procedure ");
+            print_puts(p, SUBR_VALUE(obj)->name);
+            print_put(p, ">", 1);
+
+            break;
+        default:
+            if(p->nil == NULL) {
+                /* Once per print, and not NEW_SYMBOL(): printing
+                   mustn't intern anything. NIL always exists. */
+                p->proc = symbol_table_lookup("PROC");
+                p->nil = symbol_table_lookup("NIL");
+            }
+            if(IS_PROCEDURE(p, obj)) {
+                print_procedure(p, obj);
             } else {
-                printf("()");
+                print_list(p, obj);
             }
-            printf(" %p>", CADDDR(obj));
-        } else if(CAR(obj) == NEW_SYMBOL("SUBR")) {
-            printf("<primitive-procedure %p>", CADR(obj));
-        } else {
-            print_list(obj);
+
+            break;
         }
     }
 #ifdef __DEBUG_PRINT__
-    if(obj != NULL) {
-        printf(" => %d]", OBJ_REFS(obj));
-    } else {
-        printf(" => nil]");
-    }
+    snprintf(buf, sizeof(buf), " => %d]", obj != NULL ? OBJ_REFS(obj) : 0);
+    print_puts(p, buf);
 #endif /* __DEBUG_PRINT__ */
+
     return;
 }
 
-static void print_list(struct lispobj *obj)
+/*
+ * The shortest representation which reads back to the same double,
+ * with a dot or an exponent so it reads back as FLOAT.
+ */
+void format_float(char *buf, double value)
 {
-    if(print_bracket) {
-        printf("(");
-    }
-    print_bracket = 0;
-
-    if(CAR(obj) != NULL && OBJ_TYPE(CAR(obj)) == CONS) {
-        printf("(");
-    }
-    
-    print(CAR(obj));
+    int precision;
 
-    if(CDR(obj) == NULL) {
-        printf(")");
-        print_bracket = 1;
-        return;
+    for(precision = 15; precision < 17; precision++) {
+        snprintf(buf, FLOAT_STRING_SIZE, "%.*g", precision, value);
+        if(strtod(buf, NULL) == value)
+            break;
     }
-    
-    if(OBJ_TYPE(CDR(obj)) == CONS) {
-        printf(" ");
-    } else {
-        printf(" . ");
+    if(precision == 17) {
+        snprintf(buf, FLOAT_STRING_SIZE, "%.17g", value);
     }
 
-    print_bracket = 0;
-    
-    print(CDR(obj));
-    if(!print_bracket) {
-        printf(")");
+    if(strpbrk(buf, ".eni") == NULL) { // not inf or nan either
+        strcat(buf, ".0");
     }
-    print_bracket = 1;
-    
+
     return;
 }
@@ -0,0 +1,417 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/subr.h"
+#include "../include/profile.h"
+
+/* The timer is the process's, so there is one profile at a time. */
+static struct profile *profiling = NULL;
+
+/* Applied things which aren't procedures, they fail right away. */
+static struct profile_proc unknown = {NULL, "?", 1};
+
+static unsigned long profile_hash(const void *key)
+{
+    return ((uintptr_t) key >> 4) * 0x9e3779b97f4a7c15UL;
+}
+
+/*
+ * Runs in the profiled thread between any two instructions of it,
+ * so it only reads the shadow stack and appends to the samples.
+ */
+static void profile_sample(int signum)
+{
+    struct profile *p = ctx != NULL ? ctx->profile : NULL;
+    long length;
+    int depth, i;
+
+    if(p == NULL)
+        return;
+
+    depth = p->depth < PROFILE_DEPTH ? p->depth : PROFILE_DEPTH;
+    i = depth > PROFILE_FRAMES ? depth - PROFILE_FRAMES : 0;
+
+    length = p->length;
+    if(length + (depth - i) + 1 > PROFILE_SAMPLES) {
+        p->lost++;
+        return;
+    }
+    for(; i < depth; i++) {
+        p->samples[length++] = p->stack[i];
+    }
+    p->samples[length++] = NULL;
+    p->length = length;
+
+    return;
+}
+
+static void profile_stacks_grow(struct profile *p)
+{
+    struct profile_stack *old = p->stacks;
+    long size = p->stacks_size, i, j;
+
+    p->stacks_size *= 2;
+    p->stacks = calloc(p->stacks_size, sizeof(struct profile_stack));
+    for(i = 0; i < size; i++) {
+        if(old[i].frames == NULL)
+            continue;
+        j = old[i].hash & (p->stacks_size - 1);
+        while(p->stacks[j].frames != NULL) {
+            j = (j + 1) & (p->stacks_size - 1);
+        }
+        p->stacks[j] = old[i];
+    }
+    free(old);
+
+    return;
+}
+
+static void profile_count(struct profile *p, struct profile_proc **frames,
+                          int length)
+{
+    struct profile_stack *s;
+    unsigned long hash = length;
+    long i;
+
+    for(i = 0; i < length; i++) {
+        hash = (hash ^ profile_hash(frames[i])) * 0x100000001b3UL;
+    }
+
+    /* An empty stack has frames too, it's what marks a used slot. */
+    i = hash & (p->stacks_size - 1);
+    for(s = &p->stacks[i]; s->frames != NULL; s = &p->stacks[i]) {
+        if(s->hash == hash && s->length == length &&
+           !memcmp(s->frames, frames, length * sizeof(*frames))) {
+            s->count++;
+            return;
+        }
+        i = (i + 1) & (p->stacks_size - 1);
+    }
+
+    s->hash = hash;
+    s->length = length;
+    s->count = 1;
+    s->frames = malloc((length + 1) * sizeof(*frames));
+    memcpy(s->frames, frames, length * sizeof(*frames));
+
+    if(++p->stacks_count * 2 > p->stacks_size) {
+        profile_stacks_grow(p);
+    }
+
+    return;
+}
+
+/* Folds the samples taken so far, with the handler kept out. */
+static void profile_fold(struct profile *p)
+{
+    sigset_t set, old;
+    long i, end;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+
+    for(i = 0; i < p->length; i = end + 1) {
+        for(end = i; p->samples[end] != NULL; end++)
+            ;
+        profile_count(p, p->samples + i, end - i);
+    }
+    p->length = 0;
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return;
+}
+
+static void profile_procs_grow(struct profile *p)
+{
+    struct profile_proc **old = p->procs;
+    long size = p->procs_size, i, j;
+
+    p->procs_size *= 2;
+    p->procs = calloc(p->procs_size, sizeof(struct profile_proc *));
+    for(i = 0; i < size; i++) {
+        if(old[i] == NULL)
+            continue;
+        j = profile_hash(old[i]->key) & (p->procs_size - 1);
+        while(p->procs[j] != NULL) {
+            j = (j + 1) & (p->procs_size - 1);
+        }
+        p->procs[j] = old[i];
+    }
+    free(old);
+
+    return;
+}
+
+/* Name of the lambdas of the current form. */
+static char *profile_where(struct profile *p)
+{
+    const char *file = p->file != NULL ? p->file : "toplevel";
+    char *name = malloc(strlen(file) + 32), *c;
+
+    sprintf(name, "lambda@%s#%d", file, p->form);
+    /* Frames of a folded stack are separated by semicolons. */
+    for(c = name; *c != '\0'; c++) {
+        if(*c == ';')
+            *c = '_';
+    }
+
+    return name;
+}
+
+/*
+ * The procedure of a key, made the first time. A body is kept from
+ * being freed, another one could be made at the same address. A
+ * lambda made out of code which wasn't walked, by EVAL, is named by
+ * the form it's made in.
+ */
+static struct profile_proc *profile_proc(struct profile *p, const void *key,
+                                         struct lispobj *body)
+{
+    struct profile_proc *proc;
+    long i = profile_hash(key) & (p->procs_size - 1);
+
+    while((proc = p->procs[i]) != NULL) {
+        if(proc->key == key)
+            return proc;
+        i = (i + 1) & (p->procs_size - 1);
+    }
+
+    proc = malloc(sizeof(struct profile_proc));
+    proc->key = key;
+    if(body != NULL) {
+        heap_grab(body);
+        proc->name = profile_where(p);
+        proc->labelled = 0;
+    } else {
+        proc->name = strdup(((struct subr *) key)->name);
+        proc->labelled = 1;
+    }
+    p->procs[i] = proc;
+
+    if(++p->procs_count * 2 > p->procs_size) {
+        profile_procs_grow(p);
+    }
+
+    return proc;
+}
+
+/* Profiles the current context until profile_stop(). */
+void profile_start(const char *path)
+{
+    struct profile *p = malloc(sizeof(struct profile));
+    struct itimerval timer;
+    struct sigaction sa;
+
+    memset(p, 0, sizeof(struct profile));
+    p->path = strdup(path);
+    p->stack = malloc(PROFILE_DEPTH * sizeof(struct profile_proc *));
+    p->samples = malloc(PROFILE_SAMPLES * sizeof(struct profile_proc *));
+    p->procs_size = PROFILE_PROCS;
+    p->procs = calloc(p->procs_size, sizeof(struct profile_proc *));
+    p->stacks_size = PROFILE_STACKS;
+    p->stacks = calloc(p->stacks_size, sizeof(struct profile_stack));
+    p->proc_tag = heap_grab(NEW_SYMBOL("PROC"));
+    p->lambda_tag = heap_grab(NEW_SYMBOL("LAMBDA"));
+
+    profiling = ctx->profile = p;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = profile_sample;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = PROFILE_INTERVAL;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+
+    return;
+}
+
+/* The bodies of the lambdas stay, their heap may be gone by now. */
+static void profile_free(struct profile *p)
+{
+    long i;
+
+    for(i = 0; i < p->procs_size; i++) {
+        if(p->procs[i] != NULL) {
+            free(p->procs[i]->name);
+            free(p->procs[i]);
+        }
+    }
+    for(i = 0; i < p->stacks_size; i++) {
+        free(p->stacks[i].frames);
+    }
+    free(p->procs);
+    free(p->stacks);
+    free(p->samples);
+    free(p->stack);
+    free(p->path);
+    free(p);
+
+    return;
+}
+
+/*
+ * Stops sampling and writes the folded stacks, root first. It's
+ * registered with atexit(), ended programs are profiled too.
+ */
+void profile_stop(void)
+{
+    struct profile *p = profiling;
+    struct itimerval timer;
+    struct profile_stack *s;
+    FILE *out;
+    long i;
+    int j;
+
+    if(p == NULL)
+        return;
+    profiling = NULL;
+    if(ctx != NULL && ctx->profile == p) {
+        ctx->profile = NULL;
+    }
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+    profile_fold(p);
+
+    if((out = fopen(p->path, "w")) == NULL) {
+        perror("profile");
+        profile_free(p);
+        return;
+    }
+    for(i = 0; i < p->stacks_size; i++) {
+        s = &p->stacks[i];
+        if(s->frames == NULL)
+            continue;
+        if(s->length == 0) {
+            fputs("toplevel", out);
+        }
+        for(j = 0; j < s->length; j++) {
+            fprintf(out, "%s%s", j > 0 ? ";" : "", s->frames[j]->name);
+        }
+        fprintf(out, " %ld\n", s->count);
+    }
+    fclose(out);
+
+    if(p->lost > 0) {
+        fprintf(stderr, "profile: %ld samples lost.\n", p->lost);
+    }
+    profile_free(p);
+
+    return;
+}
+
+/* Called by apply_argv() around every application. */
+void profile_enter(struct profile *p, struct lispobj *proc)
+{
+    struct profile_proc *frame = &unknown;
+
+    if(p->length >= PROFILE_SAMPLES / 2) {
+        profile_fold(p);
+    }
+
+    if(proc != NULL && OBJ_TYPE(proc) == SUBR) {
+        frame = profile_proc(p, SUBR_VALUE(proc), NULL);
+    } else if(proc != NULL && OBJ_TYPE(proc) == CONS &&
+              CAR(proc) == p->proc_tag) {
+        frame = profile_proc(p, CADDR(proc), CADDR(proc));
+    }
+
+    if(p->depth < PROFILE_DEPTH) {
+        p->stack[p->depth] = frame;
+    }
+    /* The frame is there before the handler can see it. */
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    p->depth++;
+
+    return;
+}
+
+void profile_leave(struct profile *p)
+{
+    p->depth--;
+
+    return;
+}
+
+/* Names the lambdas written in code, unless a LABEL named them. */
+static void profile_walk(struct profile *p, struct lispobj *code,
+                         const char *name)
+{
+    struct profile_proc *proc;
+
+    if(code != NULL && OBJ_TYPE(code) == CONS && CAR(code) == p->lambda_tag &&
+       CDR(code) != NULL && OBJ_TYPE(CDR(code)) == CONS) {
+        proc = profile_proc(p, CDDR(code), CDDR(code));
+        if(!proc->labelled) {
+            free(proc->name);
+            proc->name = strdup(name);
+        }
+    }
+
+    /* Elements one after another, a long list doesn't recurse. */
+    for(; code != NULL && OBJ_TYPE(code) == CONS; code = CDR(code)) {
+        profile_walk(p, CAR(code), name);
+    }
+
+    return;
+}
+
+/* A top-level form is about to be evaluated. */
+void profile_form(struct profile *p, struct lispobj *form)
+{
+    char *name;
+
+    p->form++;
+    name = profile_where(p);
+    profile_walk(p, form, name);
+    free(name);
+
+    return;
+}
+
+/*
+ * Names a lambda written as the value of a LABEL. Labels of other
+ * values are aliases, like the closures of (label add1 (plus c1)):
+ * the code is named where it's written.
+ */
+void profile_label(struct profile *p, struct lispobj *var,
+                   struct lispobj *exp, struct lispobj *val)
+{
+    struct profile_proc *proc;
+    char *name;
+
+    if(exp == NULL || OBJ_TYPE(exp) != CONS || CAR(exp) != p->lambda_tag ||
+       val == NULL || OBJ_TYPE(val) != CONS || CAR(val) != p->proc_tag)
+        return;
+
+    proc = profile_proc(p, CADDR(val), CADDR(val));
+    if(proc->labelled)
+        return;
+
+    free(proc->name);
+    proc->name = strdup(SYMBOL_VALUE(var));
+    proc->labelled = 1;
+
+    name = malloc(strlen(proc->name) + sizeof("/lambda"));
+    sprintf(name, "%s/lambda", proc->name);
+    profile_walk(p, CADDR(val), name);
+    free(name);
+
+    return;
+}
@@ -2,45 +2,54 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h> /* for memset() */
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "../include/object.h"
 #include "../include/subr.h"
 #include "../include/heap.h"
+#include "../include/hcons.h"
+#include "../include/read.h"
 
-static struct lispobj *read_list(FILE*);
-static struct lispobj *read_token(FILE*);
-static struct lispobj *read_quote(FILE*);
-static struct lispobj *read_string(FILE*);
-static void token_to_upper_case(char*);
+static struct lispobj *read_list(struct reader*);
+static struct lispobj *read_token(struct reader*);
+static struct lispobj *read_quote(struct reader*);
+static struct lispobj *read_string(struct reader*);
+static struct lispobj *read_vector(struct reader*);
+static struct lispobj *read_symbol(struct reader*, const char*, long);
 
-#define IS_NUMBER(c) (c >= '0' && c <= '9')
+/* Character classes, a character may be in several of them. */
+enum {
+    CC_LEGAL = 0x01,
+    CC_WHITESPACE = 0x02,
+    /* Starts a form of its own: ( ) ' " ; # */
+    CC_MACRO = 0x04,
+    /* May be a part of a token. */
+    CC_CONSTITUENT = 0x08,
+    CC_SYMBOL = 0x10,
+    CC_DIGIT = 0x20,
+};
 
-#define IS_SYMBOL(c)                                                    \
-    ((c >= 'a' && c <= 'z') ||                                          \
-     (c >= 'A' && c <= 'Z') ||                                          \
-     c == '+' || c == '-' || c == '*' || c == '/' ||                    \
-     c == '>' || c == '<' || c == '=' || c == '\'')
+#define CC_SYM (CC_LEGAL | CC_CONSTITUENT | CC_SYMBOL)
 
-#define IS_LEGAL(c)                             \
-    ((c >= 'a' && c <= 'z') ||                  \
-     (c >= 'A' && c <= 'Z') ||                  \
-     (c >= '0' && c <= '9') ||                  \
-     (c >= '(' && c <= '/') ||                  \
-     (c >= '<' && c <= '>') ||                  \
-     c == '\'' || c == '"' || c == ';')
+static const unsigned char char_class[256] = {
+    ['\t'] = CC_WHITESPACE, ['\n'] = CC_WHITESPACE, ['\r'] = CC_WHITESPACE,
+    ['\b'] = CC_WHITESPACE, [' '] = CC_WHITESPACE,
+    ['('] = CC_LEGAL | CC_MACRO, [')'] = CC_LEGAL | CC_MACRO,
+    ['\''] = CC_LEGAL | CC_MACRO, ['"'] = CC_LEGAL | CC_MACRO,
+    [';'] = CC_LEGAL | CC_MACRO, ['#'] = CC_LEGAL | CC_MACRO,
+    ['.'] = CC_LEGAL | CC_CONSTITUENT,
+    ['0' ... '9'] = CC_LEGAL | CC_CONSTITUENT | CC_DIGIT,
+    ['a' ... 'z'] = CC_SYM, ['A' ... 'Z'] = CC_SYM,
+    ['+'] = CC_SYM, ['-'] = CC_SYM, ['*'] = CC_SYM, ['/'] = CC_SYM,
+    ['<'] = CC_SYM, ['='] = CC_SYM, ['>'] = CC_SYM, ['!'] = CC_SYM,
+};
 
-#define IS_WHITESPACE(c)                                            \
-    (c == '\t' || c == '\n' || c == ' ' || c == '\r' || c == '\b')
-
-#define IS_MACRO(c) (c == '(' || c == ')' || c == '\'' || c == '"' || c == ';')
-
-#define IS_CONSTITUENT(c)                               \
-    ((c >= 'a' && c <= 'z') ||                          \
-     (c >= 'A' && c <= 'Z') ||                          \
-     (c >= '0' && c <= '9') ||                          \
-     c == '+' || c == '-' || c == '*' || c == '=' ||    \
-     c == '/' || c == '<' || c == '>' || c == '\'')
+#define CHAR_IS(c, classes) (char_class[(unsigned char) (c)] & (classes))
 
 #define ERROR_ILLEGAL(c)                                        \
     do {                                                        \
@@ -51,209 +60,474 @@ static void token_to_upper_case(char*);
 
 #define ERROR_UNMATCHED_BRACKETS NEW_ERROR("Unmatched paranthesis.\n")
 
-int brackets = 0;
-int quotes = 0;
+static struct reader *reader_new(void)
+{
+    struct reader *r;
 
-struct lispobj *read(FILE *stream)
+    r = malloc(sizeof(struct reader));
+    memset(r, 0, sizeof(struct reader));
+    r->mark = -1;
+    r->fd = -1;
+
+    return r;
+}
+
+struct reader *reader_open_fd(int fd)
 {
-    struct lispobj *obj = NULL;
-    char c;
-    
-    while((c = fgetc(stream)) != EOF) {
-        if(IS_WHITESPACE(c))
-            continue;
-        
-        if(!IS_LEGAL(c)) {
-            ERROR_ILLEGAL(c);
+    struct reader *r = reader_new();
+
+    r->fd = fd;
+    r->size = READER_BLOCK;
+    r->data = malloc(r->size);
+
+    return r;
+}
+
+/* Reads a malloc'd buffer, the reader frees it. */
+struct reader *reader_open_buffer(char *data, long length)
+{
+    struct reader *r = reader_new();
+
+    r->data = data;
+    r->length = r->size = length;
+
+    return r;
+}
+
+/* Maps a regular file, anything else is read in blocks. */
+struct reader *reader_open_file(const char *filename)
+{
+    struct reader *r;
+    struct stat st;
+    void *map;
+    int fd;
+
+    if((fd = open(filename, O_RDONLY)) < 0)
+        return NULL;
+
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if(st.st_size == 0) {
+            close(fd);
+
+            return reader_new();
         }
-        
-        if(IS_MACRO(c)) {
-            if(c == '\'') {
-                obj = read_quote(stream);
-                break;
-            } else if(c == '"') {
-                quotes++;
-                obj = read_string(stream);
-                break;
-            } else if(c == '(') {
-                brackets++;
-                obj = read_list(stream);
-
-                break;
-            } else if(c == ')') {
-                // NIL
-                if(!brackets) {
-                    brackets = 0;
-                    return ERROR_UNMATCHED_BRACKETS;
-                }
-                brackets--;
-                break;
-            } else if(c == ';') {
-                while((c = fgetc(stream)) != '\n' && c != EOF);
-                continue;
-            }
+
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED) {
+            close(fd);
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+            r = reader_new();
+            r->data = map;
+            r->length = r->mapped = st.st_size;
+
+            return r;
+        }
+    }
+
+    r = reader_open_fd(fd);
+    r->own_fd = 1;
+
+    return r;
+}
+
+void reader_close(struct reader *r)
+{
+    if(r->mapped) {
+        munmap(r->data, r->mapped);
+    } else {
+        free(r->data);
+    }
+    if(r->own_fd) {
+        close(r->fd);
+    }
+    free(r);
+
+    return;
+}
+
+/* Read the next block, keeping the marked token. */
+static int reader_fill(struct reader *r)
+{
+    long keep, n;
+
+    if(r->fd < 0)
+        return 0;
+
+    keep = r->mark >= 0 ? r->mark : r->pos;
+    if(keep > 0) {
+        memmove(r->data, r->data + keep, r->length - keep);
+        r->length -= keep;
+        r->pos -= keep;
+        if(r->mark >= 0) {
+            r->mark = 0;
         }
+    }
+    if(r->length == r->size) {
+        /* A token longer than the buffer. */
+        r->size *= 2;
+        r->data = realloc(r->data, r->size);
+    }
 
-        if(IS_CONSTITUENT(c)) {
-            ungetc(c, stream);
-            obj = read_token(stream);
+    /* Like stdio, show pending output before waiting for input. */
+    fflush(stdout);
+    do {
+        n = read(r->fd, r->data + r->length, r->size - r->length);
+    } while(n < 0 && errno == EINTR);
+    if(n <= 0)
+        return 0;
+    r->length += n;
 
+    return 1;
+}
+
+/* Next character without taking it, EOF at the end of the input. */
+int reader_peek(struct reader *r)
+{
+    if(r->pos == r->length && !reader_fill(r))
+        return EOF;
+
+    return (unsigned char) r->data[r->pos];
+}
+
+/* Skip whitespace and comments, returns the next character. */
+int reader_skip(struct reader *r)
+{
+    int c;
+
+    while((c = reader_peek(r)) != EOF) {
+        if(CHAR_IS(c, CC_WHITESPACE)) {
+            r->pos++;
+        } else if(c == ';') {
+            while((c = reader_peek(r)) != EOF && c != '\n') {
+                r->pos++;
+            }
+        } else {
             break;
         }
     }
 
-    return obj;
+    return c;
 }
 
-static struct lispobj *read_list(FILE *stream)
+/* Returns NULL at the end of the input. */
+struct lispobj *read_form(struct reader *r)
 {
-    struct lispobj *list, *ret;
-    char c;
-    
-    ret = read(stream);
-    if(ret == NULL) {
-        return NEW_SYMBOL("NIL");
-    } else if(OBJ_TYPE(ret) == ERROR) {
-        return ret;
+    int c;
+
+    while((c = reader_skip(r)) != EOF) {
+        if(!CHAR_IS(c, CC_LEGAL)) {
+            r->pos++;
+            ERROR_ILLEGAL(c);
+        }
+
+        if(CHAR_IS(c, CC_MACRO)) {
+            r->pos++;
+
+            switch(c) {
+            case '\'':
+                return read_quote(r);
+            case '#':
+                return read_vector(r);
+            case '"':
+                return read_string(r);
+            case '(':
+                return read_list(r);
+            default: // ')'
+                /* read_list() takes its own brackets. */
+                return ERROR_UNMATCHED_BRACKETS;
+            }
+        }
+
+        return read_token(r);
     }
-    
-    list = NEW_CONS(NULL, NULL);
-    CAR(list) = heap_grab(ret);
 
-    while((c = fgetc(stream)) != ')') {
+    return NULL;
+}
+
+/* Conses of the reader, hash-consed in the hash-consing mode. */
+static struct lispobj *read_cons(struct lispobj *car, struct lispobj *cdr)
+{
+    return ctx->read_hash_cons ? hcons(car, cdr) : NEW_CONS(car, cdr);
+}
+
+/*
+ * Elements are appended through a tail pointer, so long lists
+ * don't recurse. Nothing is evaluated while reading, so the
+ * list needs no grab until it's returned.
+ */
+static struct lispobj *read_list(struct reader *r)
+{
+    struct lispobj *head = NULL, *tail = NULL, *obj, *cell;
+    int c;
+
+    while((c = reader_skip(r)) != ')') {
         if(c == EOF) {
-            heap_release(list);
+            heap_release(head);
             return ERROR_UNMATCHED_BRACKETS;
-        } else if(IS_WHITESPACE(c)) {
-            continue;
-        } else if(IS_CONSTITUENT(c) ||
-                  c == '(' || c == '"' || c == ';') {
-            ungetc(c, stream);
-            ret = read_list(stream);
-            if(OBJ_TYPE(ret) == ERROR) {
-                heap_release(list);
-                return ret;
-            }
-            CDR(list) = heap_grab(ret);
-            return list;
+        }
+
+        obj = read_form(r);
+        if(OBJ_TYPE(obj) == ERROR) {
+            heap_release(head);
+            return obj;
+        }
+
+        cell = NEW_CONS(obj, NULL);
+        if(head == NULL) {
+            head = cell;
         } else {
-            heap_release(list);
-            ERROR_ILLEGAL(c);
+            CDR(tail) = heap_grab(cell);
         }
+        tail = cell;
+    }
+    r->pos++;
+
+    if(head == NULL)
+        return read_symbol(r, "NIL", 3);
+
+    if(ctx->read_hash_cons) {
+        /* Inner lists are hash-consed already, only this level
+           is copied. The canonical list doesn't refer to head. */
+        obj = hcons_tree(head);
+        heap_release(head);
+
+        return obj;
     }
-    brackets--;
-    CDR(list) = NULL;
-    
-    return list;
+
+    return head;
 }
 
-static struct lispobj *read_quote(FILE *stream)
+static struct lispobj *read_quote(struct reader *r)
 {
-    /* Create (quote read(stream)). */
-    return NEW_CONS(NEW_SYMBOL("QUOTE"), NEW_CONS(read(stream), NULL));
-}
+    struct lispobj *obj = read_form(r);
 
-#define STRING_LENGTH 0x10 // I'm fucking bitch I know ;3
+    if(obj != NULL && OBJ_TYPE(obj) == ERROR)
+        return obj;
+
+    /* Create (quote obj). */
+    return read_cons(read_symbol(r, "QUOTE", 5), read_cons(obj, NULL));
+}
 
-static struct lispobj *read_string(FILE *stream)
+/* #(a b c) is read as a list and copied into a vector. */
+static struct lispobj *read_vector(struct reader *r)
 {
-    struct lispobj *string = NULL;
-    char *s, c;
-    int i, s_length = STRING_LENGTH;
-    
-    s = malloc(sizeof(char) * STRING_LENGTH);
-    memset(s, 0, STRING_LENGTH);
-    
-    for(i = 0; (c = fgetc(stream)) != EOF; i++) {
-        if(i >= s_length) {
-            s = realloc(s, s_length + STRING_LENGTH);
-            s_length += STRING_LENGTH;
+    struct lispobj *list, *vec, *cell;
+    int i, n = 0;
+
+    if(reader_peek(r) != '(') {
+        if(reader_peek(r) != EOF) {
+            r->pos++;
         }
+        ERROR_ILLEGAL('#');
+    }
+    r->pos++;
+
+    list = read_list(r);
+    if(OBJ_TYPE(list) == ERROR) {
+        return list;
+    }
 
-        if(c == '"') {
-            if(s[i - 1] == '\\') {
-                s[--i] = c;
+    /* Not list_to_vector(), a reader thread has no interned NIL
+       to end the list with, the list ends with NULL anyway. */
+    for(cell = list; cell != NULL && OBJ_TYPE(cell) == CONS;
+        cell = CDR(cell)) {
+        n++;
+    }
+    vec = vector(n, NULL);
+    for(i = 0, cell = list; i < n; i++, cell = CDR(cell)) {
+        VECTOR_DATA(vec)[i] = heap_grab(CAR(cell));
+    }
+    heap_release(heap_grab(list));
+
+    return vec;
+}
+
+/*
+ * A quote right after a backslash doesn't end the string and
+ * loses the backslash, every other character is taken as it is.
+ */
+static struct lispobj *read_string(struct reader *r)
+{
+    struct lispobj *str;
+    const char *s;
+    char *d;
+    long i, n, escapes = 0;
+
+    r->mark = r->pos;
+    for(;;) {
+        if(r->pos == r->length && !reader_fill(r)) {
+            r->mark = -1;
+            return NEW_ERROR("Unmatched quotes.\n");
+        }
+        if(r->data[r->pos++] == '"') {
+            if(r->pos - 1 > r->mark && r->data[r->pos - 2] == '\\') {
+                escapes++;
                 continue;
             }
-            
-            quotes--;
-            s[i] = '\0';
-            string = NEW_STRING(s);
-            
             break;
         }
-        s[i] = c;
     }
-    free(s);
 
-    /* If string != NULL, this will never happen. */
-    if(quotes) {
-        quotes = 0;
-        return NEW_ERROR("Unmatched quotes.\n");
+    s = r->data + r->mark;
+    n = r->pos - 1 - r->mark;
+    r->mark = -1;
+
+    if(escapes == 0)
+        return string(s, n);
+
+    str = string(NULL, n - escapes);
+    d = STRING_DATA(str);
+    for(i = 0; i < n; i++) {
+        if(s[i] == '\\' && i + 1 < n && s[i + 1] == '"')
+            continue;
+        *d++ = s[i];
     }
 
-    return string;
+    return str;
 }
 
-static struct lispobj *read_token(FILE *stream)
+/* NUL-terminated copy of a token for the C library parsers. */
+static char *token_copy(const char *s, long n)
 {
-    struct lispobj *token;
-    char token_string[30], c;
-    int i = 0, token_type = 0;
+    char *copy = malloc(n + 1);
 
-    while((c = fgetc(stream)) != EOF) {
-        if(IS_MACRO(c) || IS_WHITESPACE(c)) {
-            ungetc(c, stream);
-            break;
-        }
-        if(i < 30) {
-            if(!token_type) {
-                if(!i && (c == '-' || c == '+')) {
-                    // just accumulate token
-                } else if(IS_NUMBER(c)) {
-                    token_type = NUMBER;
-                } else if(IS_SYMBOL(c)) {
-                    token_type = SYMBOL;
-                } else {
-                    ERROR_ILLEGAL(c);
-                }
-            } else if(token_type == SYMBOL) {
-                if(!IS_SYMBOL(c) && !IS_NUMBER(c))
-                    ERROR_ILLEGAL(c);
-            } else { // NUMBER
-                if(!IS_NUMBER(c))
-                    ERROR_ILLEGAL(c);
-            }
-            token_string[i] = c;
-        } else {
-            return NEW_ERROR("Length of token must be less"
-                             " then 30 characters.\n");
-        }
-        
+    memcpy(copy, s, n);
+    copy[n] = '\0';
+
+    return copy;
+}
+
+static struct lispobj *read_integer(const char *s, long n)
+{
+    struct lispobj *obj;
+    char *copy;
+    long value = 0, i = 0;
+    int negative = 0;
+
+    if(s[0] == '-' || s[0] == '+') {
+        negative = s[0] == '-';
         i++;
     }
-    token_string[i] = '\0';
 
-    if(token_type == NUMBER) {
-        token = NEW_NUMBER(token_string);
-    } else {
-        token_to_upper_case(token_string);
-        token = NEW_SYMBOL(token_string);
+    /* Accumulate negated too, so LONG_MIN fits. */
+    for(; i < n; i++) {
+        if(__builtin_mul_overflow(value, 10, &value) ||
+           __builtin_add_overflow(value,
+                                  negative ? '0' - s[i] : s[i] - '0',
+                                  &value)) {
+            /* Doesn't fit a machine word, let it be a bignum. */
+            copy = token_copy(s, n);
+            obj = NEW_NUMBER(copy);
+            free(copy);
+
+            return obj;
+        }
     }
 
-    return token;
+    return number(value);
 }
 
-static void token_to_upper_case(char *token)
+/*
+ * Symbols are upper case, only a new one needs a copy of its name.
+ * A reader running on its own thread interns into its own cache.
+ */
+static struct lispobj *read_symbol(struct reader *r, const char *s, long n)
 {
-    int i = 0;
-    
-    while(token[i] != '\0') {
-        if(token[i] >= 'a' && token[i] <= 'z') {
-            token[i] -= 0x20;
+    struct lispobj *obj;
+    char *name;
+    long i;
+
+    if(r->symbols != NULL)
+        return symbol_cache_intern(r->symbols, s, n);
+
+    if((obj = symbol_table_lookup_token(s, n)) != NULL)
+        return obj;
+
+    name = token_copy(s, n);
+    for(i = 0; i < n; i++) {
+        if(name[i] >= 'a' && name[i] <= 'z') {
+            name[i] -= 0x20;
         }
-        i++;
     }
+    obj = NEW_SYMBOL(name);
+    free(name);
 
-    return;
+    return obj;
+}
+
+static struct lispobj *read_token(struct reader *r)
+{
+    struct lispobj *obj;
+    const char *s;
+    char *copy, *end, c;
+    long i, n;
+    int token_type = 0, dot = 0, exponent = 0;
+
+    /* Find the end first, the token may span blocks. */
+    r->mark = r->pos;
+    while(r->pos < r->length || reader_fill(r)) {
+        if(CHAR_IS(r->data[r->pos], CC_MACRO | CC_WHITESPACE))
+            break;
+        r->pos++;
+    }
+    s = r->data + r->mark;
+    n = r->pos - r->mark;
+    r->mark = -1;
+
+    for(i = 0; i < n; i++) {
+        c = s[i];
+
+        if(!token_type) {
+            if(!i && (c == '-' || c == '+')) {
+                // just accumulate token
+            } else if(CHAR_IS(c, CC_DIGIT)) {
+                token_type = NUMBER;
+            } else if(c == '.') {
+                token_type = FLOAT;
+                dot = 1;
+            } else if(CHAR_IS(c, CC_SYMBOL)) {
+                token_type = SYMBOL;
+            } else {
+                ERROR_ILLEGAL(c);
+            }
+        } else if(token_type == SYMBOL) {
+            if(!CHAR_IS(c, CC_SYMBOL | CC_DIGIT)) {
+                ERROR_ILLEGAL(c);
+            }
+        } else { // NUMBER or FLOAT
+            if(c == '.' && !dot && !exponent) {
+                token_type = FLOAT;
+                dot = 1;
+            } else if((c == 'e' || c == 'E') && !exponent) {
+                token_type = FLOAT;
+                exponent = 1;
+            } else if((c == '-' || c == '+') &&
+                      (s[i - 1] == 'e' || s[i - 1] == 'E')) {
+                // sign of the exponent
+            } else if(!CHAR_IS(c, CC_DIGIT)) {
+                ERROR_ILLEGAL(c);
+            }
+        }
+    }
+
+    if(token_type == NUMBER) {
+        obj = read_integer(s, n);
+    } else if(token_type == FLOAT) {
+        copy = token_copy(s, n);
+
+        /* Catches a lone dot, "1e" and such. */
+        strtod(copy, &end);
+        if(*end != '\0') {
+            c = *end;
+            free(copy);
+            ERROR_ILLEGAL(c);
+        }
+        obj = NEW_FLOAT(copy);
+        free(copy);
+    } else {
+        obj = read_symbol(r, s, n);
+    }
+
+    return obj;
 }
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <setjmp.h>
 
 #include "../include/object.h"
 #include "../include/heap.h"
@@ -9,55 +10,171 @@
 #include "../include/eval.h"
 #include "../include/read.h"
 #include "../include/print.h"
+#include "../include/error.h"
+#include "../include/pipeline.h"
+#include "../include/fasl.h"
+#include "../include/profile.h"
 
-int load(const char *filename)
+/*
+ * Prints a result unless it's the last one of the file. A batch
+ * program prints nothing and ends at the first error instead.
+ */
+static void load_form(struct lispobj *read_obj, int more)
 {
-    FILE *stream;
-    char c;
+    struct lispobj *eval_obj = NULL;
+    struct handler h;
 
-    if((stream = fopen(filename, "r")) == NULL) {
-        perror("load");
-        return 0;
+    if(ctx->profile != NULL) {
+        profile_form(ctx->profile, read_obj);
     }
-    
-    while((c = fgetc(stream)) != EOF) {
-        struct lispobj *read_obj = NULL, *eval_obj = NULL;
-        
-        ungetc(c, stream);
-        
-        read_obj = heap_grab(read(stream));
-        eval_obj = eval(read_obj, environment);
 
-        if((eval_obj != NULL && OBJ_TYPE(eval_obj) == ERROR) ||
-           fgetc(stream) != EOF) {
+    /* The reader returns its errors, a truncated program is one. */
+    if(ctx->batch && read_obj != NULL && OBJ_TYPE(read_obj) == ERROR) {
+        error_exit(read_obj);
+    }
+
+    handler_push(&h);
+    if(setjmp(h.jmp)) {
+        eval_obj = h.condition;
+
+        if(ctx->batch) {
+            error_exit(eval_obj);
+        }
+        error_print(eval_obj);
+        printf("\n");
+    } else {
+        eval_obj = eval(read_obj, ctx->environment);
+        handler_pop(&h);
+
+        if(!ctx->batch &&
+           ((eval_obj != NULL && OBJ_TYPE(eval_obj) == ERROR) || more)) {
             print(eval_obj);
             printf("\n");
         }
+    }
 
-        heap_release(read_obj);
-        heap_release(eval_obj);
+    heap_release(read_obj);
+    heap_release(eval_obj);
+
+    return;
+}
+
+/*
+ * A fresh fasl file, see fflisp --compile, is loaded instead of the
+ * source.
+ *
+ * A big file is parsed on a reader thread while its forms are
+ * evaluated, so loading it takes about as long as the slower of
+ * the two. Hash-consed reading shares its table, it stays serial.
+ */
+static int load_file(const char *filename)
+{
+    struct reader *r;
+    struct fasl *f;
+    struct pipeline *p = NULL;
+    struct lispobj *read_obj;
+    int more;
+
+    if((f = fasl_open(filename)) != NULL) {
+        while((read_obj = fasl_next(f, &more)) != NULL) {
+            load_form(read_obj, more);
+        }
+        fasl_close(f);
+
+        return 1;
+    }
+
+    if((r = reader_open_file(filename)) == NULL) {
+        perror("load");
+        return 0;
+    }
+
+    if(r->mapped >= PIPELINE_MIN && !ctx->read_hash_cons) {
+        p = pipeline_start(r);
     }
 
+    if(p != NULL) {
+        while((read_obj = pipeline_next(p, &more)) != NULL) {
+            load_form(read_obj, more);
+        }
+        pipeline_finish(p);
+    } else {
+        while(reader_skip(r) != EOF) {
+            read_obj = heap_grab(read_form(r));
+            more = reader_peek(r) != EOF;
+            load_form(read_obj, more);
+        }
+    }
+
+    reader_close(r);
+
     return 1;
 }
 
-void repl(FILE *stream)
+/* Lambdas written in a loaded file are named after it, see profile.h. */
+int load(const char *filename)
+{
+    struct profile *p = ctx->profile;
+    const char *file;
+    int form, loaded;
+
+    if(p == NULL)
+        return load_file(filename);
+
+    file = p->file;
+    form = p->form;
+    p->file = filename;
+    p->form = 0;
+
+    loaded = load_file(filename);
+
+    p->file = file;
+    p->form = form;
+
+    return loaded;
+}
+
+/* Runs the forms of --eval and --batch, like a loaded file's. */
+void batch(struct reader *r)
+{
+    while(reader_skip(r) != EOF) {
+        load_form(heap_grab(read_form(r)), 0);
+    }
+
+    return;
+}
+
+void repl(struct reader *r)
 {
     while("all humans alive") {
         struct lispobj *read_obj = NULL, *eval_obj = NULL;
+        struct handler h;
 
         // Print prompt
         printf("fflisp> ");
-        fflush(stdin);
+        fflush(stdout);
         
-        read_obj = heap_grab(read(stream));
+        read_obj = heap_grab(read_form(r));
+        if(ctx->profile != NULL) {
+            profile_form(ctx->profile, read_obj);
+        }
+
+        handler_push(&h);
+        if(setjmp(h.jmp)) {
+            eval_obj = h.condition;
 
-        eval_obj = eval(read_obj, environment);
+            printf("=> ");
+            error_print(eval_obj);
+            printf("\n");
+        } else {
+            eval_obj = eval(read_obj, ctx->environment);
+            handler_pop(&h);
         
-        // Print result
-        printf("=> ");
-        print(eval_obj);
-        printf("\n");
+            // Print result
+            printf("=> ");
+            print(eval_obj);
+            printf("\n");
+        }
         
         heap_release(read_obj);
         heap_release(eval_obj);
@@ -0,0 +1,721 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#define _GNU_SOURCE /* for accept4() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/eval.h"
+#include "../include/read.h"
+#include "../include/print.h"
+#include "../include/error.h"
+#include "../include/pool.h"
+#include "../include/server.h"
+
+/*
+ * One thread waits on every connection with epoll, reads requests
+ * and writes responses, nothing there blocks. Evaluator threads run
+ * the requests: a session at a time each, its requests in order, in
+ * the context of the session. That context is made from the one the
+ * server started in, so sessions see its definitions and each has
+ * its own on top of them. It's made by the first request, an idle
+ * connection only costs its struct.
+ */
+
+struct request {
+    char *data;
+    long length;
+    /* When the whole frame was read. */
+    struct timespec start;
+    struct request *next;
+};
+
+struct session {
+    int fd;
+    /* Owners: the loop while it's open, an evaluator while it runs
+       it, the dirty list while it's there. */
+    int refs;
+    int closed;
+    int busy;
+    int dirty;
+    /* The client sent everything, it's closed once answered. */
+    int eof;
+    /* Events the loop waits for. */
+    unsigned int events;
+    /* Only evaluators use it, one at a time. */
+    struct fflisp_ctx *ctx;
+    /* Only the loop reads into it, NULL between requests. */
+    char *in;
+    long in_length;
+    long in_size;
+    /* Requests not run yet. */
+    struct request *head;
+    struct request *tail;
+    int pending;
+    /* Responses, sent from out_sent on. */
+    char *out;
+    long out_length;
+    long out_size;
+    long out_sent;
+    struct session *next_run;
+    struct session *next_dirty;
+    /* Closed in the current batch of events, freed after it. */
+    struct session *next_closed;
+};
+
+static struct {
+    /* Guards the fields of sessions but fd, events and the input. */
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    struct session *run_head;
+    struct session *run_tail;
+    /* Sessions with new output or room for more input. */
+    struct session *dirty;
+    int wake_fd;
+    int epoll_fd;
+    struct fflisp_ctx *base;
+    unsigned long histogram[SERVER_BUCKETS];
+} server = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .more = PTHREAD_COND_INITIALIZER,
+    .wake_fd = -1,
+    .epoll_fd = -1
+};
+
+static void session_free(struct session *s)
+{
+    struct request *req;
+
+    while((req = s->head) != NULL) {
+        s->head = req->next;
+        free(req->data);
+        free(req);
+    }
+    if(s->ctx != NULL) {
+        fflisp_ctx_free(s->ctx);
+    }
+    free(s->in);
+    free(s->out);
+    free(s);
+
+    return;
+}
+
+/* With the lock, nonzero if it was the last owner and must free s. */
+static int session_drop(struct session *s)
+{
+    return --s->refs == 0;
+}
+
+static void histogram_add(struct timespec *start)
+{
+    struct timespec now;
+    unsigned long us;
+    int bucket = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    us = (now.tv_sec - start->tv_sec) * 1000000L
+        + (now.tv_nsec - start->tv_nsec) / 1000;
+    if(us > 0) {
+        bucket = 64 - __builtin_clzl(us);
+        if(bucket >= SERVER_BUCKETS) {
+            bucket = SERVER_BUCKETS - 1;
+        }
+    }
+    __atomic_fetch_add(&server.histogram[bucket], 1, __ATOMIC_RELAXED);
+
+    return;
+}
+
+/* Bucket n holds latencies under 2^n us. */
+static void histogram_print(void)
+{
+    unsigned long counts[SERVER_BUCKETS], total = 0, sum = 0;
+    long p50 = -1, p99 = -1;
+    int i;
+
+    for(i = 0; i < SERVER_BUCKETS; i++) {
+        counts[i] = __atomic_load_n(&server.histogram[i], __ATOMIC_RELAXED);
+        total += counts[i];
+    }
+
+    fprintf(stderr, "fflisp: %lu requests\n", total);
+    if(total == 0)
+        return;
+
+    fprintf(stderr, "%16s %12s\n", "latency (us)", "count");
+    for(i = 0; i < SERVER_BUCKETS; i++) {
+        sum += counts[i];
+        if(p50 < 0 && sum * 2 >= total) {
+            p50 = 1L << i;
+        }
+        if(p99 < 0 && sum * 100 >= total * 99) {
+            p99 = 1L << i;
+        }
+        if(counts[i] > 0) {
+            fprintf(stderr, "%16ld %12lu\n", 1L << i, counts[i]);
+        }
+    }
+    fprintf(stderr, "p50 < %ldus, p99 < %ldus\n", p50, p99);
+
+    return;
+}
+
+/* Writes the frame header for the bytes after it. */
+static void frame_length(char *header, long length)
+{
+    header[0] = (length >> 24) & 0xff;
+    header[1] = (length >> 16) & 0xff;
+    header[2] = (length >> 8) & 0xff;
+    header[3] = length & 0xff;
+
+    return;
+}
+
+static void buffer_put(char **data, long *length, long *size,
+                       const char *s, long n)
+{
+    if(*length + n > *size) {
+        while(*length + n > *size) {
+            *size *= 2;
+        }
+        *data = realloc(*data, *size);
+    }
+    memcpy(*data + *length, s, n);
+    *length += n;
+
+    return;
+}
+
+/*
+ * Runs the forms of a request like the REPL does and returns the
+ * response frame, conditions are printed as error_print() does.
+ */
+static char *session_eval(struct session *s, struct request *req,
+                          long *length)
+{
+    struct lispobj *read_obj, *eval_obj;
+    struct fflisp_ctx *prev;
+    struct handler h;
+    struct reader *r;
+    long size = PRINT_STRING_SIZE;
+    char *data = malloc(size);
+
+    *length = SERVER_FRAME_HEADER;
+
+    if(s->ctx == NULL) {
+        s->ctx = fflisp_ctx_new(server.base);
+    }
+    prev = fflisp_ctx_enter(s->ctx);
+
+    r = reader_open_buffer(req->data, req->length);
+    req->data = NULL;
+    while(reader_skip(r) != EOF) {
+        read_obj = heap_grab(read_form(r));
+        handler_push(&h);
+        if(setjmp(h.jmp)) {
+            eval_obj = h.condition;
+            if(eval_obj == NULL || OBJ_TYPE(eval_obj) != ERROR) {
+                buffer_put(&data, length, &size, "Unhandled condition: ", 21);
+            }
+        } else {
+            eval_obj = eval(read_obj, ctx->environment);
+            handler_pop(&h);
+        }
+        print_append(eval_obj, &data, length, &size);
+        /* Error messages end in a newline already. */
+        if(data[*length - 1] != '\n') {
+            buffer_put(&data, length, &size, "\n", 1);
+        }
+
+        heap_release(eval_obj);
+        heap_release(read_obj);
+    }
+    reader_close(r);
+
+    fflisp_ctx_enter(prev);
+    frame_length(data, *length - SERVER_FRAME_HEADER);
+
+    return data;
+}
+
+/* With the lock, makes the loop look at s again. */
+static void session_notify(struct session *s)
+{
+    if(s->dirty || s->closed)
+        return;
+
+    s->dirty = 1;
+    s->refs++;
+    s->next_dirty = server.dirty;
+    server.dirty = s;
+
+    return;
+}
+
+static void *server_thread(void *arg)
+{
+    struct session *s;
+    struct request *req;
+    uint64_t one = 1;
+    long length;
+    char *data;
+
+    pthread_mutex_lock(&server.lock);
+    for(;;) {
+        while(server.run_head == NULL) {
+            pthread_cond_wait(&server.more, &server.lock);
+        }
+        s = server.run_head;
+        if((server.run_head = s->next_run) == NULL) {
+            server.run_tail = NULL;
+        }
+
+        while((req = s->head) != NULL) {
+            if((s->head = req->next) == NULL) {
+                s->tail = NULL;
+            }
+            s->pending--;
+            pthread_mutex_unlock(&server.lock);
+
+            data = session_eval(s, req, &length);
+
+            pthread_mutex_lock(&server.lock);
+            if(!s->closed) {
+                if(s->out == NULL) {
+                    /* Mostly the case, no copy then. */
+                    s->out = data;
+                    s->out_length = length;
+                    s->out_size = length;
+                    data = NULL;
+                } else {
+                    buffer_put(&s->out, &s->out_length, &s->out_size,
+                               data, length);
+                }
+                session_notify(s);
+            }
+            free(data);
+            histogram_add(&req->start);
+            free(req);
+        }
+
+        s->busy = 0;
+        if(s->eof) {
+            session_notify(s);
+        }
+        if(session_drop(s)) {
+            pthread_mutex_unlock(&server.lock);
+            session_free(s);
+            pthread_mutex_lock(&server.lock);
+        }
+        if(server.dirty != NULL) {
+            if(write(server.wake_fd, &one, sizeof(one)) < 0) {
+                /* The counter is full, the loop wakes anyway. */
+            }
+        }
+    }
+
+    return arg;
+}
+
+/*
+ * Tells epoll what s waits for: input unless it has too much to do,
+ * and a chance to write if it has output. Returns -1 if it's done.
+ */
+static int session_watch(struct session *s)
+{
+    struct epoll_event ev;
+    unsigned int events = 0;
+    int done;
+
+    pthread_mutex_lock(&server.lock);
+    if(!s->eof && s->out_length - s->out_sent < SERVER_MAX_OUTPUT
+       && s->pending < SERVER_MAX_PENDING) {
+        events |= EPOLLIN;
+    }
+    if(s->out_sent < s->out_length) {
+        events |= EPOLLOUT;
+    }
+    done = s->eof && !s->busy && s->pending == 0 && s->out == NULL;
+    pthread_mutex_unlock(&server.lock);
+
+    if(done)
+        return -1;
+
+    if(events != s->events) {
+        ev.events = events;
+        ev.data.ptr = s;
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, s->fd, &ev);
+        s->events = events;
+    }
+
+    return 0;
+}
+
+static void session_close(struct session *s, struct session **closed)
+{
+    struct request *req;
+
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+
+    pthread_mutex_lock(&server.lock);
+    s->closed = 1;
+    while((req = s->head) != NULL) {
+        s->head = req->next;
+        free(req->data);
+        free(req);
+    }
+    s->tail = NULL;
+    s->pending = 0;
+    pthread_mutex_unlock(&server.lock);
+
+    /* Events of this batch may still point at it. */
+    s->next_closed = *closed;
+    *closed = s;
+
+    return;
+}
+
+/* Returns -1 if the connection must be closed. */
+static int session_flush(struct session *s)
+{
+    long n = 0;
+
+    pthread_mutex_lock(&server.lock);
+    while(s->out_sent < s->out_length) {
+        n = send(s->fd, s->out + s->out_sent, s->out_length - s->out_sent,
+                 MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n < 0)
+            break;
+        s->out_sent += n;
+    }
+    if(s->out_sent == s->out_length) {
+        free(s->out);
+        s->out = NULL;
+        s->out_length = s->out_size = s->out_sent = 0;
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        return -1;
+
+    return 0;
+}
+
+/* Moves the complete frames of the input to the session's requests. */
+static int session_frames(struct session *s)
+{
+    struct request *first = NULL, *last = NULL, *req;
+    unsigned char *p;
+    long pos = 0, length;
+    int count = 0;
+
+    while(s->in_length - pos >= SERVER_FRAME_HEADER) {
+        p = (unsigned char *) s->in + pos;
+        length = ((long) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        if(length > SERVER_MAX_REQUEST)
+            return -1;
+        if(s->in_length - pos - SERVER_FRAME_HEADER < length)
+            break;
+
+        req = malloc(sizeof(struct request));
+        req->length = length;
+        req->data = malloc(length > 0 ? length : 1);
+        memcpy(req->data, p + SERVER_FRAME_HEADER, length);
+        clock_gettime(CLOCK_MONOTONIC, &req->start);
+        req->next = NULL;
+        if(last != NULL) {
+            last->next = req;
+        } else {
+            first = req;
+        }
+        last = req;
+        count++;
+        pos += SERVER_FRAME_HEADER + length;
+    }
+
+    if(pos == s->in_length) {
+        free(s->in);
+        s->in = NULL;
+        s->in_length = s->in_size = 0;
+    } else if(pos > 0) {
+        memmove(s->in, s->in + pos, s->in_length - pos);
+        s->in_length -= pos;
+    }
+
+    if(first == NULL)
+        return 0;
+
+    pthread_mutex_lock(&server.lock);
+    if(s->tail != NULL) {
+        s->tail->next = first;
+    } else {
+        s->head = first;
+    }
+    s->tail = last;
+    s->pending += count;
+    if(!s->busy) {
+        s->busy = 1;
+        s->refs++;
+        s->next_run = NULL;
+        if(server.run_tail != NULL) {
+            server.run_tail->next_run = s;
+        } else {
+            server.run_head = s;
+        }
+        server.run_tail = s;
+        pthread_cond_signal(&server.more);
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    return 0;
+}
+
+/* Returns -1 if the connection must be closed. */
+static int session_read(struct session *s)
+{
+    long n;
+
+    if(s->in == NULL) {
+        s->in_size = SERVER_READ_SIZE;
+        s->in = malloc(s->in_size);
+    } else if(s->in_size - s->in_length < SERVER_READ_SIZE) {
+        s->in_size = s->in_length + SERVER_READ_SIZE;
+        s->in = realloc(s->in, s->in_size);
+    }
+
+    n = read(s->fd, s->in + s->in_length, SERVER_READ_SIZE);
+    if(n == 0) {
+        pthread_mutex_lock(&server.lock);
+        s->eof = 1;
+        pthread_mutex_unlock(&server.lock);
+
+        return 0;
+    }
+    if(n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+            ? 0 : -1;
+    s->in_length += n;
+
+    return session_frames(s);
+}
+
+static void server_accept(int listen_fd)
+{
+    struct epoll_event ev;
+    struct session *s;
+    int fd;
+
+    while((fd = accept4(listen_fd, NULL, NULL,
+                        SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        s = malloc(sizeof(struct session));
+        memset(s, 0, sizeof(struct session));
+        s->fd = fd;
+        s->refs = 1;
+        s->events = EPOLLIN;
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = s;
+        if(epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(s);
+        }
+    }
+
+    return;
+}
+
+/* Sends what evaluators made, input may be read again too. */
+static void server_wake(struct session **closed)
+{
+    struct session *s, *next;
+    uint64_t count;
+
+    if(read(server.wake_fd, &count, sizeof(count)) < 0) {
+        /* Woken for nothing. */
+    }
+
+    pthread_mutex_lock(&server.lock);
+    s = server.dirty;
+    server.dirty = NULL;
+    pthread_mutex_unlock(&server.lock);
+
+    for(; s != NULL; s = next) {
+        next = s->next_dirty;
+
+        pthread_mutex_lock(&server.lock);
+        s->dirty = 0;
+        pthread_mutex_unlock(&server.lock);
+
+        if(!s->closed) {
+            if(session_flush(s) < 0 || session_watch(s) < 0) {
+                session_close(s, closed);
+            }
+        }
+
+        pthread_mutex_lock(&server.lock);
+        if(session_drop(s)) {
+            pthread_mutex_unlock(&server.lock);
+            session_free(s);
+        } else {
+            pthread_mutex_unlock(&server.lock);
+        }
+    }
+
+    return;
+}
+
+static int server_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "fflisp: socket path too long: %s.\n", path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    0)) < 0) {
+        perror("fflisp: socket");
+        return -1;
+    }
+    unlink(path);
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+       || listen(fd, SOMAXCONN) < 0) {
+        perror("fflisp: bind");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Serves the context of the thread on a unix socket until SIGINT or
+ * SIGTERM, SIGUSR1 prints the latency histogram. Returns 0 if it
+ * couldn't start.
+ */
+int server_run(const char *path)
+{
+    struct epoll_event ev, events[SERVER_EVENTS];
+    struct signalfd_siginfo info;
+    struct session *s, *closed;
+    pthread_attr_t attr;
+    pthread_t thread;
+    sigset_t signals;
+    int listen_fd, signal_fd, i, n, threads, running = 1;
+
+    if((listen_fd = server_listen(path)) < 0)
+        return 0;
+
+    /* Signals come as events, evaluators start with them blocked. */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    server.base = ctx;
+    server.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    /* The listening socket and the other two are told apart by their
+       fds, sessions are pointers. */
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.ptr = &server.wake_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.wake_fd, &ev);
+    ev.data.ptr = &signal_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+
+    /* Evaluating blocks, so at least two, a long request doesn't
+       hold every other session. */
+    threads = pool_workers();
+    if(threads < 2) {
+        threads = 2;
+    }
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for(i = 0; i < threads; i++) {
+        pthread_create(&thread, &attr, server_thread, NULL);
+    }
+    pthread_attr_destroy(&attr);
+
+    fprintf(stderr, "fflisp: serving on %s.\n", path);
+
+    while(running) {
+        n = epoll_wait(server.epoll_fd, events, SERVER_EVENTS, -1);
+        closed = NULL;
+
+        for(i = 0; i < n; i++) {
+            if(events[i].data.ptr == &listen_fd) {
+                server_accept(listen_fd);
+            } else if(events[i].data.ptr == &server.wake_fd) {
+                server_wake(&closed);
+            } else if(events[i].data.ptr == &signal_fd) {
+                while(read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                    if(info.ssi_signo == SIGUSR1) {
+                        histogram_print();
+                    } else {
+                        running = 0;
+                    }
+                }
+            } else {
+                s = events[i].data.ptr;
+                if(s->closed)
+                    continue;
+
+                if((events[i].events & (EPOLLERR | EPOLLHUP))
+                   && !(events[i].events & EPOLLIN)) {
+                    session_close(s, &closed);
+                } else if(((events[i].events & EPOLLIN)
+                           && session_read(s) < 0)
+                          || ((events[i].events & EPOLLOUT)
+                              && session_flush(s) < 0)
+                          || session_watch(s) < 0) {
+                    session_close(s, &closed);
+                }
+            }
+        }
+
+        for(; closed != NULL; closed = s) {
+            s = closed->next_closed;
+            pthread_mutex_lock(&server.lock);
+            if(session_drop(closed)) {
+                pthread_mutex_unlock(&server.lock);
+                session_free(closed);
+            } else {
+                pthread_mutex_unlock(&server.lock);
+            }
+        }
+    }
+
+    /* Evaluators may be running, the process ends with them. */
+    histogram_print();
+    close(listen_fd);
+    unlink(path);
+
+    return 1;
+}
@@ -0,0 +1,53 @@
+/* This file is licensed under the terms of MIT license, see LICENSE file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/object.h"
+#include "../include/heap.h"
+#include "../include/stack.h"
+#include "../include/error.h"
+
+struct stack *stack_init(void)
+{
+    struct stack *s;
+
+    s = malloc(sizeof(struct stack));
+    s->data = malloc(sizeof(struct lispobj *) * STACK_SIZE);
+    s->index = 0;
+    s->size = STACK_SIZE;
+
+    return s;
+}
+
+void stack_free(struct stack *s)
+{
+    free(s->data);
+    free(s);
+
+    return;
+}
+
+void stack_push(struct lispobj *obj)
+{
+    if(ctx->stack->index >= ctx->stack->size) {
+        heap_release(obj);
+        error_signal(ERROR_STACK);
+    }
+
+    ctx->stack->data[ctx->stack->index] = obj;
+    ctx->stack->index++;
+
+    return;
+}
+
+void stack_unwind(int index)
+{
+    /* Pop and release everything above index. */
+    while(ctx->stack->index > index) {
+        ctx->stack->index--;
+        heap_release(ctx->stack->data[ctx->stack->index]);
+    }
+
+    return;
+}
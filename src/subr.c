@@ -1,9 +1,14 @@
 /* This file is licensed under the terms of MIT license, see LICENSE file. */
 
+#define _GNU_SOURCE /* for memmem() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
 
 #include "../include/object.h"
 #include "../include/heap.h"
@@ -11,6 +16,14 @@
 #include "../include/eval.h"
 #include "../include/read.h"
 #include "../include/subr.h"
+#include "../include/error.h"
+#include "../include/bignum.h"
+#include "../include/array.h"
+#include "../include/hashtable.h"
+#include "../include/hcons.h"
+#include "../include/stack.h"
+#include "../include/print.h"
+#include "../include/pool.h"
 
 struct lispobj *cons(struct lispobj *car, struct lispobj *cdr)
 {
@@ -47,11 +60,117 @@ struct lispobj *list(int n, ...)
     return list;
 }
 
+struct lispobj *number(long value)
+{
+    struct lispobj *num;
+
+    num = object_create(NUMBER, NULL);
+    NUMBER_VALUE(num) = value;
+
+    return num;
+}
+
+struct lispobj *flonum(double value)
+{
+    struct lispobj *num;
+
+    num = object_create(FLOAT, NULL);
+    FLOAT_VALUE(num) = value;
+
+    return num;
+}
+
+/* Copies length bytes of data, NULL data leaves the text unset. */
+struct lispobj *string(const char *data, long length)
+{
+    struct lispobj *str;
+
+    str = object_create(STRING, NULL);
+    STRING_VALUE(str) = malloc(sizeof(struct string) + length + 1);
+    STRING_LENGTH(str) = length;
+    STRING_DATA(str) = (char *) (STRING_VALUE(str) + 1);
+    STRING_VALUE(str)->parent = NULL;
+    if(data != NULL)
+        memcpy(STRING_DATA(str), data, length);
+    STRING_DATA(str)[length] = '\0';
+
+    return str;
+}
+
+/* Shares the text of str, nothing is copied. */
+struct lispobj *string_slice(struct lispobj *str, long start, long end)
+{
+    struct lispobj *slice, *owner;
+
+    /* Hang on the owner of the buffer, not on another slice. */
+    owner = STRING_VALUE(str)->parent != NULL ? STRING_VALUE(str)->parent : str;
+
+    slice = object_create(STRING, NULL);
+    STRING_VALUE(slice) = malloc(sizeof(struct string));
+    STRING_LENGTH(slice) = end - start;
+    STRING_DATA(slice) = STRING_DATA(str) + start;
+    STRING_VALUE(slice)->parent = heap_grab(owner);
+
+    return slice;
+}
+
+/* NUL-terminated copy for the C library, caller frees it. */
+char *string_to_c(struct lispobj *str)
+{
+    char *s;
+
+    s = malloc(STRING_LENGTH(str) + 1);
+    memcpy(s, STRING_DATA(str), STRING_LENGTH(str));
+    s[STRING_LENGTH(str)] = '\0';
+
+    return s;
+}
+
+/* All elements are set to fill. */
+struct lispobj *vector(int length, struct lispobj *fill)
+{
+    struct lispobj *vec;
+    int i;
+
+    vec = object_create(VECTOR, NULL);
+    VECTOR_VALUE(vec) = malloc(sizeof(struct vector) +
+                               sizeof(struct lispobj *) * length);
+    VECTOR_LENGTH(vec) = length;
+    for(i = 0; i < length; i++) {
+        VECTOR_DATA(vec)[i] = heap_grab(fill);
+    }
+
+    return vec;
+}
+
+/* Signals ERROR_NOT_CONS unless list is a proper list, before
+   making anything. */
+struct lispobj *list_to_vector(struct lispobj *list)
+{
+    struct lispobj *vec, *tmp, *nil = SYMBOL_NIL;
+    int i, n = 0;
+
+    for(tmp = list; tmp != NULL && tmp != nil; tmp = CDR(tmp)) {
+        if(OBJ_TYPE(tmp) != CONS)
+            error_signal(ERROR_NOT_CONS);
+        n++;
+    }
+
+    vec = vector(n, NULL);
+    for(i = 0; i < n; i++) {
+        VECTOR_DATA(vec)[i] = heap_grab(CAR(list));
+        list = CDR(list);
+    }
+
+    return vec;
+}
+
+/* Conses of a list, NIL is a symbol so it ends like any other tail. */
 int length(struct lispobj *list)
 {
     int n = 0;
     
-    while(list != NULL && list != NEW_SYMBOL("NIL")) {
+    while(list != NULL && OBJ_TYPE(list) == CONS) {
         list = CDR(list);
         n++;
     }
@@ -59,141 +178,147 @@ int length(struct lispobj *list)
     return n;
 }
 
-struct lispobj *subr_newline(struct lispobj *args)
+struct lispobj *subr_newline(int argc, struct lispobj **argv)
 {
-    if(length(args))
-        return ERROR_ARGS;
-
     printf("\n");
 
     return OBJ_TRUE;
 }
 
-struct lispobj *subr_display(struct lispobj *args)
+struct lispobj *subr_display(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
-
-    if(CAR(args) != NULL && OBJ_TYPE(CAR(args)) == STRING) {
-        printf("%s", STRING_VALUE(CAR(args)));
+    if(argv[0] != NULL && OBJ_TYPE(argv[0]) == STRING) {
+        fwrite(STRING_DATA(argv[0]), 1, STRING_LENGTH(argv[0]), stdout);
     } else {
-        print(CAR(args));
+        print(argv[0]);
     }
 
     return OBJ_TRUE;
 }
 
-struct lispobj *subr_apply(struct lispobj *args)
+struct lispobj *subr_apply(int argc, struct lispobj **argv)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
-
     struct lispobj *proc, *params;
-    proc = CAR(args);
-    params = CADR(args);
+    proc = argv[0];
+    params = argv[1];
 
-    if((proc != NULL && OBJ_TYPE(proc) != CONS) ||
+    if((proc != NULL && OBJ_TYPE(proc) != CONS && OBJ_TYPE(proc) != SUBR) ||
        (params != NULL && OBJ_TYPE(params) != CONS)) {
-        return NEW_ERROR("Wrong arguments type.\n");
+        error_signal(ERROR_WRONG_TYPE);
     }
 
     return apply(proc, params);
 }
 
-struct lispobj *subr_error(struct lispobj *args)
+struct lispobj *subr_error(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
+    struct lispobj *obj = argv[0], *err;
+    char *message;
+    
+    if(obj == NULL || OBJ_TYPE(obj) != STRING)
+        error_signal(ERROR_NOT_STRING);
 
-    struct lispobj *obj = CAR(args);
-    if(OBJ_TYPE(obj) != STRING)
-        return NEW_ERROR("Argument is not a string.\n");
+    message = string_to_c(obj);
+    err = NEW_ERROR(message);
+    free(message);
     
-    return NEW_ERROR(STRING_VALUE(obj));
+    error_signal(err);
+}
+
+struct lispobj *subr_signal(int argc, struct lispobj **argv)
+{
+    /* Any object can be signalled, see HANDLER-CASE. */
+    error_signal(argv[0]);
 }
 
-struct lispobj *subr_eval(struct lispobj *args)
+struct lispobj *subr_error_message(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
+    struct lispobj *obj = argv[0];
+    if(obj == NULL || OBJ_TYPE(obj) != ERROR)
+        error_signal(ERROR_WRONG_TYPE);
 
-    return eval(CAR(args), environment);
+    return NEW_STRING(ERROR_VALUE(obj));
 }
 
-struct lispobj *subr_read(struct lispobj *args)
+struct lispobj *subr_eval(int argc, struct lispobj **argv)
 {
-    if(length(args) != 0)
-        return ERROR_ARGS;
+    return eval(argv[0], ctx->environment);
+}
 
-    /* Just read a standard input. */
-    return read(stdin);
+/* (touch future) waits for its value, see pool.c. */
+struct lispobj *subr_touch(int argc, struct lispobj **argv)
+{
+    return pool_touch(argv[0]);
 }
 
-struct lispobj *subr_load(struct lispobj* args)
+struct lispobj *subr_read(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
+    struct lispobj *obj;
+    
+    /* Just read a standard input. */
+    if(ctx->stdin_reader == NULL) {
+        ctx->stdin_reader = reader_open_fd(STDIN_FILENO);
+    }
+    obj = read_form(ctx->stdin_reader);
+    if(obj != NULL && OBJ_TYPE(obj) == ERROR)
+        error_signal(obj);
 
-    struct lispobj *obj = CAR(args);
+    return obj;
+}
+
+struct lispobj *subr_load(int argc, struct lispobj **argv)
+{
+    struct lispobj *obj = argv[0];
+    char *filename;
+    int loaded;
 
     if(obj == NULL || OBJ_TYPE(obj) != STRING) {
-        return NEW_ERROR("Argument is not a string.\n");
+        error_signal(ERROR_NOT_STRING);
     }
 
-    if(!load(STRING_VALUE(obj)))
-        return OBJ_FALSE;
+    filename = string_to_c(obj);
+    loaded = load(filename);
+    free(filename);
 
-    return OBJ_TRUE;
+    return loaded ? OBJ_TRUE : OBJ_FALSE;
 }
 
-struct lispobj *subr_car(struct lispobj *args)
+struct lispobj *subr_car(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
-
-    struct lispobj *obj = CAR(args);
+    struct lispobj *obj = argv[0];
         
     if(obj == NULL || OBJ_TYPE(obj) != CONS) {
-        return NEW_ERROR("Argument is not a CONS type.\n");
+        error_signal(ERROR_NOT_CONS);
     }
 
     return CAR(obj);
 }
 
-struct lispobj *subr_cdr(struct lispobj *args)
+struct lispobj *subr_cdr(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
-    
-    struct lispobj *obj = CAR(args);
+    struct lispobj *obj = argv[0];
     
     if(obj == NULL || OBJ_TYPE(obj) != CONS) {
-        return NEW_ERROR("Argument is not a CONS type.\n");
+        error_signal(ERROR_NOT_CONS);
     }
     
     return CDR(obj);
 }
 
-struct lispobj *subr_cons(struct lispobj *args)
+struct lispobj *subr_cons(int argc, struct lispobj **argv)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
-
     struct lispobj *car, *cdr, *pair;
-    car = CAR(args);
-    cdr = CADR(args);
+    car = argv[0];
+    cdr = argv[1];
 
     pair = NEW_CONS(car, cdr);
 
     return pair;
 }
 
-struct lispobj *subr_pair(struct lispobj *args)
+struct lispobj *subr_pair(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
-    
-    struct lispobj *obj = CAR(args);
+    struct lispobj *obj = argv[0];
     
     if(obj != NULL && OBJ_TYPE(obj) == CONS)
         return OBJ_TRUE;
@@ -201,38 +326,29 @@ struct lispobj *subr_pair(struct lispobj *args)
     return OBJ_FALSE;
 }
 
-struct lispobj *subr_string(struct lispobj *args)
+struct lispobj *subr_string(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
+    struct lispobj *obj = argv[0];
 
-    struct lispobj *obj = CAR(args);
-
-    if(OBJ_TYPE(obj) == STRING)
+    if(obj != NULL && OBJ_TYPE(obj) == STRING)
         return OBJ_TRUE;
 
     return OBJ_FALSE;
 }
 
-struct lispobj *subr_number(struct lispobj *args)
+struct lispobj *subr_number(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
-
-    struct lispobj *obj = CAR(args);
+    struct lispobj *obj = argv[0];
     
-    if(OBJ_TYPE(obj) == NUMBER)
+    if(IS_NUMERIC(obj))
         return OBJ_TRUE;
 
     return OBJ_FALSE;
 }
 
-struct lispobj *subr_symbol(struct lispobj *args)
+struct lispobj *subr_symbol(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
-
-    struct lispobj *obj = CAR(args);
+    struct lispobj *obj = argv[0];
     
     if(OBJ_TYPE(obj) == SYMBOL)
         return OBJ_TRUE;
@@ -240,12 +356,9 @@ struct lispobj *subr_symbol(struct lispobj *args)
     return OBJ_FALSE;
 }
 
-struct lispobj *subr_atom(struct lispobj *args)
+struct lispobj *subr_atom(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
-
-    struct lispobj *obj = CAR(args);
+    struct lispobj *obj = argv[0];
     
     if(OBJ_TYPE(obj) != CONS)
         return OBJ_TRUE;
@@ -253,306 +366,1196 @@ struct lispobj *subr_atom(struct lispobj *args)
     return OBJ_FALSE;
 }
 
-struct lispobj *subr_null(struct lispobj *args)
+struct lispobj *subr_null(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
-
-    struct lispobj *obj = CAR(args);
+    struct lispobj *obj = argv[0];
     
     if(!obj)
         return OBJ_TRUE;
     return OBJ_FALSE;
 }
 
-struct lispobj *subr_not(struct lispobj *args)
+struct lispobj *subr_not(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
-
-    struct lispobj *obj = CAR(args);
+    struct lispobj *obj = argv[0];
     
     if(obj)
         return OBJ_FALSE;
     return OBJ_TRUE;
 }
 
-struct lispobj *subr_eq(struct lispobj *args)
+struct lispobj *subr_eq(int argc, struct lispobj **argv)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
+    return argv[0] == argv[1] ? OBJ_TRUE : OBJ_FALSE;
+}
 
-    return CAR(args) == CADR(args) ? OBJ_TRUE : OBJ_FALSE;
+int eql(struct lispobj *obj1, struct lispobj *obj2)
+{
+    if(obj1 == obj2)
+        return 1;
+    if(obj1 == NULL || obj2 == NULL || OBJ_TYPE(obj1) != OBJ_TYPE(obj2))
+        return 0;
+
+    switch(OBJ_TYPE(obj1)) {
+    case NUMBER:
+        return NUMBER_VALUE(obj1) == NUMBER_VALUE(obj2);
+    case FLOAT:
+        return FLOAT_VALUE(obj1) == FLOAT_VALUE(obj2);
+    case BIGNUM:
+        return bignum_cmp(BIGNUM_VALUE(obj1), BIGNUM_VALUE(obj2)) == 0;
+    default:
+        return 0;
+    }
 }
 
-struct lispobj *subr_eql(struct lispobj *args)
+struct lispobj *subr_eql(int argc, struct lispobj **argv)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
+    return eql(argv[0], argv[1]) ? OBJ_TRUE : OBJ_FALSE;
+}
 
-    struct lispobj *obj1, *obj2;
+/* Conses and vectors are compared by contents, strings by text. */
+int equal(struct lispobj *obj1, struct lispobj *obj2)
+{
+    int i;
     
-    obj1 = CAR(args);
-    obj2 = CADR(args);
+    while(obj1 != NULL && obj2 != NULL &&
+          OBJ_TYPE(obj1) == CONS && OBJ_TYPE(obj2) == CONS) {
+        /* Hash-consed structures exist only once. */
+        if(IS_HCONS(obj1) && IS_HCONS(obj2))
+            return obj1 == obj2;
+        if(!equal(CAR(obj1), CAR(obj2)))
+            return 0;
+
+        /* Walk down the CDRs without recursion. */
+        obj1 = CDR(obj1);
+        obj2 = CDR(obj2);
+    }
 
-    if(obj1 == obj2)
-        return OBJ_TRUE;
-    
-    if(OBJ_TYPE(obj1) == OBJ_TYPE(obj2)) {
-        if(OBJ_TYPE(obj1) == SYMBOL && obj1 == obj2) {
-            return OBJ_TRUE;
-        } else if(OBJ_TYPE(obj1) == NUMBER &&
-                  NUMBER_VALUE(obj1) == NUMBER_VALUE(obj2)) {
-            return OBJ_TRUE;
+    if(obj1 != NULL && obj2 != NULL &&
+       OBJ_TYPE(obj1) == VECTOR && OBJ_TYPE(obj2) == VECTOR) {
+        if(VECTOR_LENGTH(obj1) != VECTOR_LENGTH(obj2))
+            return 0;
+
+        for(i = 0; i < VECTOR_LENGTH(obj1); i++) {
+            if(!equal(VECTOR_DATA(obj1)[i], VECTOR_DATA(obj2)[i]))
+                return 0;
         }
+
+        return 1;
     }
 
-    return OBJ_FALSE;
+    if(obj1 != NULL && obj2 != NULL &&
+       OBJ_TYPE(obj1) == STRING && OBJ_TYPE(obj2) == STRING) {
+        return STRING_LENGTH(obj1) == STRING_LENGTH(obj2) &&
+            memcmp(STRING_DATA(obj1), STRING_DATA(obj2),
+                   STRING_LENGTH(obj1)) == 0;
+    }
+
+    return eql(obj1, obj2);
 }
 
-struct lispobj *subr_equal(struct lispobj *args)
+struct lispobj *subr_equal(int argc, struct lispobj **argv)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
+    return equal(argv[0], argv[1]) ? OBJ_TRUE : OBJ_FALSE;
+}
 
-    struct lispobj *obj1, *obj2, *ret;
+struct lispobj *subr_list(int argc, struct lispobj **argv)
+{
+    struct lispobj *list = OBJ_FALSE; // NULL
 
-    obj1 = CAR(args);
-    obj2 = CADR(args);
+    /* Build the list from the tail. */
+    while(argc > 0) {
+        list = NEW_CONS(argv[--argc], list);
+    }
 
-    if(obj1 == NULL && obj2 == NULL) {
-        ret = OBJ_TRUE;
-    } else if(obj1 != NULL && obj2 != NULL && OBJ_TYPE(obj1) == OBJ_TYPE(obj2)) {
-        if(OBJ_TYPE(obj1) == CONS) {
-            struct lispobj *args_equal_cars, *args_equal_cdrs;
+    return list;
+}
 
-            args_equal_cars = heap_grab(list(2, CAR(obj1), CAR(obj2)));
-            args_equal_cdrs = heap_grab(list(2, CDR(obj1), CDR(obj2)));
+#define IS_VECTOR(x) ((x) != NULL && OBJ_TYPE((x)) == VECTOR)
 
-            if(subr_equal(args_equal_cars) &&
-               subr_equal(args_equal_cdrs)) {
-                ret = OBJ_TRUE;
-            } else {
-                ret = OBJ_FALSE;
-            }
+/* Checks the index and returns it as an int. */
+static int vector_index(struct lispobj *vec, struct lispobj *index)
+{
+    if(!IS_VECTOR(vec))
+        error_signal(ERROR_NOT_VECTOR);
+    if(index == NULL || OBJ_TYPE(index) != NUMBER)
+        error_signal(ERROR_NOT_NUMBER);
+    if(NUMBER_VALUE(index) < 0 || NUMBER_VALUE(index) >= VECTOR_LENGTH(vec))
+        error_signal(ERROR_BAD_INDEX);
+
+    return (int) NUMBER_VALUE(index);
+}
 
-            heap_release(args_equal_cars);
-            heap_release(args_equal_cdrs);
-        } else {
-            struct lispobj *args_eq;
+struct lispobj *subr_make_vector(int argc, struct lispobj **argv)
+{
+    if(argv[0] == NULL || OBJ_TYPE(argv[0]) != NUMBER)
+        error_signal(ERROR_NOT_NUMBER);
+    if(NUMBER_VALUE(argv[0]) < 0 || NUMBER_VALUE(argv[0]) > INT_MAX)
+        error_signal(ERROR_BAD_INDEX);
 
-            args_eq = heap_grab(list(2, obj1, obj2));
-            ret = subr_eq(args_eq);
-            heap_release(args_eq);
-        }
-    } else
-        ret = OBJ_FALSE;
-    
-    return ret;
+    return vector((int) NUMBER_VALUE(argv[0]), argc > 1 ? argv[1] : NULL);
+}
+
+struct lispobj *subr_vector_ref(int argc, struct lispobj **argv)
+{
+    return VECTOR_DATA(argv[0])[vector_index(argv[0], argv[1])];
 }
 
-struct lispobj *subr_list(struct lispobj *args)
+struct lispobj *subr_vector_set(int argc, struct lispobj **argv)
 {
-    if(length(args) > 0) {
-        struct lispobj *list;
+    struct lispobj **slot;
 
-        list = NEW_CONS(NULL, NULL);
-        
-        CAR(list) = heap_grab(CAR(args));
-        CDR(list) = heap_grab(subr_list(CDR(args)));
-    
-        return list;
+    if(IS_FROZEN(argv[0]))
+        error_signal(ERROR_IMMUTABLE);
+
+    slot = &VECTOR_DATA(argv[0])[vector_index(argv[0], argv[1])];
+    heap_grab(argv[2]);
+    heap_release(*slot);
+    *slot = argv[2];
+
+    return argv[2];
+}
+
+struct lispobj *subr_vector_length(int argc, struct lispobj **argv)
+{
+    if(!IS_VECTOR(argv[0]))
+        error_signal(ERROR_NOT_VECTOR);
+
+    return number(VECTOR_LENGTH(argv[0]));
+}
+
+struct lispobj *subr_vector_to_list(int argc, struct lispobj **argv)
+{
+    struct lispobj *list = OBJ_FALSE;
+    int i;
+
+    if(!IS_VECTOR(argv[0]))
+        error_signal(ERROR_NOT_VECTOR);
+
+    for(i = VECTOR_LENGTH(argv[0]) - 1; i >= 0; i--) {
+        list = NEW_CONS(VECTOR_DATA(argv[0])[i], list);
     }
-    
-    return OBJ_FALSE; // NULL
+
+    return list;
 }
 
-struct lispobj *subr_plus(struct lispobj *args)
+struct lispobj *subr_list_to_vector(int argc, struct lispobj **argv)
 {
-    struct lispobj *num;
-    
-    num = NEW_NUMBER("0");
+    return list_to_vector(argv[0]);
+}
 
-    while(args != NULL) {
-        if(CAR(args) != NULL && OBJ_TYPE(CAR(args)) == NUMBER) {
-            NUMBER_VALUE(num) += NUMBER_VALUE(CAR(args));
-            args = CDR(args);
-        } else {
-            object_delete(num);
-            return NEW_ERROR("Argument is not a number.\n");
-        }
+#define IS_FLOAT(x) ((x) != NULL && OBJ_TYPE((x)) == FLOAT)
+
+static double to_double(struct lispobj *obj)
+{
+    if(OBJ_TYPE(obj) == FLOAT) {
+        return FLOAT_VALUE(obj);
+    } else if(OBJ_TYPE(obj) == NUMBER) {
+        return (double) NUMBER_VALUE(obj);
     }
 
-    return num;
+    return bignum_to_double(BIGNUM_VALUE(obj));
 }
 
-struct lispobj *subr_minus(struct lispobj *args)
+/*
+ * Once a FLOAT shows up the rest of the fold runs on a plain
+ * double, only the final result gets an object.
+ */
+static struct lispobj *float_fold(int op, double acc,
+                                  int argc, struct lispobj **argv)
 {
-    if(length(args) == 0)
-        return ERROR_ARGS;
-    
-    struct lispobj *num;
-    char num_value[30];
+    double arg;
+    int i;
+
+    for(i = 0; i < argc; i++) {
+        if(!IS_NUMERIC(argv[i]))
+            error_signal(ERROR_NOT_NUMBER);
+
+        arg = to_double(argv[i]);
+        switch(op) {
+        case '+':
+            acc += arg;
+            break;
+        case '-':
+            acc -= arg;
+            break;
+        case '*':
+            acc *= arg;
+            break;
+        default: // '/'
+            if(arg == 0.0)
+                error_signal(ERROR_DIVISION_BY_ZERO);
+            acc /= arg;
+            break;
+        }
+    }
 
-    snprintf(num_value, 30, "%d", NUMBER_VALUE(CAR(args)));
-    num = NEW_NUMBER(num_value);
+    return flonum(acc);
+}
 
-    args = CDR(args);
-    if(args == NULL) {
-        NUMBER_VALUE(num) = 0 - NUMBER_VALUE(num);
-    } else {
-        while(args != NULL) {
-            if(CAR(args) != NULL && OBJ_TYPE(CAR(args)) == NUMBER) {
-                NUMBER_VALUE(num) -= NUMBER_VALUE(CAR(args));
-                args = CDR(args);
-            } else {
-                object_delete(num);
-                return NEW_ERROR("Argument is not a number.\n");
+/*
+ * Integer arithmetic works on machine words and checks every step
+ * for overflow. The first overflow moves the rest of the fold
+ * to bignums, bignum_normalize() brings small results back.
+ */
+static struct lispobj *bignum_fold(int op, struct bignum *acc,
+                                   int argc, struct lispobj **argv)
+{
+    struct bignum *tmp, *arg, view;
+    uint32_t buf[BIGNUM_LONG_DIGITS];
+    double d;
+    int i;
+
+    for(i = 0; i < argc; i++) {
+        if(IS_FLOAT(argv[i])) {
+            d = bignum_to_double(acc);
+            bignum_free(acc);
+            
+            return float_fold(op, d, argc - i, argv + i);
+        }
+        if(!IS_INTEGER(argv[i])) {
+            bignum_free(acc);
+            error_signal(ERROR_NOT_NUMBER);
+        }
+
+        arg = bignum_view(argv[i], &view, buf);
+        switch(op) {
+        case '+':
+            tmp = bignum_add(acc, arg);
+            break;
+        case '-':
+            tmp = bignum_sub(acc, arg);
+            break;
+        case '*':
+            tmp = bignum_mul(acc, arg);
+            break;
+        default: // '/'
+            if(!bignum_divmod(acc, arg, &tmp, NULL)) {
+                bignum_free(acc);
+                error_signal(ERROR_DIVISION_BY_ZERO);
             }
+            break;
         }
+        
+        bignum_free(acc);
+        acc = tmp;
     }
-    return num;
+
+    return bignum_normalize(acc);
 }
 
-struct lispobj *subr_multi(struct lispobj *args)
+struct lispobj *subr_plus(int argc, struct lispobj **argv)
 {
-    struct lispobj *num;
+    long acc = 0, sum;
+    int i;
+
+    for(i = 0; i < argc; i++) {
+        if(IS_FLOAT(argv[i]))
+            return float_fold('+', (double) acc, argc - i, argv + i);
+        if(argv[i] == NULL || OBJ_TYPE(argv[i]) != NUMBER ||
+           __builtin_add_overflow(acc, NUMBER_VALUE(argv[i]), &sum)) {
+            return bignum_fold('+', bignum_from_long(acc), argc - i, argv + i);
+        }
+        acc = sum;
+    }
+
+    return number(acc);
+}
+
+struct lispobj *subr_minus(int argc, struct lispobj **argv)
+{
+    long acc, diff;
+    int i;
+
+    if(!IS_NUMERIC(argv[0]))
+        error_signal(ERROR_NOT_NUMBER);
+
+    if(argc == 1) {
+        if(OBJ_TYPE(argv[0]) == FLOAT) {
+            return flonum(-FLOAT_VALUE(argv[0]));
+        } else if(OBJ_TYPE(argv[0]) == NUMBER &&
+                  NUMBER_VALUE(argv[0]) != LONG_MIN) {
+            return number(-NUMBER_VALUE(argv[0]));
+        }
+        
+        return bignum_fold('-', bignum_from_long(0), argc, argv);
+    }
     
-    num = NEW_NUMBER("1");
+    if(OBJ_TYPE(argv[0]) == FLOAT) {
+        return float_fold('-', FLOAT_VALUE(argv[0]), argc - 1, argv + 1);
+    } else if(OBJ_TYPE(argv[0]) == BIGNUM) {
+        return bignum_fold('-', bignum_copy(BIGNUM_VALUE(argv[0])),
+                           argc - 1, argv + 1);
+    }
 
-    while(args != NULL) {
-        if(CAR(args) != NULL && OBJ_TYPE(CAR(args)) == NUMBER) {
-            NUMBER_VALUE(num) *= NUMBER_VALUE(CAR(args));
-            args = CDR(args);
-        } else {
-            object_delete(num);
-            return NEW_ERROR("Argument is not a number.\n");
+    acc = NUMBER_VALUE(argv[0]);
+    for(i = 1; i < argc; i++) {
+        if(IS_FLOAT(argv[i]))
+            return float_fold('-', (double) acc, argc - i, argv + i);
+        if(argv[i] == NULL || OBJ_TYPE(argv[i]) != NUMBER ||
+           __builtin_sub_overflow(acc, NUMBER_VALUE(argv[i]), &diff)) {
+            return bignum_fold('-', bignum_from_long(acc), argc - i, argv + i);
         }
+        acc = diff;
     }
 
-    return num;
+    return number(acc);
 }
 
-struct lispobj *subr_divide(struct lispobj *args)
+struct lispobj *subr_multi(int argc, struct lispobj **argv)
 {
-    if(length(args) < 2)
-        return ERROR_ARGS;
-    
-    if(CAR(args) == NULL || OBJ_TYPE(CAR(args)) != NUMBER) {
-        return NEW_ERROR("Argument is not a number.\n");
+    long acc = 1, prod;
+    int i;
+
+    for(i = 0; i < argc; i++) {
+        if(IS_FLOAT(argv[i]))
+            return float_fold('*', (double) acc, argc - i, argv + i);
+        if(argv[i] == NULL || OBJ_TYPE(argv[i]) != NUMBER ||
+           __builtin_mul_overflow(acc, NUMBER_VALUE(argv[i]), &prod)) {
+            return bignum_fold('*', bignum_from_long(acc), argc - i, argv + i);
+        }
+        acc = prod;
     }
+
+    return number(acc);
+}
+
+/* Integers divide with truncation, any FLOAT makes it a real division. */
+struct lispobj *subr_divide(int argc, struct lispobj **argv)
+{
+    long acc;
+    int i;
     
-    struct lispobj *num = CAR(args);
-    args = CDR(args);
-    
-    while(args != NULL) {
-        if(CAR(args) != NULL && OBJ_TYPE(CAR(args)) == NUMBER) {
-            NUMBER_VALUE(num) /= NUMBER_VALUE(CAR(args));
-            args = CDR(args);
-        } else {
-            object_delete(num);
-            return NEW_ERROR("Argument is not a number.\n");
+    if(!IS_NUMERIC(argv[0]))
+        error_signal(ERROR_NOT_NUMBER);
+
+    if(OBJ_TYPE(argv[0]) == FLOAT) {
+        return float_fold('/', FLOAT_VALUE(argv[0]), argc - 1, argv + 1);
+    } else if(OBJ_TYPE(argv[0]) == BIGNUM) {
+        return bignum_fold('/', bignum_copy(BIGNUM_VALUE(argv[0])),
+                           argc - 1, argv + 1);
+    }
+
+    acc = NUMBER_VALUE(argv[0]);
+    for(i = 1; i < argc; i++) {
+        if(IS_FLOAT(argv[i]))
+            return float_fold('/', (double) acc, argc - i, argv + i);
+        /* LONG_MIN / -1 is the only overflowing case. */
+        if(argv[i] == NULL || OBJ_TYPE(argv[i]) != NUMBER ||
+           (acc == LONG_MIN && NUMBER_VALUE(argv[i]) == -1)) {
+            return bignum_fold('/', bignum_from_long(acc), argc - i, argv + i);
         }
+        if(NUMBER_VALUE(argv[i]) == 0)
+            error_signal(ERROR_DIVISION_BY_ZERO);
+        
+        acc /= NUMBER_VALUE(argv[i]);
     }
 
-    return num;
+    return number(acc);
 }
 
-struct lispobj *subr_mod(struct lispobj *args)
+struct lispobj *subr_mod(int argc, struct lispobj **argv)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
+    struct lispobj *num, *div;
+    struct bignum *rem, view1, view2;
+    uint32_t buf1[BIGNUM_LONG_DIGITS], buf2[BIGNUM_LONG_DIGITS];
+
+    num = argv[0];
+    div = argv[1];
+
+    if(!IS_NUMERIC(num) || !IS_NUMERIC(div))
+        error_signal(ERROR_NOT_NUMBER);
+
+    if(OBJ_TYPE(num) == FLOAT || OBJ_TYPE(div) == FLOAT) {
+        if(to_double(div) == 0.0)
+            error_signal(ERROR_DIVISION_BY_ZERO);
+
+        return flonum(fmod(to_double(num), to_double(div)));
+    }
+
+    if(OBJ_TYPE(num) == NUMBER && OBJ_TYPE(div) == NUMBER) {
+        if(NUMBER_VALUE(div) == 0)
+            error_signal(ERROR_DIVISION_BY_ZERO);
+        /* LONG_MIN % -1 traps, but it's 0 anyway. */
+        if(NUMBER_VALUE(div) == -1)
+            return number(0);
+        
+        return number(NUMBER_VALUE(num) % NUMBER_VALUE(div));
+    }
+
+    if(!bignum_divmod(bignum_view(num, &view1, buf1),
+                      bignum_view(div, &view2, buf2), NULL, &rem))
+        error_signal(ERROR_DIVISION_BY_ZERO);
     
-    struct lispobj *number, *div;
+    return bignum_normalize(rem);
+}
 
-    number = CAR(args);
-    div    = CADR(args);
+#define UNORDERED 2 // NaN compares neither less, greater nor equal
 
-    if(OBJ_TYPE(number) == NUMBER && OBJ_TYPE(div) == NUMBER) {
-        char mod[30];
+/* Three-way comparison of two numbers. */
+static int compare(struct lispobj *obj1, struct lispobj *obj2)
+{
+    struct bignum view1, view2;
+    uint32_t buf1[BIGNUM_LONG_DIGITS], buf2[BIGNUM_LONG_DIGITS];
+    double d1, d2;
+
+    if(!IS_NUMERIC(obj1) || !IS_NUMERIC(obj2))
+        error_signal(ERROR_NOT_NUMBER);
+
+    if(OBJ_TYPE(obj1) == NUMBER && OBJ_TYPE(obj2) == NUMBER) {
+        return (NUMBER_VALUE(obj1) > NUMBER_VALUE(obj2)) -
+            (NUMBER_VALUE(obj1) < NUMBER_VALUE(obj2));
+    }
+
+    if(OBJ_TYPE(obj1) == FLOAT || OBJ_TYPE(obj2) == FLOAT) {
+        d1 = to_double(obj1);
+        d2 = to_double(obj2);
+        if(d1 != d1 || d2 != d2)
+            return UNORDERED;
         
-        snprintf(mod, 30, "%d", NUMBER_VALUE(number) % NUMBER_VALUE(div));
-        return NEW_NUMBER(mod);
+        return (d1 > d2) - (d1 < d2);
+    }
+
+    return bignum_cmp(bignum_view(obj1, &view1, buf1),
+                      bignum_view(obj2, &view2, buf2));
+}
+
+struct lispobj *subr_greatthan(int argc, struct lispobj **argv)
+{
+    if(argv[0] != NULL && argv[1] != NULL &&
+       compare(argv[0], argv[1]) == 1) {
+        return OBJ_TRUE;
+    }
+
+    return OBJ_FALSE;
+}
+
+struct lispobj *subr_lessthan(int argc, struct lispobj **argv)
+{
+    if(argv[0] != NULL && argv[1] != NULL &&
+       compare(argv[0], argv[1]) == -1) {
+        return OBJ_TRUE;
+    }
+
+    return OBJ_FALSE;
+}
+
+struct lispobj *subr_compar(int argc, struct lispobj **argv)
+{
+    if(argv[0] != NULL && argv[1] != NULL &&
+       compare(argv[0], argv[1]) == 0) {
+        return OBJ_TRUE;
+    }
+
+    return OBJ_FALSE;
+}
+
+#define IS_ARRAY(x) ((x) != NULL && OBJ_TYPE((x)) == ARRAY)
+#define IS_FIXNUM(x) ((x) != NULL && OBJ_TYPE((x)) == NUMBER)
+
+static struct lispobj *array_object(int kind, long length)
+{
+    struct lispobj *obj;
+
+    obj = object_create(ARRAY, NULL);
+    ARRAY_VALUE(obj) = array_new(kind, length);
+
+    return obj;
+}
+
+static struct array *array_arg(struct lispobj *obj)
+{
+    if(!IS_ARRAY(obj))
+        error_signal(ERROR_NOT_ARRAY);
+
+    return ARRAY_VALUE(obj);
+}
+
+/* Both arrays must have the same kind and length. */
+static void array_match(struct array *a, struct array *b)
+{
+    if(a->kind != b->kind || a->length != b->length)
+        error_signal(ERROR_ARRAY_MISMATCH);
+
+    return;
+}
+
+/* Int64 arrays take only fixnums, float64 ones any number. */
+static void array_check(int kind, struct lispobj *obj)
+{
+    if(kind == ARRAY_INT64 && !IS_FIXNUM(obj))
+        error_signal(ERROR_WRONG_TYPE);
+    if(!IS_NUMERIC(obj))
+        error_signal(ERROR_NOT_NUMBER);
+
+    return;
+}
+
+static void array_store(struct array *a, long i, struct lispobj *obj)
+{
+    if(a->kind == ARRAY_INT64) {
+        a->data.i64[i] = NUMBER_VALUE(obj);
     } else {
-        return NEW_ERROR("Arguments must be numbers.\n");
+        a->data.f64[i] = to_double(obj);
     }
-    
+
+    return;
 }
 
-struct lispobj *subr_greatthan(struct lispobj *args)
+static struct lispobj *array_load(struct array *a, long i)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
+    if(a->kind == ARRAY_INT64)
+        return number(a->data.i64[i]);
 
-    struct lispobj *obj1, *obj2;
+    return flonum(a->data.f64[i]);
+}
 
-    obj1 = CAR(args);
-    obj2 = CADR(args);
+static struct lispobj *make_array(int kind, int argc, struct lispobj **argv)
+{
+    struct lispobj *obj;
+    struct array *a;
+    long i;
+
+    if(!IS_FIXNUM(argv[0]))
+        error_signal(ERROR_NOT_NUMBER);
+    if(NUMBER_VALUE(argv[0]) < 0)
+        error_signal(ERROR_BAD_INDEX);
+    if(argc > 1)
+        array_check(kind, argv[1]);
+
+    obj = array_object(kind, NUMBER_VALUE(argv[0]));
+    a = ARRAY_VALUE(obj);
+    if(argc > 1) {
+        for(i = 0; i < a->length; i++) {
+            array_store(a, i, argv[1]);
+        }
+    } else {
+        /* All bits zero is 0 and 0.0 alike. */
+        memset(a->data.i64, 0, sizeof(int64_t) * a->length);
+    }
+
+    return obj;
+}
 
-    if(obj1 != NULL && obj2 != NULL) {
-        if(OBJ_TYPE(obj1) == NUMBER && OBJ_TYPE(obj2) == NUMBER) {
-            if(NUMBER_VALUE(obj1) > NUMBER_VALUE(obj2)) {
-                return OBJ_TRUE;
+static struct lispobj *list_to_array(int kind, struct lispobj *list)
+{
+    struct lispobj *obj, *tmp, *nil = SYMBOL_NIL;
+    long i, n = 0;
+
+    /* Check everything first, so a bad element or tail leaks nothing. */
+    for(tmp = list; tmp != NULL && tmp != nil; tmp = CDR(tmp)) {
+        if(OBJ_TYPE(tmp) != CONS)
+            error_signal(ERROR_NOT_CONS);
+        array_check(kind, CAR(tmp));
+        n++;
+    }
+
+    obj = array_object(kind, n);
+    for(i = 0; i < n; i++) {
+        array_store(ARRAY_VALUE(obj), i, CAR(list));
+        list = CDR(list);
+    }
+
+    return obj;
+}
+
+struct lispobj *subr_make_int64_array(int argc, struct lispobj **argv)
+{
+    return make_array(ARRAY_INT64, argc, argv);
+}
+
+struct lispobj *subr_make_float64_array(int argc, struct lispobj **argv)
+{
+    return make_array(ARRAY_FLOAT64, argc, argv);
+}
+
+struct lispobj *subr_list_to_int64_array(int argc, struct lispobj **argv)
+{
+    return list_to_array(ARRAY_INT64, argv[0]);
+}
+
+struct lispobj *subr_list_to_float64_array(int argc, struct lispobj **argv)
+{
+    return list_to_array(ARRAY_FLOAT64, argv[0]);
+}
+
+struct lispobj *subr_array_to_list(int argc, struct lispobj **argv)
+{
+    struct lispobj *list = OBJ_FALSE;
+    struct array *a = array_arg(argv[0]);
+    long i;
+
+    for(i = a->length - 1; i >= 0; i--) {
+        list = NEW_CONS(array_load(a, i), list);
+    }
+
+    return list;
+}
+
+struct lispobj *subr_array_length(int argc, struct lispobj **argv)
+{
+    return number(array_arg(argv[0])->length);
+}
+
+static long array_index(struct array *a, struct lispobj *index)
+{
+    if(!IS_FIXNUM(index))
+        error_signal(ERROR_NOT_NUMBER);
+    if(NUMBER_VALUE(index) < 0 || NUMBER_VALUE(index) >= a->length)
+        error_signal(ERROR_BAD_INDEX);
+
+    return NUMBER_VALUE(index);
+}
+
+struct lispobj *subr_array_ref(int argc, struct lispobj **argv)
+{
+    struct array *a = array_arg(argv[0]);
+
+    return array_load(a, array_index(a, argv[1]));
+}
+
+struct lispobj *subr_array_set(int argc, struct lispobj **argv)
+{
+    struct array *a = array_arg(argv[0]);
+    long i = array_index(a, argv[1]);
+
+    if(IS_FROZEN(argv[0]))
+        error_signal(ERROR_IMMUTABLE);
+
+    array_check(a->kind, argv[2]);
+    array_store(a, i, argv[2]);
+
+    return argv[2];
+}
+
+/* Largest magnitude of the elements of an int64 array. */
+static int64_t array_magnitude(struct array *a)
+{
+    int64_t lo, hi;
+
+    if(a->length == 0)
+        return 0;
+
+    lo = array_kernels.i64_min(a->data.i64, a->length);
+    hi = array_kernels.i64_max(a->data.i64, a->length);
+    lo = lo == INT64_MIN ? INT64_MAX : -lo;
+
+    return lo > hi ? lo : hi;
+}
+
+/*
+ * Sum of a[i] * b[i], or of a[i] if b is NULL, checked like + and *:
+ * the first overflow moves the rest of the fold to bignums.
+ */
+static struct lispobj *array_fold(const int64_t *a, const int64_t *b, long n)
+{
+    struct bignum *acc = NULL, *x, *y, *tmp;
+    int64_t sum = 0, term, next;
+    long i;
+
+    for(i = 0; i < n; i++) {
+        if(acc == NULL) {
+            term = a[i];
+            if((b == NULL || !__builtin_mul_overflow(a[i], b[i], &term)) &&
+               !__builtin_add_overflow(sum, term, &next)) {
+                sum = next;
+                continue;
             }
-        } else {
-            return NEW_ERROR("Argument must be a number.\n");
+            acc = bignum_from_long(sum);
+        }
+
+        x = bignum_from_long(a[i]);
+        if(b != NULL) {
+            y = bignum_from_long(b[i]);
+            tmp = bignum_mul(x, y);
+            bignum_free(x);
+            bignum_free(y);
+            x = tmp;
         }
+        tmp = bignum_add(acc, x);
+        bignum_free(acc);
+        bignum_free(x);
+        acc = tmp;
     }
 
-    return OBJ_FALSE;
+    return acc != NULL ? bignum_normalize(acc) : number(sum);
 }
 
-struct lispobj *subr_lessthan(struct lispobj *args)
+/*
+ * Integer sums go through the vector kernels, which wrap, only when
+ * the magnitudes of the elements show they can't overflow.
+ */
+struct lispobj *subr_array_sum(int argc, struct lispobj **argv)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
+    struct array *a = array_arg(argv[0]);
 
-    struct lispobj *obj1, *obj2;
+    if(a->kind == ARRAY_INT64) {
+        if(array_magnitude(a) > INT64_MAX / (a->length > 0 ? a->length : 1))
+            return array_fold(a->data.i64, NULL, a->length);
 
-    obj1 = CAR(args);
-    obj2 = CADR(args);
+        return number(array_kernels.i64_sum(a->data.i64, a->length));
+    }
 
-    if(obj1 != NULL && obj2 != NULL) {
-        if(OBJ_TYPE(obj1) == NUMBER && OBJ_TYPE(obj2) == NUMBER) {
-            if(NUMBER_VALUE(obj1) < NUMBER_VALUE(obj2)) {
-                return OBJ_TRUE;
-            }
+    return flonum(array_kernels.f64_sum(a->data.f64, a->length));
+}
+
+struct lispobj *subr_array_min(int argc, struct lispobj **argv)
+{
+    struct array *a = array_arg(argv[0]);
+
+    if(a->length == 0)
+        error_signal(ERROR_EMPTY_ARRAY);
+    if(a->kind == ARRAY_INT64)
+        return number(array_kernels.i64_min(a->data.i64, a->length));
+
+    return flonum(array_kernels.f64_min(a->data.f64, a->length));
+}
+
+struct lispobj *subr_array_max(int argc, struct lispobj **argv)
+{
+    struct array *a = array_arg(argv[0]);
+
+    if(a->length == 0)
+        error_signal(ERROR_EMPTY_ARRAY);
+    if(a->kind == ARRAY_INT64)
+        return number(array_kernels.i64_max(a->data.i64, a->length));
+
+    return flonum(array_kernels.f64_max(a->data.f64, a->length));
+}
+
+struct lispobj *subr_array_dot(int argc, struct lispobj **argv)
+{
+    struct array *a = array_arg(argv[0]), *b = array_arg(argv[1]);
+    int64_t bound;
+
+    array_match(a, b);
+    if(a->kind == ARRAY_INT64) {
+        /* Like ARRAY-SUM, of the products. */
+        if(__builtin_mul_overflow(array_magnitude(a), array_magnitude(b),
+                                  &bound) ||
+           bound > INT64_MAX / (a->length > 0 ? a->length : 1))
+            return array_fold(a->data.i64, b->data.i64, a->length);
+
+        return number(array_kernels.i64_dot(a->data.i64, b->data.i64,
+                                            a->length));
+    }
+
+    return flonum(array_kernels.f64_dot(a->data.f64, b->data.f64, a->length));
+}
+
+struct lispobj *subr_array_add(int argc, struct lispobj **argv)
+{
+    struct array *a = array_arg(argv[0]), *b = array_arg(argv[1]), *r;
+    struct lispobj *obj;
+
+    array_match(a, b);
+    obj = array_object(a->kind, a->length);
+    r = ARRAY_VALUE(obj);
+    if(a->kind == ARRAY_INT64) {
+        array_kernels.i64_add(r->data.i64, a->data.i64, b->data.i64, a->length);
+    } else {
+        array_kernels.f64_add(r->data.f64, a->data.f64, b->data.f64, a->length);
+    }
+
+    return obj;
+}
+
+struct lispobj *subr_array_mul(int argc, struct lispobj **argv)
+{
+    struct array *a = array_arg(argv[0]), *b = array_arg(argv[1]), *r;
+    struct lispobj *obj;
+
+    array_match(a, b);
+    obj = array_object(a->kind, a->length);
+    r = ARRAY_VALUE(obj);
+    if(a->kind == ARRAY_INT64) {
+        array_kernels.i64_mul(r->data.i64, a->data.i64, b->data.i64, a->length);
+    } else {
+        array_kernels.f64_mul(r->data.f64, a->data.f64, b->data.f64, a->length);
+    }
+
+    return obj;
+}
+
+struct lispobj *subr_array_scale(int argc, struct lispobj **argv)
+{
+    struct array *a = array_arg(argv[0]), *r;
+    struct lispobj *obj;
+
+    if(a->kind == ARRAY_INT64 ? !IS_FIXNUM(argv[1]) : !IS_NUMERIC(argv[1]))
+        error_signal(ERROR_WRONG_TYPE);
+
+    obj = array_object(a->kind, a->length);
+    r = ARRAY_VALUE(obj);
+    if(a->kind == ARRAY_INT64) {
+        array_kernels.i64_scale(r->data.i64, a->data.i64,
+                                NUMBER_VALUE(argv[1]), a->length);
+    } else {
+        array_kernels.f64_scale(r->data.f64, a->data.f64,
+                                to_double(argv[1]), a->length);
+    }
+
+    return obj;
+}
+
+/* (array-count array '< x) counts elements less than x, also > and =. */
+struct lispobj *subr_array_count(int argc, struct lispobj **argv)
+{
+    struct array *a = array_arg(argv[0]);
+    int op;
+
+    if(argv[1] == NEW_SYMBOL("<")) {
+        op = ARRAY_LT;
+    } else if(argv[1] == NEW_SYMBOL(">")) {
+        op = ARRAY_GT;
+    } else if(argv[1] == NEW_SYMBOL("=")) {
+        op = ARRAY_EQ;
+    } else {
+        error_signal(ERROR_WRONG_TYPE);
+    }
+
+    if(a->kind == ARRAY_INT64) {
+        if(!IS_FIXNUM(argv[2]))
+            error_signal(ERROR_WRONG_TYPE);
+        
+        return number(array_kernels.i64_count(a->data.i64, a->length,
+                                              op, NUMBER_VALUE(argv[2])));
+    }
+    if(!IS_NUMERIC(argv[2]))
+        error_signal(ERROR_NOT_NUMBER);
+
+    return number(array_kernels.f64_count(a->data.f64, a->length,
+                                          op, to_double(argv[2])));
+}
+
+#define IS_STRING(x) ((x) != NULL && OBJ_TYPE((x)) == STRING)
+
+static struct lispobj *string_arg(struct lispobj *obj)
+{
+    if(!IS_STRING(obj))
+        error_signal(ERROR_NOT_STRING);
+
+    return obj;
+}
+
+/* Optional index argument in 0..limit, default if it's absent. */
+static long string_index(int argc, struct lispobj **argv, int i,
+                         long dflt, long limit)
+{
+    if(i >= argc)
+        return dflt;
+    if(!IS_FIXNUM(argv[i]))
+        error_signal(ERROR_NOT_NUMBER);
+    if(NUMBER_VALUE(argv[i]) < 0 || NUMBER_VALUE(argv[i]) > limit)
+        error_signal(ERROR_BAD_INDEX);
+
+    return NUMBER_VALUE(argv[i]);
+}
+
+/* First occurrence of needle in hay, or NULL. */
+static char *string_find(char *hay, long hay_len, char *needle, long needle_len)
+{
+    if(needle_len == 1)
+        return memchr(hay, needle[0], hay_len);
+
+    return memmem(hay, hay_len, needle, needle_len);
+}
+
+struct lispobj *subr_string_length(int argc, struct lispobj **argv)
+{
+    return number(STRING_LENGTH(string_arg(argv[0])));
+}
+
+/* Sizes everything first and copies once. */
+struct lispobj *subr_string_append(int argc, struct lispobj **argv)
+{
+    struct lispobj *str;
+    long length = 0;
+    char *p;
+    int i;
+
+    for(i = 0; i < argc; i++) {
+        length += STRING_LENGTH(string_arg(argv[i]));
+    }
+
+    str = string(NULL, length);
+    p = STRING_DATA(str);
+    for(i = 0; i < argc; i++) {
+        memcpy(p, STRING_DATA(argv[i]), STRING_LENGTH(argv[i]));
+        p += STRING_LENGTH(argv[i]);
+    }
+
+    return str;
+}
+
+/* (substring string start [end]) shares the text of the string. */
+struct lispobj *subr_substring(int argc, struct lispobj **argv)
+{
+    long start, end, length;
+
+    length = STRING_LENGTH(string_arg(argv[0]));
+    start = string_index(argc, argv, 1, 0, length);
+    end = string_index(argc, argv, 2, length, length);
+    if(start > end)
+        error_signal(ERROR_BAD_INDEX);
+
+    return string_slice(argv[0], start, end);
+}
+
+/* (string-search needle string [start]) is an index or NIL. */
+struct lispobj *subr_string_search(int argc, struct lispobj **argv)
+{
+    struct lispobj *needle, *hay;
+    long start;
+    char *found;
+
+    needle = string_arg(argv[0]);
+    hay = string_arg(argv[1]);
+    start = string_index(argc, argv, 2, 0, STRING_LENGTH(hay));
+
+    if(STRING_LENGTH(needle) == 0)
+        return number(start);
+
+    found = string_find(STRING_DATA(hay) + start, STRING_LENGTH(hay) - start,
+                        STRING_DATA(needle), STRING_LENGTH(needle));
+    if(found == NULL)
+        return OBJ_FALSE;
+
+    return number(found - STRING_DATA(hay));
+}
+
+/* (string-split string separator) is a list of slices. */
+struct lispobj *subr_string_split(int argc, struct lispobj **argv)
+{
+    struct lispobj *str, *sep, *list, *tail, *cell;
+    char *p, *end, *found;
+
+    str = string_arg(argv[0]);
+    sep = string_arg(argv[1]);
+    if(STRING_LENGTH(sep) == 0)
+        error_signal(ERROR_WRONG_TYPE);
+
+    p = STRING_DATA(str);
+    end = p + STRING_LENGTH(str);
+    list = tail = NULL;
+
+    /* Appends at the tail. */
+    for(;;) {
+        found = string_find(p, end - p, STRING_DATA(sep), STRING_LENGTH(sep));
+        cell = NEW_CONS(string_slice(str, p - STRING_DATA(str),
+                                     (found != NULL ? found : end) -
+                                     STRING_DATA(str)), NULL);
+        if(list == NULL) {
+            list = cell;
         } else {
-            return NEW_ERROR("Argument must be a number.\n");
+            CDR(tail) = heap_grab(cell);
         }
+        tail = cell;
+
+        if(found == NULL)
+            break;
+        p = found + STRING_LENGTH(sep);
     }
 
-    return OBJ_FALSE;
+    return list;
 }
 
-struct lispobj *subr_compar(struct lispobj *args)
+/* Same syntax as the reader, NIL if it's not a number. */
+struct lispobj *subr_string_to_number(int argc, struct lispobj **argv)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
-
-    struct lispobj *obj1, *obj2;
+    struct lispobj *ret = OBJ_FALSE;
+    char *s, *end;
+    int i = 0, digits = 0, integer = 1;
+
+    s = string_to_c(string_arg(argv[0]));
+
+    if(s[i] == '-' || s[i] == '+')
+        i++;
+    for(; s[i] != '\0'; i++) {
+        if(s[i] >= '0' && s[i] <= '9') {
+            digits++;
+        } else if(s[i] == '.' || s[i] == 'e' || s[i] == 'E' ||
+                  s[i] == '-' || s[i] == '+') {
+            integer = 0;
+        } else {
+            digits = 0;
+            break;
+        }
+    }
 
-    obj1 = CAR(args);
-    obj2 = CADR(args);
-    
-    if(obj1 != NULL && obj2 != NULL) {
-        if(OBJ_TYPE(obj1) == NUMBER && OBJ_TYPE(obj2) == NUMBER) {
-            if(NUMBER_VALUE(obj1) == NUMBER_VALUE(obj2))
-                return OBJ_TRUE;
+    if(digits > 0) {
+        if(integer) {
+            ret = NEW_NUMBER(s);
         } else {
-            return NEW_ERROR("Arguments must be a number.\n");
+            strtod(s, &end);
+            if(*end == '\0')
+                ret = NEW_FLOAT(s);
         }
     }
+    free(s);
 
-    return OBJ_FALSE;
+    return ret;
+}
+
+struct lispobj *subr_number_to_string(int argc, struct lispobj **argv)
+{
+    struct lispobj *num = argv[0], *str;
+    char buf[FLOAT_STRING_SIZE], *digits;
+
+    if(!IS_NUMERIC(num))
+        error_signal(ERROR_NOT_NUMBER);
+
+    switch(OBJ_TYPE(num)) {
+    case NUMBER:
+        snprintf(buf, sizeof(buf), "%ld", NUMBER_VALUE(num));
+        break;
+    case FLOAT:
+        format_float(buf, FLOAT_VALUE(num));
+        break;
+    default:
+        digits = bignum_to_string(BIGNUM_VALUE(num));
+        str = NEW_STRING(digits);
+        free(digits);
+
+        return str;
+    }
+
+    return NEW_STRING(buf);
+}
+
+struct lispobj *subr_write_to_string(int argc, struct lispobj **argv)
+{
+    return print_to_string(argv[0]);
+}
+
+struct lispobj *subr_string_equal(int argc, struct lispobj **argv)
+{
+    string_arg(argv[0]);
+    string_arg(argv[1]);
+
+    return equal(argv[0], argv[1]) ? OBJ_TRUE : OBJ_FALSE;
+}
+
+static struct hash_table *hash_table_arg(struct lispobj *obj)
+{
+    if(obj == NULL || OBJ_TYPE(obj) != HASHTABLE)
+        error_signal(ERROR_NOT_HASHTABLE);
+
+    return HASHTABLE_VALUE(obj);
 }
 
-struct lispobj *subr_heap_object(struct lispobj *args)
+/* Test is a symbol or the primitive itself: 'equal or equal. */
+struct lispobj *subr_make_hash_table(int argc, struct lispobj **argv)
 {
-    if(length(args) != 1)
-        return ERROR_ARGS;
+    struct lispobj *obj, *test;
+    int kind;
+
+    test = argc > 0 ? argv[0] : NEW_SYMBOL("EQL");
+    if(test != NULL && OBJ_TYPE(test) == SUBR)
+        test = NEW_SYMBOL(SUBR_VALUE(test)->name);
+
+    if(test == NEW_SYMBOL("EQ")) {
+        kind = HASH_EQ;
+    } else if(test == NEW_SYMBOL("EQL")) {
+        kind = HASH_EQL;
+    } else if(test == NEW_SYMBOL("EQUAL")) {
+        kind = HASH_EQUAL;
+    } else {
+        error_signal(ERROR_BAD_TEST);
+    }
+
+    obj = object_create(HASHTABLE, NULL);
+    HASHTABLE_VALUE(obj) = hash_table_new(kind);
 
-    struct lispobj *obj = CAR(args);
+    return obj;
+}
+
+/* (gethash key table [default]) */
+struct lispobj *subr_gethash(int argc, struct lispobj **argv)
+{
+    struct hash_table *t = hash_table_arg(argv[1]);
+    struct lispobj *value;
+    int found;
+
+    /* A lookup moves entries of a growing table, unless others may
+       be reading it: a table of another context, or while futures
+       of this one run. */
+    if(IS_FROZEN(argv[1]) || ctx->heap->readers > 0) {
+        value = hash_table_peek(t, argv[0], &found);
+    } else {
+        value = hash_table_get(t, argv[0], &found);
+    }
+    if(!found)
+        return argc > 2 ? argv[2] : OBJ_FALSE;
+
+    return value;
+}
+
+/* (puthash key value table) */
+struct lispobj *subr_puthash(int argc, struct lispobj **argv)
+{
+    if(IS_FROZEN(argv[2]))
+        error_signal(ERROR_IMMUTABLE);
+
+    hash_table_put(hash_table_arg(argv[2]), argv[0], argv[1]);
+
+    return argv[1];
+}
+
+/* (remhash key table) */
+struct lispobj *subr_remhash(int argc, struct lispobj **argv)
+{
+    if(IS_FROZEN(argv[1]))
+        error_signal(ERROR_IMMUTABLE);
+
+    return hash_table_remove(hash_table_arg(argv[1]), argv[0]) ?
+        OBJ_TRUE : OBJ_FALSE;
+}
+
+struct lispobj *subr_hash_count(int argc, struct lispobj **argv)
+{
+    return number(hash_table_arg(argv[0])->count);
+}
+
+/*
+ * (maphash proc table) calls proc with every key and value.
+ * Entries are copied into a vector first, so proc may change
+ * the table, the vector sits on the stack for error unwinding.
+ */
+struct lispobj *subr_maphash(int argc, struct lispobj **argv)
+{
+    struct hash_table *t = hash_table_arg(argv[1]);
+    struct hash_part *parts[] = {&t->cur, &t->old};
+    struct hash_entry *e;
+    struct lispobj *entries, **data;
+    int base = ctx->stack->index, i, n = 0;
+    long j;
+
+    entries = vector(2 * t->count, NULL);
+    data = VECTOR_DATA(entries);
+    stack_push(heap_grab(entries));
+
+    for(i = 0; i < 2; i++) {
+        for(j = 0; j < parts[i]->size; j++) {
+            e = &parts[i]->entries[j];
+            if(e->state == HASH_SLOT_FULL) {
+                data[n++] = heap_grab(e->key);
+                data[n++] = heap_grab(e->value);
+            }
+        }
+    }
+
+    for(i = 0; i < n; i += 2) {
+        heap_release(apply_argv(argv[0], 2, data + i));
+    }
+    stack_unwind(base);
+
+    return OBJ_FALSE;
+}
+
+struct lispobj *subr_heap_object(int argc, struct lispobj **argv)
+{
+    struct lispobj *obj = argv[0];
 
     printf("Debug object:");
     heap_debug_object(obj);
@@ -561,59 +1564,51 @@ struct lispobj *subr_heap_object(struct lispobj *args)
     return OBJ_FALSE;
 }
 
-struct lispobj *subr_heap(struct lispobj *args)
+struct lispobj *subr_heap(int argc, struct lispobj **argv)
 {
-    if(length(args) != 0)
-        return ERROR_ARGS;
-
     heap_debug();
 
     return OBJ_FALSE;
 }
 
-struct lispobj *subr_or(struct lispobj *args)
+struct lispobj *subr_or(int argc, struct lispobj **argv)
 {
-    if(length(args) > 0) {
-        while(args != NULL) {
-            if(CAR(args)) {
-                return CAR(args);
-            }
+    int i;
 
-            args = CDR(args);
+    for(i = 0; i < argc; i++) {
+        if(argv[i]) {
+            return argv[i];
         }
     }
 
     return OBJ_FALSE;
 }
 
-struct lispobj *subr_and(struct  lispobj *args)
+struct lispobj *subr_and(int argc, struct lispobj **argv)
 {
-    if(length(args) > 0) {
-        struct lispobj *ret = NULL;
+    if(argc > 0) {
+        int i;
         
-        while(args != NULL) {
-            if(!CAR(args)) {
+        for(i = 0; i < argc; i++) {
+            if(!argv[i]) {
                 return OBJ_FALSE;
             }
-            
-            ret = CAR(args);
-            args = CDR(args);
         }
 
-        return ret;
+        return argv[argc - 1];
     }
 
     return OBJ_TRUE;
 }
 
-struct lispobj *subr_rplaca(struct lispobj *args)
+struct lispobj *subr_rplaca(int argc, struct lispobj **argv)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
-
     struct lispobj *old, *val, *place;
-    place = CAR(args);
-    val = CADR(args);
+    place = argv[0];
+    val = argv[1];
+
+    if(IS_HCONS(place) || IS_FROZEN(place))
+        error_signal(ERROR_IMMUTABLE);
 
     old = CAR(place);
     CAR(place) = heap_grab(val);
@@ -622,14 +1617,14 @@ struct lispobj *subr_rplaca(struct lispobj *args)
     return place;
 }
 
-struct lispobj *subr_rplacd(struct lispobj *args)
+struct lispobj *subr_rplacd(int argc, struct lispobj **argv)
 {
-    if(length(args) != 2)
-        return ERROR_ARGS;
-
     struct lispobj *old, *val, *place;
-    place = CAR(args);
-    val = CADR(args);
+    place = argv[0];
+    val = argv[1];
+
+    if(IS_HCONS(place) || IS_FROZEN(place))
+        error_signal(ERROR_IMMUTABLE);
 
     old = CDR(place);
     CDR(place) = heap_grab(val);
@@ -637,3 +1632,31 @@ struct lispobj *subr_rplacd(struct lispobj *args)
     
     return place;
 }
+
+struct lispobj *subr_hcons(int argc, struct lispobj **argv)
+{
+    return hcons(argv[0], argv[1]);
+}
+
+/* Canonical, hash-consed copy of a structure. */
+struct lispobj *subr_hash_cons(int argc, struct lispobj **argv)
+{
+    return hcons_tree(argv[0]);
+}
+
+struct lispobj *subr_hcons_p(int argc, struct lispobj **argv)
+{
+    return IS_HCONS(argv[0]) ? OBJ_TRUE : OBJ_FALSE;
+}
+
+/* (hash-cons-reader [flag]), returns the previous mode. */
+struct lispobj *subr_hash_cons_reader(int argc, struct lispobj **argv)
+{
+    int old = ctx->read_hash_cons;
+
+    if(argc > 0) {
+        ctx->read_hash_cons = argv[0] != NULL;
+    }
+
+    return old ? OBJ_TRUE : OBJ_FALSE;
+}